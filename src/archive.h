@@ -0,0 +1,239 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+/*
+ defines classes:
+    archive_lock
+    archive
+
+  An archive on disk, as seen by the programs that work on whole archives rather than on
+  source trees: the tax and store directories, the taxonomy in memory, and the commit of a
+  new taxonomy version.
+
+  The commit follows the same steps as insert: the new taxonomy is written to a temporary
+  file and handed to commit_taxonomy(), which keeps the old sources;0 as a delta and puts
+  the new one in its place, see history.h.  The mtime index is rebuilt from the nodes_map and
+  written alongside, the Bloom filter that insert keeps is removed for insert to build again.
+
+  Version numbers shift on every commit, sources;0 is always the newest, so they can not be
+  used to remember a point in the history.  Each commit also advances the generation held in
+  tax/generation, a count that only goes up.  The taxonomy of generation g is version G - g
+  where G is the current generation.
+*/
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+// STL objects used
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+using namespace std;
+
+// locally defined objects
+#include "types.h"
+#include "file.h"
+#include "directory.h"
+#include "taxonomy.h"
+#include "mtime_index.h"
+#include "history.h"
+
+  const uint Archive_Success = 0;
+  const uint Archive_OpenFail = 1;
+  const uint Archive_ParseFail = 2;
+  const uint Archive_WriteFail = 3;
+
+/*--------------------------------------------------------------------------------
+  an exclusive hold on an archive, for a program that commits to it
+
+  Every program that commits a taxonomy or changes the store holds one for as long as it
+  runs: insert, --watch included, gc, synch, merge, resign, and versions convert.  Otherwise
+  one would commit over the taxonomy another had committed since it was loaded, or gc would
+  remove node files an insert had written and not yet committed.  The hold is a flock on the
+  tax directory, so it goes with the process however that ends.  It is not waited for, a
+  program that finds the archive held stops.
+*/
+  class archive_lock{
+  public:
+    archive_lock(): busy(false),fd(-1){;}
+    ~archive_lock(){ if( fd != -1 ) close(fd); }
+
+    bool busy;  // the last acquire() failed because another program holds the archive
+
+    // false when another program holds the archive, or the tax directory can not be opened
+    bool acquire(const string &tax_path){
+      if( fd != -1 ) RETURN true;
+      busy = false;
+      fd = open(tax_path.c_str() ,O_RDONLY | O_DIRECTORY);
+      if( fd == -1 ) RETURN false;
+      if( flock(fd ,LOCK_EX | LOCK_NB) == 0 ) RETURN true;
+      busy = errno == EWOULDBLOCK;
+      close(fd);
+      fd = -1;
+      RETURN false;
+    }
+
+  private:
+    int fd;
+    archive_lock(const archive_lock &);
+    archive_lock &operator = (const archive_lock &);
+  };
+
+
+/*--------------------------------------------------------------------------------
+  an archive
+*/
+  class archive{
+  public:
+    string path;
+    string tax_path;
+    string store_path;
+
+    nodes_map a_nodes_map;
+    node_number_allocator nna;
+
+    // sets up the paths, and if 'create' is set makes the tax and store directories
+    bool open(const string &arch_path ,bool create){
+      path = arch_path;
+      strip_trailing(path);
+      tax_path = path + "/tax";
+      store_path = path + "/store";
+      // blaze_path makes the directories leading up to the last path component
+      if( create ) RETURN blaze_path(tax_path + "/") && blaze_path(store_path + "/");
+      RETURN exists(tax_path) && exists(store_path);
+    }
+
+    // holds the archive until this object goes, see archive_lock; says so when it is held elsewhere
+    bool lock(){
+      if( held.acquire(tax_path) ) RETURN true;
+      if( held.busy ) cerr << "archive is in use by another program: \"" << path << "\"" << endl;
+      else cerr << "could not open archive tax directory: \"" << tax_path << "\"" << endl;
+      RETURN false;
+    }
+
+    // as lock(), but quiet, for a program that can go on without it; 'busy' as in archive_lock
+    bool try_lock(bool &busy){
+      bool acquired = held.acquire(tax_path);
+      busy = held.busy;
+      RETURN acquired;
+    }
+
+    string taxonomy_pathname() const{
+      RETURN tax_path + "/sources;0";
+    }
+
+    // the version is still in the archive, see history.h
+    bool has_version(size_t version) const{
+      RETURN version_reader(tax_path ,version).found;
+    }
+
+    string node_pathname(size_t node) const{
+      stringstream ss;
+      ss << store_path << "/" << node;
+      RETURN ss.str();
+    }
+
+    // parses version 'version' into 'hd', rebuilt from the deltas when it is not sources;0, a missing taxonomy is empty
+    uint load_version(size_t version ,nodes_map &hd) const{
+      hd.clear();
+      if( version != 0 ){
+        version_reader reader(tax_path ,version);
+        if( !reader.found ){
+          cerr << "version " << version << " is not in the archive: \"" << path << "\"" << endl;
+          RETURN Archive_OpenFail;
+        }
+        node_set ns;
+        string text;
+        while( reader.next(ns ,text) ){
+          istringstream is(text);
+          node_set a_node_set;
+          a_node_set.clear();
+          if( a_node_set.parse(is ,tax_path ,0) != ParseStatus::Found ){
+            cerr << "parse failed: version " << version << " of \"" << path << "\" at node " << ns.node << endl;
+            RETURN Archive_ParseFail;
+          }
+          hd.insert(pair<size_t ,node_set>(a_node_set.node ,a_node_set));
+        }
+        if( reader.failed() ) RETURN Archive_ParseFail;
+        RETURN Archive_Success;
+      }
+      string pathname = taxonomy_pathname();
+      if( !exists(pathname) ) RETURN Archive_Success;
+      ifstream is(pathname);
+      if( !is.good() ){
+        cerr << "could not open taxonomy file: \"" << pathname << "\"" << endl;
+        RETURN Archive_OpenFail;
+      }
+      size_t lineno = 0;
+      if( hd.parse(is ,pathname ,lineno) != ParseStatus::Found ){
+        cerr << "parse failed: \"" << pathname << "\"" << endl;
+        RETURN Archive_ParseFail;
+      }
+      RETURN Archive_Success;
+    }
+
+    // parses sources;0 into a_nodes_map, an archive without a taxonomy is empty
+    uint load(){
+      uint status = load_version(0 ,a_nodes_map);
+      if( status != Archive_Success ) RETURN status;
+      nna = node_number_allocator();
+      nna.parse(a_nodes_map);
+      RETURN Archive_Success;
+    }
+
+    size_t generation() const{
+      RETURN taxonomy_generation(tax_path);
+    }
+
+    // writes a_nodes_map as the new sources;0, the old one is kept as a delta
+    uint commit(){
+      stringstream temp_pathname;
+      temp_pathname << tax_path << "/sources-" << getpid();
+      size_t taxonomy_length;
+      {
+        ofstream os(temp_pathname.str());
+        if( !os.good() ){
+          cerr << "could not open taxonomy file for writing: \"" << temp_pathname.str() << "\"" << endl;
+          RETURN Archive_WriteFail;
+        }
+        a_nodes_map.print(os);
+        taxonomy_length = os.tellp();
+        os.close();
+        if( os.fail() ){
+          cerr << "could not write taxonomy file: \"" << temp_pathname.str() << "\"" << endl;
+          RETURN Archive_WriteFail;
+        }
+      }
+
+      uint status = commit_taxonomy(tax_path ,temp_pathname.str());
+      if( status == History_DeltaFail || status == History_RenameFail ){
+        cerr << "could not move the new taxonomy to: \"" << taxonomy_pathname() << "\", it is left in: \""
+             << temp_pathname.str() << "\"" << endl;
+        RETURN Archive_WriteFail;
+      }
+      if( status == History_GenerationFail ){
+        cerr << "the new taxonomy is in place, but could not write the taxonomy generation: \"" << tax_path << "/generation\"" << endl;
+      }
+
+      mtime_index a_mtime_index;
+      a_mtime_index.build(a_nodes_map);
+      a_mtime_index.generation = taxonomy_generation(tax_path);  // known from the delta even on History_GenerationFail
+      a_mtime_index.taxonomy_length = taxonomy_length;
+      if( !a_mtime_index.write(tax_path + "/mtimes") ){
+        cerr << "could not write mtime index: \"" << tax_path << "/mtimes\"" << endl;
+      }
+      // the Bloom filter is for insert to keep, a commit here can remove signatures, so it is dropped
+      // and insert builds it again from the signature index, see bloom.h
+      unlink((tax_path + "/bloom").c_str());
+      if( status == History_GenerationFail ) RETURN Archive_WriteFail;
+      RETURN Archive_Success;
+    }
+
+  private:
+    archive_lock held;
+  };
+
+#endif
@@ -0,0 +1,533 @@
+/*
+  bench_insert
+
+  A reproducible benchmark for insert.
+
+  A synthetic source tree is generated from a seed: a given number of files, with sizes
+  drawn from a distribution, some of them byte for byte duplicates of earlier files, and
+  some that share their first SIGNATURE_CHARS bytes with an earlier file while differing
+  after.  Head signatures of those collide and insert must fall back on same(), the current
+  signatures tell them apart, see file.h; same_false and collision_rate in the stats show it.
+
+  insert is then run as a child process, found with wait4() so that its rusage comes back:
+
+    cold    into an empty archive, with the source tree dropped from the page cache
+    warm    into another empty archive, with the source tree now cached
+    repeat  into the warm archive again, every file is already there
+
+  and the results are written as one JSON object, so that runs can be compared across
+  commits.  Give --label to tag the object, e.g. with a commit id.  Each run is given
+  --stats, and when insert was built with STATS its per phase timings and counters are
+  included with the run.  --io and --no-cache-pollution are handed on to insert, so they can
+  be compared on the same tree.
+
+  After each run the source files and the node files are looked up with mincore(), and the
+  bytes of them still in the page cache are reported with the run, this is what an insert
+  leaves behind for everything else on the machine to compete with.
+*/
+
+// before we start, a bit of Vogon poetry:
+//
+  const char *vogon_poetry = R"VOGON_POETRY(
+     bench_insert [options]
+
+    options:
+
+      -h --help               this message
+         --files <n>          files in the source tree, default 2000
+         --min-size <bytes>   smallest file, default 0
+         --max-size <bytes>   largest file, default 1048576
+         --dist <d>           size distribution, 'uniform' or 'log' (log uniform), default log
+         --dup-ratio <r>      fraction of files that duplicate an earlier file, default 0.2
+         --collision-rate <r> fraction of files whose first block matches an earlier file, default 0.05
+         --seed <n>           random seed, default 1
+         --dir <path>         scratch directory, default bench_insert_dir, removed at the end
+         --insert <path>      the insert program to run, default ./insert
+         --io <engine>        handed on to insert, 'sync' or 'uring', default sync
+         --no-cache-pollution handed on to insert
+         --out <path>         where the JSON goes, default stdout
+         --label <text>       copied into the JSON, e.g. a commit id
+         --keep               leave the scratch directory in place
+
+  )VOGON_POETRY";
+
+#include "types.h"
+
+// Program Termination Return Codes
+const uint Exit_NoError   =0;
+const uint Exit_BadParms  =1;
+const uint Exit_InternalError =4;
+const uint Exit_FileCreationError =5;
+
+// for sterror and errno
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+// STL objects used
+#include <string>
+#include <fstream>
+#include <vector>
+#include <list>
+#include <random>
+using namespace std;
+
+// local objects used
+#include "file.h"
+
+
+/*--------------------------------------------------------------------------------
+  seconds on the monotonic clock
+*/
+  double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC ,&ts);
+    RETURN ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  the parameters of the synthetic tree
+*/
+  class tree_spec{
+  public:
+    tree_spec():
+      files(2000),min_size(0),max_size(1 << 20),log_dist(true)
+      ,dup_ratio(0.2),collision_rate(0.05),seed(1)
+    {;}
+
+    size_t files;
+    size_t min_size;
+    size_t max_size;
+    bool log_dist;
+    double dup_ratio;
+    double collision_rate;
+    unsigned long seed;
+
+    void print(ostream &os) const{
+      os << "{\"files\": " << files
+         << ", \"min_size\": " << min_size
+         << ", \"max_size\": " << max_size
+         << ", \"dist\": \"" << (log_dist ? "log" : "uniform") << "\""
+         << ", \"dup_ratio\": " << dup_ratio
+         << ", \"collision_rate\": " << collision_rate
+         << ", \"seed\": " << seed
+         << "}";
+    }
+  };
+
+
+/*--------------------------------------------------------------------------------
+  writes the synthetic source tree under 'source_path'
+
+  Every file gets its content from its own seed, so a duplicate is made by reusing the seed
+  of an earlier file, and a collision by reusing the seed of an earlier file for the first
+  block only.  Files go 100 to a directory.
+*/
+  class tree_stats{
+  public:
+    tree_stats(): files(0),bytes(0),duplicates(0),collisions(0){;}
+    size_t files;
+    size_t bytes;
+    size_t duplicates;
+    size_t collisions;
+    vector<string> pathnames;
+  };
+
+  void fill(vector<char> &buffer ,size_t begin ,size_t end ,unsigned long seed){
+    mt19937_64 gen(seed);
+    size_t i = begin;
+    while( i < end ){
+      uint64_t r = gen();
+      for( uint k = 0; k < 8 && i < end; k++, i++ ) buffer[i] = (char)(r >> (8 * k));
+    }
+  }
+
+  bool generate(const string &source_path ,const tree_spec &spec ,tree_stats &stats){
+    mt19937_64 gen(spec.seed);
+    uniform_real_distribution<double> unit(0.0 ,1.0);
+
+    class made{ public: size_t size; unsigned long seed; };
+    vector<made> earlier;
+    vector<char> buffer;
+    for( size_t i = 0; i < spec.files; i++ ){
+      made m;
+      unsigned long head_seed;
+      double r = unit(gen);
+      if( !earlier.empty() && r < spec.dup_ratio ){
+        m = earlier[gen() % earlier.size()];
+        head_seed = m.seed;
+        stats.duplicates++;
+      }else{
+        double u = unit(gen);
+        if( spec.log_dist ){
+          double lo = log((double)spec.min_size + 1);
+          double hi = log((double)spec.max_size + 1);
+          m.size = (size_t)(exp(lo + u * (hi - lo)) - 1);
+        }else{
+          m.size = spec.min_size + (size_t)(u * (spec.max_size - spec.min_size));
+        }
+        m.seed = gen();
+        head_seed = m.seed;
+        if( !earlier.empty() && r < spec.dup_ratio + spec.collision_rate ){
+          // same first block as an earlier file that has a whole first block, the rest differs
+          const made &other = earlier[gen() % earlier.size()];
+          if( other.size >= SIGNATURE_CHARS ){
+            head_seed = other.seed;
+            if( m.size <= SIGNATURE_CHARS ) m.size = SIGNATURE_CHARS + 1;
+            stats.collisions++;
+          }
+        }
+        earlier.push_back(m);
+      }
+
+      buffer.resize(m.size);
+      size_t head = m.size < SIGNATURE_CHARS ? m.size : SIGNATURE_CHARS;
+      fill(buffer ,0 ,head ,head_seed);
+      fill(buffer ,head ,m.size ,m.seed + 1);
+
+      stringstream dir;
+      dir << source_path << "/d" << i / 100;
+      if( i % 100 == 0 && mkdir(dir.str().c_str() ,S_IRWXU) == -1 && errno != EEXIST ) RETURN false;
+      stringstream pathname;
+      pathname << dir.str() << "/f" << i;
+      int fd = open(pathname.str().c_str() ,O_CREAT | O_TRUNC | O_WRONLY ,S_IRUSR | S_IWUSR);
+      if( fd == -1 ) RETURN false;
+      bool ok = m.size == 0 || write(fd ,&buffer[0] ,m.size) == (ssize_t)m.size;
+      if( close(fd) == -1 ) ok = false;
+      if( !ok ) RETURN false;
+      stats.pathnames.push_back(pathname.str());
+      stats.files++;
+      stats.bytes += m.size;
+    }
+    RETURN true;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  asks the kernel to drop the cached pages of the source files, so the next read comes from
+  the device.  Dropping every cache through /proc needs root and disturbs the whole machine,
+  this only touches our files and works for clean pages.
+*/
+  void drop_cache(const vector<string> &pathnames){
+    sync();
+    for( size_t i = 0; i < pathnames.size(); i++ ){
+      int fd = open_read(pathnames[i]);
+      if( fd == -1 ) CONTINUE;
+      posix_fadvise(fd ,0 ,0 ,POSIX_FADV_DONTNEED);
+      close(fd);
+    }
+  }
+
+
+/*--------------------------------------------------------------------------------
+  bytes of the given files that are in the page cache, found with mincore() over a mapping
+  of each, which does not itself bring pages in
+*/
+  size_t cached_bytes(const vector<string> &pathnames){
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t total = 0;
+    vector<unsigned char> pages;
+    for( size_t i = 0; i < pathnames.size(); i++ ){
+      int fd = open_read(pathnames[i]);
+      if( fd == -1 ) CONTINUE;
+      struct stat file_attributes;
+      if( fstat(fd ,&file_attributes) == -1 || file_attributes.st_size == 0 ){
+        close(fd);
+        CONTINUE;
+      }
+      size_t size = file_attributes.st_size;
+      void *pt = mmap(0 ,size ,PROT_READ ,MAP_SHARED ,fd ,0);
+      close(fd);
+      if( pt == MAP_FAILED ) CONTINUE;
+      pages.resize((size + page_size - 1) / page_size);
+      if( mincore(pt ,size ,&pages[0]) == 0 ){
+        for( size_t k = 0; k < pages.size(); k++ ){
+          if( !(pages[k] & 1) ) CONTINUE;
+          size_t end = (k + 1) * page_size;
+          total += (end > size ? size : end) - k * page_size;
+        }
+      }
+      munmap(pt ,size);
+    }
+    RETURN total;
+  }
+
+  // the node files of a store
+  vector<string> store_files(const string &store_path){
+    vector<string> pathnames;
+    DIR *dirp = opendir(store_path.c_str());
+    if( dirp == NULL ) RETURN pathnames;
+    struct dirent *dep;
+    while( (dep = readdir(dirp)) != NULL ){
+      if( dep->d_name[0] == '.' ) CONTINUE;
+      pathnames.push_back(store_path + "/" + dep->d_name);
+    }
+    closedir(dirp);
+    RETURN pathnames;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  one run of insert as a child process
+*/
+  class run_result{
+  public:
+    string name;
+    int exit_status;
+    double seconds;
+    struct rusage usage;
+    string insert_stats;  // the final stats line written by insert, empty when built without STATS
+    size_t source_cached;  // bytes of the source files in the page cache after the run
+    size_t store_cached;   // bytes of the node files in the page cache after the run
+
+    void print(ostream &os ,const tree_stats &stats) const{
+      double mb = stats.bytes / 1e6;
+      os << "{\"name\": \"" << name << "\""
+         << ", \"exit\": " << exit_status
+         << ", \"seconds\": " << seconds
+         << ", \"files_per_s\": " << (seconds > 0 ? stats.files / seconds : 0)
+         << ", \"mb_per_s\": " << (seconds > 0 ? mb / seconds : 0)
+         << ", \"user_s\": " << usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6
+         << ", \"system_s\": " << usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6
+         << ", \"max_rss_kb\": " << usage.ru_maxrss
+         << ", \"major_faults\": " << usage.ru_majflt
+         << ", \"blocks_in\": " << usage.ru_inblock
+         << ", \"blocks_out\": " << usage.ru_oublock
+         << ", \"source_cached_bytes\": " << source_cached
+         << ", \"store_cached_bytes\": " << store_cached;
+      if( !insert_stats.empty() ) os << ", \"stats\": " << insert_stats;
+      os << "}";
+    }
+  };
+
+  bool run_insert(
+     const string &insert_program
+    ,const string &arch_path
+    ,const string &source_path
+    ,const string &stats_pathname
+    ,const vector<string> &insert_options  // handed on ahead of the arguments
+    ,run_result &result
+  ){
+    unlink(stats_pathname.c_str());
+    double start = now();
+    pid_t pid = fork();
+    if( pid == -1 ) RETURN false;
+    if( pid == 0 ){
+      int devnull = open("/dev/null" ,O_WRONLY);
+      if( devnull != -1 ) dup2(devnull ,1);
+      vector<const char *> args;
+      args.push_back(insert_program.c_str());
+      args.push_back("--stats");
+      args.push_back(stats_pathname.c_str());
+      for( size_t i = 0; i < insert_options.size(); i++ ) args.push_back(insert_options[i].c_str());
+      args.push_back(arch_path.c_str());
+      args.push_back(source_path.c_str());
+      args.push_back(0);
+      execv(insert_program.c_str() ,(char **)&args[0]);
+      cerr << "could not run: " << insert_program << ": " << strerror(errno) << endl;
+      _exit(127);
+    }
+    int status;
+    if( wait4(pid ,&status ,0 ,&result.usage) == -1 ) RETURN false;
+    result.seconds = now() - start;
+    result.exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+    result.insert_stats.clear();
+    ifstream stats_file(stats_pathname);
+    string line;
+    while( getline(stats_file ,line) ) if( !line.empty() ) result.insert_stats = line;
+    RETURN true;
+  }
+
+
+/*--------------------------------------------------------------------------------
+
+   This is called from the shell. See the Vogon poetry at the top of this file for
+   the usage message.
+
+*/
+  int main(int argc ,char **argv){
+
+    //----------------------------------------
+    // parse options
+    //
+      tree_spec spec;
+      string dir = "bench_insert_dir";
+      string insert_program = "./insert";
+      string out_pathname;
+      string label;
+      string io = "sync";
+      bool no_cache_pollution=false;
+      bool keep=false;
+      bool bad_parms=false;
+
+      if(argv == 0){
+        cerr << "serious problem here, argv was zero when the program was called" << endl;
+        RETURN Exit_InternalError;
+      }
+
+      for( argv++ ; *argv; argv++ ){
+        if( !strcmp(*argv, "-h") || !strcmp(*argv, "--help") ){
+          cout << vogon_poetry;
+          bad_parms=true;
+          CONTINUE;
+        }
+        if( !strcmp(*argv, "--keep") ){
+          keep=true;
+          CONTINUE;
+        }
+        if( !strcmp(*argv, "--no-cache-pollution") ){
+          no_cache_pollution=true;
+          CONTINUE;
+        }
+
+        // the rest take a value
+        char *option = *argv;
+        char *value = argv[1];
+        if( value == 0 ){
+          cerr << "unrecognized option, or missing value: " << option << endl;
+          bad_parms=true;
+          BREAK;
+        }
+        argv++;
+        char *end = value;
+        if( !strcmp(option, "--files") ) spec.files = strtoul(value ,&end ,10);
+        else if( !strcmp(option, "--min-size") ) spec.min_size = strtoul(value ,&end ,10);
+        else if( !strcmp(option, "--max-size") ) spec.max_size = strtoul(value ,&end ,10);
+        else if( !strcmp(option, "--dup-ratio") ) spec.dup_ratio = strtod(value ,&end);
+        else if( !strcmp(option, "--collision-rate") ) spec.collision_rate = strtod(value ,&end);
+        else if( !strcmp(option, "--seed") ) spec.seed = strtoul(value ,&end ,10);
+        else if( !strcmp(option, "--dist") ){
+          spec.log_dist = !strcmp(value ,"log");
+          if( !spec.log_dist && strcmp(value ,"uniform") ) end = value;
+          else end = value + strlen(value);
+        }
+        else if( !strcmp(option, "--dir") ){ dir = value; end = value + strlen(value); }
+        else if( !strcmp(option, "--insert") ){ insert_program = value; end = value + strlen(value); }
+        else if( !strcmp(option, "--out") ){ out_pathname = value; end = value + strlen(value); }
+        else if( !strcmp(option, "--label") ){ label = value; end = value + strlen(value); }
+        else if( !strcmp(option, "--io") ){ io = value; end = value + strlen(value); }
+        else{
+          cerr << "unrecognized option: " << option << endl;
+          bad_parms=true;
+          CONTINUE;
+        }
+        if( *end != 0 || end == value ){
+          cerr << "bad value for " << option << ": " << value << endl;
+          bad_parms=true;
+        }
+      }
+      if( spec.max_size < spec.min_size || spec.dup_ratio + spec.collision_rate > 1.0 ){
+        cerr << "need min-size <= max-size and dup-ratio + collision-rate <= 1" << endl;
+        bad_parms=true;
+      }
+    if(bad_parms){
+      cerr << "errors when parsing parameters, nothing done" << endl;
+      RETURN Exit_BadParms;
+    }
+
+  //----------------------------------------
+  // the source tree and two empty archives
+  //
+    string source_path = dir + "/source";
+    string cold_path = dir + "/cold";
+    string warm_path = dir + "/warm";
+    string remove_command = "rm -rf '" + dir + "'";
+    if( system(remove_command.c_str()) != 0 ) RETURN Exit_FileCreationError;
+    if(
+      !blaze_path(source_path + "/")
+      || !blaze_path(cold_path + "/tax/") || !blaze_path(cold_path + "/store/")
+      || !blaze_path(warm_path + "/tax/") || !blaze_path(warm_path + "/store/")
+    ){
+      cerr << "could not make the scratch directories under: " << dir << endl;
+      RETURN Exit_FileCreationError;
+    }
+
+    tree_stats stats;
+    double start = now();
+    if( !generate(source_path ,spec ,stats) ){
+      cerr << "could not generate the source tree: " << strerror(errno) << endl;
+      RETURN Exit_FileCreationError;
+    }
+    double generate_seconds = now() - start;
+
+  //----------------------------------------
+  // the runs
+  //
+    list<run_result> results;
+    run_result result;
+    uint errors = 0;
+
+    vector<string> insert_options;
+    insert_options.push_back("--io");
+    insert_options.push_back(io);
+    if( no_cache_pollution ) insert_options.push_back("--no-cache-pollution");
+
+    const char *run_names[] = { "cold" ,"warm" ,"repeat" };
+    const string *run_archives[] = { &cold_path ,&warm_path ,&warm_path };
+    drop_cache(stats.pathnames);
+    for( uint k = 0; k < 3; k++ ){
+      result.name = run_names[k];
+      string stats_pathname = dir + "/stats-" + result.name + ".json";
+      if( !run_insert(insert_program ,*run_archives[k] ,source_path ,stats_pathname ,insert_options ,result) ){
+        errors++;
+        CONTINUE;
+      }
+      result.source_cached = cached_bytes(stats.pathnames);
+      result.store_cached = cached_bytes(store_files(*run_archives[k] + "/store"));
+      results.push_back(result);
+    }
+
+  //----------------------------------------
+  // the report
+  //
+    ofstream out_file;
+    if( !out_pathname.empty() ){
+      out_file.open(out_pathname);
+      if( !out_file.good() ){
+        cerr << "could not open for writing: " << out_pathname << endl;
+        RETURN Exit_FileCreationError;
+      }
+    }
+    ostream &os = out_pathname.empty() ? cout : out_file;
+    os << "{\"benchmark\": \"insert\"";
+    if( !label.empty() ) os << ", \"label\": \"" << label << "\"";
+    os << ", \"io\": \"" << io << "\"";
+    os << ", \"no_cache_pollution\": " << (no_cache_pollution ? "true" : "false");
+    os << ", \"parameters\": ";
+    spec.print(os);
+    os << ", \"tree\": {\"files\": " << stats.files
+       << ", \"bytes\": " << stats.bytes
+       << ", \"duplicates\": " << stats.duplicates
+       << ", \"collisions\": " << stats.collisions
+       << ", \"generate_seconds\": " << generate_seconds
+       << "}";
+    os << ", \"runs\": [";
+    list<run_result>::const_iterator it = results.begin();
+    while( it != results.end() ){
+      if( it != results.begin() ) os << ", ";
+      it->print(os ,stats);
+      if( it->exit_status != 0 ) errors++;
+    it++;
+    }
+    os << "]}" << endl;
+
+    if( !keep ) system(remove_command.c_str());
+    if( errors != 0 ){
+      cerr << errors << " runs of insert failed" << endl;
+      RETURN Exit_InternalError;
+    }
+  RETURN Exit_NoError;
+  }
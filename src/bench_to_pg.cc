@@ -0,0 +1,275 @@
+/*
+  bench_to_pg <user> <db>
+
+  Measures the rate at which taxonomy metadata goes into PostgreSQL, in rows per second.
+
+  A synthetic nodes_map is generated in memory, and loaded into temporary tables shaped like
+  arch_nodes and arch_source, first the old way, one INSERT per row with a transaction per
+  node, then with the binary COPY loader of pg_copy.h that to_pg uses.  Temporary tables go
+  away with the connection, so the database is left as it was.
+
+  The row at a time load is slow, so by default it is only given the first nodes.
+*/
+
+// before we start, a bit of Vogon poetry:
+//
+  const char *vogon_poetry = R"VOGON_POETRY(
+     bench_to_pg [options] <user> <db>
+
+         <user> the database user
+         <db> a database, nothing in it is changed
+
+    options:
+
+      -h --help            this message
+         --nodes <n>       nodes in the synthetic taxonomy, default 100000
+         --sources <n>     source phrases per node, default 2
+         --insert <n>      nodes given to the row at a time load, default 2000, 0 to skip it
+         --batch <n>       rows handed to the server at a time, default 10000
+         --commit <n>      rows per transaction, default 0, one transaction per table
+
+  )VOGON_POETRY";
+
+#include "types.h"
+
+// Program Termination Return Codes
+const uint Exit_NoError   =0;
+const uint Exit_BadParms  =1;
+const uint Exit_InternalError =4;
+
+// for sterror and errno
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+// STL objects used
+#include <string>
+#include <set>
+#include <list>
+using namespace std;
+
+#include<libpq-fe.h>
+
+// local objects used
+#include "file.h"
+#include "directory.h"
+#include "taxonomy.h"
+#include "pg_copy.h"
+
+
+/*--------------------------------------------------------------------------------
+  seconds on the monotonic clock
+*/
+  double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC ,&ts);
+    RETURN ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+
+  void report(const string &method ,size_t rows ,double seconds){
+    cout << method << ": rows: " << rows << " seconds: " << seconds;
+    if( seconds > 0 ) cout << " rows/s: " << (size_t)(rows / seconds);
+    cout << endl;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  a taxonomy of 'node_count' nodes with 'source_count' source phrases each
+*/
+  void synthesize(size_t node_count ,size_t source_count ,nodes_map &a_nodes_map){
+    node_set ns;
+    file_record fr;
+    for( size_t node = 1; node <= node_count; node++ ){
+      ns.clear();
+      ns.node = node;
+      ns.mtime = 1350000000 + node;
+      MD5((const uchar *)&node ,sizeof(node) ,ns.node_signature.data);
+      for( size_t k = 0; k < source_count; k++ ){
+        stringstream pathname;
+        pathname << "bench_source" << k << "/dir" << node % 1000 << "/file" << node;
+        fr.pathname = pathname.str();
+        fr.mtime = ns.mtime + k;
+        fr.type = F_file;
+        ns.sources.insert(fr);
+      }
+      a_nodes_map.insert(pair<size_t ,node_set>(node ,ns));
+    }
+  }
+
+
+/*--------------------------------------------------------------------------------
+  the load as to_pg used to do it: SQL text, one PQexec per row, one transaction per node
+*/
+  bool insert_rows(PGconn *conn ,const nodes_map &a_nodes_map ,size_t node_limit ,size_t &row_count){
+    stringstream stream_buffer;
+    char *pathname;
+    nodes_map::const_iterator nm_it = a_nodes_map.begin();
+    for( size_t n = 0; n < node_limit && nm_it != a_nodes_map.end(); n++, nm_it++ ){
+      if( !pg_command(conn ,"BEGIN") ) RETURN false;
+      stream_buffer.clear();
+      stream_buffer.str(std::string());
+      stream_buffer
+        << "INSERT INTO bench_nodes (node ,file_id ,mtime ,signature) VALUES ("
+        << dec << nm_it->second.node
+        << " ,NULL ," << nm_it->second.mtime
+        << " ,'";
+      nm_it->second.node_signature.print(stream_buffer);
+      stream_buffer << "');";
+      if( !pg_command(conn ,stream_buffer.str().c_str()) ) RETURN false;
+      row_count++;
+
+      file_record_list::const_iterator fr_it = nm_it->second.sources.begin();
+      while( fr_it != nm_it->second.sources.end() ){
+        pathname = PQescapeLiteral(conn, fr_it->pathname.c_str(), fr_it->pathname.size());
+        stream_buffer.clear();
+        stream_buffer.str(std::string());
+        stream_buffer
+          << "INSERT INTO bench_source (node ,mtime ,pathname) VALUES ("
+          << dec << nm_it->second.node
+          << " ," << fr_it->mtime
+          << " ," << pathname
+          << ");";
+        PQfreemem(pathname);
+        if( !pg_command(conn ,stream_buffer.str().c_str()) ) RETURN false;
+        row_count++;
+      fr_it++;
+      }
+      if( !pg_command(conn ,"COMMIT") ) RETURN false;
+    }
+    RETURN true;
+  }
+
+
+/*--------------------------------------------------------------------------------
+
+   This is called from the shell. See the Vogon poetry at the top of this file for
+   the usage message.
+
+*/
+  int main(int argc ,char **argv){
+
+    //----------------------------------------
+    // parse options
+    //
+      list<char *> args;
+      size_t node_count = 100000;
+      size_t source_count = 2;
+      size_t insert_nodes = 2000;
+      size_t batch_rows = 10000;
+      size_t commit_rows = 0;
+      bool bad_parms=false;
+
+      if(argv == 0){
+        cerr << "serious problem here, argv was zero when the program was called" << endl;
+        RETURN Exit_InternalError;
+      }
+      if(argc == 1){
+        cerr << vogon_poetry;
+        RETURN Exit_BadParms;
+      }
+
+      for( argv++ ; *argv; argv++ ){
+        // check for options
+        //
+          if( (*argv)[0] == '-' ){
+            if( !strcmp(*argv, "-h") || !strcmp(*argv, "--help") ){
+              cout << vogon_poetry;
+              bad_parms=true;
+              CONTINUE;
+            }
+
+            size_t *count = 0;
+            if( !strcmp(*argv, "--nodes") ) count = &node_count;
+            if( !strcmp(*argv, "--sources") ) count = &source_count;
+            if( !strcmp(*argv, "--insert") ) count = &insert_nodes;
+            if( !strcmp(*argv, "--batch") ) count = &batch_rows;
+            if( !strcmp(*argv, "--commit") ) count = &commit_rows;
+            if( count ){
+              char *option = *argv;
+              argv++;
+              char *end;
+              if( *argv ){
+                *count = strtoul(*argv ,&end ,10);
+                if( *end == 0 ) CONTINUE;
+              }
+              cerr << "expected a count after " << option << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            bad_parms=true;
+            cerr << "unrecognized option: " << *argv << endl;
+            CONTINUE;
+          }
+
+        // if it isn't and option, it is an arg
+        //
+          args.push_back(*argv);
+          CONTINUE;
+      }
+    if(bad_parms){
+      cerr << "errors when parsing parameters, nothing done" << endl;
+      RETURN Exit_BadParms;
+    }
+    if( args.size() != 2 ){
+      cerr << "need two arguments, but found " << args.size() << " argument";
+      if(args.size() != 1)  cerr << "s";
+      cerr << endl;
+      RETURN Exit_BadParms;
+    }
+    string user = args.front();
+    string db = args.back();
+
+  //----------------------------------------
+  // the synthetic taxonomy and the scratch tables
+  //
+    nodes_map a_nodes_map;
+    synthesize(node_count ,source_count ,a_nodes_map);
+
+    stringstream query;
+    query << "user=" << user << " " << "dbname=" << db;
+    PGconn *conn = PQconnectdb(query.str().c_str());
+    if( PQstatus(conn) == CONNECTION_BAD ){
+      cerr << "Connection to database failed: " << PQerrorMessage(conn) << endl;
+      PQfinish(conn);
+      RETURN Exit_InternalError;
+    }
+    if(
+      !pg_command(conn ,"CREATE TEMP TABLE bench_nodes (node BIGINT PRIMARY KEY ,file_id OID ,mtime BIGINT ,signature TEXT)")
+      || !pg_command(conn ,"CREATE TEMP TABLE bench_source (id BIGSERIAL PRIMARY KEY ,node BIGINT ,mtime BIGINT ,pathname TEXT)")
+    ){
+      PQfinish(conn);
+      RETURN Exit_InternalError;
+    }
+    cout << "nodes: " << node_count << " sources per node: " << source_count
+         << " batch: " << batch_rows << " commit: " << commit_rows << endl;
+
+  //----------------------------------------
+  // row at a time
+  //
+    uint errors = 0;
+    double start;
+    if( insert_nodes != 0 ){
+      size_t rows = 0;
+      start = now();
+      if( !insert_rows(conn ,a_nodes_map ,insert_nodes ,rows) ) errors++;
+      report("insert" ,rows ,now() - start);
+      pg_command(conn ,"TRUNCATE bench_nodes ,bench_source");
+    }
+
+  //----------------------------------------
+  // binary COPY
+  //
+    size_t rows = 0;
+    file_id_map no_file_ids;
+    start = now();
+    if( !copy_arch_nodes(conn ,"bench_nodes" ,a_nodes_map ,no_file_ids ,batch_rows ,commit_rows ,rows) ) errors++;
+    else if( !copy_arch_source(conn ,"bench_source" ,a_nodes_map ,batch_rows ,commit_rows ,rows) ) errors++;
+    report("copy" ,rows ,now() - start);
+
+    PQfinish(conn);
+    if( errors != 0 ) RETURN Exit_InternalError;
+  RETURN Exit_NoError;
+  }
@@ -0,0 +1,169 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+/*
+ defines classes:
+    bloom_filter
+
+  A blocked Bloom filter over the node signatures of a taxonomy.  insert asks it first, and
+  a source file whose signature it has never seen is new content for certain, so the file
+  goes straight to the write path without a lookup in the signature index.  On a first time
+  ingest that is most files.
+
+  Each signature sets Probes bits in one block of Block_Bits bits, a cache line, so a lookup
+  touches one line of memory rather than Probes lines spread over the filter.  The signature
+  is already an MD5 digest, its bytes are used as the hashes.  At Bits_Per_Key bits a key the
+  false positive rate is about one percent, a false positive costs the index lookup that
+  would have been done anyway.  When more keys are added than the filter was sized for it is
+  built again, twice as large, from the signature index.
+
+  The filter is persisted in the tax directory as 'bloom', beside the mtime index and in the
+  same way: it is derived data for 'sources;0', and it records the generation and byte
+  length of the taxonomy it was built from so that one left behind is detected as stale and
+  built again.  A commit by another program drops it, see archive::commit().  A header phrase
+  is followed by the blocks, in the byte order of the machine.
+
+    # bloom # <generation> # <taxonomy length> # <blocks> # <keys>
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+
+// STL objects used
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// locally defined objects
+#include "types.h"
+#include "file.h"
+#include "taxonomy.h"
+
+
+  class bloom_filter{
+  public:
+    static const size_t Block_Bits = 512;
+    static const size_t Block_Words = Block_Bits / 64;
+    static const size_t Bits_Per_Key = 10;
+    static const uint Probes = 7;
+
+    bloom_filter(): generation(0),taxonomy_length(0),keys(0),blocks(0){;}
+
+    size_t generation;  // generation of the taxonomy file this filter describes, see history.h
+    size_t taxonomy_length;  // its length in bytes
+    size_t keys;  // signatures added
+
+    // bytes held by the filter
+    size_t memory() const{ RETURN words.size() * sizeof(uint64_t); }
+
+    // the filter was sized for fewer keys than it now holds
+    bool full() const{ RETURN keys > blocks * Block_Bits / Bits_Per_Key; }
+
+    // an empty filter with room for 'expected_keys'
+    void clear(size_t expected_keys){
+      generation = 0;
+      taxonomy_length = 0;
+      keys = 0;
+      blocks = (expected_keys * Bits_Per_Key + Block_Bits - 1) / Block_Bits;
+      if( blocks == 0 ) blocks = 1;
+      words.assign(blocks * Block_Words ,0);
+    }
+
+    // with room for twice the signatures in the index, so inserts do not fill it right away
+    void build(const signature_index &index){
+      clear(2 * index.size());
+      for( signature_index::const_iterator it = index.begin(); it != index.end(); it++ ){
+        insert(it->first);
+      }
+    }
+
+    void insert(const signature &key){
+      uint64_t *block = &words[block_of(key) * Block_Words];
+      uint32_t h1 ,h2;
+      hashes(key ,h1 ,h2);
+      for( uint k = 0; k < Probes; k++ ){
+        uint bit = (h1 + k * h2) % Block_Bits;
+        block[bit / 64] |= (uint64_t)1 << (bit % 64);
+      }
+      keys++;
+    }
+
+    // false when no node has signature 'key', true when one may
+    bool may_contain(const signature &key) const{
+      const uint64_t *block = &words[block_of(key) * Block_Words];
+      uint32_t h1 ,h2;
+      hashes(key ,h1 ,h2);
+      for( uint k = 0; k < Probes; k++ ){
+        uint bit = (h1 + k * h2) % Block_Bits;
+        if( !(block[bit / 64] & ((uint64_t)1 << (bit % 64))) ) RETURN false;
+      }
+      RETURN true;
+    }
+
+    /*
+      loads the filter persisted at filter_pathname
+      returns false if there is none, it is damaged, or it was built for a taxonomy of another
+      generation or length than those given, in which case the caller should build() it instead
+    */
+    bool load(const string &filter_pathname ,size_t expected_generation ,size_t expected_taxonomy_length){
+      ifstream is(filter_pathname ,ios::binary);
+      if( !is.good() ) RETURN false;
+      string header;
+      getline(is ,header);
+      stringstream ss(header);
+      string mark[5] ,tag;
+      size_t a_generation ,length ,a_blocks ,a_keys;
+      ss >> mark[0] >> tag >> mark[1] >> a_generation >> mark[2] >> length >> mark[3] >> a_blocks >> mark[4] >> a_keys;
+      if( ss.fail() || tag != "bloom" || a_blocks == 0 ) RETURN false;
+      if( a_generation != expected_generation || length != expected_taxonomy_length ) RETURN false;
+      for( uint k = 0; k < 5; k++ ) if( mark[k] != "#" ) RETURN false;
+      vector<uint64_t> a_words(a_blocks * Block_Words);
+      is.read((char *)&a_words[0] ,a_words.size() * sizeof(uint64_t));
+      if( !is || is.peek() != EOF ) RETURN false;
+      generation = a_generation;
+      taxonomy_length = length;
+      blocks = a_blocks;
+      keys = a_keys;
+      words.swap(a_words);
+      RETURN true;
+    }
+
+    // written beside filter_pathname and renamed into place, as mtime_index::write() does
+    bool write(const string &filter_pathname) const{
+      stringstream temp_pathname;
+      temp_pathname << filter_pathname << "-" << getpid();
+      ofstream os(temp_pathname.str() ,ios::binary | ios::trunc);
+      if( !os.good() ) RETURN false;
+      os << "# bloom # " << generation << " # " << taxonomy_length << " # " << blocks << " # " << keys << endl;
+      os.write((const char *)&words[0] ,words.size() * sizeof(uint64_t));
+      os.close();
+      if( os.fail() || rename(temp_pathname.str().c_str() ,filter_pathname.c_str()) == -1 ){
+        unlink(temp_pathname.str().c_str());
+        RETURN false;
+      }
+      RETURN true;
+    }
+
+  private:
+    size_t block_of(const signature &key) const{
+      uint64_t h;
+      memcpy(&h ,key.data ,sizeof(h));
+      RETURN h % blocks;
+    }
+
+    static void hashes(const signature &key ,uint32_t &h1 ,uint32_t &h2){
+      memcpy(&h1 ,key.data + 8 ,sizeof(h1));
+      memcpy(&h2 ,key.data + 12 ,sizeof(h2));
+      h2 |= 1;  // odd, so the probes do not repeat within a block
+    }
+
+    size_t blocks;
+    vector<uint64_t> words;  // blocks * Block_Words
+  };
+
+#endif
@@ -0,0 +1,453 @@
+#ifndef BOUNDED_H
+#define BOUNDED_H
+
+/*
+ defines classes:
+    index_entry
+    spill_record
+    external_sorter
+    signature_run
+    bounded_index
+
+ provides functions:
+    merge_spill
+
+  For insert --memory-cap, an insert into an archive whose nodes_map does not fit in memory.
+
+  Rather than parse the taxonomy into a nodes_map, insert reads it one node set at a time and
+  keeps only (signature, node) pairs, the bounded_index.  Should they not fit in their share
+  of the cap they are sorted in runs, the runs are merged into one file, and a lookup reads
+  the block of the file its signature falls in, found through the first signature of each
+  block kept in memory.  Nodes created during the insert go into a small map that is put out
+  as another run when it gets too big.
+
+  What the insert learns, a node phrase for each new node and a source phrase for each source
+  file, is appended to a spill, which is sorted the same way, by node.  At the end the spill
+  is merged with the old taxonomy, read again with a taxonomy_reader, see taxonomy.h, into
+  the new taxonomy, which comes out as it would have from the nodes_map.
+
+  The run files are in a directory under tax/ that is removed at the end.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+
+// STL objects used
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <queue>
+#include <algorithm>
+#include <memory>
+using namespace std;
+
+// locally defined objects
+#include "types.h"
+#include "file.h"
+#include "directory.h"
+#include "taxonomy.h"
+
+
+/*--------------------------------------------------------------------------------
+  the records that are sorted
+
+  Each can say how much memory it takes, for the cap, and read and write itself to a run.
+*/
+  class index_entry{
+  public:
+    signature node_signature;
+    size_t node;
+
+    size_t memory() const{ RETURN sizeof(index_entry); }
+
+    bool operator < (const index_entry &other) const{
+      if( node_signature < other.node_signature ) RETURN true;
+      if( other.node_signature < node_signature ) RETURN false;
+      RETURN node < other.node;
+    }
+
+    void write(ostream &os) const{
+      os.write((const char *)node_signature.data ,MD5_DIGEST_LENGTH);
+      os.write((const char *)&node ,sizeof(node));
+    }
+    bool read(istream &is){
+      is.read((char *)node_signature.data ,MD5_DIGEST_LENGTH);
+      is.read((char *)&node ,sizeof(node));
+      RETURN is.good();
+    }
+    static const size_t Bytes = MD5_DIGEST_LENGTH + sizeof(size_t);
+  };
+
+  // a node phrase of a new node, or a source phrase
+  class spill_record{
+  public:
+    spill_record(): node(0),is_node(false){;}
+
+    size_t node;
+    bool is_node;
+    signature node_signature;  // of a node phrase
+    file_record source;  // the mtime of a node phrase, the pathname too of a source phrase
+
+    size_t memory() const{ RETURN sizeof(spill_record) + source.pathname.capacity(); }
+
+    // by node, then the node phrase, then the sources in file_record order
+    bool operator < (const spill_record &other) const{
+      if( node != other.node ) RETURN node < other.node;
+      if( is_node != other.is_node ) RETURN is_node;
+      RETURN source < other.source;
+    }
+
+    void write(ostream &os) const{
+      os.write((const char *)&node ,sizeof(node));
+      char kind = is_node ? 'n' : 's';
+      os.write(&kind ,1);
+      os.write((const char *)&source.mtime ,sizeof(source.mtime));
+      if( is_node ){
+        os.write((const char *)node_signature.data ,MD5_DIGEST_LENGTH);
+        RETURN;
+      }
+      uint32_t length = source.pathname.size();
+      os.write((const char *)&length ,sizeof(length));
+      os.write(source.pathname.data() ,length);
+    }
+    bool read(istream &is){
+      char kind;
+      is.read((char *)&node ,sizeof(node));
+      is.read(&kind ,1);
+      is.read((char *)&source.mtime ,sizeof(source.mtime));
+      is_node = kind == 'n';
+      if( is_node ){
+        is.read((char *)node_signature.data ,MD5_DIGEST_LENGTH);
+        RETURN is.good();
+      }
+      uint32_t length = 0;
+      is.read((char *)&length ,sizeof(length));
+      source.pathname.resize(length);
+      if( length ) is.read(&source.pathname[0] ,length);
+      source.type = F_file;
+      RETURN is.good();
+    }
+  };
+
+
+/*--------------------------------------------------------------------------------
+  sorts more records than fit in 'budget' bytes
+
+  Records are gathered in memory until they reach the budget, then sorted and written out
+  as a run.  After finish() they come back in order from next(), merged from the runs, or
+  straight from memory when there never was a run.
+*/
+  template<class record>
+  class external_sorter{
+  public:
+    external_sorter(): budget(0),used(0),position(0){;}
+    ~external_sorter(){
+      runs.clear();
+      for( size_t k = 0; k < run_pathnames.size(); k++ ) unlink(run_pathnames[k].c_str());
+    }
+
+    // 'run_prefix' names the run files, a number is added
+    void open(const string &a_run_prefix ,size_t a_budget){
+      run_prefix = a_run_prefix;
+      budget = a_budget;
+    }
+
+    bool add(const record &r){
+      buffer.push_back(r);
+      used += r.memory();
+      if( used >= budget ) RETURN spill();
+      RETURN true;
+    }
+
+    bool in_memory() const{ RETURN run_pathnames.empty(); }
+
+    // the records, sorted, when in_memory()
+    const vector<record> &sorted() const{ RETURN buffer; }
+
+    bool finish(){
+      if( in_memory() ){
+        sort(buffer.begin() ,buffer.end());
+        position = 0;
+        RETURN true;
+      }
+      if( !buffer.empty() && !spill() ) RETURN false;
+      vector<record>().swap(buffer);
+      for( size_t k = 0; k < run_pathnames.size(); k++ ){
+        runs.push_back(shared_ptr<run_reader>(new run_reader(run_pathnames[k])));
+        if( runs.back()->next() ) heads.push(runs.back().get());
+      }
+      RETURN true;
+    }
+
+    // the next record in order, false when there are no more
+    bool next(record &r){
+      if( in_memory() ){
+        if( position == buffer.size() ) RETURN false;
+        r = buffer[position++];
+        RETURN true;
+      }
+      if( heads.empty() ) RETURN false;
+      run_reader *head = heads.top();
+      heads.pop();
+      r = head->current;
+      if( head->next() ) heads.push(head);
+      RETURN true;
+    }
+
+  private:
+    class run_reader{
+    public:
+      run_reader(const string &pathname): is(pathname ,ios::binary){;}
+      ifstream is;
+      record current;
+      bool next(){ RETURN current.read(is); }
+    };
+    class later{
+    public:
+      bool operator () (const run_reader *a ,const run_reader *b) const{ RETURN b->current < a->current; }
+    };
+
+    bool spill(){
+      sort(buffer.begin() ,buffer.end());
+      stringstream pathname;
+      pathname << run_prefix << run_pathnames.size();
+      run_pathnames.push_back(pathname.str());
+      ofstream os(pathname.str() ,ios::binary | ios::trunc);
+      for( size_t k = 0; k < buffer.size() && os.good(); k++ ) buffer[k].write(os);
+      os.close();
+      buffer.clear();
+      used = 0;
+      if( !os ){
+        cerr << "could not write run file: \"" << pathname.str() << "\"" << endl;
+        RETURN false;
+      }
+      RETURN true;
+    }
+
+    string run_prefix;
+    size_t budget;
+    size_t used;
+    vector<record> buffer;
+    size_t position;  // of next() while in memory
+    vector<string> run_pathnames;
+    vector< shared_ptr<run_reader> > runs;
+    priority_queue<run_reader * ,vector<run_reader *> ,later> heads;
+  };
+
+
+/*--------------------------------------------------------------------------------
+  sorted index entries in a file, looked up a block at a time
+*/
+  class signature_run{
+  public:
+    static const size_t Block_Entries = 4096 / index_entry::Bytes;
+
+    signature_run(): fd(-1),entries(0){;}
+    ~signature_run(){
+      if( fd != -1 ) close(fd);
+      if( !pathname.empty() ) unlink(pathname.c_str());
+    }
+
+    // writes the entries 'next' gives, which must come in order
+    template<class source>
+    bool write(const string &a_pathname ,source &next){
+      pathname = a_pathname;
+      ofstream os(pathname ,ios::binary | ios::trunc);
+      index_entry entry;
+      while( next(entry) ){
+        if( entries % Block_Entries == 0 ) fences.push_back(entry.node_signature);
+        entry.write(os);
+        entries++;
+      }
+      os.close();
+      if( !os ){
+        cerr << "could not write index file: \"" << pathname << "\"" << endl;
+        RETURN false;
+      }
+      fd = open_read(pathname);
+      RETURN fd != -1;
+    }
+
+    // appends the nodes of the entries with 'key' as their signature
+    void lookup(const signature &key ,vector<size_t> &nodes) const{
+      if( fences.empty() ) RETURN;
+      size_t block = lower_bound(fences.begin() ,fences.end() ,key) - fences.begin();
+      if( block > 0 ) block--;  // the key may start at the end of the block before
+      char buff[Block_Entries * index_entry::Bytes];
+      for( ; block < fences.size(); block++ ){
+        if( key < fences[block] ) RETURN;
+        ssize_t n = pread(fd ,buff ,sizeof(buff) ,block * sizeof(buff));
+        if( n <= 0 ) RETURN;
+        for( size_t k = 0; k + index_entry::Bytes <= (size_t)n; k += index_entry::Bytes ){
+          signature entry_signature;
+          memcpy(entry_signature.data ,buff + k ,MD5_DIGEST_LENGTH);
+          if( key < entry_signature ) RETURN;
+          if( entry_signature != key ) CONTINUE;
+          size_t node;
+          memcpy(&node ,buff + k + MD5_DIGEST_LENGTH ,sizeof(node));
+          nodes.push_back(node);
+        }
+      }
+    }
+
+  private:
+    string pathname;
+    int fd;
+    size_t entries;
+    vector<signature> fences;  // the first signature of each block
+
+    signature_run(const signature_run &);
+    signature_run &operator = (const signature_run &);
+  };
+
+
+/*--------------------------------------------------------------------------------
+  (signature, node) lookup for a taxonomy read one node set at a time
+
+  The nodes of the taxonomy are given to add() while it is read, then finish() sorts them,
+  in memory when they fit in 'base_budget' bytes, and into one run file when not.  New nodes
+  go to add_new() and may be looked up at once, once they take 'recent_budget' bytes they are
+  put out as another run.  lookup() gives the nodes of the taxonomy first, in node order, then the new
+  ones, as signature_index does.
+*/
+  class bounded_index{
+  public:
+    bounded_index(): recent_budget(0),recent_used(0),run_count(0){;}
+
+    void open(const string &a_run_prefix ,size_t base_budget ,size_t a_recent_budget){
+      run_prefix = a_run_prefix;
+      recent_budget = a_recent_budget;
+      base.open(run_prefix + "base-" ,base_budget);
+    }
+
+    bool add(const signature &node_signature ,size_t node){
+      index_entry entry;
+      entry.node_signature = node_signature;
+      entry.node = node;
+      RETURN base.add(entry);
+    }
+
+    bool finish(){
+      if( !base.finish() ) RETURN false;
+      if( base.in_memory() ) RETURN true;
+      RETURN put_run(base);
+    }
+
+    bool add_new(const signature &node_signature ,size_t node){
+      recent.insert(pair<signature ,size_t>(node_signature ,node));
+      recent_used += Recent_Memory;
+      if( recent_used < recent_budget ) RETURN true;
+      recent_source source(recent);
+      bool ok = put_run(source);
+      recent.clear();
+      recent_used = 0;
+      RETURN ok;
+    }
+
+    void lookup(const signature &key ,vector<size_t> &nodes) const{
+      nodes.clear();
+      if( base.in_memory() ){
+        index_entry first;
+        first.node_signature = key;
+        first.node = 0;
+        const vector<index_entry> &entries = base.sorted();
+        vector<index_entry>::const_iterator it = lower_bound(entries.begin() ,entries.end() ,first);
+        for( ; it != entries.end() && it->node_signature == key; it++ ) nodes.push_back(it->node);
+      }
+      for( size_t k = 0; k < runs.size(); k++ ) runs[k]->lookup(key ,nodes);
+      pair<multimap<signature ,size_t>::const_iterator ,multimap<signature ,size_t>::const_iterator> range = recent.equal_range(key);
+      for( ; range.first != range.second; range.first++ ) nodes.push_back(range.first->second);
+    }
+
+  private:
+    static const size_t Recent_Memory = 80;  // a multimap node of a (signature, node) pair, about
+
+    class recent_source{
+    public:
+      recent_source(const multimap<signature ,size_t> &a_map): it(a_map.begin()),end(a_map.end()){;}
+      bool operator () (index_entry &entry){
+        if( it == end ) RETURN false;
+        entry.node_signature = it->first;
+        entry.node = it->second;
+        it++;
+        RETURN true;
+      }
+      multimap<signature ,size_t>::const_iterator it;
+      multimap<signature ,size_t>::const_iterator end;
+    };
+
+    class sorter_source{
+    public:
+      sorter_source(external_sorter<index_entry> &a_sorter): sorter(a_sorter){;}
+      bool operator () (index_entry &entry){ RETURN sorter.next(entry); }
+      external_sorter<index_entry> &sorter;
+    };
+
+    bool put_run(external_sorter<index_entry> &sorter){
+      sorter_source source(sorter);
+      RETURN put_run(source);
+    }
+    template<class source>
+    bool put_run(source &next){
+      stringstream pathname;
+      pathname << run_prefix << "index-" << run_count++;
+      runs.push_back(shared_ptr<signature_run>(new signature_run));
+      RETURN runs.back()->write(pathname.str() ,next);
+    }
+
+    string run_prefix;
+    size_t recent_budget;
+    external_sorter<index_entry> base;
+    vector< shared_ptr<signature_run> > runs;
+    multimap<signature ,size_t> recent;
+    size_t recent_used;
+    size_t run_count;
+  };
+
+
+/*--------------------------------------------------------------------------------
+  writes the new taxonomy: the node sets of the old taxonomy with the spilled sources added,
+  and the node sets of the spilled new nodes, in node order
+*/
+  bool merge_spill(taxonomy_reader &old_taxonomy ,external_sorter<spill_record> &spill ,ostream &os){
+    node_set old_set;
+    bool old_more = old_taxonomy.next(old_set);
+    spill_record r;
+    bool spill_more = spill.next(r);
+    while( old_more || spill_more ){
+      node_set a_set;
+      if( old_more && (!spill_more || old_set.node < r.node || (old_set.node == r.node && !r.is_node)) ){
+        a_set = old_set;
+        old_more = old_taxonomy.next(old_set);
+      }else if( r.is_node && (!old_more || r.node < old_set.node) ){
+        a_set.clear();
+        a_set.node = r.node;
+        a_set.mtime = r.source.mtime;
+        a_set.node_signature = r.node_signature;
+        spill_more = spill.next(r);
+      }else{
+        cerr << "node " << r.node << " is in both the taxonomy and the spill, or in neither, nothing merged" << endl;
+        RETURN false;
+      }
+
+      while( spill_more && r.node == a_set.node && !r.is_node ){
+        a_set.sources.insert(r.source);
+        if( r.source.mtime < a_set.mtime ) a_set.mtime = r.source.mtime;
+        spill_more = spill.next(r);
+      }
+      a_set.print(os);
+      os << endl;
+    }
+    RETURN !old_taxonomy.failed && os.good();
+  }
+
+#endif
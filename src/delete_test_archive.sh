@@ -7,6 +7,8 @@ popd > /dev/null
 pushd test_archive/tax > /dev/null
 rm -f sources\;?
 rm -f sources\-*
+rm -f mtimes mtimes\-*
+rm -f generation generation\-*
 popd > /dev/null
 
 pushd test_archive > /dev/null
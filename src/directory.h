@@ -6,7 +6,7 @@
 /*
 file and pathname string manipulations
 defines 'file_record'
-regular expression match for file names
+defines 'exclude_matcher', the exclude patterns compiled for matching names and relative paths
 breadth first directory tree traversal routine, 'list_files'
 
 */
@@ -24,6 +24,8 @@ breadth first directory tree traversal routine, 'list_files'
 
 // STL objects
 #include <string>
+#include <vector>
+#include <unordered_set>
 #include <regex>
 
 // archive objects
@@ -43,17 +45,20 @@ breadth first directory tree traversal routine, 'list_files'
 //  type = F_file or F_symbolic_link
 //  pathname - is the path to the file with the file name appended 
 //  mtime - modification time
+//  size - length in bytes when the file was listed, 0 for the sources of a taxonomy
 //
   #define F_file 1
   #define F_symbol_link 2
   class file_record{
   public:
-    file_record(){;}
-    file_record(string &pathname ,time_t mtime): pathname(pathname),mtime(mtime),type(F_file){;}
-    file_record(string &pathname ,time_t mtime, string &target): pathname(pathname),mtime(mtime),type(F_symbol_link),target(target){;}
+    file_record(): size(0){;}
+    file_record(string &pathname ,time_t mtime): pathname(pathname),mtime(mtime),size(0),type(F_file){;}
+    file_record(string &pathname ,time_t mtime ,off_t size): pathname(pathname),mtime(mtime),size(size),type(F_file){;}
+    file_record(string &pathname ,time_t mtime, string &target): pathname(pathname),mtime(mtime),size(0),type(F_symbol_link),target(target){;}
 
     unsigned int type;
     time_t mtime;  // the modification time of the file
+    off_t size;  // from the stat that listed the file, see list_files()
     string pathname;  // the full path to the file
     string target; // used for symoblic links, target file pathname
 
@@ -108,31 +113,193 @@ breadth first directory tree traversal routine, 'list_files'
 
 
 //--------------------------------------------------------------------------------
-// name matches any regex in a list - helper function
+// exclude patterns
 //
-  bool match(const string &name ,const list<regex> &regex_list){
-    list<regex>::const_iterator i = regex_list.begin();
-    while( i != regex_list.end() ){
-      if( regex_match(name ,*i) ) return true;
-      ++i;
+//  A pattern without a '/' is matched against the file name, one with a '/' against the
+//  pathname relative to the root of the traversal, e.g. "tmp/rdiff-backup-data" or
+//  "build/.*\.o".  A leading '/' is dropped, relative paths never have one.  Either way the
+//  whole name or path must match, as with regex_match, and a matching directory is not
+//  descended into.
+//
+//  Rather than running every regex on every directory entry:
+//    patterns that are plain text go into a hash set
+//    the rest are compiled into one regex, an alternation of all of them
+//    the literal text that each of those must begin with is kept, and when every one of
+//    them has some, a name that begins with none of it is turned away without the regex
+//  Patterns with back references are kept as regexs of their own, their group numbers
+//  would change inside the alternation.
+//
+  class exclude_matcher{
+  public:
+    // false when 'pattern' is not an ECMAscript regex
+    bool add(const string &pattern){
+      if( pattern.find('/') == string::npos ) RETURN names.add(pattern);
+      size_t start = pattern.find_first_not_of('/');
+      if( start == string::npos ) RETURN false;
+      RETURN paths.add(pattern.substr(start));
+    }
+
+    bool empty() const{ RETURN names.empty() && paths.empty(); }
+    bool has_paths() const{ RETURN !paths.empty(); }
+
+    bool excluded(const string &name ,const string &relative_path) const{
+      RETURN names.match(name) || paths.match(relative_path);
     }
-    return false;
-  }
+
+  protected:
+    class pattern_set{
+    public:
+      pattern_set(): unprefixed(false){
+        for( uint i = 0; i < 256; i++ ) first_chars[i] = false;
+      }
+
+      bool empty() const{ RETURN literals.empty() && sources.empty() && separate.empty(); }
+
+      bool add(const string &pattern){
+        regex compiled;
+        try{
+          compiled = regex(pattern);
+        }catch( const regex_error &e ){
+          RETURN false;
+        }
+
+        bool is_literal;
+        string prefix = literal_prefix(pattern ,is_literal);
+        if( is_literal ){
+          literals.insert(prefix);
+          RETURN true;
+        }
+        if( has_back_reference(pattern) ){
+          separate.push_back(compiled);
+          RETURN true;
+        }
+
+        if( prefix.empty() ) unprefixed = true;
+        else{
+          prefixes.push_back(prefix);
+          first_chars[(unsigned char)prefix[0]] = true;
+        }
+        sources.push_back(pattern);
+        string alternation;
+        vector<string>::const_iterator it = sources.begin();
+        while( it != sources.end() ){
+          if( it != sources.begin() ) alternation += "|";
+          alternation += "(?:" + *it + ")";
+        it++;
+        }
+        combined = regex(alternation ,regex::ECMAScript | regex::optimize);
+        RETURN true;
+      }
+
+      bool match(const string &s) const{
+        if( literals.count(s) ) RETURN true;
+        list<regex>::const_iterator sit = separate.begin();
+        while( sit != separate.end() ){
+          if( regex_match(s ,*sit) ) RETURN true;
+        sit++;
+        }
+        if( sources.empty() ) RETURN false;
+        if( !unprefixed ){
+          if( s.empty() || !first_chars[(unsigned char)s[0]] ) RETURN false;
+          bool prefixed = false;
+          vector<string>::const_iterator pit = prefixes.begin();
+          while( pit != prefixes.end() ){
+            if( s.compare(0 ,pit->size() ,*pit) == 0 ){
+              prefixed = true;
+              BREAK;
+            }
+          pit++;
+          }
+          if( !prefixed ) RETURN false;
+        }
+        RETURN regex_match(s ,combined);
+      }
+
+    protected:
+      // the text every match of 'pattern' begins with, is_literal when that text is the only match
+      static string literal_prefix(const string &pattern ,bool &is_literal){
+        const string special = ".^$|?*+()[]{}";
+        string prefix;
+        is_literal = false;
+        // an alternation anywhere means no one prefix, be conservative about where it is
+        for( size_t i = 0; i < pattern.size(); i++ ){
+          if( pattern[i] == '\\' ) i++;
+          else if( pattern[i] == '|' ) RETURN prefix;
+        }
+        size_t i = 0;
+        while( i < pattern.size() ){
+          char c = pattern[i];
+          size_t step = 1;
+          if( c == '\\' ){
+            if( i + 1 == pattern.size() || isalnum((unsigned char)pattern[i + 1]) ) RETURN prefix;  // \d \w \1 and such
+            c = pattern[i + 1];
+            step = 2;
+          }else if( special.find(c) != string::npos ) RETURN prefix;
+          size_t next = i + step;
+          if( next < pattern.size() ){
+            char q = pattern[next];
+            if( q == '?' || q == '*' || q == '{' ) RETURN prefix;  // c is optional or repeated
+            if( q == '+' ){
+              prefix += c;
+              RETURN prefix;
+            }
+          }
+          prefix += c;
+          i = next;
+        }
+        is_literal = true;
+        RETURN prefix;
+      }
+
+      static bool has_back_reference(const string &pattern){
+        for( size_t i = 0; i + 1 < pattern.size(); i++ ){
+          if( pattern[i] != '\\' ) CONTINUE;
+          if( isdigit((unsigned char)pattern[i + 1]) && pattern[i + 1] != '0' ) RETURN true;
+          if( pattern[i + 1] == 'k' ) RETURN true;
+          i++;
+        }
+        RETURN false;
+      }
+
+      unordered_set<string> literals;
+      vector<string> sources;  // patterns in 'combined'
+      vector<string> prefixes;  // literal prefixes of the patterns in 'combined'
+      bool unprefixed;  // some pattern in 'combined' has no literal prefix, the prefilter is off
+      bool first_chars[256];  // first characters of 'prefixes'
+      regex combined;
+      list<regex> separate;
+    };
+
+    pattern_set names;
+    pattern_set paths;
+  };
 
 
 //--------------------------------------------------------------------------------
 // breadth first traversal of directory to create a file_record_list
 //   directory path given in:  source_root_dir
 //   returns a list of file records
+//   excluded directories are pruned, neither they nor anything under them is read
+//   relative_root is the path of source_root_dir relative to the root that path excludes are
+//   written against, when the traversal starts below that root
 // 
-  void list_files(const string &source_root_dirname ,file_record_list &files, file_record_list &links, const list<regex> &excludes){
+  void list_files(
+     const string &source_root_dirname
+    ,file_record_list &files
+    ,file_record_list &links
+    ,const exclude_matcher &excludes
+    ,const string &relative_root = ""
+  ){
 
     struct dirent *dep;
 
     string filepath;
     string filename;
+    string relative_path;
     list<string> directories;
+    list<string> relative_paths;  // of the directories, relative to source_root_dirname
     directories.push_back(source_root_dirname);
+    relative_paths.push_back(relative_root);
 
     DIR *source_dirp;
     string source_dirname;
@@ -143,6 +310,7 @@ breadth first directory tree traversal routine, 'list_files'
     while(dit != directories.end() ){
 
         source_dirname = *dit;
+        const string &relative_dirname = relative_paths.front();
         source_dirp = opendir( source_dirname.c_str() );
         if( source_dirp == NULL){
           cerr << "could not open source directory, skipping: " << source_dirname << endl;
@@ -151,17 +319,22 @@ breadth first directory tree traversal routine, 'list_files'
         while( dep = readdir(source_dirp) ){
 
           filename = dep->d_name;
-          if(filename == "." || filename == ".." || match(filename ,excludes) ) CONTINUE;
-          filepath = source_dirname + "/" + filename;
-
-          if( stat( filepath.c_str() ,&file_attributes) == -1){
-            cerr << filepath << " " << strerror(errno) << endl;
-            CONTINUE;
+          if(filename == "." || filename == "..") CONTINUE;
+          if( excludes.has_paths() ){
+            relative_path = relative_dirname.empty() ? filename : relative_dirname + "/" + filename;
           }
+          if( excludes.excluded(filename ,relative_path) ) CONTINUE;
+          filepath = source_dirname + "/" + filename;
 
           if( dep->d_type == DT_DIR ) { 
             //cout << "adding to directory list: " << filepath << endl;
             directories.push_back(filepath);
+            relative_paths.push_back(relative_dirname.empty() ? filename : relative_dirname + "/" + filename);
+            CONTINUE;
+          }
+
+          if( stat( filepath.c_str() ,&file_attributes) == -1){
+            cerr << filepath << " " << strerror(errno) << endl;
             CONTINUE;
           }
 
@@ -192,13 +365,14 @@ breadth first directory tree traversal routine, 'list_files'
             CONTINUE;
           }
 
-          files.insert( file_record(filepath, file_attributes.st_mtime) );
+          files.insert( file_record(filepath, file_attributes.st_mtime, file_attributes.st_size) );
         }
         
     _next_dir:
       closedir(source_dirp);
       dit++;
       directories.pop_front();
+      relative_paths.pop_front();
     }
 
   };
@@ -3,7 +3,7 @@
 #define FILE_H
 
 /*
-  file functions: signature, same, copy
+  file functions: signature, same, copy, durable_rename
 
 */
 
@@ -13,11 +13,15 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <linux/fs.h>
 #include <openssl/md5.h>
+#include <openssl/sha.h>
 
 #include <istream>
 #include <iostream>
@@ -25,6 +29,9 @@
 #include <string>
 #include <sstream>
 #include <list>
+#include <map>
+#include <vector>
+#include <algorithm>
 using namespace std;
 
 #include "types.h"
@@ -52,16 +59,95 @@ const static uint SIGNATURE_CHARS = 4096; // this is version specific, changing
      RETURN open_write(ss.str());
    }
 
+/*
+  Files opened for reading, kept open for the next time they are asked for, up to 'capacity'
+  of them, the least recently used is closed to make room.  For files that do not change
+  while they are open here, insert's node files: a node that comes up as a candidate for one
+  source file often does again for the next.
+*/
+  class fd_cache{
+  public:
+    fd_cache(size_t capacity = 64): capacity(capacity){;}
+    ~fd_cache(){ clear(); }
+
+    // a descriptor open on 'pathname', owned by the cache, or -1 with errno set
+    int open(const string &pathname){
+      map<string ,list<pair<string ,int>>::iterator>::iterator it = index.find(pathname);
+      if( it != index.end() ){
+        lru.splice(lru.begin() ,lru ,it->second);
+        RETURN it->second->second;
+      }
+      int fd = open_read(pathname);
+      if( fd == -1 ) RETURN -1;
+      if( lru.size() >= capacity ){
+        close(lru.back().second);
+        index.erase(lru.back().first);
+        lru.pop_back();
+      }
+      lru.push_front(pair<string ,int>(pathname ,fd));
+      index[pathname] = lru.begin();
+      RETURN fd;
+    }
+
+    void clear(){
+      for( list<pair<string ,int>>::iterator it = lru.begin(); it != lru.end(); it++ ) close(it->second);
+      lru.clear();
+      index.clear();
+    }
+
+  private:
+    size_t capacity;
+    list<pair<string ,int>> lru;  // most recently used first
+    map<string ,list<pair<string ,int>>::iterator> index;
+
+    fd_cache(const fd_cache &);
+    fd_cache &operator = (const fd_cache &);
+  };
+
+/*
+  For insert --no-cache-pollution: a file read or written once is let go of by the page
+  cache, so that a large insert does not push out the working set of everything else.
+  Only clean pages can be dropped, so written pages are put out to the device first.
+*/
+   void drop_cached(int fd){
+     posix_fadvise(fd ,0 ,0 ,POSIX_FADV_DONTNEED);
+   }
+   void drop_written(int fd){
+     sync_file_range(fd ,0 ,0 ,SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+     posix_fadvise(fd ,0 ,0 ,POSIX_FADV_DONTNEED);
+   }
+
 
 
 /*--------------------------------------------------------------------------------
-  This uses the MD5 sum of the first 4096 bytes of a file as a signature. The 'same' function we are currently
-  using already checks file length.  Using only the first block (or as many bytes as the file has if it less
-  that of a block) is for performance reasons.  Typically if the signatures match, we then run 'same' to 
-  make sure it is not due to aliasing.
+  A signature is the MD5 sum of some of the bytes of a file, a quick way to tell files apart.
+  Typically if the signatures match, we then run 'same' to make sure it is not due to aliasing.
+  Which bytes are summed is given by the kind of the signature, recorded with it in the node
+  phrase, so that nodes signed either way can be in one taxonomy:
+
+    Sign_Head     the first SIGNATURE_CHARS bytes, or the whole file if it is shorter.  Every
+                  taxonomy written before signatures had kinds is signed this way, and the kind
+                  is left out of their node phrases.  Files that share a header, disk images,
+                  archives, documents from one template, all have the same signature.
+
+    Sign_Regions  a file of up to Sign_Whole_Limit bytes whole, otherwise the head, the
+                  Sign_Interior blocks spaced evenly between the head and the tail, and the
+                  tail, each SIGNATURE_CHARS bytes, then the length of the file as 8 bytes.
+                  Files that differ past their header, or in length, differ here.
+
+  New nodes are signed Sign_Current.  Comparisons are on the sums alone, the kinds differ in
+  what was summed, not in the sums.  See resign.cc for bringing old nodes to the current kind.
 */
+  const uint Sign_Head = 0;
+  const uint Sign_Regions = 1;
+  const uint Sign_Current = Sign_Regions;
+  const uint Sign_Interior = 6;
+  const size_t Sign_Whole_Limit = (Sign_Interior + 2) * SIGNATURE_CHARS;
+
   class signature{
   public:
+    signature(): kind(Sign_Current){;}
+
     void print(ostream &os) const {
       const uchar *pt = data + MD5_DIGEST_LENGTH - 1;
       const uchar *end = data -1;
@@ -71,16 +157,58 @@ const static uint SIGNATURE_CHARS = 4096; // this is version specific, changing
       };
     }
 
-    bool sign( int file_descript ){// file_descript must be value, i.e. not less than zero
-      unsigned long file_size;
-      char* file_buffer;
+    // the offsets of the bytes summed by a signature of 'a_kind' of a file 'length' bytes long, each region SIGNATURE_CHARS or less
+    static void regions(uint a_kind ,size_t length ,vector<off_t> &offsets ,size_t &region_length){
+      offsets.clear();
+      if( a_kind == Sign_Head || length <= Sign_Whole_Limit ){
+        region_length = a_kind == Sign_Head ? min(length ,(size_t)SIGNATURE_CHARS) : length;
+        offsets.push_back(0);
+        RETURN;
+      }
+      region_length = SIGNATURE_CHARS;
+      size_t span = length - SIGNATURE_CHARS;
+      offsets.push_back(0);
+      for( uint k = 1; k <= Sign_Interior; k++ ) offsets.push_back(k * (span / (Sign_Interior + 1)));
+      offsets.push_back(span);
+    }
 
-      uchar buff[SIGNATURE_CHARS];
-      size_t buffer_size = read(file_descript ,buff ,SIGNATURE_CHARS);
-      MD5(buff, buffer_size, data);
+    // file_descript must be value, i.e. not less than zero, the file offset is left where it was
+    // false when the file can not be read, a file that got shorter is summed as far as it goes
+    bool sign( int file_descript ,uint a_kind = Sign_Current ){
+      struct stat file_attributes;
+      if( fstat(file_descript ,&file_attributes) == -1 ) RETURN false;
+      size_t length = file_attributes.st_size;
+      vector<off_t> offsets;
+      size_t region_length;
+      regions(a_kind ,length ,offsets ,region_length);
+      vector<uchar> buff(region_length);
+      MD5_CTX context;
+      MD5_Init(&context);
+      for( size_t k = 0; k < offsets.size(); k++ ){
+        size_t done = 0;
+        while( done < region_length ){
+          ssize_t n = pread(file_descript ,&buff[done] ,region_length - done ,offsets[k] + done);
+          if( n < 0 ) RETURN false;
+          if( n == 0 ) BREAK;  // the file got shorter, sum what is there
+          done += n;
+        }
+        MD5_Update(&context ,&buff[0] ,done);
+      }
+      finish(context ,a_kind ,length);
       RETURN true;
     }
 
+    // for a file already in memory, 'length' bytes long
+    void sign( const char *buff ,size_t length ,uint a_kind = Sign_Current ){
+      vector<off_t> offsets;
+      size_t region_length;
+      regions(a_kind ,length ,offsets ,region_length);
+      MD5_CTX context;
+      MD5_Init(&context);
+      for( size_t k = 0; k < offsets.size(); k++ ) MD5_Update(&context ,buff + offsets[k] ,region_length);
+      finish(context ,a_kind ,length);
+    }
+
     bool sign( char *filepath ){
       int file_descript;
       unsigned long file_size;
@@ -96,7 +224,6 @@ const static uint SIGNATURE_CHARS = 4096; // this is version specific, changing
       RETURN mksign;
     }
 
-
     bool fromhex(uint ch ,uint &result){
       if(ch >= '0' && ch <= '9'){
         result = ch - '0';
@@ -111,8 +238,8 @@ const static uint SIGNATURE_CHARS = 4096; // this is version specific, changing
       RETURN false;
     }
 
-    bool parse( string &signature_string ){
-      string::reverse_iterator rit = signature_string.rbegin();
+    bool parse( const string &signature_string ){
+      string::const_reverse_iterator rit = signature_string.rbegin();
       uint ch0;
       uint ch1;
       uchar *pt = data;
@@ -139,15 +266,57 @@ const static uint SIGNATURE_CHARS = 4096; // this is version specific, changing
       RETURN pt0 == pt0_end;
     }
 
+    bool operator != (const signature &other) const{
+      RETURN !(*this == other);
+    }
+
+    // an arbitrary but fixed order so that signatures can be sorted and merge joined
+    bool operator < (const signature &other) const{
+      RETURN memcmp(data ,other.data ,MD5_DIGEST_LENGTH) < 0;
+    }
+
     signature &operator = (const signature &other){
       uchar *pt0 = data;
       const uchar *pt0_end = data + MD5_DIGEST_LENGTH;
       const uchar *pt1 = other.data;
       while( pt0 != pt0_end){ *pt0 = *pt1; pt0++; pt1++;}
+      kind = other.kind;
       RETURN *this;
     }
 
     uchar data[MD5_DIGEST_LENGTH];
+    uint kind;  // Sign_Head, Sign_Regions, which bytes were summed
+
+  private:
+    void finish(MD5_CTX &context ,uint a_kind ,size_t length){
+      if( a_kind != Sign_Head ){
+        uchar length_bytes[8];
+        for( uint k = 0; k < 8; k++ ) length_bytes[k] = (uchar)((uint64_t)length >> (8 * k));
+        MD5_Update(&context ,length_bytes ,sizeof(length_bytes));
+      }
+      MD5_Final(data ,&context);
+      kind = a_kind;
+    }
+  };
+
+
+/*--------------------------------------------------------------------------------
+  A strong hash is the SHA-256 sum of a whole file.  Where a signature only narrows the nodes
+  a file has to be compared with, two files of one length with the same strong hash are
+  taken to be the same without either being read again.  See insert.cc, where it stands in
+  for comparing a source file with the nodes created earlier in the same run.
+*/
+  class strong_hash{
+  public:
+    void hash(const char *buff ,size_t length){
+      SHA256((const uchar *)buff ,length ,data);
+    }
+
+    bool operator == (const strong_hash &other) const{
+      RETURN memcmp(data ,other.data ,SHA256_DIGEST_LENGTH) == 0;
+    }
+
+    uchar data[SHA256_DIGEST_LENGTH];
   };
 
 
@@ -250,6 +419,73 @@ const static uint SIGNATURE_CHARS = 4096; // this is version specific, changing
      RETURN copy(s0.str(), s1.str());
    };
 
+/*--------------------------------------------------------------------------------
+  copies file fdi to fdj without passing the data through user space
+
+  copy_file_range lets the kernel, or the filesystem, move the data directly (and on some
+  filesystems share the extents).  Should it not be supported between the two files we
+  fall back to sendfile, and then to copy().
+*/
+  bool transfer(int fdi, int fdj){
+    off_t size = lseek(fdi ,0 ,SEEK_END);
+    if( size == -1 ) RETURN false;
+    lseek(fdi ,0 ,SEEK_SET);
+    lseek(fdj ,0 ,SEEK_SET);
+
+    off_t done = 0;
+    ssize_t n;
+    while( done < size ){
+      n = copy_file_range(fdi ,0 ,fdj ,0 ,size - done ,0);
+      if( n <= 0 ) BREAK;
+      done += n;
+    }
+    if( done == size ) RETURN true;
+
+    while( done < size ){
+      n = sendfile(fdj ,fdi ,0 ,size - done);
+      if( n <= 0 ) BREAK;
+      done += n;
+    }
+    if( done == size ) RETURN true;
+
+    // neither worked, start over through a user space buffer
+    if( ftruncate(fdj ,0) == -1 ) RETURN false;
+    RETURN copy(fdi ,fdj);
+  }
+
+  bool transfer(const string &s0,  const string &s1){
+    int fd0 = open_read(s0);
+    if( fd0 == -1 ) RETURN false;
+    int fd1 = open_write(s1);
+    if( fd1 == -1 ){
+      close(fd0);
+      RETURN false;
+    }
+    bool ok = ftruncate(fd1 ,0) == 0 && transfer(fd0 ,fd1);
+    close(fd0);
+    if( close(fd1) == -1 ) ok = false;
+    RETURN ok;
+  }
+
+/*--------------------------------------------------------------------------------
+  makes s1 a reflink of s0, a copy that shares the data extents of s0 so nothing is read or
+  written.  Returns false when the filesystem can not do this, s1 is then removed.
+*/
+  bool reflink(const string &s0,  const string &s1){
+    int fd0 = open_read(s0);
+    if( fd0 == -1 ) RETURN false;
+    int fd1 = open(s1.c_str() ,O_CREAT | O_TRUNC | O_WRONLY ,S_IRUSR | S_IWUSR);
+    if( fd1 == -1 ){
+      close(fd0);
+      RETURN false;
+    }
+    bool ok = ioctl(fd1 ,FICLONE ,fd0) == 0;
+    close(fd0);
+    if( close(fd1) == -1 ) ok = false;
+    if( !ok ) unlink(s1.c_str());
+    RETURN ok;
+  }
+
    bool touch(const string &s1){ 
      int fd1;
      if( (fd1=open_write(s1)) == -1) RETURN false;
@@ -267,10 +503,42 @@ const static uint SIGNATURE_CHARS = 4096; // this is version specific, changing
     close(fd);
     RETURN true;
   }
-  bool exists(const stringstream &pathname){ 
+  bool exists(const stringstream &pathname){
     RETURN exists(pathname.str());
   }
 
+/*--------------------------------------------------------------------------------
+  puts the file at 'from', just written and closed, in place at 'to' so that after a crash
+  'to' is either the old file or all of the new one
+
+  The file is synced, renamed over 'to', and then the directory is synced so that the rename
+  itself is on disk.  On failure 'from' is left where it is.
+*/
+  bool durable_rename(const string &from ,const string &to){
+    int fd = open_read(from);
+    if( fd == -1 ) RETURN false;
+    bool ok = fsync(fd) == 0;
+    if( close(fd) == -1 ) ok = false;
+    if( !ok || rename(from.c_str() ,to.c_str()) == -1 ) RETURN false;
+    size_t slash = to.rfind('/');
+    string directory = slash == string::npos ? "." : slash == 0 ? "/" : to.substr(0 ,slash);
+    fd = open(directory.c_str() ,O_RDONLY | O_DIRECTORY);
+    if( fd == -1 ) RETURN false;
+    ok = fsync(fd) == 0;
+    close(fd);
+    RETURN ok;
+  }
+
+/*--------------------------------------------------------------------------------
+  size of a file in bytes, returns false if the file can not be stat'ed
+*/
+  bool file_size(const string &pathname ,off_t &size){
+    struct stat file_attributes;
+    if( stat(pathname.c_str() ,&file_attributes) == -1 ) RETURN false;
+    size = file_attributes.st_size;
+    RETURN true;
+  }
+
 
 
 /*--------------------------------------------------------------------------------
@@ -337,6 +605,8 @@ const static uint SIGNATURE_CHARS = 4096; // this is version specific, changing
           suffix--;
           versioned_pathname << not_versioned_pathname << ";" << suffix; 
           rename( versioned_pathname.str().c_str() ,new_pathname.c_str()); // should be checking for errors !
+          versioned_pathname.clear();
+          versioned_pathname.str("");
       } while(suffix != 0 );
         
   RETURN maxsuffix;
@@ -0,0 +1,414 @@
+/*
+  gc [options] <archive> [<node> ...]
+
+  Removes source records, and the nodes left without any, from an archive.
+
+  Source records are chosen by an ECMAscript regex on their pathname, --source, and whole
+  nodes by number on the command line.  One pass over the nodes_map drops the chosen source
+  records, and a node with no source records left is taken out of the map and its number
+  given back to the node_number_allocator.  The new taxonomy is then committed as a new
+  version, see archive.h, so the removal can be looked back on or undone from the history.
+
+  Node files are deleted only after the new taxonomy is in place, and an intent log,
+  tax/gc-intent, makes the deletion safe against a crash part way:
+
+    1. the nodes to delete and the generation the commit will produce are written to
+       tax/gc-intent, through a temporary file, fsync and rename
+    2. the new taxonomy is committed
+    3. the node files are unlinked
+    4. tax/gc-intent is removed
+
+  Every run of gc first looks for a gc-intent left behind.  If the taxonomy generation shows
+  that its commit was made the listed node files are deleted, except for any node that is
+  back in the taxonomy because a later insert reused the number, otherwise the commit never
+  happened and the intent is dropped.  Running gc with no selection just does this.
+
+  --orphans also deletes files in the store that are not nodes of the taxonomy, e.g. those
+  left by an insert that was interrupted before it wrote its taxonomy.  gc holds the archive
+  while it runs, see archive_lock in archive.h, so the node files of an insert still running
+  are never taken for orphans.
+*/
+
+// before we start, a bit of Vogon poetry:
+//
+  const char *vogon_poetry = R"VOGON_POETRY(
+     gc [options] <archive> [<node> ...]
+
+    <archive> the archive to remove from
+    <node>    nodes to remove, with all their source records
+
+    options:
+
+      -h --help            this message
+      -n --dry-run         report what would be removed, change nothing
+      -v --verbose         progress information, and each node removed
+      -s --source <regx>   remove the source records whose pathname matches the ECMAscript regx
+         --orphans         also delete files in the store that are not nodes
+
+    nodes left with no source records are removed, and a new taxonomy version is written
+
+    exits with 6 when another program holds the archive
+
+  )VOGON_POETRY";
+
+#include "types.h"
+
+// Program Termination Return Codes
+const uint Exit_NoError   =0;
+const uint Exit_BadParms  =1;
+const uint Exit_NoArchive =2;
+const uint Exit_InternalError =4;
+const uint Exit_FileCreationError =5;
+const uint Exit_ArchiveBusy =6;
+
+// for sterror and errno
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+
+// STL objects used
+#include <string>
+#include <fstream>
+#include <set>
+#include <list>
+#include <regex>
+using namespace std;
+
+// local objects used
+#include "file.h"
+#include "directory.h"
+#include "taxonomy.h"
+#include "archive.h"
+
+
+/*--------------------------------------------------------------------------------
+  the intent log
+
+    line 1     the generation the commit makes
+    following  one node number per line
+*/
+  string intent_pathname(const archive &an_archive){
+    RETURN an_archive.tax_path + "/gc-intent";
+  }
+
+  bool write_intent(const archive &an_archive ,size_t generation ,const set<size_t> &nodes){
+    stringstream ss;
+    ss << generation << endl;
+    set<size_t>::const_iterator it = nodes.begin();
+    while( it != nodes.end() ){
+      ss << *it << endl;
+    it++;
+    }
+    string contents = ss.str();
+
+    stringstream temp_pathname;
+    temp_pathname << intent_pathname(an_archive) << "-" << getpid();
+    int fd = open_write(temp_pathname);
+    if( fd == -1 ) RETURN false;
+    if( ftruncate(fd ,0) == -1 ){
+      close(fd);
+      unlink(temp_pathname.str().c_str());
+      RETURN false;
+    }
+    size_t done = 0;
+    while( done < contents.size() ){
+      ssize_t n = write(fd ,contents.data() + done ,contents.size() - done);
+      if( n <= 0 ) BREAK;
+      done += n;
+    }
+    bool ok = done == contents.size() && fsync(fd) == 0;
+    if( close(fd) == -1 ) ok = false;
+    if( ok ) ok = rename(temp_pathname.str().c_str() ,intent_pathname(an_archive).c_str()) == 0;
+    if( !ok ) unlink(temp_pathname.str().c_str());
+    RETURN ok;
+  }
+
+  // false when there is no intent log, or it can not be read
+  bool read_intent(const archive &an_archive ,size_t &generation ,set<size_t> &nodes){
+    nodes.clear();
+    ifstream is(intent_pathname(an_archive));
+    if( !is.good() || !(is >> generation) ) RETURN false;
+    size_t node;
+    while( is >> node ) nodes.insert(node);
+    RETURN true;
+  }
+
+  // unlinks the node files of 'nodes' that are not in the taxonomy, counts those unlinked
+  size_t delete_nodes(const archive &an_archive ,const set<size_t> &nodes ,bool verbose){
+    size_t deleted = 0;
+    set<size_t>::const_iterator it = nodes.begin();
+    while( it != nodes.end() ){
+      size_t node = *it;
+      it++;
+      if( an_archive.a_nodes_map.find(node) != an_archive.a_nodes_map.end() ) CONTINUE;
+      string pathname = an_archive.node_pathname(node);
+      if( unlink(pathname.c_str()) == -1 ){
+        if( errno != ENOENT ) cerr << "could not delete node: " << pathname << " " << strerror(errno) << endl;
+        CONTINUE;
+      }
+      if( verbose ) cout << "deleted: " << pathname << endl;
+      deleted++;
+    }
+    RETURN deleted;
+  }
+
+  // finishes or drops an intent left by a gc that did not complete
+  void recover(const archive &an_archive ,bool dry_run ,bool verbose){
+    size_t generation;
+    set<size_t> nodes;
+    if( !read_intent(an_archive ,generation ,nodes) ) RETURN;
+    if( an_archive.generation() < generation ){
+      if( verbose || dry_run ) cout << "dropping the intent of a gc that did not commit" << endl;
+      if( !dry_run ) unlink(intent_pathname(an_archive).c_str());
+      RETURN;
+    }
+    if( verbose || dry_run ) cout << "finishing an interrupted gc, nodes: " << nodes.size() << endl;
+    if( dry_run ) RETURN;
+    delete_nodes(an_archive ,nodes ,verbose);
+    unlink(intent_pathname(an_archive).c_str());
+  }
+
+
+/*--------------------------------------------------------------------------------
+  drops the selected source records, and the nodes left without any, from a_nodes_map
+
+  the removed nodes are returned in 'removed' and given back to the allocator
+ */
+  void select(
+     archive &an_archive
+    ,const list<regex> &source_regexes
+    ,const set<size_t> &node_numbers
+    ,size_t &sources_removed
+    ,set<size_t> &removed
+    ,bool verbose
+  ){
+    set<size_t>::const_iterator nit = node_numbers.begin();
+    while( nit != node_numbers.end() ){
+      if( an_archive.a_nodes_map.find(*nit) == an_archive.a_nodes_map.end() ) cerr << "not a node of the archive: " << *nit << endl;
+    nit++;
+    }
+
+    nodes_map::iterator nm_it = an_archive.a_nodes_map.begin();
+    while( nm_it != an_archive.a_nodes_map.end() ){
+      node_set &ns = nm_it->second;
+      if( node_numbers.find(ns.node) != node_numbers.end() ){
+        sources_removed += ns.sources.size();
+        ns.sources.clear();
+      } else if( !source_regexes.empty() ){
+        file_record_list::iterator fr_it = ns.sources.begin();
+        while( fr_it != ns.sources.end() ){
+          bool matched = false;
+          list<regex>::const_iterator rit = source_regexes.begin();
+          while( !matched && rit != source_regexes.end() ){
+            matched = regex_match(fr_it->pathname ,*rit);
+          rit++;
+          }
+          if( !matched ){
+            fr_it++;
+            CONTINUE;
+          }
+          if( verbose ) cout << "source removed: " << fr_it->pathname << endl;
+          sources_removed++;
+          fr_it = ns.sources.erase(fr_it);
+        }
+      }
+
+      if( !ns.sources.empty() ){
+        nm_it++;
+        CONTINUE;
+      }
+      size_t node = ns.node;
+      if( verbose ) cout << "node removed: " << an_archive.node_pathname(node) << endl;
+      removed.insert(node);
+      an_archive.nna.dealloc(node);
+      nm_it = an_archive.a_nodes_map.erase(nm_it);
+    }
+  }
+
+  // store files that are not nodes of the taxonomy
+  void find_orphans(const archive &an_archive ,list<string> &orphans){
+    DIR *store_dirp = opendir(an_archive.store_path.c_str());
+    if( store_dirp == NULL ){
+      cerr << "could not open the store: " << an_archive.store_path << " " << strerror(errno) << endl;
+      RETURN;
+    }
+    struct dirent *dep;
+    while( (dep = readdir(store_dirp)) != NULL ){
+      string filename = dep->d_name;
+      if( filename == "." || filename == ".." ) CONTINUE;
+      char *end;
+      errno = 0;
+      size_t node = strtoul(filename.c_str() ,&end ,10);
+      bool numeric = *end == 0 && errno == 0 && isdigit((uchar)filename[0]);
+      if( numeric && an_archive.a_nodes_map.find(node) != an_archive.a_nodes_map.end() ) CONTINUE;
+      orphans.push_back(an_archive.store_path + "/" + filename);
+    }
+    closedir(store_dirp);
+    orphans.sort();
+  }
+
+
+/*--------------------------------------------------------------------------------
+
+   This is called from the shell. See the Vogon poetry at the top of this file for
+   the usage message.
+
+*/
+  int main(int argc ,char **argv){
+
+    //----------------------------------------
+    // parse options
+    //
+      list<char *> args;
+      list<regex> source_regexes;
+      bool verbose=false;
+      bool dry_run=false;
+      bool orphans=false;
+      bool bad_parms=false;
+
+      if(argv == 0){
+        cerr << "serious problem here, argv was zero when the program was called" << endl;
+        RETURN Exit_InternalError;
+      }
+      if(argc == 1){
+        cerr << vogon_poetry;
+        RETURN Exit_BadParms;
+      }
+
+      for( argv++ ; *argv; argv++ ){
+        // check for options
+        //
+          if( (*argv)[0] == '-' ){
+            if( !strcmp(*argv, "-h") || !strcmp(*argv, "--help") ){
+              cout << vogon_poetry;
+              bad_parms=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "-n") || !strcmp(*argv, "--dry-run") ){
+              dry_run=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "-v") || !strcmp(*argv, "--verbose") ){
+              verbose=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--orphans") ){
+              orphans=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "-s") || !strcmp(*argv, "--source") ){
+              argv++;
+              if( !*argv ){
+                cerr << "expected an ECMAscript regex after the source option" << endl;
+                bad_parms=true;
+                BREAK;
+              }
+              try{
+                source_regexes.push_back(regex(*argv));
+              }catch( const regex_error &e ){
+                cerr << "not an ECMAscript regex: \"" << *argv << "\"" << endl;
+                bad_parms=true;
+              }
+              CONTINUE;
+            }
+
+            bad_parms=true;
+            cerr << "unrecognized option: " << *argv << endl;
+            CONTINUE;
+          }
+
+        // if it isn't and option, it is an arg
+        //
+          args.push_back(*argv);
+          CONTINUE;
+      }
+    if( args.empty() ){
+      cerr << "need an archive argument" << endl;
+      bad_parms=true;
+    }
+    string arch_path;
+    set<size_t> node_numbers;
+    if( !args.empty() ){
+      arch_path = args.front();
+      args.pop_front();
+    }
+    list<char *>::const_iterator ait = args.begin();
+    while( ait != args.end() ){
+      char *end;
+      size_t node = strtoul(*ait ,&end ,10);
+      if( *end != 0 || node == 0 ){
+        cerr << "not a node number: " << *ait << endl;
+        bad_parms=true;
+      }
+      node_numbers.insert(node);
+    ait++;
+    }
+    if(bad_parms){
+      cerr << "errors when parsing parameters, nothing done" << endl;
+      RETURN Exit_BadParms;
+    }
+
+  //----------------------------------------
+  // load the taxonomy, and finish any gc that was interrupted
+  //
+    archive an_archive;
+    if( !an_archive.open(arch_path ,false) ){
+      cerr << "not an archive: \"" << arch_path << "\"" << endl;
+      RETURN Exit_NoArchive;
+    }
+    if( !an_archive.lock() ) RETURN Exit_ArchiveBusy;
+    if( verbose ) cout << "parsing taxonomy file: \"" << an_archive.taxonomy_pathname() << "\"" << endl;
+    if( an_archive.load() != Archive_Success ) RETURN Exit_InternalError;
+    recover(an_archive ,dry_run ,verbose);
+
+  //----------------------------------------
+  // drop the selected sources and nodes
+  //
+    list<string> orphan_pathnames;
+    if( orphans ) find_orphans(an_archive ,orphan_pathnames);  // before select, removed nodes are not orphans
+    size_t sources_removed = 0;
+    set<size_t> removed;
+    select(an_archive ,source_regexes ,node_numbers ,sources_removed ,removed ,verbose || dry_run);
+    if( dry_run ){
+      list<string>::const_iterator oit = orphan_pathnames.begin();
+      while( oit != orphan_pathnames.end() ){
+        cout << "orphan: " << *oit << endl;
+      oit++;
+      }
+    }
+    cout << "sources removed: " << sources_removed
+         << " nodes removed: " << removed.size()
+         << " orphans: " << orphan_pathnames.size()
+         << endl;
+    if( dry_run ) RETURN Exit_NoError;
+
+  //----------------------------------------
+  // intent, commit, delete, done
+  //
+    if( sources_removed != 0 || !removed.empty() ){
+      if( !write_intent(an_archive ,an_archive.generation() + 1 ,removed) ){
+        cerr << "could not write the intent log: \"" << intent_pathname(an_archive) << "\", nothing done" << endl;
+        RETURN Exit_FileCreationError;
+      }
+      if( an_archive.commit() != Archive_Success ){
+        recover(an_archive ,false ,verbose);  // the commit may have been made, the generation tells
+        RETURN Exit_InternalError;
+      }
+      delete_nodes(an_archive ,removed ,verbose);
+      unlink(intent_pathname(an_archive).c_str());
+    }
+
+    list<string>::const_iterator oit = orphan_pathnames.begin();
+    while( oit != orphan_pathnames.end() ){
+      if( unlink(oit->c_str()) == -1 ) cerr << "could not delete orphan: " << *oit << " " << strerror(errno) << endl;
+      else if( verbose ) cout << "deleted: " << *oit << endl;
+    oit++;
+    }
+
+  RETURN Exit_NoError;
+  }
@@ -0,0 +1,493 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+/*
+ defines classes:
+    taxonomy_stream
+    version_reader
+
+ provides functions:
+    taxonomy_generation, advance_generation
+    write_delta, convert_history, commit_taxonomy
+
+  The versions of a taxonomy.  sources;0 is the newest and the only one kept whole.  Each
+  older version is kept as a delta against the version after it, in a file named for its
+  generation, see below:
+
+    delta;<g>  the taxonomy of generation g, given as its differences from generation g + 1
+
+  A commit writes one delta, that of the outgoing sources;0 against the new one, and puts the
+  new one in place, so it costs the same however long the history.  Version numbers count
+  back from sources;0 as they always have, version n is generation G - n, where G is the
+  current generation.  Generation 0 is the empty taxonomy of an archive that has never had a
+  commit, it has no delta.
+
+  A delta is a list of the node numbers that are in the newer version but not in the older
+  one, followed by the node sets of the older version that are not in the newer one exactly
+  as they are, copied as text:
+
+    # delta # <g> # <inode> # <length>
+    # drop # <node>
+    ...
+    # node # <node> # <mtime> # <signature> [# <kind>]
+    # source # <pathname> # <mtime>
+    ...
+
+  An old version is rebuilt by a merge on node number: sources;0 is read one node set at a
+  time, the delta of the generation before it is merged in, and so on back to the version
+  wanted.  Every file of the chain is read in node order at once, so the memory used is a
+  node set for each delta and not a whole taxonomy.  Node sets are handled as text and only
+  their node phrases are parsed, a rebuilt version has the bytes the version had.
+
+  Archives written before deltas keep their older versions whole, as sources;1, sources;2,
+  and so on.  convert_history() turns those into deltas, a commit does so first when it
+  finds any, and until then a version whose whole copy is still there is read from it.
+
+  Each commit also advances the generation held in tax/generation, a count that only goes
+  up.  An archive from before the generation file existed is taken to be at the generation
+  equal to its number of versions.  The generation file is written after the new sources;0
+  is in place, so a crash between the two leaves it one behind.  The inode and length in the
+  header of a delta are those of the newer version it was taken against, and when delta;<G>
+  was taken against the sources;0 that is there, its commit was made and the generation is
+  G + 1, see taxonomy_generation().  A delta;<G> left by a commit that did not get as far as
+  replacing sources;0 names another file, and is written over by the next commit.
+*/
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// STL objects used
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <memory>
+using namespace std;
+
+// locally defined objects
+#include "types.h"
+#include "file.h"
+#include "phrase.h"
+#include "taxonomy.h"
+
+
+/*--------------------------------------------------------------------------------
+  generations
+*/
+  string versioned_pathname(const string &tax_path ,size_t version){
+    stringstream ss;
+    ss << tax_path << "/sources;" << version;
+    RETURN ss.str();
+  }
+
+  string delta_pathname(const string &tax_path ,size_t generation){
+    stringstream ss;
+    ss << tax_path << "/delta;" << generation;
+    RETURN ss.str();
+  }
+
+  // true if the delta at 'pathname' was taken against the file at 'newer_pathname', see above
+  bool delta_taken_against(const string &pathname ,const string &newer_pathname){
+    ifstream is(pathname);
+    if( !is.good() ) RETURN false;
+    stringstream phrase_stream;
+    stringstream data_stream;
+    stringstream err;
+    size_t lineno = 0;
+    phrase a_phrase;
+    if( getphraseline(is ,lineno ,pathname ,phrase_stream ,data_stream) != ParseStatus::Found ) RETURN false;
+    if( a_phrase.parse(phrase_stream ,data_stream ,pathname ,lineno ,err) != ParseStatus::Found ) RETURN false;
+    if( a_phrase.size() != 4 || a_phrase.front() != string("delta") ) RETURN false;  // from before the header named the newer version
+    phrase::const_iterator pit = a_phrase.begin();
+    pit++; pit++;
+    ino_t inode;
+    off_t length;
+    stringstream ss(*pit);
+    if( !(ss >> inode) ) RETURN false;
+    pit++;
+    ss.clear();
+    ss.str(*pit);
+    if( !(ss >> length) ) RETURN false;
+    struct stat newer_attributes;
+    if( stat(newer_pathname.c_str() ,&newer_attributes) == -1 ) RETURN false;
+    RETURN newer_attributes.st_ino == inode && newer_attributes.st_size == length;
+  }
+
+  // the generation of the taxonomy in sources;0, see above
+  size_t taxonomy_generation(const string &tax_path){
+    ifstream is(tax_path + "/generation");
+    size_t generation;
+    if( !(is.good() && (is >> generation)) ){
+      generation = 0;
+      while( exists(versioned_pathname(tax_path ,generation)) ) generation++;
+    }
+    if( delta_taken_against(delta_pathname(tax_path ,generation) ,versioned_pathname(tax_path ,0)) ) generation++;
+    RETURN generation;
+  }
+
+  // called once a new sources;0 is in place, the file is replaced by rename so it is never partial
+  bool advance_generation(const string &tax_path ,size_t previous_generation){
+    stringstream temp_pathname;
+    temp_pathname << tax_path << "/generation-" << getpid();
+    {
+      ofstream os(temp_pathname.str());
+      os << previous_generation + 1 << endl;
+      os.close();
+      if( os.fail() ) RETURN false;
+    }
+    if( durable_rename(temp_pathname.str() ,tax_path + "/generation") ) RETURN true;
+    unlink(temp_pathname.str().c_str());
+    RETURN false;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  a taxonomy read one node set at a time, in node order, as text
+*/
+  class taxonomy_stream{
+  public:
+    taxonomy_stream(): failed(false){;}
+    virtual ~taxonomy_stream(){;}
+    bool failed;  // a node set did not parse, or a file could not be read
+    virtual bool next(node_set &ns ,string &text) = 0;
+  };
+
+  // a taxonomy kept whole, no file is an empty taxonomy
+  class file_stream : public taxonomy_stream{
+  public:
+    file_stream(const string &pathname): is(pathname),scanner(is ,pathname),previous(0){
+      if( exists(pathname) && !is.good() ){
+        cerr << "could not open taxonomy file: \"" << pathname << "\"" << endl;
+        failed = true;
+      }
+    }
+    bool next(node_set &ns ,string &text){
+      if( failed || !scanner.next(ns ,&text) ){
+        if( scanner.misparse_count ) failed = true;
+        RETURN false;
+      }
+      if( ns.node <= previous ){
+        cerr << "taxonomy is not in node order at node " << ns.node << endl;
+        failed = true;
+        RETURN false;
+      }
+      previous = ns.node;
+      RETURN true;
+    }
+  private:
+    ifstream is;
+    node_set_scanner scanner;
+    size_t previous;
+  };
+
+  // the version before that of 'newer', from 'newer' and the delta at 'pathname'
+  class delta_stream : public taxonomy_stream{
+  public:
+    delta_stream(taxonomy_stream *a_newer ,const string &a_pathname)
+      :newer(a_newer)
+      ,pathname(a_pathname)
+      ,drops_is(pathname)
+      ,sets_is(pathname)
+      ,sets(sets_is ,pathname)
+      ,drops_lineno(0)
+      ,newer_ready(false),newer_done(false)
+      ,set_ready(false),sets_done(false)
+      ,drop_ready(false),drops_done(false)
+    {
+      if( !drops_is.good() || !sets_is.good() ){
+        cerr << "could not open delta file: \"" << pathname << "\"" << endl;
+        failed = true;
+      }
+    }
+
+    bool next(node_set &ns ,string &text){
+      while( !failed ){
+        if( !newer_ready && !newer_done ){
+          newer_ready = newer->next(newer_set ,newer_text);
+          newer_done = !newer_ready;
+          if( newer->failed ) failed = true;
+        }
+        if( !set_ready && !sets_done ){
+          set_ready = sets.next(delta_set ,&delta_text);
+          sets_done = !set_ready;
+          if( sets.misparse_count ) failed = true;
+        }
+        if( failed ) BREAK;
+
+        if( newer_ready && (!set_ready || newer_set.node < delta_set.node) ){
+          newer_ready = false;
+          if( dropped(newer_set.node) ) CONTINUE;
+          ns = newer_set;
+          text.swap(newer_text);
+          RETURN true;
+        }
+        if( set_ready ){
+          if( newer_ready && newer_set.node == delta_set.node ) newer_ready = false;  // replaced
+          set_ready = false;
+          ns = delta_set;
+          text.swap(delta_text);
+          RETURN true;
+        }
+        RETURN false;
+      }
+      RETURN false;
+    }
+
+  private:
+    // true if 'node' is in the drop list, which is read along with the newer version
+    bool dropped(size_t node){
+      while( !drops_done && (!drop_ready || drop < node) ){
+        drop_ready = next_drop();
+        drops_done = !drop_ready;
+      }
+      RETURN drop_ready && drop == node;
+    }
+
+    // the drop phrases come before the first node phrase
+    bool next_drop(){
+      stringstream phrase_stream;
+      stringstream data_stream;
+      stringstream err;
+      phrase a_phrase;
+      ParseStatus stat;
+      while( !((stat = getphraseline(drops_is ,drops_lineno ,pathname ,phrase_stream ,data_stream)).value & ParseStatus::NotFound) ){
+        if( stat.value & ParseStatus::NullObject ) CONTINUE;
+        a_phrase.clear();
+        if( a_phrase.parse(phrase_stream ,data_stream ,pathname ,drops_lineno ,err) != ParseStatus::Found ) CONTINUE;
+        if( a_phrase.front() == string("node") ) RETURN false;
+        if( a_phrase.front() != string("drop") || a_phrase.size() != 2 ) CONTINUE;
+        stringstream ss(a_phrase.back());
+        if( !(ss >> drop) ){
+          cerr << pathname << ":" << drops_lineno << " malformed drop phrase" << endl;
+          failed = true;
+          RETURN false;
+        }
+        RETURN true;
+      }
+      RETURN false;
+    }
+
+    unique_ptr<taxonomy_stream> newer;
+    string pathname;
+    ifstream drops_is;
+    ifstream sets_is;
+    node_set_scanner sets;
+    size_t drops_lineno;
+
+    node_set newer_set;
+    string newer_text;
+    bool newer_ready ,newer_done;
+    node_set delta_set;
+    string delta_text;
+    bool set_ready ,sets_done;
+    size_t drop;
+    bool drop_ready ,drops_done;
+  };
+
+
+/*--------------------------------------------------------------------------------
+  a version of the taxonomy of the archive with tax directory 'tax_path', rebuilt as it is read
+*/
+  class version_reader{
+  public:
+    version_reader(const string &tax_path ,size_t version): found(true){
+      size_t generation = taxonomy_generation(tax_path);
+      string whole = versioned_pathname(tax_path ,version);
+      if( version == 0 || exists(whole) ){
+        stream.reset(new file_stream(whole));
+        RETURN;
+      }
+      if( version > generation ){
+        found = false;
+        RETURN;
+      }
+      if( version == generation ){  // generation 0, the empty taxonomy
+        stream.reset(new file_stream(""));
+        RETURN;
+      }
+      for( size_t g = generation - 1; g + version >= generation; g-- ){
+        if( !exists(delta_pathname(tax_path ,g)) ){
+          found = false;
+          RETURN;
+        }
+      }
+      stream.reset(new file_stream(versioned_pathname(tax_path ,0)));
+      for( size_t g = generation - 1; g + version >= generation; g-- ){
+        stream.reset(new delta_stream(stream.release() ,delta_pathname(tax_path ,g)));
+      }
+    }
+
+    bool found;  // the version is in the archive, the deltas back to it are all there
+
+    bool next(node_set &ns ,string &text){ RETURN found && stream->next(ns ,text); }
+    bool failed() const{ RETURN found && stream->failed; }
+
+    // the whole version onto 'os'
+    bool write(ostream &os){
+      node_set ns;
+      string text;
+      while( next(ns ,text) ) os << text;
+      RETURN !failed() && os.good();
+    }
+
+  private:
+    unique_ptr<taxonomy_stream> stream;
+  };
+
+
+/*--------------------------------------------------------------------------------
+  writes to 'pathname' the delta of the taxonomy at 'older_pathname' against the one at
+  'newer_pathname', for generation 'generation'
+
+  The node sets go to a temporary file as the two taxonomies are merged, and are appended
+  once the drop list, which comes first, is known.
+*/
+  bool write_delta(const string &older_pathname ,const string &newer_pathname ,const string &pathname ,size_t generation){
+    struct stat newer_attributes;
+    if( stat(newer_pathname.c_str() ,&newer_attributes) == -1 ){
+      cerr << "could not stat taxonomy file: \"" << newer_pathname << "\"" << endl;
+      RETURN false;
+    }
+    stringstream temp_pathname ,sets_pathname;
+    temp_pathname << pathname << "-" << getpid();
+    sets_pathname << pathname << "-sets-" << getpid();
+    vector<size_t> drops;
+    bool ok;
+    {
+      file_stream older(older_pathname) ,newer(newer_pathname);
+      ofstream os(sets_pathname.str() ,ios::binary | ios::trunc);
+      node_set older_set ,newer_set;
+      string older_text ,newer_text;
+      bool older_ready = older.next(older_set ,older_text);
+      bool newer_ready = newer.next(newer_set ,newer_text);
+      while( (older_ready || newer_ready) && os.good() ){
+        if( older_ready && (!newer_ready || older_set.node < newer_set.node) ){
+          os << older_text;
+          older_ready = older.next(older_set ,older_text);
+        }else if( !older_ready || newer_set.node < older_set.node ){
+          drops.push_back(newer_set.node);
+          newer_ready = newer.next(newer_set ,newer_text);
+        }else{
+          if( older_text != newer_text ) os << older_text;
+          older_ready = older.next(older_set ,older_text);
+          newer_ready = newer.next(newer_set ,newer_text);
+        }
+      }
+      os.close();
+      ok = !older.failed && !newer.failed && !os.fail();
+    }
+    if( ok ){
+      ofstream os(temp_pathname.str() ,ios::binary | ios::trunc);
+      os << "# delta # " << generation << " # " << newer_attributes.st_ino << " # " << newer_attributes.st_size << endl;
+      for( size_t k = 0; k < drops.size(); k++ ) os << "# drop # " << drops[k] << endl;
+      ifstream is(sets_pathname.str() ,ios::binary);
+      if( is.peek() != EOF ) os << is.rdbuf();
+      os.close();
+      ok = !os.fail() && durable_rename(temp_pathname.str() ,pathname);  // on disk before sources;0 is replaced
+    }
+    unlink(sets_pathname.str().c_str());
+    if( !ok ){
+      unlink(temp_pathname.str().c_str());
+      cerr << "could not write delta file: \"" << pathname << "\"" << endl;
+    }
+    RETURN ok;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  turns the whole older versions of an archive from before deltas into deltas, see above
+
+  Every delta is written before any whole version is removed, and the generation file is
+  written first, as the generation of such an archive is known from its number of versions.
+  Returns the number of versions converted, or -1 on an error.
+
+  A delta is taken against the version after it, so the versions must run from sources;1
+  without a gap.  The tax directory is listed for them, and when one is missing the gap is
+  reported and nothing is converted, rather than leaving the versions after it whole for
+  good.  Until the versions past the gap are moved out of the way, commits fail here too.
+*/
+  // the version number of a taxonomy kept whole, false for other file names
+  bool whole_version(const char *name ,size_t &version){
+    const char *prefix = "sources;";
+    if( strncmp(name ,prefix ,strlen(prefix)) != 0 ) RETURN false;
+    const char *digits = name + strlen(prefix);
+    if( *digits == 0 || strspn(digits ,"0123456789") != strlen(digits) ) RETURN false;
+    stringstream ss(digits);
+    RETURN (bool)(ss >> version);
+  }
+
+  int convert_history(const string &tax_path){
+    DIR *dirp = opendir(tax_path.c_str());
+    if( dirp == NULL ){
+      cerr << "could not list the tax directory: \"" << tax_path << "\"" << endl;
+      RETURN -1;
+    }
+    size_t oldest = 0;
+    size_t version;
+    struct dirent *dep;
+    while( (dep = readdir(dirp)) != NULL ){
+      if( whole_version(dep->d_name ,version) && version > oldest ) oldest = version;
+    }
+    closedir(dirp);
+    size_t count = 1;
+    while( exists(versioned_pathname(tax_path ,count)) ) count++;
+    if( count <= oldest ){
+      cerr << "\"" << versioned_pathname(tax_path ,count) << "\" is missing, the versions after it, to \""
+           << versioned_pathname(tax_path ,oldest) << "\", can not be made deltas, nothing converted" << endl;
+      RETURN -1;
+    }
+    if( count == 1 ) RETURN 0;
+    size_t generation = taxonomy_generation(tax_path);
+    if( generation < count ){
+      cerr << "the generation of \"" << tax_path << "\" is less than its number of versions" << endl;
+      RETURN -1;
+    }
+    if( !advance_generation(tax_path ,generation - 1) ){
+      cerr << "could not write the taxonomy generation: \"" << tax_path << "/generation\"" << endl;
+      RETURN -1;
+    }
+    for( size_t version = 1; version < count; version++ ){
+      if( !write_delta(
+             versioned_pathname(tax_path ,version) ,versioned_pathname(tax_path ,version - 1)
+            ,delta_pathname(tax_path ,generation - version) ,generation - version
+          )
+      ) RETURN -1;
+    }
+    for( size_t version = 1; version < count; version++ ) unlink(versioned_pathname(tax_path ,version).c_str());
+    RETURN count - 1;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  makes the taxonomy at 'new_pathname' sources;0 of the archive with tax directory 'tax_path'
+
+  The sources;0 being replaced is kept as a delta against the new one, then the new taxonomy
+  is renamed over it, see durable_rename() in file.h, and the generation is advanced.  A crash
+  leaves sources;0 whole, old or new, never a partial copy.  On success 'new_pathname' is gone,
+  on History_DeltaFail or History_RenameFail it is left for the caller.  On
+  History_GenerationFail the new sources;0 is in place and its generation is still known from
+  its delta, see above, but the commit is to be reported as failed.  A reader of the old
+  sources;0 keeps it through its open descriptor, see nodes_map::index().
+*/
+  const uint History_Success = 0;
+  const uint History_DeltaFail = 1;
+  const uint History_RenameFail = 2;
+  const uint History_GenerationFail = 3;
+
+  uint commit_taxonomy(const string &tax_path ,const string &new_pathname){
+    if( convert_history(tax_path) < 0 ) RETURN History_DeltaFail;
+    size_t previous_generation = taxonomy_generation(tax_path);
+    string current_pathname = versioned_pathname(tax_path ,0);
+    if( exists(current_pathname) ){
+      if( !write_delta(current_pathname ,new_pathname ,delta_pathname(tax_path ,previous_generation) ,previous_generation) ){
+        RETURN History_DeltaFail;
+      }
+    }
+    // when only the sync of the directory failed the rename was made, and the generation must follow it
+    if( !durable_rename(new_pathname ,current_pathname) && exists(new_pathname) ) RETURN History_RenameFail;
+    if( !advance_generation(tax_path ,previous_generation) ) RETURN History_GenerationFail;
+    RETURN History_Success;
+  }
+
+#endif
@@ -1,8 +1,9 @@
 /*
-  insert <archive> <source>
+  insert <archive> ... <source>
 
   <archive>
-     directory to hold the archived data
+     directory to hold the archived data, several may be given, each is brought up to date
+     from one traversal and one read of the source
 
   <source> 
      <source> is a directory to be traversed.  During traversal 1) unique
@@ -36,14 +37,20 @@
 
   also tempted to add simultaneous update of multiple mirroed archives ..
 
+----
+  simultaneous update of mirrored archives: every argument before the source is an archive.
+  Each source file is signed and brought into memory once, see node_writer.h, then looked up
+  in each archive's signature index.  New nodes are written by one thread per archive from
+  that same image, so source media is read once however many mirrors there are.
+
 */
 
 // before we start, a bit of Vogon poetry:
 //
   const char *vogon_poetry = R"VOGON_POETRY(
-     insert [options] <archive> <source>
+     insert [options] <archive> ... <source>
 
-    <archive> the name of the archive
+    <archive> the name of the archive, more than one may be given to update mirrors together
      <source> a source directory tree 
 
     options:
@@ -51,7 +58,24 @@
       -h --help            this message
          --list_insert     prints 'insert-file <filename>' on cout for each file included in the archive
       -v --verbose         progress information, does not do --list_insert as that can get very long
-      -x --exclude <regx>  ECMAscript regx for excluding files that have a matching path name
+      -x --exclude <regx>  ECMAscript regx for excluding files and directories that have a matching
+                           name, or when <regx> has a '/', a matching path relative to <source>
+         --io <engine>     how source files are read and nodes written: 'sync', one system call
+                           at a time, the default, or 'uring', many files in flight through io_uring
+         --io-depth <n>    with --io uring, files in flight, default 64
+         --no-cache-pollution  source files and nodes read or written are dropped from the page
+                           cache once done with, so a large insert does not evict everything else
+         --memory-cap <size>  bounded memory insert for an archive whose taxonomy does not fit in
+                           memory, <size> in MiB, or with a K, M or G suffix, one archive only,
+                           covers the file list, the indexes, and the files being read and written
+         --stats <file>    per phase timings and counters as JSON lines, "-" for stderr
+         --watch           after inserting, keep watching <source> and insert files as they are
+                           written, until SIGINT or SIGTERM
+         --batch <n>       with --watch, files gathered before they are committed, default 1000
+         --commit-interval <seconds>  with --watch, longest a file waits to be committed, default 5
+         --stats-interval <seconds>  also write them this often while running, default only at the end
+
+    exits with 6 when another program holds one of the archives
 
   )VOGON_POETRY";
 
@@ -64,67 +88,185 @@ const uint Exit_NoArchive =2;
 const uint Exit_NoSource  =3;
 const uint Exit_InternalError =4;
 const uint Exit_FileCreationError =5;
+const uint Exit_ArchiveBusy =6;
 
 // for sterror and errno
 #include <errno.h>
 #include <string.h>
 
+// for --watch
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+
 // STL objects used
 #include <string>
 #include <regex>
 #include <fstream>
 #include <set>
 #include <list>
+#include <map>
 using namespace std;
 
 // local objects used
 #include "file.h"
 #include "directory.h"
 #include "taxonomy.h"
+#include "mtime_index.h"
+#include "bloom.h"
+#include "archive.h"
+#include "node_writer.h"
+#include "source_reader.h"
+#include "bounded.h"
+#include "stats.h"
+#include "watch.h"
+
 
+/*--------------------------------------------------------------------------------
+  a node created in this run, known by the length and strong hash of its image
+
+  only a node whose length another listed file has too can be met again in the run, so only
+  those are hashed and kept, see insert_files()
+*/
+  class run_node{
+  public:
+    size_t size;
+    strong_hash digest;
+  };
 
 
 /*--------------------------------------------------------------------------------
+  one of the archives being inserted into
+
+  Several archives can be given on the command line, typically mirrors of one another.  Each
+  has its own taxonomy, node numbers, and store, but the source tree is traversed once and
+  each source file is read and signed once for all of them.  See node_writer.h.
+*/
+  class mirror{
+  public:
+    mirror(): drop_cache(false),unique_count(0),failed(false){;}
+
+    string arch_path;
+    string tax_path;
+    string store_path;
+    string temp_tax_pathname;  // the new taxonomy is written here, then renamed over sources;0, see main()
+    string original_taxonomy_pathname;
+    string mtime_index_pathname;
+    string bloom_pathname;
+
+    nodes_map a_nodes_map;
+    node_number_allocator nna;
+    mtime_index a_mtime_index;  // mtime ordered index over a_nodes_map, kept in step with it
+    signature_index a_signature_index;  // signature lookup over a_nodes_map, kept in step with it
+    bloom_filter a_bloom;  // the signatures of a_signature_index, asked before it
+    node_writer writer;
+    fd_cache node_fds;  // node files kept open for find(), a candidate for one source file is often one for the next
+    bool drop_cache;  // node files compared by find() are dropped from the page cache
+    map<size_t ,run_node> run_nodes;  // the nodes created in this run, see same_node(), cleared by commit_mirrors()
+
+    archive_lock held;  // for the whole run, --watch included, see archive.h
+    uint unique_count;  // files inserted into this archive
+    bool failed;  // a node could not be created, the taxonomy is not to be committed
+  };
 
-  Given one source file, fds: scans through each node set entry in the nodes_map, hd.  If
-  the node file referenced in the node set is the same() as the source file, then we
-  return true and set 'npi' to point to the corresponding node set entry in the nodes_map.
 
-          archpath - is the name of the archive directory
-  source signature - is the signature of the fixed source file
-               fds - is an open C file handle for the source file - used when the source signature matches to check for aliasing
-               npi - is an iterator on the nodes_map, it iterates through node sets
+/*--------------------------------------------------------------------------------
 
-  first we check for matching signatures between the node in the nodes_map and the
-  source file.  If the signatures are the same, we then check to see if the files themselves
-  are the same.
+  Given one source file, held in 'image': looks up the nodes of the mirror that have the
+  same signature as the source file.  If the node file referenced in one of them is the
+  same as the source file, then we return true and set 'npi' to point to the corresponding
+  node set entry in the nodes_map.
+
+  A run_node, a node created earlier in this run, is not read back, whether or not the node
+  writer has got to it: the source file is the node when it has the node's length and strong
+  hash, and is not otherwise.  So the copies of one file within a source tree come to one
+  node with all their paths as sources, and cost a hash each, not a read of the store.  A
+  node queued in the writer that is not a run_node, as in the bounded insert or when the file
+  changed length after it was listed, is compared with its image in memory.  The node files
+  of the other candidates are compared with the image all together, see
+  source_image::same_as_any(), through descriptors the mirror keeps open across source
+  files.
 
   The signature object is found in "file.h"
 
  */
-   bool find(const string &store_path ,nodes_map &hd ,signature &source_signature ,int fds ,nodes_map::iterator &npi){
-     nodes_map::iterator i = hd.begin();
-     while( i != hd.end() ){
-       if( source_signature == i->second.node_signature ){ // then we must check the files to be sure
-         stringstream ss;
-         ss << store_path << "/" << i->first;
-         int fdn;
-         fdn = open_read(ss);
-         if( fdn == -1 ){ // pretty serious error as these are the archive node files
-           cerr << "could not open archive node file for reading, skipping: " << ss.str() << endl;
-           cerr << strerror(errno) << endl;
-         } else {
-           if(same(fds ,fdn)){
-             npi = i; // npi points to the record found
-             close(fdn);
-             RETURN true;
-           }
-           close(fdn);
+   // sets 'node' to the one of 'candidates' that holds the same bytes as 'image', false if none does
+   bool same_node(mirror &m ,const vector<size_t> &candidates ,const source_image &image ,size_t &node){
+     STATS_ADD(Count_Candidates ,candidates.size());
+     vector<size_t> on_disk;
+     vector<int> fds;
+     for( size_t k = 0; k < candidates.size(); k++ ){
+       map<size_t ,run_node>::const_iterator rit = m.run_nodes.find(candidates[k]);
+       if( rit != m.run_nodes.end() ){
+         if( rit->second.size == image.size && rit->second.digest == image.strong() ){
+           STATS_ADD(Count_RunDuplicates ,1);
+           node = candidates[k];
+           RETURN true;
+         }
+         CONTINUE;
+       }
+       source_image_ptr pending = m.writer.pending(candidates[k]);
+       if( pending ){
+         STATS_ADD(Count_SameCalls ,1);
+         if( pending->same(image) ){
+           node = candidates[k];
+           RETURN true;
          }
+         STATS_ADD(Count_SameFalse ,1);
+         CONTINUE;
        }
-     i++;  
+       stringstream ss;
+       ss << m.store_path << "/" << candidates[k];
+       int fdn = m.node_fds.open(ss.str());
+       if( fdn == -1 ){ // pretty serious error as these are the archive node files
+         cerr << "could not open archive node file for reading, skipping: " << ss.str() << endl;
+         cerr << strerror(errno) << endl;
+         CONTINUE;
+       }
+       on_disk.push_back(candidates[k]);
+       fds.push_back(fdn);
+     }
+     if( fds.empty() ) RETURN false;
+     int found;
+     {
+       STATS_TIMER(Phase_Same);
+       size_t different;
+       found = image.same_as_any(fds ,different);
+       STATS_ADD(Count_SameCalls ,fds.size());
+       STATS_ADD(Count_SameFalse ,different);
      }
-     RETURN false;
+     if( m.drop_cache ) for( size_t k = 0; k < fds.size(); k++ ) drop_cached(fds[k]);
+     if( found < 0 ) RETURN false;
+     node = on_disk[found];
+     RETURN true;
+   }
+
+   bool find_signed(mirror &m ,const signature &source_signature ,const source_image &image ,nodes_map::iterator &npi){
+     if( !m.a_bloom.may_contain(source_signature) ){
+       STATS_ADD(Count_BloomRejects ,1);
+       RETURN false;
+     }
+     pair<signature_index::iterator ,signature_index::iterator> candidates = m.a_signature_index.equal_range(source_signature);
+     if( candidates.first == candidates.second ){
+       STATS_ADD(Count_BloomFalse ,1);
+       RETURN false;
+     }
+     vector<size_t> nodes;
+     for( signature_index::iterator i = candidates.first; i != candidates.second; i++ ) nodes.push_back(i->second);
+     size_t node;
+     if( !same_node(m ,nodes ,image ,node) ) RETURN false;
+     npi = m.a_nodes_map.find(node); // npi points to the record found
+     RETURN true;
+   }
+
+   // while the archive still has nodes signed by their head only, see file.h, they are looked for too
+   bool find(mirror &m ,const signature &source_signature ,const source_image &image ,nodes_map::iterator &npi){
+     STATS_TIMER(Phase_Find);
+     if( find_signed(m ,source_signature ,image ,npi) ) RETURN true;
+     if( m.a_signature_index.head_signed == 0 || source_signature.kind == Sign_Head ) RETURN false;
+     signature head_signature;
+     head_signature.sign(image.data ,image.size ,Sign_Head);
+     RETURN find_signed(m ,head_signature ,image ,npi);
    }
 
 
@@ -133,7 +275,8 @@ using namespace std;
   if the source file is already in the archive, but its filepath is not, we add its filepath to the node set in the tax file
   if the source file modification time is older than that of the corresponding node, we update the mtime in the node set
 
-  this routine calls 'find()' to see if the proposed file is already in the archive
+  this routine calls 'find()' to see if the proposed file is already in the archive, the
+  node file itself is written by the mirror's node writer
 
 */
   const uint Insert_NotInserted =0;
@@ -142,75 +285,91 @@ using namespace std;
   const uint Insert_StorageFailure  =2;
   const uint Insert_NodesMapFailure = 3;
 
-  uint insert_if_unique(  
-     uint &unique_count   // this counter incremented if file is inserted in the archive
-    ,const string &store_path // path to the node storage directory, the node storage directory holds the nodes (number named unique files)
-    ,node_number_allocator &nna // provides the next number name for a file to be written into the node storage directory
-    ,nodes_map &a_nodes_map  // in memory index for the node storage directory, will be updated should the proposed file be inserted
+  uint insert_if_unique(
+     mirror &m  // the archive, its nodes_map and indexes are updated should the proposed file be inserted
     ,const file_record &source_file_record  // file proposed for inclusion, descriptor class, the file name is in the pathname field
+    ,const signature &source_signature  // signature of the source file
+    ,const source_image_ptr &image  // the source file in memory
+    ,bool size_shared  // another listed file has the same length, so a copy may come later
   ){
-    bool inserted = false;
-    int fds = open_read(source_file_record.pathname);
-    signature source_signature;
-    source_signature.sign(fds);
     nodes_map::iterator node_set_it;
 
     // check if already in archive
     //
-      if(find(store_path ,a_nodes_map ,source_signature ,fds ,node_set_it)){ // if found sets node_set_it
-        node_set_it->second.sources.insert(source_file_record);    
-        if(node_set_it->second.mtime > source_file_record.mtime)  node_set_it->second.mtime = source_file_record.mtime;
-      close(fds);
+      if(find(m ,source_signature ,*image ,node_set_it)){ // if found sets node_set_it
+        node_set &ns = node_set_it->second;
+        if( !m.a_nodes_map.load(ns) ){  // the sources of the node, see nodes_map::index()
+          m.failed = true;
+          RETURN Insert_NodesMapFailure;
+        }
+        if( ns.sources.insert(source_file_record).second ) m.a_mtime_index.insert_source(ns.node ,source_file_record);
+        if(ns.mtime > source_file_record.mtime){
+          m.a_mtime_index.move_node(ns.node ,ns.mtime ,source_file_record.mtime);
+          ns.mtime = source_file_record.mtime;
+        }
       RETURN Insert_NotInserted;
       }
 
     // insert file in archive
     //
       // insert node phrase in nodes_map
-      unique_count++;
-      inserted = true;
+      m.unique_count++;
+      STATS_ADD(Count_Inserted ,1);
       node_set  np;
-      if( !nna.alloc(np.node) ){
-        cerr << "could not allocate a new node number" << endl;
+      if( !m.nna.alloc(np.node) ){
+        cerr << "could not allocate a new node number in: " << m.arch_path << endl;
         RETURN Insert_NameAllocationFailure;
       };
       np.mtime = source_file_record.mtime;
       np.sources.insert(source_file_record);
       np.node_signature = source_signature;
-      a_nodes_map.insert(pair<size_t ,node_set>(np.node ,np));
-
-      // copy source file into archive
-      stringstream ss;
-      ss << store_path << "/" << np.node;
-      int fda = open_write( ss );
-      if( fda == -1 ){ // oh no, we can't write into the archive
-        cerr << "could not create node in the archive, exiting: " << ss.str() << endl;
-        cerr << strerror(errno) << endl;
-        RETURN Insert_StorageFailure;
+      m.a_nodes_map.insert(pair<size_t ,node_set>(np.node ,np));
+      m.a_mtime_index.insert(np);
+      m.a_signature_index.insert(np);
+      m.a_bloom.insert(np.node_signature);
+      if( m.a_bloom.full() ){
+        STATS_ADD(Count_BloomBytes ,-m.a_bloom.memory());
+        m.a_bloom.build(m.a_signature_index);
+        STATS_ADD(Count_BloomBytes ,m.a_bloom.memory());
       }
-      if( !copy(fds ,fda) ){
-        cerr << "copy of source file node failed! node: "
-             << ss.str()  
-             << " source file: \"" 
-             << source_file_record.pathname 
-             << "\""
-             << endl;
-        RETURN Insert_StorageFailure;
+
+      // later copies of it in this run are known by its strong hash
+      if( size_shared ){
+        run_node &rn = m.run_nodes[np.node];
+        rn.size = image->size;
+        STATS_TIMER(Phase_Sign);
+        rn.digest = image->strong();
       }
-    close(fda);
-    close(fds);
+
+      // copy source file into archive
+      m.writer.push(np.node ,image);
+
     RETURN Insert_Inserted;
   }
 
 /*--------------------------------------------------------------------------------
   Traverses the directory tree found at 'source_path'.  For each file that does
-  not match an excluded pattern, it calls 'insert_if_unique(file)'.
+  not match an excluded pattern, it calls 'insert_if_unique(file)' once per mirror.
+
+    starts by calling nodes_map::index to recover the node map of each mirror from the
+    sources file found at its 'original_taxonomy_pathname'.  Only the node phrases are
+    parsed, the sources of a node set are parsed when a source file is found to match it.
+
+    tells the nodes_map object in memory to print an ascii imagege back to the tax/sources
+    files, at 'temp_tax_pathname'.  Node sets that were never parsed are copied as they are.
+
+    the mtime index at 'mtime_index_pathname' is loaded, or rebuilt when it is missing or
+    stale, kept in step with the nodes_map while inserting, and written back at the end.  So
+    is the Bloom filter of node signatures at 'bloom_pathname', see bloom.h.
 
-    starts by calling nodes_map::parse to recover the node map from the sources file found
-    at 'taxonomy_pathname'.
+    A mirror whose node files could not all be written is marked failed, its taxonomy is
+    left alone so that it never refers to a node that is not in the store.
 
-    tells the nodes_map object in memory to print an ascii imagege back to a tax/sources
-    files.
+    The work is in three parts so that --watch can parse once and then insert batch after
+    batch: load_mirrors, insert_files, and insert which does both around one traversal.
+
+    The source files are read by a source_reader, see source_reader.h, with the engine given
+    by --io, and the node writers use the same engine.
 
  */
   const uint AI_Success = 0;
@@ -218,79 +377,587 @@ using namespace std;
   const uint AI_ParseFail = 2;
   const uint AI_SystemErr = 3;
 
-  uint insert(
-     const string &taxonomy_pathname
-    ,const string &source_path // source files from this directory subtree
-    ,const string &store_path  // directory that holds the file 'nodes' - a node is a unique file with a number for a name
-    ,const list<regex> &excludes // source files with names that match any of these regexs should not be put in the archive
-    ,bool verbose // progress messgaes
-    ,bool list_insert // individual file insert commands to be used for incremental backup on mirrors
+  // index the sources file of each mirror, its node phrases into memory, see nodes_map::index()
+  uint load_mirrors(list<mirror> &mirrors ,bool verbose){
+    list<mirror>::iterator mit;
+      for( mit = mirrors.begin(); mit != mirrors.end(); mit++ ){
+        STATS_TIMER(Phase_Parse);
+        const string &taxonomy_pathname = mit->original_taxonomy_pathname;
+        off_t taxonomy_length = 0;
+        if( exists(taxonomy_pathname) ){
+          ParseStatus stat = mit->a_nodes_map.index(taxonomy_pathname);  // the sources are parsed as nodes are matched
+          if( stat == ParseStatus::NotFound ){
+            cerr << "could not open taxonomy file: \"" << taxonomy_pathname << "\"" << endl;
+            RETURN AI_OpenFail;
+          }
+          if( stat != ParseStatus::Found ){
+            cerr << "parse failed" << endl;
+            RETURN AI_ParseFail;
+          }
+          file_size(taxonomy_pathname ,taxonomy_length);
+        }
+        if(verbose) cout << "parse complete" << endl;
+
+        mit->nna.parse(mit->a_nodes_map);
+
+        size_t generation = taxonomy_generation(mit->tax_path);  // see history.h
+        if( !mit->a_mtime_index.load(mit->mtime_index_pathname ,generation ,taxonomy_length) ){
+          if( !mit->a_nodes_map.load_all() ){
+            cerr << "parse failed" << endl;
+            RETURN AI_ParseFail;
+          }
+          mit->a_mtime_index.build(mit->a_nodes_map);
+        }
+        mit->a_signature_index.build(mit->a_nodes_map);
+        if( !mit->a_bloom.load(mit->bloom_pathname ,generation ,taxonomy_length) ){
+          mit->a_bloom.build(mit->a_signature_index);
+        }
+        STATS_ADD(Count_BloomBytes ,mit->a_bloom.memory());
+      }
+  RETURN AI_Success;
+  }
+
+  // inserts 'source_files' into the mirrors and writes their temporary taxonomies and indexes
+  uint insert_files(
+     list<mirror> &mirrors
+    ,const file_record_list &source_files
+    ,const io_options &io
+    ,bool verbose
+    ,bool list_insert
   ){
+    list<mirror>::iterator mit;
 
-    // open, parse into memory, and close, the sources file 
+    // find and insert unique source files
+    //   each source file is read once, into an image that is shared by all the mirrors
     //
-      ifstream is(taxonomy_pathname);
-      if( !is.good() ){
-        cerr << "could not open taxonomy file: \"" << taxonomy_pathname << "\"" << endl;
-        RETURN AI_OpenFail;
+      source_reader reader(source_files ,io);
+      for( mit = mirrors.begin(); mit != mirrors.end(); mit++ ){
+        mit->drop_cache = io.drop_cache;
+        mit->writer.use_uring = io.uring;
+        mit->writer.drop_cache = io.drop_cache;
+        mit->writer.buffers = reader.registered_buffers();
+        mit->writer.start(mit->store_path);
       }
 
-      // tests fail becamse the taxonomy_pathname here is a temp file name that has the pid as a suffix
-      // also deleted the line from test_insert_out.txt_expected
-      //      if(verbose) cout << "parsing taxonomy file: \"" << taxonomy_pathname << "\" to get the nodes_map.. " << endl;
-      uint lineno=0;
-      nodes_map a_nodes_map;
-      if( a_nodes_map.parse(is ,taxonomy_pathname ,lineno) != ParseStatus::Found){ // filename passed for err messes
-        cerr << "parse failed" << endl;
-        RETURN AI_ParseFail;
+      // lengths that two or more of the listed files have, a file of any other length can not
+      // be a copy of another in this batch, and the node made of it is not hashed
+      set<off_t> shared_sizes;
+      {
+        set<off_t> sizes;
+        file_record_list::const_iterator fit = source_files.begin();
+        while( fit != source_files.end() ){
+          if( !sizes.insert(fit->size).second ) shared_sizes.insert(fit->size);
+        fit++;
+        }
       }
-      if(verbose) cout << "parse complete" << endl;
 
-      node_number_allocator nna;
-      nna.parse(a_nodes_map);
+      if(verbose) cout << "inserting files not already in the archive and not excluded" << endl;
+      source_read r;
+      uint count = 0;
+      uint unique_count = 0;  // files inserted into at least one mirror
+      uint return_code;
+      bool out_of_numbers = false;
+      while( !out_of_numbers && reader.next(r) ){
+        if( verbose && count > 1 && (count % 1000) == 0) 
+          cout << "examined: " << count << " inserted: " << unique_count << ".." << endl;
+        STATS_TICK();
+        STATS_ADD(Count_Examined ,1);
+        count++;
 
-      is.close();
+        if( r.error ){
+          cerr << "could not open source file for reading, skipping: \"" << r.record->pathname << "\"" << endl;
+          cerr << strerror(r.error) << endl;
+          CONTINUE;
+        }
+        if( r.image ) STATS_ADD(Count_BytesRead ,r.image->size);
+        if( !r.loaded ){
+          cerr << "could not read source file, skipping: \"" << r.record->pathname << "\"" << endl;
+          CONTINUE;
+        }
+
+        bool inserted = false;
+        bool size_shared = shared_sizes.count(r.record->size) != 0;
+        for( mit = mirrors.begin(); mit != mirrors.end(); mit++ ){
+          if( mit->failed ) CONTINUE;
+          return_code = insert_if_unique(*mit ,*r.record ,r.source_signature ,r.image ,size_shared);
+          if( return_code == Insert_Inserted ) inserted = true;
+          else if( return_code != Insert_NotInserted ) out_of_numbers = true;
+        }
+        if( inserted ) unique_count++;
+        if( list_insert && inserted ){
+          cout << "insert-file \"" << r.record->pathname << "\"" << endl;
+        } 
+      };
+      r = source_read();  // lets go of the last image, and of its buffer
+
+      // wait for the writers to drain before the taxonomies go out
+      for( mit = mirrors.begin(); mit != mirrors.end(); mit++ ){
+        if( mit->writer.finish() != 0 ){
+          cerr << mit->writer.failed.size() << " nodes could not be written to: \"" << mit->store_path << "\"" << endl;
+          mit->failed = true;
+        }
+      }
+
+      if( verbose ) cout << "examined: " << count << " inserted: " << unique_count << endl;
+      if( verbose && mirrors.size() > 1 ){
+        for( mit = mirrors.begin(); mit != mirrors.end(); mit++ ){
+          cout << "  into \"" << mit->arch_path << "\": " << mit->unique_count << endl;
+        }
+      }
+
+    // write out the modified taxonomy maps to disk
+    //
+      for( mit = mirrors.begin(); mit != mirrors.end(); mit++ ){
+        if( mit->failed ) CONTINUE;
+        STATS_TIMER(Phase_Print);
+        const string &taxonomy_pathname = mit->temp_tax_pathname;
+        ofstream os(taxonomy_pathname);
+        if( !os.good() ){
+          cerr << "could not open taxonomy file for writing: \"" << taxonomy_pathname << "\"";
+          mit->failed = true;
+          CONTINUE;
+        }
+        mit->a_nodes_map.print(os);
+        mit->a_mtime_index.generation = taxonomy_generation(mit->tax_path) + 1;  // the one commit_mirrors() makes
+        mit->a_mtime_index.taxonomy_length = os.tellp();
+        mit->a_bloom.generation = mit->a_mtime_index.generation;
+        mit->a_bloom.taxonomy_length = mit->a_mtime_index.taxonomy_length;
+        os.close();
+        if( os.fail() ){
+          cerr << "could not write taxonomy file: \"" << taxonomy_pathname << "\"" << endl;
+          mit->failed = true;
+          CONTINUE;
+        }
+
+        // the index records the generation and length of the taxonomy just written, should that
+        // taxonomy not make it back to sources;0 the index is found stale on the next run and rebuilt
+        //
+        if( !mit->a_mtime_index.write(mit->mtime_index_pathname) ){
+          cerr << "could not write mtime index: \"" << mit->mtime_index_pathname << "\"" << endl;
+        }
+        if( !mit->a_bloom.write(mit->bloom_pathname) ){
+          cerr << "could not write Bloom filter: \"" << mit->bloom_pathname << "\"" << endl;
+        }
+      }
+
+    if( out_of_numbers || reader.failed ) RETURN AI_SystemErr;
+    for( mit = mirrors.begin(); mit != mirrors.end(); mit++ ){
+      if( mit->failed ) RETURN AI_SystemErr;
+    }
+  RETURN AI_Success;
+  }
+
+  uint insert(
+     list<mirror> &mirrors  // the archives to insert into
+    ,const string &source_path // source files from this directory subtree
+    ,const exclude_matcher &excludes // source files with names, or relative paths, that match one of these should not be put in the archive
+    ,const io_options &io // the engine that reads source files and writes nodes
+    ,bool verbose // progress messgaes
+    ,bool list_insert // individual file insert commands to be used for incremental backup on mirrors
+  ){
+    uint status = load_mirrors(mirrors ,verbose);
+    if( status != AI_Success ) RETURN status;
 
     // makes list of source files
     //
       if(verbose) cout << "traversing source directory on disk.. ";
       file_record_list source_files; // see directory.h for file_record_list, file_records hold a lot of information about a file, including its name
       file_record_list link_targets; // nothing is done with this right now!  we need to hunt down the link targets
-      list_files(source_path ,source_files ,link_targets, excludes);  // see directory.h, traverse source_path makes list of file names 'source_files'
+      {
+        STATS_TIMER(Phase_Traverse);
+        list_files(source_path ,source_files ,link_targets, excludes);  // see directory.h, traverse source_path makes list of file names 'source_files'
+      }
       if(verbose) cout << "found " << source_files.size() << " files" << endl;
 
-    // find and insert unique source files 
+  RETURN insert_files(mirrors ,source_files ,io ,verbose ,list_insert);
+  }
+
+
+/*--------------------------------------------------------------------------------
+  --memory-cap
+
+  insert for an archive whose nodes_map does not fit in memory, see bounded.h.  sources;0 is
+  read twice, one node set at a time, first for the bounded_index and the node numbers in
+  use, then to be merged with the spill into the temporary taxonomy.  The mtime index and
+  the Bloom filter are not kept in step, they are removed, and the next program that wants
+  them rebuilds them from the taxonomy.
+
+  What the cap covers: the list of source files is made first and what it takes is charged
+  to 'memory_cap'.  A quarter of the rest goes to the source files in flight, split between
+  the read ahead of the source_reader, with its registered buffers, and the queue of the
+  node_writer.  Of the remainder half goes to the index of the taxonomy, a quarter to the
+  index of new nodes, and a quarter to the spill.  Not covered are the node number
+  allocator, and the one source file being handed out, which is held whole whatever its
+  size.  When the list alone takes the cap, that is reported, and the rest is run with
+  nothing in memory that can go to a run file and one file in flight at a time.
+
+  One archive at a time.
+*/
+  // about what a file list takes, the records, their strings, and the list nodes
+  size_t list_memory(const file_record_list &files){
+    size_t bytes = 0;
+    file_record_list::const_iterator it = files.begin();
+    for( ; it != files.end(); it++ ){
+      bytes += sizeof(file_record) + 2 * sizeof(void *) + it->pathname.capacity() + it->target.capacity();
+    }
+    RETURN bytes;
+  }
+
+  // the run files are made under 'run_prefix' and are gone again on return
+  uint insert_bounded_runs(
+     mirror &m
+    ,const string &run_prefix
+    ,const string &source_path
+    ,const exclude_matcher &excludes
+    ,const io_options &io
+    ,size_t memory_cap
+    ,bool verbose
+    ,bool list_insert
+  ){
+    uint status = AI_Success;
+    size_t head_signed = 0;  // as signature_index::head_signed
+
+    // makes list of source files, it is charged to the cap before anything else, see above
+    //
+      if(verbose) cout << "traversing source directory on disk.. ";
+      file_record_list source_files;
+      file_record_list link_targets;
+      {
+        STATS_TIMER(Phase_Traverse);
+        list_files(source_path ,source_files ,link_targets, excludes);
+      }
+      if(verbose) cout << "found " << source_files.size() << " files" << endl;
+      size_t listed = list_memory(source_files) + list_memory(link_targets);
+      size_t rest = 0;
+      if( listed < memory_cap ) rest = memory_cap - listed;
+      else cerr << "the list of source files alone takes the --memory-cap, the rest is run to files" << endl;
+
+    // the source files in flight, the uring engine's registered buffers come out of the read ahead
     //
+      io_options bounded_io = io;
+      size_t in_flight = rest / 4;
+      size_t buffers_allowed = in_flight / 4 / Uring_BufferSize;
+      if( bounded_io.uring && bounded_io.depth > buffers_allowed ) bounded_io.depth = buffers_allowed ? buffers_allowed : 1;
+      bounded_io.read_ahead = in_flight / 2;
+      if( bounded_io.uring ) bounded_io.read_ahead -= min(bounded_io.read_ahead ,(size_t)bounded_io.depth * Uring_BufferSize);
+      m.writer.byte_capacity = in_flight / 2;
+      rest -= in_flight;
+
+    bounded_index index;
+    index.open(run_prefix ,rest / 2 ,rest / 4);
+    external_sorter<spill_record> spill;
+    spill.open(run_prefix + "spill-" ,rest / 4);
+
+    // the index and the node numbers in use, from the taxonomy
+    //
+      bool has_taxonomy = exists(m.original_taxonomy_pathname);
+      {
+        STATS_TIMER(Phase_Parse);
+        ifstream is(m.original_taxonomy_pathname);
+        if( has_taxonomy && !is.good() ){
+          cerr << "could not open taxonomy file: \"" << m.original_taxonomy_pathname << "\"" << endl;
+          RETURN AI_OpenFail;
+        }
+        taxonomy_reader reader(is ,m.original_taxonomy_pathname);
+        node_set ns;
+        m.nna.clear();
+        while( has_taxonomy && reader.next(ns) ){
+          if( !index.add(ns.node_signature ,ns.node) ) RETURN AI_SystemErr;
+          if( ns.node_signature.kind == Sign_Head ) head_signed++;
+          m.nna.add(ns.node);
+        }
+        if( reader.failed ){
+          cerr << "parse failed" << endl;
+          RETURN AI_ParseFail;
+        }
+        if( !index.finish() ) RETURN AI_SystemErr;
+        if(verbose) cout << "parse complete" << endl;
+      }
+
+    // find and insert unique source files
+    //
+      source_reader reader(source_files ,bounded_io);
+      m.drop_cache = io.drop_cache;
+      m.writer.use_uring = io.uring;
+      m.writer.drop_cache = io.drop_cache;
+      m.writer.buffers = reader.registered_buffers();
+      m.writer.start(m.store_path);
+
       if(verbose) cout << "inserting files not already in the archive and not excluded" << endl;
-      file_record_list::iterator i = source_files.begin();
+      source_read r;
+      vector<size_t> candidates;
       uint count = 0;
-      uint unique_count = 0;
-      uint return_code;
-      while( i != source_files.end() ){
+      while( status == AI_Success && reader.next(r) ){
         if( verbose && count > 1 && (count % 1000) == 0) 
-          cout << "examined: " << count << " inserted: " << unique_count << ".." << endl;
-        return_code = insert_if_unique(unique_count ,store_path ,nna ,a_nodes_map ,*i);
-        if( list_insert && return_code==Insert_Inserted ){
-          cout << "insert-file \"" << i->pathname << "\"" << endl;
-        } 
-        if( return_code != Insert_Inserted && return_code != Insert_NotInserted){
-          RETURN AI_SystemErr;
+          cout << "examined: " << count << " inserted: " << m.unique_count << ".." << endl;
+        STATS_TICK();
+        STATS_ADD(Count_Examined ,1);
+        count++;
+
+        if( r.error ){
+          cerr << "could not open source file for reading, skipping: \"" << r.record->pathname << "\"" << endl;
+          cerr << strerror(r.error) << endl;
+          CONTINUE;
         }
-      count++;
-      i++;
-      };
-      if( verbose ) cout << "examined: " << count << " inserted: " << unique_count << endl;
+        if( r.image ) STATS_ADD(Count_BytesRead ,r.image->size);
+        if( !r.loaded ){
+          cerr << "could not read source file, skipping: \"" << r.record->pathname << "\"" << endl;
+          CONTINUE;
+        }
+
+        spill_record source;
+        source.source = *r.record;
+        bool found = false;
+        {
+          STATS_TIMER(Phase_Find);
+          index.lookup(r.source_signature ,candidates);
+          if( head_signed != 0 ){
+            signature head_signature;
+            head_signature.sign(r.image->data ,r.image->size ,Sign_Head);
+            vector<size_t> head_candidates;
+            index.lookup(head_signature ,head_candidates);
+            candidates.insert(candidates.end() ,head_candidates.begin() ,head_candidates.end());
+          }
+          found = !candidates.empty() && same_node(m ,candidates ,*r.image ,source.node);
+        }
+        if( !found ){
+          if( !m.nna.alloc(source.node) ){
+            cerr << "could not allocate a new node number in: " << m.arch_path << endl;
+            status = AI_SystemErr;
+            BREAK;
+          }
+          m.unique_count++;
+          STATS_ADD(Count_Inserted ,1);
+          spill_record node;
+          node.node = source.node;
+          node.is_node = true;
+          node.node_signature = r.source_signature;
+          node.source.mtime = r.record->mtime;
+          if( !index.add_new(r.source_signature ,node.node) || !spill.add(node) ) status = AI_SystemErr;
+          m.writer.push(node.node ,r.image);
+          if( list_insert ) cout << "insert-file \"" << r.record->pathname << "\"" << endl;
+        }
+        if( !spill.add(source) ) status = AI_SystemErr;
+      }
+      r = source_read();
+
+      if( m.writer.finish() != 0 ){
+        cerr << m.writer.failed.size() << " nodes could not be written to: \"" << m.store_path << "\"" << endl;
+        m.failed = true;
+      }
+      if( reader.failed || status != AI_Success ) m.failed = true;
+      if( verbose ) cout << "examined: " << count << " inserted: " << m.unique_count << endl;
 
-    // write out the modified taxonomy map to disk
+    // the new taxonomy, from the old one and the spill
     //
-      ofstream os(taxonomy_pathname);
-      if( !os.good() ){
-        cerr << "could not open taxonomy file for writing: \"" << taxonomy_pathname << "\"";
-        RETURN AI_OpenFail;
+      if( !m.failed ){
+        STATS_TIMER(Phase_Print);
+        ifstream is(m.original_taxonomy_pathname);
+        taxonomy_reader old_taxonomy(is ,m.original_taxonomy_pathname);
+        ofstream os(m.temp_tax_pathname);
+        if( !os.good() ){
+          cerr << "could not open taxonomy file for writing: \"" << m.temp_tax_pathname << "\"" << endl;
+          m.failed = true;
+        }else if( !spill.finish() || !merge_spill(old_taxonomy ,spill ,os) ){
+          cerr << "could not merge the spill into: \"" << m.temp_tax_pathname << "\"" << endl;
+          m.failed = true;
+        }
+        if( !m.failed ){
+          unlink(m.mtime_index_pathname.c_str());
+          unlink(m.bloom_pathname.c_str());
+        }
       }
-      a_nodes_map.print(os);
+    if( m.failed ) RETURN AI_SystemErr;
+  RETURN status;
+  }
 
-  RETURN AI_Success;
+  uint insert_bounded(
+     mirror &m
+    ,const string &source_path
+    ,const exclude_matcher &excludes
+    ,const io_options &io
+    ,size_t memory_cap
+    ,bool verbose
+    ,bool list_insert
+  ){
+    stringstream run_directory;
+    run_directory << m.tax_path << "/bounded-" << getpid();
+    if( mkdir(run_directory.str().c_str() ,S_IRWXU) == -1 ){
+      cerr << "could not make directory for run files: \"" << run_directory.str() << "\" " << strerror(errno) << endl;
+      RETURN AI_SystemErr;
+    }
+    uint status = insert_bounded_runs(m ,run_directory.str() + "/" ,source_path ,excludes ,io ,memory_cap ,verbose ,list_insert);
+    rmdir(run_directory.str().c_str());
+  RETURN status;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  renames the temporary taxonomy of each mirror over sources;0, the one there is kept as a
+  delta, and advances the generation
+
+  a mirror that failed keeps its old taxonomy, as does one whose commit could not be made,
+  the new taxonomy is then left in its temporary file.  A mirror whose generation could not
+  be advanced has its new taxonomy in place, but is failed all the same.  Returns
+  AI_SystemErr when any commit was not made in full.
+
+  the run_nodes go, under --watch they would otherwise grow batch after batch, and the nodes
+  are in the store by now, where same_node() reads them as it does any other node
+*/
+  uint commit_mirrors(list<mirror> &mirrors ,bool verbose){
+    uint status = AI_Success;
+    list<mirror>::iterator mit;
+    for( mit = mirrors.begin(); mit != mirrors.end(); mit++ ){
+      mit->run_nodes.clear();
+      if( mit->failed ){
+        cerr << "taxonomy of \"" << mit->arch_path << "\" not updated. Check for extraneous temp files and nodes." << endl;
+        CONTINUE;
+      }
+      STATS_TIMER(Phase_Rev);
+      if(verbose) cout << "writing nodes_map back to: " << mit->original_taxonomy_pathname << endl;
+      uint commit_status = commit_taxonomy(mit->tax_path ,mit->temp_tax_pathname);  // see history.h
+      if( commit_status == History_DeltaFail || commit_status == History_RenameFail ){
+        cerr << "all done, but could not move the new taxonomy into place, it is left in: \"" << mit->temp_tax_pathname << "\"" << endl;
+        mit->failed = true;
+        status = AI_SystemErr;
+      }else if( commit_status == History_GenerationFail ){
+        cerr << "the new taxonomy is in place, but could not write the taxonomy generation: \"" << mit->tax_path << "/generation\"" << endl;
+        mit->failed = true;
+        status = AI_SystemErr;
+      }
+    }
+    RETURN status;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  --watch
+
+  The tree is watched before it is traversed, so that a file written during the traversal
+  is not missed, then the traversal is inserted and committed as without --watch.  After
+  that the files reported by the tree_watch, see watch.h, are gathered and inserted as a
+  batch, then committed, once there are 'batch_files' of them or the oldest has waited
+  'commit_interval' seconds.  The nodes_maps and indexes stay in memory the whole time, and
+  each archive is held the whole time, see archive_lock in archive.h, so that no other
+  program commits to it or removes its nodes underneath them.
+
+  SIGINT and SIGTERM stop the watch, the files already gathered are inserted and committed
+  first.  The signals are blocked except while waiting in ppoll, so one that arrives while
+  a batch is being inserted is seen when the batch is done.
+*/
+  volatile sig_atomic_t stop_watching = 0;
+  void on_stop_signal(int){ stop_watching = 1; }
+
+  double monotonic_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC ,&ts);
+    RETURN ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+
+  // inserts and commits the pending files that are still there
+  uint insert_batch(list<mirror> &mirrors ,set<string> &pending ,const io_options &io ,bool verbose ,bool list_insert){
+    file_record_list source_files;
+    struct stat file_attributes;
+    set<string>::iterator it = pending.begin();
+    while( it != pending.end() ){
+      string pathname = *it;
+      it++;
+      if( lstat(pathname.c_str() ,&file_attributes) == -1 || !S_ISREG(file_attributes.st_mode) ) CONTINUE;
+      source_files.insert(file_record(pathname ,file_attributes.st_mtime ,file_attributes.st_size));
+    }
+    pending.clear();
+    if( source_files.empty() ) RETURN AI_Success;
+    uint status = insert_files(mirrors ,source_files ,io ,verbose ,list_insert);
+    if( commit_mirrors(mirrors ,verbose) != AI_Success ) status = AI_SystemErr;
+    RETURN status;
+  }
+
+  uint watch(
+     list<mirror> &mirrors
+    ,const string &source_path
+    ,const exclude_matcher &excludes
+    ,const io_options &io
+    ,size_t batch_files
+    ,double commit_interval
+    ,bool verbose
+    ,bool list_insert
+  ){
+    sigset_t stop_signals;
+    sigset_t wait_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals ,SIGINT);
+    sigaddset(&stop_signals ,SIGTERM);
+    sigprocmask(SIG_BLOCK ,&stop_signals ,&wait_mask);
+    sigdelset(&wait_mask ,SIGINT);
+    sigdelset(&wait_mask ,SIGTERM);
+    struct sigaction action;
+    memset(&action ,0 ,sizeof(action));
+    action.sa_handler = on_stop_signal;
+    sigaction(SIGINT ,&action ,0);
+    sigaction(SIGTERM ,&action ,0);
+
+    tree_watch a_watch;
+    if( !a_watch.open() ) RETURN AI_SystemErr;
+    a_watch.add_tree(source_path ,"" ,excludes ,0);
+    if( verbose ) cout << "watching " << a_watch.size() << " directories" << endl;
+
+    uint status = insert(mirrors ,source_path ,excludes ,io ,verbose ,list_insert);
+    if( status == AI_OpenFail || status == AI_ParseFail ) RETURN status;
+    if( commit_mirrors(mirrors ,verbose) != AI_Success ) status = AI_SystemErr;
+
+    set<string> pending;
+    double first_pending = 0;  // when the oldest of the pending files was reported
+    while( status == AI_Success && !stop_watching ){
+      if( a_watch.overflowed ){
+        if( verbose ) cout << "watch events were lost, traversing again" << endl;
+        a_watch.overflowed = false;
+        a_watch.add_tree(source_path ,"" ,excludes ,0);
+        file_record_list source_files;
+        file_record_list link_targets;
+        list_files(source_path ,source_files ,link_targets ,excludes);
+        status = insert_files(mirrors ,source_files ,io ,verbose ,list_insert);
+        if( commit_mirrors(mirrors ,verbose) != AI_Success ) status = AI_SystemErr;
+        CONTINUE;
+      }
+
+      struct timespec timeout;
+      struct timespec *timeout_pt = 0;  // wait for events however long it takes
+      if( !pending.empty() ){
+        double remaining = first_pending + commit_interval - monotonic_seconds();
+        if( remaining < 0 ) remaining = 0;
+        timeout.tv_sec = (time_t)remaining;
+        timeout.tv_nsec = (long)((remaining - timeout.tv_sec) * 1e9);
+        timeout_pt = &timeout;
+      }
+      struct pollfd watch_poll;
+      watch_poll.fd = a_watch.descriptor();
+      watch_poll.events = POLLIN;
+      watch_poll.revents = 0;
+      int ready = ppoll(&watch_poll ,1 ,timeout_pt ,&wait_mask);
+      if( ready == -1 && errno != EINTR ){
+        cerr << "ppoll: " << strerror(errno) << endl;
+        BREAK;
+      }
+      if( ready > 0 ){
+        bool was_empty = pending.empty();
+        a_watch.read_events(excludes ,pending);
+        if( was_empty && !pending.empty() ) first_pending = monotonic_seconds();
+      }
+      STATS_TICK();
+
+      if( pending.empty() ) CONTINUE;
+      if( pending.size() < batch_files && monotonic_seconds() - first_pending < commit_interval ) CONTINUE;
+      status = insert_batch(mirrors ,pending ,io ,verbose ,list_insert);
+    }
+
+    // files closed just before the signal are already queued
+    if( status == AI_Success ){
+      a_watch.read_events(excludes ,pending);
+      if( !pending.empty() ) status = insert_batch(mirrors ,pending ,io ,verbose ,list_insert);
+    }
+    if( verbose ) cout << "stopped watching" << endl;
+    sigprocmask(SIG_UNBLOCK ,&stop_signals ,0);
+  RETURN status;
   }
 
 /*--------------------------------------------------------------------------------
@@ -298,13 +965,14 @@ using namespace std;
    This is called from the shell. See the Vogon poetry at the top of this file for
    the usage message.
 
-   The goal is to insert files found in a source directory tree into the archive.
+   The goal is to insert files found in a source directory tree into the archives.
 
    1. This parses the command line and gets the options
-   2. makes a tempory file of the tax/source, though this seems unnecessary as the next
-      step only reads the tax/source temporary file
-   3. calls 'insert' to put the source files into the archive and to update the index
-   4. writes the index back out to a new tax/source file
+   2. names a temporary file in the tax directory of each archive for its new taxonomy,
+      sources;0 itself is only read
+   3. calls 'insert' to put the source files into the archives and to update the indexes
+   4. writes the new taxonomies to the temporary files and commits each by renaming it over
+      sources;0, the old one is kept as a delta, see history.h
 
 */
   int main(int argc ,char **argv){
@@ -313,9 +981,16 @@ using namespace std;
     // parse options
     // 
       list<char *> args;
-      list<regex> excludes;
+      exclude_matcher excludes;  // see directory.h
+      io_options io;  // see source_reader.h
+      size_t memory_cap=0;  // bytes, 0 when the taxonomy is parsed into memory
       bool verbose=false;
       bool list_insert=false;
+      string stats_pathname;
+      double stats_interval=0;
+      bool watching=false;
+      size_t batch_files=1000;
+      double commit_interval=5;
       bool bad_parms=false;
       bool help=false;
 
@@ -338,12 +1013,14 @@ using namespace std;
             if( !strcmp(*argv, "-x") || !strcmp(*argv, "--exclude") ){
               argv++;
               if( *argv ){
-                excludes.push_back(regex(*argv));
+                if( excludes.add(*argv) ) CONTINUE;
+                cerr << "not an ECMAscript regex: \"" << *argv << "\"" << endl;
+                bad_parms=true;
                 CONTINUE;
               }
               cerr << "expected an ECMAscript regex after exclude option" << endl;
               bad_parms=true;
-              CONTINUE;
+              BREAK;
             }
 
             if( !strcmp(*argv, "-h") || !strcmp(*argv, "--help") ){
@@ -362,6 +1039,104 @@ using namespace std;
               CONTINUE;
             }
 
+            if( !strcmp(*argv, "--watch") ){
+              watching=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--batch") ){
+              argv++;
+              char *end;
+              if( *argv ){
+                batch_files = strtoul(*argv ,&end ,10);
+                if( *end == 0 && batch_files != 0 ) CONTINUE;
+              }
+              cerr << "expected a count greater than zero after --batch" << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--commit-interval") ){
+              argv++;
+              char *end;
+              if( *argv ){
+                commit_interval = strtod(*argv ,&end);
+                if( *end == 0 && commit_interval > 0 ) CONTINUE;
+              }
+              cerr << "expected seconds greater than zero after --commit-interval" << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--io") ){
+              argv++;
+              if( *argv && (!strcmp(*argv, "sync") || !strcmp(*argv, "uring")) ){
+                io.uring = !strcmp(*argv, "uring");
+                CONTINUE;
+              }
+              cerr << "expected 'sync' or 'uring' after --io" << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--no-cache-pollution") ){
+              io.drop_cache=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--memory-cap") ){
+              argv++;
+              char *end;
+              if( *argv ){
+                memory_cap = strtoul(*argv ,&end ,10);
+                size_t unit = 1 << 20;
+                if( *end == 'K' ) unit = 1 << 10;
+                if( *end == 'G' ) unit = 1 << 30;
+                if( *end == 'K' || *end == 'M' || *end == 'G' ) end++;
+                memory_cap *= unit;
+                if( *end == 0 && memory_cap != 0 ) CONTINUE;
+              }
+              cerr << "expected a size greater than zero after --memory-cap" << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--io-depth") ){
+              argv++;
+              char *end;
+              if( *argv ){
+                io.depth = strtoul(*argv ,&end ,10);
+                if( *end == 0 && io.depth != 0 && io.depth <= 4096 ) CONTINUE;
+              }
+              cerr << "expected a count from 1 to 4096 after --io-depth" << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--stats") || !strcmp(*argv, "--stats-interval") ){
+              bool interval = !strcmp(*argv, "--stats-interval");
+              char *option = *argv;
+              argv++;
+              char *end = 0;
+              if( *argv && !interval ){
+                stats_pathname = *argv;
+                CONTINUE;
+              }
+              if( *argv ){
+                stats_interval = strtod(*argv ,&end);
+                if( *end == 0 && stats_interval >= 0 ) CONTINUE;
+              }
+              cerr << "expected a value after " << option << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
             bad_parms=true;
             cerr << "unrecognized option: " << *argv << endl;
             CONTINUE;
@@ -374,33 +1149,52 @@ using namespace std;
       }
 
   //----------------------------------------
-  // pull out the program arguments: the archive and source paths
+  // pull out the program arguments: the archive paths and the source path
   //    see file.h for blaze_path - makes directories along the whole path if needed
   // 
-    if( args.size() != 2 ){
-      cerr << "need two arguments, but found " << args.size() << " argument";
+    if( args.size() < 2 ){
+      cerr << "need at least two arguments, but found " << args.size() << " argument";
       if(args.size() != 1)  cerr << "s";
       cerr << endl;
       RETURN Exit_BadParms;
     }
 
-    string arch_path = args.front();
-    strip_trailing(arch_path);
-
     string source_path = args.back();
     strip_trailing(source_path);
+    args.pop_back();
+
+    list<mirror> mirrors;
+    list<char *>::iterator ait = args.begin();
+    while( ait != args.end() ){
+      mirrors.emplace_back();
+      mirror &m = mirrors.back();
+
+      m.arch_path = *ait;
+      strip_trailing(m.arch_path);
+
+      m.tax_path = m.arch_path;
+      m.tax_path += "/tax";
+      if( !blaze_path(m.tax_path) ){ 
+        cerr << "couldn't create archive tax directory: \"" << m.tax_path << "\"" << endl; 
+        bad_parms = true;
+      }
 
-    string tax_path = arch_path;
-    tax_path += "/tax";
-    if( !blaze_path(tax_path) ){ 
-      cerr << "couldn't create archive tax directory: \"" << tax_path << "\"" << endl; 
+      m.store_path = m.arch_path;
+      m.store_path += "/store";
+      if( !blaze_path(m.store_path) ){ 
+        cerr << "couldn't create archive store directory: \"" << m.store_path << "\"" << endl; 
+        bad_parms = true;
+      }
+    ait++;
+    }
+
+    if( memory_cap && (mirrors.size() > 1 || watching) ){
+      cerr << "--memory-cap works on one archive, and not with --watch" << endl;
       bad_parms = true;
     }
 
-    string store_path = arch_path;
-    store_path += "/store";
-    if( !blaze_path(store_path) ){ 
-      cerr << "couldn't create archive store directory: \"" << source_path << "\"" << endl; 
+    if( !stats_pathname.empty() && !STATS_OPEN(stats_pathname ,stats_interval) ){
+      cerr << "could not open stats file: \"" << stats_pathname << "\"" << endl;
       bad_parms = true;
     }
 
@@ -409,69 +1203,93 @@ using namespace std;
       RETURN Exit_BadParms;
     }
 
+    for( list<mirror>::iterator lit = mirrors.begin(); lit != mirrors.end(); lit++ ){
+      if( !lit->held.acquire(lit->tax_path) ){
+        if( !lit->held.busy ){
+          cerr << "could not open archive tax directory: \"" << lit->tax_path << "\"" << endl;
+          RETURN Exit_NoArchive;
+        }
+        cerr << "archive is in use by another program: \"" << lit->arch_path << "\"" << endl;
+        RETURN Exit_ArchiveBusy;
+      }
+    }
+
+    if( io.uring && !uring_usable() ){
+      cerr << "io_uring is not available, reading and writing with system calls: " << strerror(errno) << endl;
+      io.uring = false;
+    }
+
   //----------------------------------------
   // add version if not present or check version  ...... to be added here ..
   //
 
   //----------------------------------------
-  // make a temporary file to hold updates to the source taxonomy while we are working
-  //   see file.h for exists(), copy(), etc.
+  // name the temporary file the new taxonomy is written to, a stale one of ours is removed
+  //   see file.h for exists(), durable_rename(), etc.
   //
-    stringstream temp_tax_pathname;
-    temp_tax_pathname << tax_path <<  "/sources-" << getpid();
-    if( exists(temp_tax_pathname) ){
-      if( unlink( temp_tax_pathname.str().c_str()) == -1 ){
-        cerr << "temporary file \"" << temp_tax_pathname.str() << "\" already exists and can't be deleted, exiting." << endl;
-        RETURN 1;
-      }
-    }
-
-    /*
-      We make a copy of the source taxonomy and work on that.  If all goes well, we will
-      copy it back.  However, if we stop in an intermediate state, new nodes may have
-      been created in store, and those would still need to be cleaned up.
-    */
-      stringstream original_taxonomy_pathname;
-      original_taxonomy_pathname  << tax_path << "/sources" << ";" << 0;
-      int fd0, fd1;
-      if( exists(original_taxonomy_pathname) ){
-        if( !copy( original_taxonomy_pathname, temp_tax_pathname ) ){
-          cerr << "error making working version of source taxonomy, exiting" << endl;
-          RETURN 1;
-        }
-      }else{
-        if( !touch( temp_tax_pathname ) ){
-          cerr << "error making working version of source taxonomy, exiting" << endl;
+    list<mirror>::iterator mit;
+    for( mit = mirrors.begin(); mit != mirrors.end(); mit++ ){
+      stringstream temp_tax_pathname;
+      temp_tax_pathname << mit->tax_path <<  "/sources-" << getpid();
+      mit->temp_tax_pathname = temp_tax_pathname.str();
+      if( exists(temp_tax_pathname) ){
+        if( unlink( temp_tax_pathname.str().c_str()) == -1 ){
+          cerr << "temporary file \"" << temp_tax_pathname.str() << "\" already exists and can't be deleted, exiting." << endl;
           RETURN 1;
         }
       }
 
+      /*
+        The source taxonomy is read where it is, and the new one is written to the temporary
+        file.  If all goes well, it is renamed into place.  However, if we stop in an
+        intermediate state, new nodes may have been created in store, and those would still
+        need to be cleaned up.
+      */
+        stringstream original_taxonomy_pathname;
+        original_taxonomy_pathname  << mit->tax_path << "/sources" << ";" << 0;
+        mit->original_taxonomy_pathname = original_taxonomy_pathname.str();
+
+      mit->mtime_index_pathname = mit->tax_path + "/mtimes";
+      mit->bloom_pathname = mit->tax_path + "/bloom";
+    }
+
   //----------------------------------------
   // call this routine to do the heavy lifting:
   //
     if( verbose ){
       cout << "sourcing files from: \"" << source_path << "\"" << endl;
-      cout << "placing nodes in store at: \"" << store_path << "\"" << endl;
+      for( mit = mirrors.begin(); mit != mirrors.end(); mit++ ){
+        cout << "placing nodes in store at: \"" << mit->store_path << "\"" << endl;
+      }
     }
-    if( insert(temp_tax_pathname.str() ,source_path ,store_path ,excludes ,verbose ,list_insert) != AI_Success){
+    uint insert_status;
+    if( memory_cap ){
+      insert_status = insert_bounded(mirrors.front() ,source_path ,excludes ,io ,memory_cap ,verbose ,list_insert);
+    }else if( watching ){
+      insert_status = watch(mirrors ,source_path ,excludes ,io ,batch_files ,commit_interval ,verbose ,list_insert);  // commits as it goes
+    }else{
+      insert_status = insert(mirrors ,source_path ,excludes ,io ,verbose ,list_insert);
+    }
+    if( insert_status == AI_OpenFail || insert_status == AI_ParseFail ){
       cerr << "Internal error when inserting into archive. Check for extraneous temp files and nodes." << endl;
       RETURN Exit_InternalError;
     }
 
   //----------------------------------------
-  // move the temporary sources tax file to a permanent file
+  // move the temporary sources tax files to permanent files
+  //   a committed mirror's temporary file was renamed away, one left by a mirror that never
+  //   got to its commit is removed, one that failed keeps its for inspection
   //
-    stringstream a_pathname;
-    if( exists( original_taxonomy_pathname ) ){
-      a_pathname << tax_path << "/sources"; // original_taxonomy_pathname_not_versioned 
-      rev(a_pathname.str());  // increases rev number on all the tax_path/sources files on disk, making space for version 1
-    }
-    if(verbose) cout << "writing nodes_map back to: " << original_taxonomy_pathname.str() << endl;
-    if( !copy(temp_tax_pathname, original_taxonomy_pathname) ){
-      cerr << "all done, but not allowed to copy the temp file back.." << endl;
+    if( !watching && commit_mirrors(mirrors ,verbose) != AI_Success ) insert_status = AI_SystemErr;
+    for( mit = mirrors.begin(); mit != mirrors.end(); mit++ ){
+      if( !mit->failed ) unlink(mit->temp_tax_pathname.c_str());
     }
-    unlink(temp_tax_pathname.str().c_str());
 
+    STATS_FINISH();
+    if( insert_status != AI_Success ){
+      cerr << "Internal error when inserting into archive. Check for extraneous temp files and nodes." << endl;
+      RETURN Exit_InternalError;
+    }
 
   RETURN Exit_NoError;
   }
@@ -0,0 +1,416 @@
+/*
+  merge <target> <archive> ...
+
+  Folds several archives into one.
+
+  The node keys, (size, signature), of the target and of every input archive are sorted, and
+  a k-way merge walks them in key order.  Nodes that share a key across archives are taken to
+  be the same file and become one node in the target with the union of their source phrases.
+  Node numbers are given out by the target's node_number_allocator.
+
+  Node files are never read to decide identity unless a key is ambiguous, i.e. one archive
+  has more than one node with that key, a key is a head signature, see node_key.h, or
+  --compare is given.  Node files that are new to
+  the target are hard linked into it with --move, otherwise reflinked, and only copied when
+  the filesystem can do neither.
+
+  With --move the input archives give up their node files and should be discarded after
+  the merge.  A node file is unlinked from its input archive only after the target taxonomy
+  that names it has been committed, so a crash part way leaves every node in its input, and
+  at worst an orphan in the target store for gc to collect.
+
+*/
+
+// before we start, a bit of Vogon poetry:
+//
+  const char *vogon_poetry = R"VOGON_POETRY(
+     merge [options] <target> <archive> ...
+
+    <target> the archive to merge into, it is created if it does not exist
+    <archive> archives to be folded into the target, they are not changed unless --move
+
+    options:
+
+      -h --help            this message
+      -n --dry-run         report what would be done, change nothing
+      -v --verbose         progress information, and each node placed in the target
+         --move            take node files from the inputs rather than reflinking them
+         --compare         confirm every (size, signature) match by comparing the node files
+
+    exits with 6 when another program holds one of the archives
+
+  )VOGON_POETRY";
+
+#include "types.h"
+
+// Program Termination Return Codes
+const uint Exit_NoError   =0;
+const uint Exit_BadParms  =1;
+const uint Exit_NoArchive =2;
+const uint Exit_InternalError =4;
+const uint Exit_FileCreationError =5;
+const uint Exit_ArchiveBusy =6;
+
+// for sterror and errno
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+
+// STL objects used
+#include <string>
+#include <fstream>
+#include <vector>
+#include <queue>
+#include <set>
+#include <list>
+using namespace std;
+
+// local objects used
+#include "file.h"
+#include "directory.h"
+#include "taxonomy.h"
+#include "archive.h"
+#include "node_key.h"
+
+
+/*--------------------------------------------------------------------------------
+  a node of one of the archives being merged
+*/
+  class merge_member{
+  public:
+    merge_member(uint archive_index ,size_t node): archive_index(archive_index),node(node){;}
+    uint archive_index;  // 0 is the target
+    size_t node;
+  };
+  typedef vector<merge_member> merge_cluster;  // members that are one file
+
+
+/*--------------------------------------------------------------------------------
+  k-way merge over the sorted node key lists
+
+  each call to next_group() returns all the members, over all archives, that share the next
+  smallest key
+*/
+  class key_merger{
+  public:
+    key_merger(const vector<node_key_list> &keys): keys(keys){
+      for( uint k = 0; k < keys.size(); k++ ){
+        if( !keys[k].empty() ) heads.push(cursor(keys[k].begin() ,k));
+      }
+    }
+
+    bool next_group(vector<merge_member> &group){
+      group.clear();
+      if( heads.empty() ) RETURN false;
+      node_key the_key = *heads.top().it;
+      while( !heads.empty() && heads.top().it->same_key(the_key) ){
+        cursor c = heads.top();
+        heads.pop();
+        node_key_list::const_iterator group_end = keys[c.archive_index].group_end(c.it);
+        for( ; c.it != group_end; c.it++ ) group.push_back(merge_member(c.archive_index ,c.it->node));
+        if( c.it != keys[c.archive_index].end() ) heads.push(c);
+      }
+      RETURN true;
+    }
+
+  protected:
+    class cursor{
+    public:
+      cursor(node_key_list::const_iterator it ,uint archive_index): it(it),archive_index(archive_index){;}
+      node_key_list::const_iterator it;
+      uint archive_index;
+      // priority_queue puts the greatest on top, so this is reversed to get the smallest key
+      bool operator < (const cursor &other) const{
+        if( other.it->key_less(*it) ) RETURN true;
+        if( it->key_less(*other.it) ) RETURN false;
+        RETURN archive_index > other.archive_index;
+      }
+    };
+
+    const vector<node_key_list> &keys;
+    priority_queue<cursor> heads;
+  };
+
+
+/*--------------------------------------------------------------------------------
+  splits a group of members sharing a key into clusters of identical files
+
+  When no archive has more than one member in the group the key is taken as identity, and the
+  whole group is one cluster.  Otherwise, or with 'compare', members are compared against the
+  first member of each cluster.  A cluster never holds two nodes of the same archive, as
+  those were already found to differ when they were inserted.
+*/
+  void cluster_group(
+     const vector<archive> &archives
+    ,const vector<merge_member> &group
+    ,bool compare
+    ,list<merge_cluster> &clusters
+  ){
+    clusters.clear();
+    bool ambiguous = false;
+    set<uint> seen;
+    vector<merge_member>::const_iterator it = group.begin();
+    while( it != group.end() ){
+      if( !seen.insert(it->archive_index).second ) ambiguous = true;
+    it++;
+    }
+    if( !ambiguous && !compare ){
+      clusters.push_back(group);
+      RETURN;
+    }
+
+    for( it = group.begin(); it != group.end(); it++ ){
+      list<merge_cluster>::iterator cit = clusters.begin();
+      while( cit != clusters.end() ){
+        bool has_archive = false;
+        merge_cluster::const_iterator mit = cit->begin();
+        while( mit != cit->end() ){
+          if( mit->archive_index == it->archive_index ) has_archive = true;
+        mit++;
+        }
+        if( !has_archive
+          && same_nodes(
+               archives[cit->front().archive_index].node_pathname(cit->front().node)
+              ,archives[it->archive_index].node_pathname(it->node)
+             )
+        ) BREAK;
+      cit++;
+      }
+      if( cit == clusters.end() ) clusters.push_back(merge_cluster(1 ,*it));
+      else cit->push_back(*it);
+    }
+  }
+
+
+/*--------------------------------------------------------------------------------
+  places a node file from an input archive in the target store without reading it when the
+  filesystem allows
+
+  The input node file is left in place, with --move it is unlinked by the caller once the
+  target has been committed.
+*/
+  const uint Place_Moved = 0;
+  const uint Place_Reflinked = 1;
+  const uint Place_Copied = 2;
+  const uint Place_Failed = 3;
+
+  uint place(const string &from_pathname ,const string &to_pathname ,bool move){
+    if( move && link(from_pathname.c_str() ,to_pathname.c_str()) == 0 ) RETURN Place_Moved;
+    if( reflink(from_pathname ,to_pathname) ) RETURN Place_Reflinked;
+    if( transfer(from_pathname ,to_pathname) ) RETURN Place_Copied;
+    unlink(to_pathname.c_str());
+    RETURN Place_Failed;
+  }
+
+
+/*--------------------------------------------------------------------------------
+
+   This is called from the shell. See the Vogon poetry at the top of this file for
+   the usage message.
+
+*/
+  int main(int argc ,char **argv){
+
+    //----------------------------------------
+    // parse options
+    //
+      list<char *> args;
+      bool verbose=false;
+      bool dry_run=false;
+      bool move=false;
+      bool compare=false;
+      bool bad_parms=false;
+
+      if(argv == 0){
+        cerr << "serious problem here, argv was zero when the program was called" << endl;
+        RETURN Exit_InternalError;
+      }
+      if(argc == 1){
+        cerr << vogon_poetry;
+        RETURN Exit_BadParms;
+      }
+
+      for( argv++ ; *argv; argv++ ){
+        // check for options
+        //
+          if( (*argv)[0] == '-' ){
+            if( !strcmp(*argv, "-h") || !strcmp(*argv, "--help") ){
+              cout << vogon_poetry;
+              bad_parms=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "-n") || !strcmp(*argv, "--dry-run") ){
+              dry_run=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "-v") || !strcmp(*argv, "--verbose") ){
+              verbose=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--move") ){
+              move=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--compare") ){
+              compare=true;
+              CONTINUE;
+            }
+
+            bad_parms=true;
+            cerr << "unrecognized option: " << *argv << endl;
+            CONTINUE;
+          }
+
+        // if it isn't and option, it is an arg
+        //
+          args.push_back(*argv);
+          CONTINUE;
+      }
+    if(bad_parms){
+      cerr << "errors when parsing parameters, nothing done" << endl;
+      RETURN Exit_BadParms;
+    }
+    if( args.size() < 2 ){
+      cerr << "need a target and at least one archive to merge into it" << endl;
+      RETURN Exit_BadParms;
+    }
+
+  //----------------------------------------
+  // open and load the target and the input archives
+  //
+    vector<archive> archives(args.size());
+    vector<node_key_list> keys(args.size());
+    set<string> real_paths;
+    uint k = 0;
+    list<char *>::const_iterator ait = args.begin();
+    while( ait != args.end() ){
+      bool opened = archives[k].open(*ait ,k == 0 && !dry_run);
+      if( !opened ){
+        if( k != 0 || !dry_run ){
+          cerr << "not an archive: \"" << *ait << "\"" << endl;
+          RETURN Exit_NoArchive;
+        }
+      }
+      char real_path[PATH_MAX];
+      if( realpath(archives[k].path.c_str() ,real_path) && !real_paths.insert(real_path).second ){
+        cerr << "archive given more than once: \"" << *ait << "\"" << endl;
+        RETURN Exit_BadParms;
+      }
+      if( opened && !archives[k].lock() ) RETURN Exit_ArchiveBusy;  // the inputs too, --move takes their node files
+      if( archives[k].load() != Archive_Success ) RETURN Exit_InternalError;
+    k++;
+    ait++;
+    }
+    // one file signed by its head in one archive and otherwise in another meets only on its head signature
+    bool by_head = false;
+    for( k = 0; k < archives.size(); k++ ) by_head = by_head || node_key_list::has_head_signed(archives[k].a_nodes_map);
+    if( by_head ) cerr << "nodes signed by their head only, see resign: the archives are merged on head signatures and every match is read" << endl;
+    for( k = 0; k < archives.size(); k++ ){
+      keys[k].build(archives[k].store_path ,archives[k].a_nodes_map ,by_head);
+      if( verbose ) cout << archives[k].path << ": " << keys[k].size() << " nodes" << endl;
+    }
+    archive &target = archives[0];
+
+  //----------------------------------------
+  // k-way merge, one cluster of identical files at a time
+  //
+    uint counts[4] = {0 ,0 ,0 ,0};
+    size_t matched = 0;  // input nodes found already in the target
+    size_t unioned = 0;
+    uint errors = 0;
+    bool out_of_numbers = false;
+    key_merger merger(keys);
+    vector<merge_member> group;
+    list<merge_cluster> clusters;
+    list<string> taken;  // with --move, input node files to unlink once the target is committed
+    while( merger.next_group(group) ){
+      cluster_group(archives ,group ,compare || by_head ,clusters);  // a head signature is not identity
+      list<merge_cluster>::const_iterator cit = clusters.begin();
+      for( ; cit != clusters.end(); cit++ ){
+        const merge_member &first = cit->front();
+
+        // a cluster that includes a target node only gains source phrases
+        if( first.archive_index == 0 ){
+          if( cit->size() > 1 ) matched++;
+          if( dry_run ) CONTINUE;
+          node_set &ns = target.a_nodes_map.find(first.node)->second;
+          for( merge_cluster::const_iterator mit = cit->begin() + 1; mit != cit->end(); mit++ ){
+            if( ns.union_sources(archives[mit->archive_index].a_nodes_map.find(mit->node)->second) ) unioned++;
+          }
+          CONTINUE;
+        }
+
+        // otherwise the first member's node file becomes a new target node
+        const archive &from = archives[first.archive_index];
+        if( dry_run ){
+          cout << "place " << from.node_pathname(first.node) << " in " << target.store_path << endl;
+          CONTINUE;
+        }
+        node_set ns = from.a_nodes_map.find(first.node)->second;
+        if( !target.nna.alloc(ns.node) ){
+          cerr << "could not allocate a new node number in: " << target.path << endl;
+          errors++;
+          out_of_numbers = true;
+          BREAK;
+        }
+        uint how = place(from.node_pathname(first.node) ,target.node_pathname(ns.node) ,move);
+        counts[how]++;
+        if( how == Place_Failed ){
+          cerr << "could not place node: " << from.node_pathname(first.node) << " at: " << target.node_pathname(ns.node) << endl;
+          cerr << strerror(errno) << endl;
+          target.nna.dealloc(ns.node);
+          errors++;
+          CONTINUE;
+        }
+        if( verbose ) cout << "placed " << from.node_pathname(first.node) << " at " << target.node_pathname(ns.node) << endl;
+        if( move ) taken.push_back(from.node_pathname(first.node));
+        for( merge_cluster::const_iterator mit = cit->begin() + 1; mit != cit->end(); mit++ ){
+          ns.union_sources(archives[mit->archive_index].a_nodes_map.find(mit->node)->second);
+        }
+        target.a_nodes_map.insert(pair<size_t ,node_set>(ns.node ,ns));
+      }
+      if( out_of_numbers ) BREAK;
+    }
+
+    if( verbose || dry_run ){
+      cout << "matched in target: " << matched
+           << " given new sources: " << unioned
+           << " moved: " << counts[Place_Moved]
+           << " reflinked: " << counts[Place_Reflinked]
+           << " copied: " << counts[Place_Copied]
+           << " failed: " << counts[Place_Failed]
+           << endl;
+    }
+    if( dry_run ) RETURN Exit_NoError;
+
+  //----------------------------------------
+  // commit the target taxonomy, even after errors, so the nodes that were placed are not orphans
+  //
+    if( verbose ) cout << "writing nodes_map back to: " << target.taxonomy_pathname() << endl;
+    if( target.commit() != Archive_Success ){
+      cerr << "could not commit the taxonomy of: " << target.path << ", the inputs keep their node files" << endl;
+      RETURN Exit_FileCreationError;
+    }
+
+  //----------------------------------------
+  // only now that the target names them may the inputs give up their node files
+  //
+    list<string>::const_iterator tit = taken.begin();
+    for( ; tit != taken.end(); tit++ ){
+      if( unlink(tit->c_str()) != 0 ){
+        cerr << "could not unlink moved node file: " << *tit << endl;
+        cerr << strerror(errno) << endl;
+      }
+    }
+    if( errors != 0 ){
+      cerr << errors << " nodes could not be placed in the target" << endl;
+      RETURN Exit_InternalError;
+    }
+
+  RETURN Exit_NoError;
+  }
@@ -0,0 +1,340 @@
+#ifndef MINHASH_H
+#define MINHASH_H
+
+/*
+ defines classes:
+    sketch
+    sketcher
+    sketch_store
+    lsh_index
+
+  Near duplicates among the nodes of an archive.  A signature tells only whether two nodes are
+  the same, and insert makes sure no two nodes are, so nodes that differ by a line of text or
+  a few bytes of a header look as unrelated as any two others.
+
+  The content of a node is taken as the set of its shingles, every run of Shingle_Bytes bytes,
+  and two nodes are compared by the Jaccard similarity of their sets, the shingles they share
+  over the shingles either has.  A MinHash sketch estimates it from a fixed number of values
+  per node: the fraction of bins where two sketches hold the same value.
+
+  The sketch is built in one pass with one hash per shingle, one permutation hashing: the top
+  bits of the hash choose a bin, and the bin keeps the smallest of the low bits that land in
+  it.  Bins no shingle landed in, in small nodes, borrow from the next filled bin over, with
+  an offset for the distance, so that two sketches agree on a borrowed bin only where they
+  agree on the bin it came from.  A node shorter than a shingle is one shingle, an empty node
+  has an empty sketch and is similar to nothing.
+
+  Sketches are kept in the tax directory as 'sketches', each with the signature of the node it
+  was made from.  A node number freed by gc and reused by insert has a new signature, so its
+  old sketch is found stale.  Only the nodes without a current sketch are read, by a pool of
+  threads, so after the first run the cost follows the number of new nodes.  A header phrase
+  is followed by the records, in the byte order of the machine.
+
+    # sketches # <bins> # <records>
+    <node, 8 bytes> <signature, 16 bytes> <bins, 4 bytes each> ...
+
+  The lsh_index finds candidate pairs without comparing all of them: the bins are cut into
+  Bands of Rows, and nodes whose sketches agree on every bin of some band share a bucket.
+  Pairs at a similarity of s share a bucket with probability 1 - (1 - s^Rows)^Bands, at 0.8
+  nearly always and at 0.3 about one time in eight.  Candidates are then held to the threshold
+  by their estimated similarity.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+
+// STL objects used
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+using namespace std;
+
+// locally defined objects
+#include "types.h"
+#include "file.h"
+#include "taxonomy.h"
+
+  const uint Sketch_Bins = 64;
+  const uint Sketch_Bin_Bits = 6;  // log2 of Sketch_Bins
+  const uint Shingle_Bytes = 8;
+  const uint LSH_Bands = 16;
+  const uint LSH_Rows = Sketch_Bins / LSH_Bands;
+  const size_t LSH_Bucket_Limit = 64;  // larger buckets are compared against their first node only
+
+  // the splitmix64 finalizer, spreads the bits of a shingle over the whole word
+  inline uint64_t mix64(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    RETURN x;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  the MinHash of one node
+*/
+  class sketch{
+  public:
+    static const uint32_t Unset = 0xffffffff;
+
+    sketch(){ clear(); }
+    void clear(){ for( uint k = 0; k < Sketch_Bins; k++ ) bins[k] = Unset; }
+
+    // made from an empty node
+    bool empty() const{
+      for( uint k = 0; k < Sketch_Bins; k++ ) if( bins[k] != Unset ) RETURN false;
+      RETURN true;
+    }
+
+    // estimated Jaccard similarity of the two nodes
+    double similarity(const sketch &other) const{
+      if( empty() || other.empty() ) RETURN 0;
+      uint same = 0;
+      for( uint k = 0; k < Sketch_Bins; k++ ) if( bins[k] == other.bins[k] ) same++;
+      RETURN (double)same / Sketch_Bins;
+    }
+
+    uint64_t band_hash(uint band) const{
+      uint64_t h = band;
+      for( uint k = band * LSH_Rows; k < (band + 1) * LSH_Rows; k++ ) h = mix64(h ^ bins[k]);
+      RETURN h;
+    }
+
+    uint32_t bins[Sketch_Bins];
+  };
+
+
+/*--------------------------------------------------------------------------------
+  builds a sketch from the bytes of a node, given in as many pieces as they come
+*/
+  class sketcher{
+  public:
+    sketcher(): window(0),count(0){ s.clear(); }
+
+    void add(const uchar *data ,size_t length){
+      for( size_t i = 0; i < length; i++ ){
+        window = (window << 8) | data[i];
+        count++;
+        if( count >= Shingle_Bytes ) add_shingle(window);
+      }
+    }
+
+    const sketch &finish(){
+      if( count > 0 && count < Shingle_Bytes ) add_shingle(window | ((uint64_t)count << 56));
+      densify();
+      RETURN s;
+    }
+
+  protected:
+    void add_shingle(uint64_t shingle){
+      uint64_t h = mix64(shingle);
+      uint bin = h >> (64 - Sketch_Bin_Bits);
+      uint32_t value = (uint32_t)h;
+      if( value == sketch::Unset ) value--;
+      if( value < s.bins[bin] ) s.bins[bin] = value;
+    }
+
+    void densify(){
+      uint filled = 0;
+      for( uint k = 0; k < Sketch_Bins; k++ ) if( s.bins[k] != sketch::Unset ) filled++;
+      if( filled == 0 || filled == Sketch_Bins ) RETURN;
+      sketch dense = s;
+      for( uint k = 0; k < Sketch_Bins; k++ ){
+        if( s.bins[k] != sketch::Unset ) CONTINUE;
+        uint distance = 1;
+        while( s.bins[(k + distance) % Sketch_Bins] == sketch::Unset ) distance++;
+        uint32_t value = s.bins[(k + distance) % Sketch_Bins] + distance * 0x9e3779b9u;
+        if( value == sketch::Unset ) value--;
+        dense.bins[k] = value;
+      }
+      s = dense;
+    }
+
+    sketch s;
+    uint64_t window;  // the last Shingle_Bytes bytes
+    size_t count;     // bytes added
+  };
+
+  // sketches the file at 'pathname', false if it can not be read
+  bool sketch_file(const string &pathname ,sketch &s){
+    int fd = open_read(pathname);
+    if( fd == -1 ) RETURN false;
+    posix_fadvise(fd ,0 ,0 ,POSIX_FADV_SEQUENTIAL);
+    const size_t chunk = 1 << 20;
+    vector<uchar> buff(chunk);
+    sketcher a_sketcher;
+    ssize_t n;
+    while( (n = read(fd ,&buff[0] ,chunk)) > 0 ) a_sketcher.add(&buff[0] ,n);
+    posix_fadvise(fd ,0 ,0 ,POSIX_FADV_DONTNEED);  // a scan of the whole store should not push out the working set
+    close(fd);
+    if( n == -1 ) RETURN false;
+    s = a_sketcher.finish();
+    RETURN true;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  the sketches of the nodes of an archive, persisted as tax/sketches
+*/
+  class sketch_entry{
+  public:
+    signature node_signature;  // of the node when it was sketched
+    sketch s;
+  };
+
+  class sketch_store : public map<size_t ,sketch_entry>{
+  public:
+    /*
+      loads the sketches persisted at 'pathname'
+      returns false if there are none or they are damaged, the store is then empty and every
+      node is sketched again
+    */
+    bool load(const string &pathname){
+      clear();
+      ifstream is(pathname ,ios::binary);
+      if( !is.good() ) RETURN false;
+      string header;
+      getline(is ,header);
+      stringstream ss(header);
+      string mark[3] ,tag;
+      size_t bins ,records;
+      ss >> mark[0] >> tag >> mark[1] >> bins >> mark[2] >> records;
+      if( ss.fail() || tag != "sketches" || bins != Sketch_Bins ) RETURN false;
+      for( uint k = 0; k < 3; k++ ) if( mark[k] != "#" ) RETURN false;
+      for( size_t i = 0; i < records; i++ ){
+        uint64_t node;
+        sketch_entry entry;
+        is.read((char *)&node ,sizeof(node));
+        is.read((char *)entry.node_signature.data ,sizeof(entry.node_signature.data));
+        is.read((char *)entry.s.bins ,sizeof(entry.s.bins));
+        if( !is ){
+          clear();
+          RETURN false;
+        }
+        (*this)[node] = entry;
+      }
+      if( is.peek() != EOF ){
+        clear();
+        RETURN false;
+      }
+      RETURN true;
+    }
+
+    // written beside 'pathname' and renamed into place, as bloom_filter::write() does
+    bool write(const string &pathname) const{
+      stringstream temp_pathname;
+      temp_pathname << pathname << "-" << getpid();
+      ofstream os(temp_pathname.str() ,ios::binary | ios::trunc);
+      if( !os.good() ) RETURN false;
+      os << "# sketches # " << Sketch_Bins << " # " << size() << endl;
+      for( const_iterator it = begin(); it != end(); it++ ){
+        uint64_t node = it->first;
+        os.write((const char *)&node ,sizeof(node));
+        os.write((const char *)it->second.node_signature.data ,sizeof(it->second.node_signature.data));
+        os.write((const char *)it->second.s.bins ,sizeof(it->second.s.bins));
+      }
+      os.close();
+      if( os.fail() || rename(temp_pathname.str().c_str() ,pathname.c_str()) == -1 ){
+        unlink(temp_pathname.str().c_str());
+        RETURN false;
+      }
+      RETURN true;
+    }
+
+    /*
+      brings the store in step with 'a_nodes_map': sketches of nodes that are gone or were
+      reused are dropped, and the nodes without one are read from 'store_path' by
+      'thread_count' threads and sketched
+
+      returns the number of nodes sketched, 'unreadable' counts those that could not be read,
+      they are left without a sketch and tried again next time
+    */
+    size_t update(const nodes_map &a_nodes_map ,const string &store_path ,uint thread_count ,size_t &unreadable){
+      iterator it = begin();
+      while( it != end() ){
+        nodes_map::const_iterator nm_it = a_nodes_map.find(it->first);
+        if( nm_it == a_nodes_map.end() || nm_it->second.node_signature != it->second.node_signature ) it = erase(it);
+        else it++;
+      }
+
+      vector<const node_set *> jobs;
+      for( nodes_map::const_iterator nm_it = a_nodes_map.begin(); nm_it != a_nodes_map.end(); nm_it++ ){
+        if( find(nm_it->first) == end() ) jobs.push_back(&nm_it->second);
+      }
+      vector<sketch_entry> results(jobs.size());
+      vector<char> read_ok(jobs.size() ,0);
+      atomic<size_t> next(0);
+      vector<thread> readers;
+      for( uint k = 0; k < thread_count; k++ ){
+        readers.push_back(thread([&]{
+          size_t i;
+          while( (i = next++) < jobs.size() ){
+            stringstream pathname;
+            pathname << store_path << "/" << jobs[i]->node;
+            results[i].node_signature = jobs[i]->node_signature;
+            read_ok[i] = sketch_file(pathname.str() ,results[i].s);
+          }
+        }));
+      }
+      for( uint k = 0; k < thread_count; k++ ) readers[k].join();
+
+      size_t sketched = 0;
+      unreadable = 0;
+      for( size_t i = 0; i < jobs.size(); i++ ){
+        if( !read_ok[i] ){
+          unreadable++;
+          CONTINUE;
+        }
+        (*this)[jobs[i]->node] = results[i];
+        sketched++;
+      }
+      RETURN sketched;
+    }
+  };
+
+
+/*--------------------------------------------------------------------------------
+  the LSH buckets over a sketch_store
+*/
+  class lsh_index{
+  public:
+    typedef unordered_map<uint64_t ,vector<size_t>> bucket_map;
+
+    void build(const sketch_store &store){
+      bands.assign(LSH_Bands ,bucket_map());
+      for( sketch_store::const_iterator it = store.begin(); it != store.end(); it++ ){
+        if( it->second.s.empty() ) CONTINUE;
+        for( uint b = 0; b < LSH_Bands; b++ ) bands[b][it->second.s.band_hash(b)].push_back(it->first);
+      }
+    }
+
+    // the nodes sharing a bucket with 's' in some band, in node order, may include the node of 's'
+    vector<size_t> candidates(const sketch &s) const{
+      vector<size_t> found;
+      if( s.empty() ) RETURN found;
+      for( uint b = 0; b < LSH_Bands; b++ ){
+        bucket_map::const_iterator bit = bands[b].find(s.band_hash(b));
+        if( bit != bands[b].end() ) found.insert(found.end() ,bit->second.begin() ,bit->second.end());
+      }
+      sort(found.begin() ,found.end());
+      found.erase(unique(found.begin() ,found.end()) ,found.end());
+      RETURN found;
+    }
+
+    vector<bucket_map> bands;
+  };
+
+#endif
@@ -0,0 +1,464 @@
+#ifndef MTIME_INDEX_H
+#define MTIME_INDEX_H
+
+/*
+ defines classes:
+    mtime_entry
+    mtime_set
+    mtime_index
+    mtime_index_file
+
+  file_record::operator< orders source records by mtime, but only within one node_set.  The
+  mtime index orders every node phrase and every source phrase of the taxonomy by mtime so
+  that time range and newest/oldest N questions are answered with a lower_bound rather than
+  by a scan of the whole nodes_map.
+
+  An entry is only an mtime and a node number.  The pathnames stay in the taxonomy, a caller
+  that wants them loads the node sets its entries name, see nodes_map::load(), and picks out
+  the sources with the entry's mtime.  Two sources of one node with the same mtime share an
+  entry.
+
+  The index is persisted in the tax directory next to the taxonomy as 'mtimes'.  It is derived
+  data, so only the index for 'sources;0' is kept.  Its first phrase records the generation
+  and the byte length of the taxonomy it was built from, see history.h, so an index left
+  behind by an older program, or by a commit that rewrote sources;0 to the same length, is
+  detected as stale and rebuilt.
+
+    # taxonomy # <generation> # <taxonomy length>
+    # node # <mtime> # <node>
+    # source # <mtime> # <node>
+
+  The entries are written in order, node entries before source entries, one line each, so a
+  reader that wants only a range of them need not load the index, see mtime_index_file.
+*/
+
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// STL objects used
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sstream>
+#include <set>
+using namespace std;
+
+// locally defined objects
+#include "types.h"
+#include "parse_status.h"
+#include "phrase.h"
+#include "taxonomy.h"
+
+
+/*--------------------------------------------------------------------------------
+  one node phrase or one source phrase, as seen from the mtime index
+*/
+  class mtime_entry{
+  public:
+    mtime_entry(){;}
+    mtime_entry(time_t mtime ,size_t node): mtime(mtime),node(node){;}
+
+    time_t mtime;
+    size_t node;
+
+    // # <mtime> # <node>
+    void print(phrase &ph) const{
+      stringstream ss;
+      ss << mtime;
+      ph.push_back(ss.str());
+      ss.clear();
+      ss.str("");
+      ss << node;
+      ph.push_back(ss.str());
+    }
+
+    // # <mtime> # <node>
+    ParseStatus parse(phrase &ph){
+      if(ph.size() != 2) RETURN ParseStatus::Malformed;
+
+      stringstream ss;
+      ss.str(*ph.first());
+      if( !(ss >> mtime) ) RETURN ParseStatus::Malformed;
+      ph.pop_front();
+
+      ss.clear();
+      ss.str(*ph.first());
+      if( !(ss >> node) ) RETURN ParseStatus::Malformed;
+      ph.pop_front();
+      RETURN ParseStatus::Found;
+    }
+
+    bool operator < (const mtime_entry &other) const {
+      RETURN mtime < other.mtime || (mtime == other.mtime && node < other.node);
+    }
+  };
+
+
+/*--------------------------------------------------------------------------------
+  a set of mtime entries, all of one phrase type
+*/
+  class mtime_set : public set<mtime_entry>{
+  public:
+    typedef pair<const_iterator ,const_iterator> range_type;
+
+    // entries with begin_time <= mtime < end_time
+    range_type range(time_t begin_time ,time_t end_time) const{
+      const_iterator first = lower_bound(mtime_entry(begin_time ,0));
+      const_iterator last = lower_bound(mtime_entry(end_time ,0));
+      if( end_time < begin_time ) last = first;
+      RETURN range_type(first ,last);
+    }
+
+    void print(ostream &os ,const string &head) const{
+      phrase a_phrase;
+      const_iterator it = begin();
+      while(it != end()){
+        a_phrase.clear();
+        a_phrase.push_back(head);
+        it->print(a_phrase);
+        a_phrase.print(os);
+      it++;
+      }
+    }
+  };
+
+
+/*--------------------------------------------------------------------------------
+  the mtime index for a whole taxonomy
+
+  node entries and source entries are kept in separate sets so that a query restricted to
+  one type does not have to step over entries of the other
+*/
+  class mtime_index{
+  public:
+    mtime_index(){ generation = 0; taxonomy_length = 0; }
+
+    size_t generation;  // generation of the taxonomy file this index describes, see history.h
+    size_t taxonomy_length;  // its length in bytes
+    mtime_set nodes;
+    mtime_set sources;
+
+    void clear(){
+      generation = 0;
+      taxonomy_length = 0;
+      nodes.clear();
+      sources.clear();
+    }
+
+    size_t size() const{
+      RETURN nodes.size() + sources.size();
+    }
+
+    // adds the node phrase and all the source phrases of a node set
+    void insert(const node_set &ns){
+      nodes.insert(mtime_entry(ns.mtime ,ns.node));
+      file_record_list::const_iterator it = ns.sources.begin();
+      while( it != ns.sources.end() ){
+        sources.insert(mtime_entry(it->mtime ,ns.node));
+      it++;
+      }
+    }
+
+    void insert_source(size_t node ,const file_record &fr){
+      sources.insert(mtime_entry(fr.mtime ,node));
+    }
+
+    // the node phrase mtime is the earliest source mtime, so it can move when a source is added
+    void move_node(size_t node ,time_t old_mtime ,time_t new_mtime){
+      nodes.erase(mtime_entry(old_mtime ,node));
+      nodes.insert(mtime_entry(new_mtime ,node));
+    }
+
+    void build(const nodes_map &a_nodes_map){
+      nodes.clear();
+      sources.clear();
+      nodes_map::const_iterator it = a_nodes_map.begin();
+      while( it != a_nodes_map.end() ){
+        insert(it->second);
+      it++;
+      }
+    }
+
+    void print(ostream &os) const{
+      phrase a_phrase;
+      a_phrase.push_back(string("taxonomy"));
+      stringstream ss;
+      ss << generation;
+      a_phrase.push_back(ss.str());
+      ss.clear();
+      ss.str("");
+      ss << taxonomy_length;
+      a_phrase.push_back(ss.str());
+      a_phrase.print(os);
+      nodes.print(os ,node_tag);
+      sources.print(os ,source_tag);
+    }
+
+    /*
+      is is the open index file.
+      index_pathname and lineno are for error messages.
+    */
+    ParseStatus parse(istream &is ,const string &index_pathname ,size_t lineno){
+      uint errors = 0;
+      stringstream err;
+      ParseStatus stat;
+      phrase a_phrase;
+      stringstream phrase_stream;
+      stringstream data_stream;
+      mtime_entry an_entry;
+
+      clear();
+      while( !((stat=getphraseline(is ,lineno ,index_pathname ,phrase_stream ,data_stream)).value & ParseStatus::NotFound) ){
+        if(stat.value & ParseStatus::NullObject) CONTINUE;
+        if(stat.value & ParseStatus::Malformed){
+          errors++;
+          CONTINUE;
+        }
+        a_phrase.clear();
+        if( a_phrase.parse(phrase_stream ,data_stream ,index_pathname ,lineno ,err) != ParseStatus::Found ){
+          cerr << err.str();
+          cerr << index_pathname << ":" << lineno << " phrase parse failed" << endl;
+          errors++;
+          CONTINUE;
+        }
+        string head = a_phrase.front();
+        a_phrase.pop_front();
+        if( head == "taxonomy" && a_phrase.size() == 2 ){
+          stringstream ss(a_phrase.front() + " " + a_phrase.back());
+          if( !(ss >> generation >> taxonomy_length) ) errors++;
+          CONTINUE;
+        }
+        if( (head == node_tag || head == source_tag) && an_entry.parse(a_phrase) == ParseStatus::Found ){
+          // the file was printed in order, so the end of the set is the right hint
+          if( head == node_tag ) nodes.insert(nodes.end() ,an_entry);
+          else sources.insert(sources.end() ,an_entry);
+          CONTINUE;
+        }
+        cerr << index_pathname << ":" << lineno << " unrecognized phrase in mtime index" << endl;
+        errors++;
+      }
+      if( errors != 0 ) RETURN ParseStatus::Malformed;
+      RETURN ParseStatus::Found;
+    }
+
+    /*
+      loads the index persisted at index_pathname
+      returns false if there is no index, it does not parse, or it was built for a taxonomy of
+      another generation or length than those given, in which case the caller should build() it
+      instead
+    */
+    bool load(const string &index_pathname ,size_t expected_generation ,size_t expected_taxonomy_length){
+      ifstream is(index_pathname);
+      if( !is.good() ) RETURN false;
+      size_t lineno = 0;
+      if( parse(is ,index_pathname ,lineno) != ParseStatus::Found
+        || generation != expected_generation || taxonomy_length != expected_taxonomy_length
+      ){
+        clear();
+        RETURN false;
+      }
+      RETURN true;
+    }
+
+    /*
+      writes the index to a temporary file beside index_pathname, then renames it into place so
+      that a reader never sees a partial index
+    */
+    bool write(const string &index_pathname) const{
+      stringstream temp_pathname;
+      temp_pathname << index_pathname << "-" << getpid();
+      ofstream os(temp_pathname.str());
+      if( !os.good() ) RETURN false;
+      print(os);
+      os.close();
+      if( os.fail() || rename(temp_pathname.str().c_str() ,index_pathname.c_str()) == -1 ){
+        unlink(temp_pathname.str().c_str());
+        RETURN false;
+      }
+      RETURN true;
+    }
+
+  protected:
+    const string node_tag = "node";
+    const string source_tag = "source";
+  };
+
+
+/*--------------------------------------------------------------------------------
+  a persisted mtime index searched where it lies in the file
+
+  Only the taxonomy phrase is read by open().  lower_bound() finds the first entry of a time
+  by a binary search over byte offsets, stepping from an offset to the start of the next line,
+  and next() and prev() read entries on either side of an offset.  So a query reads the few
+  pages its range is on, however large the index.
+
+  An entry line that does not parse sets 'bad', and the caller should fall back to building
+  the index from the taxonomy.
+*/
+  class mtime_index_file{
+  public:
+    mtime_index_file(): bad(false),fd(-1),file_length(0),entries_offset(0){;}
+    ~mtime_index_file(){
+      if( fd != -1 ) close(fd);
+    }
+
+    bool bad;
+
+    /*
+      returns false if there is no index, or it was built for a taxonomy of another generation
+      or length than those given, as with mtime_index::load()
+    */
+    bool open(const string &index_pathname ,size_t expected_generation ,size_t expected_taxonomy_length){
+      pathname = index_pathname;
+      fd = open_read(pathname);
+      if( fd == -1 ) RETURN false;
+      struct stat st;
+      if( fstat(fd ,&st) == -1 ) RETURN false;
+      file_length = st.st_size;
+
+      string line;
+      entries_offset = after_newline(0);
+      if( !read_line(0 ,entries_offset ,line) ) RETURN false;
+      stringstream phrase_stream(line);
+      stringstream data_stream;
+      stringstream err;
+      size_t lineno = 1;
+      phrase a_phrase;
+      if( a_phrase.parse(phrase_stream ,data_stream ,pathname ,lineno ,err) != ParseStatus::Found
+        || a_phrase.size() != 3 || a_phrase.front() != "taxonomy"
+      ) RETURN false;
+      a_phrase.pop_front();
+      size_t generation ,taxonomy_length;
+      stringstream ss(a_phrase.front() + " " + a_phrase.back());
+      if( !(ss >> generation >> taxonomy_length) ) RETURN false;
+      RETURN generation == expected_generation && taxonomy_length == expected_taxonomy_length;
+    }
+
+    // the offset of the first entry of type 'head' with an mtime at or after t
+    off_t lower_bound(const string &head ,time_t t){
+      const uint Scan_Length = 4096;  // below this the lines are read one after the other
+      int type = rank(head);
+      mtime_entry target(t ,0);
+      int a_type;
+      mtime_entry entry;
+      off_t lo = entries_offset;  // a line start, every entry before it is less than the target
+      off_t hi = file_length;  // a line start, the first entry not less starts at or before it
+      while( !bad && hi - lo > Scan_Length ){
+        off_t mid = after_newline(lo + (hi - lo) / 2 - 1);
+        if( mid >= hi ) BREAK;
+        off_t after = mid;
+        if( !read_entry(after ,a_type ,entry) ) RETURN hi;
+        if( a_type < type || (a_type == type && entry < target) ) lo = after;
+        else hi = mid;
+      }
+      while( !bad && lo < hi ){
+        off_t after = lo;
+        if( !read_entry(after ,a_type ,entry) ) RETURN hi;
+        if( !(a_type < type || (a_type == type && entry < target)) ) BREAK;
+        lo = after;
+      }
+      RETURN lo;
+    }
+
+    // the entry at offset, offset is moved past it
+    bool next(off_t &offset ,mtime_entry &entry){
+      int a_type;
+      RETURN offset < file_length && read_entry(offset ,a_type ,entry);
+    }
+
+    // the entry before offset, offset is moved back to it
+    bool prev(off_t &offset ,mtime_entry &entry){
+      if( offset <= entries_offset ) RETURN false;
+      offset = line_start(offset - 1);
+      off_t after = offset;
+      int a_type;
+      RETURN read_entry(after ,a_type ,entry);
+    }
+
+  private:
+    string pathname;
+    int fd;
+    off_t file_length;
+    off_t entries_offset;  // where the line after the taxonomy phrase starts
+
+    // node entries come before source entries
+    int rank(const string &head) const{
+      RETURN head == "node" ? 0 : 1;
+    }
+
+    // the offset just past the first newline at or after pos, the file length when there is none
+    off_t after_newline(off_t pos){
+      char buff[256];
+      while( pos < file_length ){
+        ssize_t n = pread(fd ,buff ,sizeof(buff) ,pos);
+        if( n <= 0 ){
+          bad = true;
+          RETURN file_length;
+        }
+        char *p = (char *)memchr(buff ,'\n' ,n);
+        if( p ) RETURN pos + (p - buff) + 1;
+        pos += n;
+      }
+      RETURN file_length;
+    }
+
+    // the offset of the start of the line that holds the byte at pos
+    off_t line_start(off_t pos){
+      char buff[256];
+      while( pos > 0 ){
+        off_t from = pos > (off_t)sizeof(buff) ? pos - sizeof(buff) : 0;
+        ssize_t n = pread(fd ,buff ,pos - from ,from);
+        if( n != pos - from ){
+          bad = true;
+          RETURN 0;
+        }
+        char *p = (char *)memrchr(buff ,'\n' ,n);
+        if( p ) RETURN from + (p - buff) + 1;
+        pos = from;
+      }
+      RETURN 0;
+    }
+
+    bool read_line(off_t from ,off_t to ,string &line){
+      line.resize(to - from);
+      if( pread(fd ,&line[0] ,to - from ,from) != to - from ){
+        bad = true;
+        RETURN false;
+      }
+      if( !line.empty() && line[line.size() - 1] == '\n' ) line.resize(line.size() - 1);
+      RETURN true;
+    }
+
+    // the entry of the line at offset, offset is moved to the next line
+    bool read_entry(off_t &offset ,int &type ,mtime_entry &entry){
+      off_t end = after_newline(offset);
+      string line;
+      if( !read_line(offset ,end ,line) ) RETURN false;
+      stringstream phrase_stream(line);
+      stringstream data_stream;
+      stringstream err;
+      size_t lineno = 0;
+      phrase a_phrase;
+      if( line.empty() || line[0] == '.'
+        || a_phrase.parse(phrase_stream ,data_stream ,pathname ,lineno ,err) != ParseStatus::Found
+        || (a_phrase.front() != "node" && a_phrase.front() != "source")
+      ){
+        cerr << pathname << " unrecognized phrase in mtime index at byte " << offset << endl;
+        bad = true;
+        RETURN false;
+      }
+      type = rank(a_phrase.front());
+      a_phrase.pop_front();
+      if( entry.parse(a_phrase) != ParseStatus::Found ){
+        cerr << pathname << " unrecognized phrase in mtime index at byte " << offset << endl;
+        bad = true;
+        RETURN false;
+      }
+      offset = end;
+      RETURN true;
+    }
+  };
+
+#endif
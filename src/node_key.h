@@ -0,0 +1,144 @@
+#ifndef NODE_KEY_H
+#define NODE_KEY_H
+
+/*
+ defines classes:
+    node_key
+    node_key_list
+
+  A node key is the content identity of a node as far as it can be known without reading
+  the node: the length of the node file and the signature from the node phrase.  Lists of
+  node keys sorted on (size, signature) are how two or more taxonomies are merge joined.
+
+  Signatures of different kinds, see file.h, are sums of different bytes, so one file signed
+  Sign_Head in one archive and Sign_Regions in another would never meet.  When any of the
+  archives being joined still has head signed nodes, every key is built on the head
+  signature, read from the node file for the nodes signed otherwise, and as a head signature
+  is not identity every match is then confirmed by reading.  resign.cc brings an archive to
+  the current kind.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// STL objects used
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+// locally defined objects
+#include "types.h"
+#include "file.h"
+#include "taxonomy.h"
+
+
+/*--------------------------------------------------------------------------------
+  content identity of one node
+*/
+  class node_key{
+  public:
+    off_t size;
+    signature node_signature;
+    size_t node;
+
+    // same (size, signature), the node number is not part of the identity
+    bool same_key(const node_key &other) const{
+      RETURN size == other.size && node_signature == other.node_signature;
+    }
+
+    // (size, signature) order, the node number is not looked at
+    bool key_less(const node_key &other) const{
+      if( size != other.size ) RETURN size < other.size;
+      RETURN node_signature < other.node_signature;
+    }
+
+    bool operator < (const node_key &other) const{
+      if( size != other.size ) RETURN size < other.size;
+      if( node_signature != other.node_signature ) RETURN node_signature < other.node_signature;
+      RETURN node < other.node;
+    }
+  };
+
+
+/*--------------------------------------------------------------------------------
+  the node keys of a whole taxonomy, sorted
+
+  the node sizes come from a stat of each node file in the store, nodes whose files can
+  not be stat'ed are left out of the list and counted in 'missing'.  With 'by_head' the keys
+  are head signatures, see above, and the first block of each node not signed that way is
+  read to make one.
+*/
+  class node_key_list : public vector<node_key>{
+  public:
+    node_key_list(){ missing = 0; }
+    size_t missing;
+
+    void build(const string &store_path ,const nodes_map &a_nodes_map ,bool by_head = false){
+      clear();
+      missing = 0;
+      reserve(a_nodes_map.size());
+      stringstream node_pathname;
+      struct stat file_attributes;
+      node_key a_key;
+      nodes_map::const_iterator it = a_nodes_map.begin();
+      while( it != a_nodes_map.end() ){
+        node_pathname.clear();
+        node_pathname.str("");
+        node_pathname << store_path << "/" << it->first;
+        a_key.node_signature = it->second.node_signature;
+        bool keyed;
+        const char *failure = "could not stat node file, left out: ";
+        if( by_head && a_key.node_signature.kind != Sign_Head ){
+          int fd = open_read(node_pathname);
+          keyed = fd != -1 && fstat(fd ,&file_attributes) == 0 && a_key.node_signature.sign(fd ,Sign_Head);
+          if( fd != -1 ) close(fd);
+          failure = "could not read node file, left out: ";
+        }else{
+          keyed = stat(node_pathname.str().c_str() ,&file_attributes) == 0;
+        }
+        if( !keyed ){
+          cerr << failure << node_pathname.str() << endl;
+          missing++;
+        }else{
+          a_key.size = file_attributes.st_size;
+          a_key.node = it->first;
+          push_back(a_key);
+        }
+      it++;
+      }
+      sort(begin() ,end());
+    }
+
+    // true when a node of 'a_nodes_map' is signed by its head only, the join must then be by_head
+    static bool has_head_signed(const nodes_map &a_nodes_map){
+      for( nodes_map::const_iterator it = a_nodes_map.begin(); it != a_nodes_map.end(); it++ ){
+        if( it->second.node_signature.kind == Sign_Head ) RETURN true;
+      }
+      RETURN false;
+    }
+
+    // [first, result) all share the key of *first
+    const_iterator group_end(const_iterator first) const{
+      const_iterator it = first;
+      while( it != end() && it->same_key(*first) ) it++;
+      RETURN it;
+    }
+  };
+
+
+/*--------------------------------------------------------------------------------
+  true if two node files are the same, used when a key alone does not settle identity
+*/
+  bool same_nodes(const string &pathname0 ,const string &pathname1){
+    int fd0 = open_read(pathname0);
+    int fd1 = open_read(pathname1);
+    bool result = fd0 != -1 && fd1 != -1 && same(fd0 ,fd1);
+    if( fd0 != -1 ) close(fd0);
+    if( fd1 != -1 ) close(fd1);
+    RETURN result;
+  }
+
+#endif
@@ -0,0 +1,408 @@
+#ifndef NODE_WRITER_H
+#define NODE_WRITER_H
+
+/*
+ defines classes:
+    source_image
+    node_writer
+
+  A source image is a source file brought into memory once, read into a buffer.  insert
+  compares it with candidate nodes and writes new nodes from it, so a file on slow source
+  media is read one time no matter how many mirrored archives it goes into.  The file is not
+  mapped: a source file truncated while its mapping is in use raises SIGBUS, and under
+  --watch files are truncated all the time.  Read, a file that gets shorter is a short read,
+  and the file is skipped.
+
+  A node writer is a thread that owns the writes into one store.  Jobs, a node number and
+  the image to write there, are handed to it through a queue bounded in jobs and in bytes,
+  so the reader is held back when a store falls behind rather than holding an unbounded
+  number of files in memory.  Until a
+  job is written the image is available from pending(), so a later source file with the
+  same content is compared with the image instead of with a half written node file.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+// STL objects used
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <list>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+
+// locally defined objects
+#include "types.h"
+#include "file.h"
+#include "stats.h"
+#include "uring.h"
+
+
+/*--------------------------------------------------------------------------------
+  a source file held in memory
+*/
+  class source_image{
+  public:
+    source_image(): data(0),size(0),buffer_index(-1),hashed(false){;}
+    ~source_image(){
+      if( buffer_index >= 0 ) buffers->give(buffer_index);
+    }
+
+    const char *data;
+    size_t size;
+    int buffer_index;  // the registered buffer that holds the data, -1 when there is none
+    shared_ptr<uring_buffers> buffers;  // the pool buffer_index is from
+
+    // room for 'a_size' bytes that the caller fills in
+    char *allocate(size_t a_size){
+      size = a_size;
+      buffer.resize(size);
+      data = size ? &buffer[0] : 0;
+      RETURN (char *)data;
+    }
+
+    // takes a registered buffer, it is given back to the pool when the image goes
+    char *adopt(const shared_ptr<uring_buffers> &a_buffers ,int index ,size_t a_size){
+      buffers = a_buffers;
+      buffer_index = index;
+      size = a_size;
+      data = buffers->buffer(index);
+      RETURN (char *)data;
+    }
+
+    // brings in the file open on fd, the fd may be closed afterward, false if the file got
+    // shorter while it was read, could not be read, or does not fit in memory
+    bool load(int fd ,bool drop_cache = false){
+      off_t end = lseek(fd ,0 ,SEEK_END);
+      if( end == -1 ) RETURN false;
+      size = end;
+      if( size == 0 ) RETURN true;
+
+      try{
+        buffer.resize(size);
+      }catch( const bad_alloc & ){
+        RETURN false;
+      }
+      lseek(fd ,0 ,SEEK_SET);
+      size_t done = 0;
+      while( done < size ){
+        ssize_t n = read(fd ,&buffer[done] ,size - done);
+        if( n <= 0 ) RETURN false;
+        done += n;
+      }
+      data = &buffer[0];
+      if( drop_cache ) drop_cached(fd);
+      RETURN true;
+    }
+
+    // true if the file open on fd holds exactly this image
+    bool same(int fd) const{
+      if( lseek(fd ,0 ,SEEK_END) != (off_t)size ) RETURN false;
+      lseek(fd ,0 ,SEEK_SET);
+      char buff[BLOCKSIZE];
+      size_t done = 0;
+      while( done < size ){
+        ssize_t n = read(fd ,buff ,BLOCKSIZE);
+        if( n <= 0 || done + n > size || memcmp(buff ,data + done ,n) != 0 ) RETURN false;
+        done += n;
+      }
+      RETURN true;
+    }
+
+    /*
+      the index in 'fds' of a file that holds exactly this image, or -1 when none does
+
+      The files are compared together, a block of each at a time, and each is dropped at its
+      first difference, first of all a difference in length, so the work is that of comparing
+      the longest agreeing prefix once per file still agreeing, rather than whole files in
+      turn.  'different' counts the files dropped.
+    */
+    int same_as_any(const vector<int> &fds ,size_t &different) const{
+      static const size_t Compare_Block = 64 << 10;
+      vector<size_t> live;
+      different = 0;
+      for( size_t k = 0; k < fds.size(); k++ ){
+        struct stat file_attributes;
+        if( fstat(fds[k] ,&file_attributes) == -1 || file_attributes.st_size != (off_t)size ) different++;
+        else live.push_back(k);
+      }
+      vector<char> buff(min(size ,Compare_Block));
+      for( size_t done = 0; done < size && !live.empty(); ){
+        size_t length = min(size - done ,Compare_Block);
+        vector<size_t> agreeing;
+        for( size_t j = 0; j < live.size(); j++ ){
+          size_t got = 0;
+          while( got < length ){
+            ssize_t n = pread(fds[live[j]] ,&buff[got] ,length - got ,done + got);
+            if( n <= 0 ) BREAK;
+            got += n;
+          }
+          if( got == length && memcmp(&buff[0] ,data + done ,length) == 0 ) agreeing.push_back(live[j]);
+          else different++;
+        }
+        live.swap(agreeing);
+        done += length;
+      }
+      RETURN live.empty() ? -1 : (int)live.front();
+    }
+
+    // summed the first time it is asked for, once for all the mirrors
+    const strong_hash &strong() const{
+      if( !hashed ){
+        digest.hash(data ,size);
+        hashed = true;
+      }
+      RETURN digest;
+    }
+
+    bool same(const source_image &other) const{
+      RETURN size == other.size && (size == 0 || memcmp(data ,other.data ,size) == 0);
+    }
+
+    bool write(int fd) const{
+      size_t done = 0;
+      while( done < size ){
+        ssize_t n = ::write(fd ,data + done ,size - done);
+        if( n <= 0 ) RETURN false;
+        done += n;
+      }
+      RETURN true;
+    }
+
+  private:
+    vector<char> buffer;  // the data, when it is not in a registered buffer
+    mutable strong_hash digest;
+    mutable bool hashed;
+
+    source_image(const source_image &);
+    source_image &operator = (const source_image &);
+  };
+  typedef shared_ptr<const source_image> source_image_ptr;
+
+
+/*--------------------------------------------------------------------------------
+  writes node files into one store from its own thread
+*/
+  class node_writer{
+  public:
+    node_writer(): capacity(16),byte_capacity(256 << 20),use_uring(false),drop_cache(false),queued_bytes(0),done(false){;}
+
+    string store_path;
+    size_t capacity;  // jobs queued before push() waits
+    size_t byte_capacity;  // image bytes queued before push() waits, a larger image waits for an empty queue
+    bool use_uring;  // write through an io_uring
+    bool drop_cache;  // node files leave the page cache once written
+    shared_ptr<uring_buffers> buffers;  // registered with the ring when given
+    list<size_t> failed;  // nodes that could not be written, read after finish()
+
+    // may be called again after finish(), for the next batch
+    void start(const string &a_store_path){
+      store_path = a_store_path;
+      done = false;
+      failed.clear();
+      worker = thread(&node_writer::run ,this);
+    }
+
+    void push(size_t node ,source_image_ptr image){
+      unique_lock<mutex> lock(guard);
+      room.wait(lock ,[this ,&image]{
+        RETURN jobs.size() < capacity && (jobs.empty() || queued_bytes + image->size <= byte_capacity);
+      });
+      jobs.push_back(job(node ,image));
+      queued_bytes += image->size;
+      pending_nodes[node] = image;
+      work.notify_one();
+    }
+
+    // the image of a node that is queued but not yet written, empty otherwise
+    source_image_ptr pending(size_t node){
+      lock_guard<mutex> lock(guard);
+      map<size_t ,source_image_ptr>::const_iterator it = pending_nodes.find(node);
+      if( it == pending_nodes.end() ) RETURN source_image_ptr();
+      RETURN it->second;
+    }
+
+    // waits for the queue to drain, returns the number of nodes that could not be written
+    size_t finish(){
+      {
+        lock_guard<mutex> lock(guard);
+        done = true;
+        work.notify_one();
+      }
+      if( worker.joinable() ) worker.join();
+      RETURN failed.size();
+    }
+
+  protected:
+    typedef pair<size_t ,source_image_ptr> job;
+
+    void run(){
+      uring ring;
+      bool fixed = false;  // the images in 'buffers' may be written with WRITE_FIXED
+      if( use_uring && ring.open(2 * capacity) ) fixed = buffers && buffers->register_with(ring);
+      while( true ){
+        deque<job> batch;
+        {
+          unique_lock<mutex> lock(guard);
+          work.wait(lock ,[this]{ RETURN done || !jobs.empty(); });
+          if( jobs.empty() ) RETURN;
+          if( ring.is_open() ){
+            batch.swap(jobs);
+            queued_bytes = 0;
+          }else{
+            batch.push_back(jobs.front());
+            jobs.pop_front();
+            queued_bytes -= batch.front().second->size;
+          }
+          room.notify_one();
+        }
+        list<size_t> batch_failed;
+        if( ring.is_open() ){
+          write_nodes(ring ,fixed ,batch ,batch_failed);
+        }else if( !write_node(batch.front().first ,*batch.front().second) ){
+          batch_failed.push_back(batch.front().first);
+        }
+        {
+          lock_guard<mutex> lock(guard);
+          for( deque<job>::iterator it = batch.begin(); it != batch.end(); it++ ) pending_nodes.erase(it->first);
+          failed.splice(failed.end() ,batch_failed);
+        }
+      }
+    }
+
+    bool write_node(size_t node ,const source_image &image){
+      STATS_TIMER(Phase_Copy);
+      stringstream ss;
+      ss << store_path << "/" << node;
+      int fda = open_write(ss);
+      if( fda == -1 ){
+        cerr << "could not create node in the archive: " << ss.str() << endl;
+        cerr << strerror(errno) << endl;
+        RETURN false;
+      }
+      bool ok = ftruncate(fda ,0) == 0 && image.write(fda);  // a number freed by gc may still have its old file
+      if( ok && drop_cache ) drop_written(fda);
+      if( close(fda) == -1 ) ok = false;
+      if( ok ) STATS_ADD(Count_BytesWritten ,image.size);
+      if( !ok ) cerr << "copy of source file to node failed! node: " << ss.str() << endl;
+      RETURN ok;
+    }
+
+    /*
+      Every job of the batch is opened at once, then each is written as its open completes
+      and closed as its writes complete, with drop_cache it is synced and dropped from the
+      cache in between.  A job has one operation in the ring at a time, the ring is twice the
+      queue capacity so there is always room for it.
+    */
+    enum write_stage{ Write_Opening ,Write_Writing ,Write_Syncing ,Write_Dropping ,Write_Closing ,Write_Finished };
+
+    class write_state{
+    public:
+      write_state(): fd(-1),written(0),stage(Write_Opening),ok(true){;}
+      size_t node;
+      const source_image *image;
+      string pathname;
+      int fd;
+      size_t written;
+      write_stage stage;
+      bool ok;
+    };
+
+    void write_nodes(uring &ring ,bool fixed ,const deque<job> &batch ,list<size_t> &batch_failed){
+      STATS_TIMER(Phase_Copy);
+      vector<write_state> states(batch.size());
+      for( size_t k = 0; k < batch.size(); k++ ){
+        write_state &state = states[k];
+        state.node = batch[k].first;
+        state.image = batch[k].second.get();
+        stringstream ss;
+        ss << store_path << "/" << state.node;
+        state.pathname = ss.str();
+        ring.prep_openat(state.pathname.c_str() ,O_CREAT | O_TRUNC | O_RDWR ,S_IRUSR | S_IWUSR ,k);
+      }
+      size_t remaining = states.size();
+      while( remaining ){
+        if( !ring.submit(1) ){
+          cerr << "io_uring_enter: " << strerror(errno) << endl;
+          BREAK;
+        }
+        struct io_uring_cqe cqe;
+        while( ring.peek(cqe) ){
+          write_state &state = states[cqe.user_data];
+          const source_image &image = *state.image;
+          switch( state.stage ){
+          case Write_Opening:
+            if( cqe.res < 0 ){
+              cerr << "could not create node in the archive: " << state.pathname << endl;
+              cerr << strerror(-cqe.res) << endl;
+              state.ok = false;
+              state.stage = Write_Finished;
+              remaining--;
+              CONTINUE;
+            }
+            state.fd = cqe.res;
+            state.stage = Write_Writing;
+            BREAK;
+          case Write_Writing:
+            if( cqe.res <= 0 ) state.ok = false;
+            else state.written += cqe.res;
+            BREAK;
+          case Write_Syncing:
+            state.stage = Write_Dropping;
+            ring.prep_fadvise(state.fd ,POSIX_FADV_DONTNEED ,cqe.user_data);
+            CONTINUE;
+          case Write_Dropping:
+            state.stage = Write_Closing;
+            ring.prep_close(state.fd ,cqe.user_data);
+            CONTINUE;
+          default:  // the close completed
+            if( cqe.res < 0 ) state.ok = false;
+            if( state.ok ) STATS_ADD(Count_BytesWritten ,image.size);
+            if( !state.ok ) cerr << "copy of source file to node failed! node: " << state.pathname << endl;
+            state.stage = Write_Finished;
+            remaining--;
+            CONTINUE;
+          }
+
+          // still writing
+          if( state.ok && state.written < image.size ){
+            size_t length = image.size - state.written;
+            if( length > Uring_IOMax ) length = Uring_IOMax;
+            int index = fixed && image.buffers == buffers ? image.buffer_index : -1;
+            ring.prep_rw(IORING_OP_WRITE ,state.fd ,image.data + state.written ,length ,state.written ,index ,cqe.user_data);
+          }else if( state.ok && drop_cache ){
+            state.stage = Write_Syncing;
+            ring.prep_sync_file_range(state.fd ,cqe.user_data);
+          }else{
+            state.stage = Write_Closing;
+            ring.prep_close(state.fd ,cqe.user_data);
+          }
+        }
+      }
+      for( size_t k = 0; k < states.size(); k++ ){
+        if( !states[k].ok || states[k].stage != Write_Finished ) batch_failed.push_back(states[k].node);
+      }
+    }
+
+    thread worker;
+    mutex guard;
+    condition_variable work;  // signalled when a job is queued or when finishing
+    condition_variable room;  // signalled when a job is taken off the queue
+    deque<job> jobs;
+    size_t queued_bytes;  // image bytes in 'jobs'
+    map<size_t ,source_image_ptr> pending_nodes;
+    bool done;
+  };
+
+#endif
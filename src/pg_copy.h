@@ -0,0 +1,253 @@
+#ifndef PG_COPY_H
+#define PG_COPY_H
+
+/*
+ defines classes:
+    pg_copy
+
+ provides functions:
+    copy_node_row
+    copy_source_row
+    copy_arch_nodes
+    copy_arch_source
+
+  Bulk loading of taxonomy metadata into PostgreSQL with COPY ... FROM STDIN in binary
+  format, rather than with one INSERT statement per row.  Rows are gathered in a buffer and
+  handed to libpq every 'batch_rows' rows, and the transaction, with the COPY inside it, is
+  committed every 'commit_rows' rows, zero meaning once at the end.
+
+  binary COPY stream:
+    header   "PGCOPY\n\377\r\n\0", int32 flags, int32 header extension length
+    row      int16 field count, then per field int32 length (-1 for NULL) and the bytes
+    trailer  int16 -1
+  all integers in network byte order.  Field values must match the column types exactly,
+  BIGINT is 8 bytes, OID 4 bytes, and TEXT is the raw bytes.
+*/
+
+#include <endian.h>
+#include <arpa/inet.h>
+#include <stdint.h>
+
+// STL objects used
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <map>
+using namespace std;
+
+#include<libpq-fe.h>
+
+// locally defined objects
+#include "types.h"
+#include "taxonomy.h"
+
+
+/*--------------------------------------------------------------------------------
+  one COPY ... FROM STDIN (FORMAT binary) in progress on a connection
+*/
+  class pg_copy{
+  public:
+    pg_copy(PGconn *conn ,size_t batch_rows): conn(conn),batch_rows(batch_rows),rows(0),active(false){;}
+    ~pg_copy(){
+      if( active ) PQputCopyEnd(conn ,"abandoned");
+    }
+
+    PGconn *conn;
+    size_t batch_rows;  // rows gathered before they are handed to libpq
+    size_t rows;  // rows sent since begin()
+
+    // 'columns' is a table name and column list, e.g. "arch_source (node ,mtime ,pathname)"
+    bool begin(const string &columns){
+      string statement = "COPY " + columns + " FROM STDIN (FORMAT binary)";
+      PGresult *res = PQexec(conn ,statement.c_str());
+      bool ok = PQresultStatus(res) == PGRES_COPY_IN;
+      if( !ok ) cerr << PQresultErrorMessage(res) << endl;
+      PQclear(res);
+      if( !ok ) RETURN false;
+      active = true;
+      rows = 0;
+      batched = 0;
+      buffer.assign("PGCOPY\n\377\r\n\0" ,11);
+      put_int32(0);  // flags
+      put_int32(0);  // header extension length
+      RETURN true;
+    }
+
+    void row(uint16_t field_count){
+      put_int16(field_count);
+    }
+    void field_int64(int64_t value){
+      put_int32(8);
+      uint64_t v = htobe64((uint64_t)value);
+      buffer.append((const char *)&v ,8);
+    }
+    void field_oid(Oid value){
+      put_int32(4);
+      put_int32(value);
+    }
+    void field_text(const string &value){
+      put_int32(value.size());
+      buffer.append(value);
+    }
+    void field_null(){
+      put_int32((uint32_t)-1);
+    }
+
+    // called after the fields of each row, sends the buffer when a batch is complete
+    bool end_row(){
+      rows++;
+      batched++;
+      if( batched < batch_rows ) RETURN true;
+      RETURN flush();
+    }
+
+    // sends what is left and the trailer, then collects the result of the COPY
+    bool end(){
+      if( !active ) RETURN false;
+      put_int16((uint16_t)-1);
+      bool ok = flush();
+      active = false;
+      if( PQputCopyEnd(conn ,ok ? 0 : "send failed") != 1 ){
+        cerr << PQerrorMessage(conn) << endl;
+        ok = false;
+      }
+      PGresult *res;
+      while( (res = PQgetResult(conn)) != 0 ){
+        if( PQresultStatus(res) != PGRES_COMMAND_OK ){
+          cerr << PQresultErrorMessage(res) << endl;
+          ok = false;
+        }
+        PQclear(res);
+      }
+      RETURN ok;
+    }
+
+  protected:
+    bool flush(){
+      batched = 0;
+      if( buffer.empty() ) RETURN true;
+      bool ok = PQputCopyData(conn ,buffer.data() ,buffer.size()) == 1;
+      if( !ok ) cerr << PQerrorMessage(conn) << endl;
+      buffer.clear();
+      RETURN ok;
+    }
+
+    void put_int16(uint16_t value){
+      uint16_t v = htons(value);
+      buffer.append((const char *)&v ,2);
+    }
+    void put_int32(uint32_t value){
+      uint32_t v = htonl(value);
+      buffer.append((const char *)&v ,4);
+    }
+
+    string buffer;
+    size_t batched;  // rows in buffer
+    bool active;
+  };
+
+
+/*--------------------------------------------------------------------------------
+  transaction helpers, errors are reported on cerr
+*/
+  bool pg_command(PGconn *conn ,const char *command){
+    PGresult *res = PQexec(conn ,command);
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    if( !ok ) cerr << command << ": " << PQresultErrorMessage(res) << endl;
+    PQclear(res);
+    RETURN ok;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  one row of arch_nodes, or of arch_source, into a COPY begun with the columns below
+
+  file_ids gives the large object holding each node, nodes not found there get a NULL file_id
+*/
+  typedef map<size_t ,Oid> file_id_map;
+
+  const char *arch_nodes_columns = " (node ,file_id ,mtime ,signature)";
+  const char *arch_source_columns = " (node ,mtime ,pathname)";
+
+  bool copy_node_row(pg_copy &copy ,const node_set &ns ,const file_id_map &file_ids){
+    stringstream node_sig;
+    ns.node_signature.print(node_sig);
+    copy.row(4);
+    copy.field_int64(ns.node);
+    file_id_map::const_iterator fid_it = file_ids.find(ns.node);
+    if( fid_it == file_ids.end() ) copy.field_null();
+    else copy.field_oid(fid_it->second);
+    copy.field_int64(ns.mtime);
+    copy.field_text(node_sig.str());
+    RETURN copy.end_row();
+  }
+
+  bool copy_source_row(pg_copy &copy ,size_t node ,const file_record &source){
+    copy.row(3);
+    copy.field_int64(node);
+    copy.field_int64(source.mtime);
+    copy.field_text(source.pathname);
+    RETURN copy.end_row();
+  }
+
+
+/*--------------------------------------------------------------------------------
+  loads the rows of a nodes_map into 'table' with the columns of arch_nodes, or of
+  arch_source, committing every commit_rows rows
+*/
+  bool copy_arch_nodes(
+     PGconn *conn
+    ,const string &table
+    ,const nodes_map &a_nodes_map
+    ,const file_id_map &file_ids
+    ,size_t batch_rows
+    ,size_t commit_rows
+    ,size_t &row_count
+  ){
+    string columns = table + arch_nodes_columns;
+    pg_copy copy(conn ,batch_rows);
+    if( !pg_command(conn ,"BEGIN") || !copy.begin(columns) ) RETURN false;
+    nodes_map::const_iterator nm_it = a_nodes_map.begin();
+    while( nm_it != a_nodes_map.end() ){
+      if( !copy_node_row(copy ,nm_it->second ,file_ids) ) RETURN false;
+      row_count++;
+
+      if( commit_rows != 0 && copy.rows == commit_rows ){
+        if( !copy.end() || !pg_command(conn ,"COMMIT") ) RETURN false;
+        if( !pg_command(conn ,"BEGIN") || !copy.begin(columns) ) RETURN false;
+      }
+    nm_it++;
+    }
+    RETURN copy.end() && pg_command(conn ,"COMMIT");
+  }
+
+  bool copy_arch_source(
+     PGconn *conn
+    ,const string &table
+    ,const nodes_map &a_nodes_map
+    ,size_t batch_rows
+    ,size_t commit_rows
+    ,size_t &row_count
+  ){
+    string columns = table + arch_source_columns;
+    pg_copy copy(conn ,batch_rows);
+    if( !pg_command(conn ,"BEGIN") || !copy.begin(columns) ) RETURN false;
+    nodes_map::const_iterator nm_it = a_nodes_map.begin();
+    while( nm_it != a_nodes_map.end() ){
+      file_record_list::const_iterator fr_it = nm_it->second.sources.begin();
+      while( fr_it != nm_it->second.sources.end() ){
+        if( !copy_source_row(copy ,nm_it->second.node ,*fr_it) ) RETURN false;
+        row_count++;
+
+        if( commit_rows != 0 && copy.rows == commit_rows ){
+          if( !copy.end() || !pg_command(conn ,"COMMIT") ) RETURN false;
+          if( !pg_command(conn ,"BEGIN") || !copy.begin(columns) ) RETURN false;
+        }
+      fr_it++;
+      }
+    nm_it++;
+    }
+    RETURN copy.end() && pg_command(conn ,"COMMIT");
+  }
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef PG_LO_H
+#define PG_LO_H
+
+/*
+ defines classes:
+    lo_upload_pool
+
+ provides functions:
+    lo_upload
+
+  Uploading node files into PostgreSQL large objects over several connections at once.
+
+  lo_import does one file at a time on one connection, so the client reads and the server
+  writes are both serial.  Here each worker thread has its own connection and takes the next
+  node from a shared list, streams the node file with lo_create/lo_open/lo_write in large
+  chunks, and commits.  The large object ids come back per worker and are joined into one
+  map by node number, which is what the arch_nodes COPY in pg_copy.h wants.
+
+  A large object descriptor is only good until the end of the transaction that opened it.
+  Outside an explicit transaction every call is its own transaction, and the descriptor from
+  lo_open is already closed by the time lo_write uses it, which is the "invalid large-object
+  descriptor: 0" of problem.txt.  lo_upload always works inside BEGIN/COMMIT.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+// STL objects used
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <atomic>
+#include <thread>
+using namespace std;
+
+#include<libpq-fe.h>
+#include<libpq/libpq-fs.h>
+
+// locally defined objects
+#include "types.h"
+#include "file.h"
+#include "pg_copy.h"
+
+
+/*--------------------------------------------------------------------------------
+  copies one file into a new large object, returns InvalidOid on failure
+
+  the whole upload is one transaction, so a failure leaves no partial large object behind
+*/
+  Oid lo_upload(PGconn *conn ,const string &pathname ,vector<char> &chunk){
+    int fd = open_read(pathname);
+    if( fd == -1 ){
+      cerr << "could not open node file for reading: " << pathname << endl;
+      cerr << strerror(errno) << endl;
+      RETURN InvalidOid;
+    }
+    if( !pg_command(conn ,"BEGIN") ){
+      close(fd);
+      RETURN InvalidOid;
+    }
+    Oid file_id = lo_create(conn ,InvalidOid);
+    int lo_fd = file_id == InvalidOid ? -1 : lo_open(conn ,file_id ,INV_WRITE);
+    bool ok = lo_fd >= 0;
+    while( ok ){
+      ssize_t n = read(fd ,&chunk[0] ,chunk.size());
+      if( n == 0 ) BREAK;
+      if( n < 0 ){
+        cerr << "could not read node file: " << pathname << endl;
+        cerr << strerror(errno) << endl;
+        ok = false;
+        BREAK;
+      }
+      if( lo_write(conn ,lo_fd ,&chunk[0] ,n) != n ) ok = false;
+    }
+    if( ok && lo_close(conn ,lo_fd) != 0 ) ok = false;
+    close(fd);
+    if( !ok ){
+      cerr << pathname << ": " << PQerrorMessage(conn) << endl;
+      pg_command(conn ,"ROLLBACK");
+      RETURN InvalidOid;
+    }
+    if( !pg_command(conn ,"COMMIT") ) RETURN InvalidOid;
+    RETURN file_id;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  a pool of connections, one worker thread each, that upload a list of node files
+*/
+  class lo_upload_pool{
+  public:
+    lo_upload_pool(): chunk_size(1 << 20){;}
+    ~lo_upload_pool(){
+      for( size_t k = 0; k < conns.size(); k++ ) PQfinish(conns[k]);
+    }
+
+    size_t chunk_size;  // bytes per lo_write
+
+    // opens 'count' connections with the same connection string
+    bool open(const string &conninfo ,size_t count){
+      for( size_t k = 0; k < count; k++ ){
+        PGconn *conn = PQconnectdb(conninfo.c_str());
+        if( PQstatus(conn) == CONNECTION_BAD ){
+          cerr << "Connection to database failed: " << PQerrorMessage(conn) << endl;
+          PQfinish(conn);
+          RETURN false;
+        }
+        conns.push_back(conn);
+      }
+      RETURN true;
+    }
+
+    /*
+      uploads store_path/<node> for each node in 'nodes', and puts the large object id of
+      each into 'file_ids'.  Returns the number of nodes that could not be uploaded.
+    */
+    size_t upload(const string &store_path ,const vector<size_t> &nodes ,file_id_map &file_ids){
+      next = 0;
+      vector<file_id_map> results(conns.size());
+      vector<size_t> failures(conns.size() ,0);
+      vector<thread> workers;
+      for( size_t k = 0; k < conns.size(); k++ ){
+        workers.push_back(thread(&lo_upload_pool::work ,this ,conns[k] ,cref(store_path) ,cref(nodes) ,ref(results[k]) ,ref(failures[k])));
+      }
+      size_t failed = 0;
+      for( size_t k = 0; k < workers.size(); k++ ){
+        workers[k].join();
+        file_ids.insert(results[k].begin() ,results[k].end());
+        failed += failures[k];
+      }
+      RETURN failed;
+    }
+
+  protected:
+    void work(PGconn *conn ,const string &store_path ,const vector<size_t> &nodes ,file_id_map &result ,size_t &failed){
+      vector<char> chunk(chunk_size);
+      size_t i;
+      while( (i = next++) < nodes.size() ){
+        stringstream pathname;
+        pathname << store_path << "/" << nodes[i];
+        Oid file_id = lo_upload(conn ,pathname.str() ,chunk);
+        if( file_id == InvalidOid ) failed++;
+        else result[nodes[i]] = file_id;
+      }
+    }
+
+    vector<PGconn *> conns;
+    atomic<size_t> next;  // index of the next node to be taken by a worker
+  };
+
+#endif
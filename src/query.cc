@@ -0,0 +1,392 @@
+/*
+  query <archive>
+
+  Answers time range questions about an archive from its mtime index, see mtime_index.h.
+  The index is not loaded, the ends of the range are found by a binary search in the index
+  file and only the entries of the answer are read.  Should the index be missing or stale
+  it is rebuilt in memory from the taxonomy, the index on disk is left for the next insert
+  to bring up to date.
+
+  The index holds no pathnames, so the node sets named by the source lines of the answer are
+  found in the taxonomy by a binary search on node number, and only those are read.  A
+  taxonomy that is not in node order is indexed whole instead.
+
+*/
+
+// before we start, a bit of Vogon poetry:
+//
+  const char *vogon_poetry = R"VOGON_POETRY(
+     query [options] <archive>
+
+    <archive> the name of the archive
+
+    options:
+
+      -h --help            this message
+         --after <time>    only phrases with an mtime at or after <time>
+         --before <time>   only phrases with an mtime before <time>
+         --newest <n>      only the <n> phrases with the latest mtimes, newest first
+         --oldest <n>      only the <n> phrases with the earliest mtimes
+         --nodes           only node phrases
+         --sources         only source phrases
+
+    <time> is seconds since the epoch, or local time given as 'YYYY-MM-DD' or
+    'YYYY-MM-DD HH:MM:SS'
+
+    Phrases are printed with the mtime as a comment, source phrases with the
+    pathname found in the taxonomy:
+
+      # node # <mtime> # <node>
+      # source # <mtime> # <node> # <pathname>
+
+  )VOGON_POETRY";
+
+#include "types.h"
+
+// Program Termination Return Codes
+const uint Exit_NoError   =0;
+const uint Exit_BadParms  =1;
+const uint Exit_NoArchive =2;
+const uint Exit_InternalError =4;
+
+// for sterror and errno
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+
+// STL objects used
+#include <string>
+#include <fstream>
+#include <vector>
+#include <set>
+#include <list>
+#include <algorithm>
+using namespace std;
+
+// local objects used
+#include "file.h"
+#include "directory.h"
+#include "taxonomy.h"
+#include "mtime_index.h"
+#include "history.h"
+
+
+/*--------------------------------------------------------------------------------
+  time arguments are either seconds since the epoch or a local date and time
+*/
+  bool parse_time(const char *s ,time_t &t){
+    struct tm tm;
+    const char *end;
+
+    memset(&tm ,0 ,sizeof(tm));
+    if( (end = strptime(s ,"%Y-%m-%d %H:%M:%S" ,&tm)) != 0 && *end == 0
+      || (end = strptime(s ,"%Y-%m-%d" ,&tm)) != 0 && *end == 0
+    ){
+      tm.tm_isdst = -1;
+      t = mktime(&tm);
+      RETURN t != (time_t)-1;
+    }
+
+    stringstream ss(s);
+    RETURN (ss >> t) && ss.eof();
+  }
+
+  bool parse_count(const char *s ,size_t &n){
+    stringstream ss(s);
+    RETURN (ss >> n) && ss.eof();
+  }
+
+
+/*--------------------------------------------------------------------------------
+  a query result line, the phrase head tells node entries from source entries
+*/
+  class query_line{
+  public:
+    query_line(const string &head ,const mtime_entry &entry): head(head),entry(entry){;}
+    query_line(const string &head ,const mtime_entry &entry ,const string &pathname)
+      : head(head),entry(entry),pathname(pathname){;}
+    string head;
+    mtime_entry entry;
+    string pathname;  // empty for node lines
+
+    void print(ostream &os) const{
+      phrase a_phrase;
+      a_phrase.push_back(head);
+      entry.print(a_phrase);
+      if( pathname.length() != 0 ) a_phrase.push_back(pathname);
+      char date[64];
+      struct tm tm;
+      localtime_r(&entry.mtime ,&tm);
+      strftime(date ,sizeof(date) ,"; %Y-%m-%d %H:%M:%S" ,&tm);
+      a_phrase.comment = date;
+      a_phrase.print(os);
+    }
+
+    bool operator < (const query_line &other) const{
+      if( entry < other.entry ) RETURN true;
+      if( other.entry < entry ) RETURN false;
+      RETURN head < other.head || (head == other.head && pathname < other.pathname);
+    }
+  };
+
+  const uint Q_All = 0;
+  const uint Q_Newest = 1;
+  const uint Q_Oldest = 2;
+
+  /*
+    collects the lines for one entry type from the index file, as the one below does from an
+    mtime_set
+  */
+  bool collect(
+     mtime_index_file &the_file
+    ,const string &head
+    ,time_t after
+    ,time_t before
+    ,uint which
+    ,size_t n
+    ,vector<query_line> &lines
+  ){
+    off_t first = the_file.lower_bound(head ,after);
+    off_t last = before < after ? first : the_file.lower_bound(head ,before);
+    mtime_entry entry;
+    if( which == Q_Newest ){
+      off_t offset = last;
+      while( offset > first && n != 0 && the_file.prev(offset ,entry) ){
+        lines.push_back(query_line(head ,entry));
+      n--;
+      }
+      RETURN !the_file.bad;
+    }
+    off_t offset = first;
+    while( offset < last && (which == Q_All || n != 0) && the_file.next(offset ,entry) ){
+      lines.push_back(query_line(head ,entry));
+    if(n != 0) n--;
+    }
+    RETURN !the_file.bad;
+  }
+
+
+  /*
+    collects the lines for one mtime_set
+
+    the range is found with two lower_bounds, newest and oldest then step at most n entries in
+    from the ends of the range
+  */
+  void collect(
+     const mtime_set &the_set
+    ,const string &head
+    ,time_t after
+    ,time_t before
+    ,uint which
+    ,size_t n
+    ,vector<query_line> &lines
+  ){
+    mtime_set::range_type r = the_set.range(after ,before);
+    if( which == Q_Newest ){
+      mtime_set::const_iterator it = r.second;
+      while( it != r.first && n != 0 ){
+        it--;
+        lines.push_back(query_line(head ,*it));
+      n--;
+      }
+      RETURN;
+    }
+    mtime_set::const_iterator it = r.first;
+    while( it != r.second && (which == Q_All || n != 0) ){
+      lines.push_back(query_line(head ,*it));
+    if(n != 0) n--;
+    it++;
+    }
+  }
+
+
+  /*
+    an index entry for a source names only the node, each becomes one line per source of that
+    node with the entry's mtime, the node set is loaded from the taxonomy to find them
+
+    a_nodes_map holds the node sets found so far, it is indexed whole only when a node set
+    is not found by seek()
+  */
+  bool expand_sources(nodes_map &a_nodes_map ,const string &taxonomy_pathname ,vector<query_line> &lines){
+    bool indexed = a_nodes_map.size() != 0;
+    vector<query_line> expanded;
+    vector<query_line>::const_iterator it = lines.begin();
+    while( it != lines.end() ){
+      if( it->head != "source" ){
+        expanded.push_back(*it);
+        it++;
+        CONTINUE;
+      }
+      nodes_map::iterator nit = a_nodes_map.find(it->entry.node);
+      if( nit == a_nodes_map.end() && !indexed && !a_nodes_map.seek(it->entry.node) ){
+        cerr << "taxonomy is not in node order, indexing it" << endl;
+        if( a_nodes_map.index(taxonomy_pathname) != ParseStatus::Found ) RETURN false;
+        indexed = true;
+      }
+      nit = a_nodes_map.find(it->entry.node);
+      if( nit == a_nodes_map.end() ){
+        cerr << "node " << it->entry.node << " of the mtime index is not in the taxonomy" << endl;
+        RETURN false;
+      }
+      if( !a_nodes_map.load(nit->second) ) RETURN false;
+      file_record_list::const_iterator fit = nit->second.sources.begin();
+      while( fit != nit->second.sources.end() ){
+        if( fit->mtime == it->entry.mtime ) expanded.push_back(query_line(it->head ,it->entry ,fit->pathname));
+      fit++;
+      }
+    it++;
+    }
+    lines.swap(expanded);
+    RETURN true;
+  }
+
+
+/*--------------------------------------------------------------------------------
+
+   This is called from the shell. See the Vogon poetry at the top of this file for
+   the usage message.
+
+*/
+  int main(int argc ,char **argv){
+
+    //----------------------------------------
+    // parse options
+    //
+      list<char *> args;
+      bool bad_parms=false;
+      time_t after = LONG_MIN;
+      time_t before = LONG_MAX;
+      uint which = Q_All;
+      size_t n = 0;
+      bool want_nodes = true;
+      bool want_sources = true;
+
+      if(argv == 0){
+        cerr << "serious problem here, argv was zero when the program was called" << endl;
+        RETURN Exit_InternalError;
+      }
+      if(argc == 1){
+        cerr << vogon_poetry;
+        RETURN Exit_BadParms;
+      }
+
+      for( argv++ ; *argv; argv++ ){
+        // check for options
+        //
+          if( (*argv)[0] == '-' ){
+            if( !strcmp(*argv, "-h") || !strcmp(*argv, "--help") ){
+              cout << vogon_poetry;
+              bad_parms=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--after") || !strcmp(*argv, "--before") ){
+              time_t &t = !strcmp(*argv, "--after") ? after : before;
+              argv++;
+              if( *argv && parse_time(*argv ,t) ) CONTINUE;
+              cerr << "expected a time after the " << *(argv-1) << " option" << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--newest") || !strcmp(*argv, "--oldest") ){
+              which = !strcmp(*argv, "--newest") ? Q_Newest : Q_Oldest;
+              argv++;
+              if( *argv && parse_count(*argv ,n) ) CONTINUE;
+              cerr << "expected a count after the " << *(argv-1) << " option" << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--nodes") ){
+              want_sources=false;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--sources") ){
+              want_nodes=false;
+              CONTINUE;
+            }
+
+            bad_parms=true;
+            cerr << "unrecognized option: " << *argv << endl;
+            CONTINUE;
+          }
+
+        // if it isn't and option, it is an arg
+        //
+          args.push_back(*argv);
+          CONTINUE;
+      }
+    if(bad_parms){
+      cerr << "errors when parsing parameters, nothing done" << endl;
+      RETURN Exit_BadParms;
+    }
+    if( args.size() != 1 ){
+      cerr << "need one argument, but found " << args.size() << " arguments" << endl;
+      RETURN Exit_BadParms;
+    }
+
+  //----------------------------------------
+  // load the mtime index, or rebuild it from the taxonomy
+  //
+    string arch_path = args.front();
+    strip_trailing(arch_path);
+
+    stringstream taxonomy_pathname;
+    taxonomy_pathname << arch_path << "/tax/sources" << ";" << "0";
+    off_t taxonomy_length;
+    if( !file_size(taxonomy_pathname.str() ,taxonomy_length) ){
+      cerr << "taxonomy_pathname not found: " << "\"" << taxonomy_pathname.str() << "\"" << endl;
+      RETURN Exit_NoArchive;
+    }
+
+    nodes_map a_nodes_map;
+    if( !a_nodes_map.open(taxonomy_pathname.str()) ){  // node sets are sought as lines need them
+      cerr << "could not open: " << "\"" << taxonomy_pathname.str() << "\"" << endl;
+      RETURN Exit_NoArchive;
+    }
+
+  //----------------------------------------
+  // run the query against the index file, or against an index rebuilt from the taxonomy
+  //
+    string mtime_index_pathname = arch_path + "/tax/mtimes";
+    vector<query_line> lines;
+    mtime_index_file the_file;
+    bool answered =
+      the_file.open(mtime_index_pathname ,taxonomy_generation(arch_path + "/tax") ,taxonomy_length)
+      && (!want_nodes || collect(the_file ,"node" ,after ,before ,which ,n ,lines))
+      && (!want_sources || collect(the_file ,"source" ,after ,before ,which ,n ,lines));
+    if( !answered ){
+      cerr << "mtime index missing or stale, building it from the taxonomy" << endl;
+      lines.clear();
+      if( a_nodes_map.index(taxonomy_pathname.str()) != ParseStatus::Found || !a_nodes_map.load_all() ){
+        cerr << "parse failed" << endl;
+        RETURN Exit_InternalError;
+      }
+      mtime_index a_mtime_index;
+      a_mtime_index.build(a_nodes_map);
+      if( want_nodes ) collect(a_mtime_index.nodes ,"node" ,after ,before ,which ,n ,lines);
+      if( want_sources ) collect(a_mtime_index.sources ,"source" ,after ,before ,which ,n ,lines);
+    }
+    if( !expand_sources(a_nodes_map ,taxonomy_pathname.str() ,lines) ){
+      cerr << "could not read the sources back from the taxonomy" << endl;
+      RETURN Exit_InternalError;
+    }
+
+    // when both sets contributed the result is the merge of the two, cut back to n
+    sort(lines.begin() ,lines.end());
+    if( which == Q_Newest ) reverse(lines.begin() ,lines.end());
+    if( which != Q_All && lines.size() > n ) lines.erase(lines.begin() + n ,lines.end());
+
+    vector<query_line>::const_iterator it = lines.begin();
+    while( it != lines.end() ){
+      it->print(cout);
+    it++;
+    }
+
+  RETURN Exit_NoError;
+  }
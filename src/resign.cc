@@ -0,0 +1,230 @@
+/*
+  resign [options] <archive>
+
+  Brings the nodes of an archive that are still signed by their first block only, Sign_Head,
+  to the current signature kind, see file.h.  Insert looks a source file up under both kinds
+  while an archive has any such nodes, and every source file that shares a header with one
+  of them is compared with it in full, so an archive is best re-signed once.
+
+  The node files are read by a pool of threads.  Each is first checked against the head
+  signature in its node phrase, a node that does not match is reported and keeps its
+  signature, it is a case for verify.  The re-signed taxonomy is committed as a new version,
+  the old one is kept as a delta.  Running it again finds nothing to do.
+*/
+
+// before we start, a bit of Vogon poetry:
+//
+  const char *vogon_poetry = R"VOGON_POETRY(
+     resign [options] <archive>
+
+    <archive> the archive to re-sign
+
+    options:
+
+      -h --help            this message
+      -v --verbose         progress information
+      -n --dry-run         count the nodes that would be re-signed, change nothing
+         --threads <n>     reader threads, default 4
+
+    exits with 3 when some nodes could not be re-signed, 6 when another program holds the archive
+
+  )VOGON_POETRY";
+
+#include "types.h"
+
+// Program Termination Return Codes
+const uint Exit_NoError   =0;
+const uint Exit_BadParms  =1;
+const uint Exit_NoArchive =2;
+const uint Exit_ProblemsFound =3;
+const uint Exit_InternalError =4;
+const uint Exit_ArchiveBusy =6;
+
+// for sterror and errno
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+// STL objects used
+#include <string>
+#include <fstream>
+#include <vector>
+#include <set>
+#include <list>
+#include <thread>
+#include <atomic>
+using namespace std;
+
+// local objects used
+#include "file.h"
+#include "directory.h"
+#include "taxonomy.h"
+#include "archive.h"
+
+
+/*--------------------------------------------------------------------------------
+  one node to be re-signed
+*/
+  class resign_job{
+  public:
+    resign_job(): ns(0),error(0),mis_signed(false){;}
+    node_set *ns;
+    signature current;  // the new signature
+    int error;          // errno when the node file could not be read
+    bool mis_signed;    // the file no longer matches the signature in its node phrase
+  };
+
+  void resign_node(const string &pathname ,resign_job &job){
+    int fd = open_read(pathname);
+    if( fd == -1 ){
+      job.error = errno;
+      RETURN;
+    }
+    signature head;
+    if( !head.sign(fd ,Sign_Head) || !job.current.sign(fd ,Sign_Current) ){
+      job.error = errno;
+    }else if( head != job.ns->node_signature ){
+      job.mis_signed = true;
+    }
+    close(fd);
+  }
+
+
+/*--------------------------------------------------------------------------------
+
+   This is called from the shell. See the Vogon poetry at the top of this file for
+   the usage message.
+
+*/
+  int main(int argc ,char **argv){
+
+    //----------------------------------------
+    // parse options
+    //
+      list<char *> args;
+      bool verbose=false;
+      bool dry_run=false;
+      uint thread_count=4;
+      bool bad_parms=false;
+
+      if(argv == 0){
+        cerr << "serious problem here, argv was zero when the program was called" << endl;
+        RETURN Exit_InternalError;
+      }
+      if(argc == 1){
+        cerr << vogon_poetry;
+        RETURN Exit_BadParms;
+      }
+
+      for( argv++ ; *argv; argv++ ){
+        // check for options
+        //
+          if( (*argv)[0] == '-' ){
+            if( !strcmp(*argv, "-h") || !strcmp(*argv, "--help") ){
+              cout << vogon_poetry;
+              bad_parms=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "-v") || !strcmp(*argv, "--verbose") ){
+              verbose=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "-n") || !strcmp(*argv, "--dry-run") ){
+              dry_run=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--threads") ){
+              argv++;
+              char *end;
+              if( *argv ){
+                thread_count = strtoul(*argv ,&end ,10);
+                if( *end == 0 && thread_count != 0 ) CONTINUE;
+              }
+              cerr << "expected a count greater than zero after --threads" << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            bad_parms=true;
+            cerr << "unrecognized option: " << *argv << endl;
+            CONTINUE;
+          }
+
+        // if it isn't and option, it is an arg
+        //
+          args.push_back(*argv);
+          CONTINUE;
+      }
+    if(bad_parms){
+      cerr << "errors when parsing parameters, nothing done" << endl;
+      RETURN Exit_BadParms;
+    }
+    if( args.size() != 1 ){
+      cerr << "need one argument, but found " << args.size() << " arguments" << endl;
+      RETURN Exit_BadParms;
+    }
+
+  //----------------------------------------
+  // load the taxonomy, find the nodes signed the old way
+  //
+    string arch_path = args.front();
+    archive an_archive;
+    if( !an_archive.open(arch_path ,false) ){
+      cerr << "not an archive: \"" << arch_path << "\"" << endl;
+      RETURN Exit_NoArchive;
+    }
+    if( !an_archive.lock() ) RETURN Exit_ArchiveBusy;
+    if( verbose ) cout << "parsing taxonomy file: \"" << an_archive.taxonomy_pathname() << "\"" << endl;
+    if( an_archive.load() != Archive_Success ) RETURN Exit_InternalError;
+
+    vector<resign_job> jobs;
+    for( nodes_map::iterator it = an_archive.a_nodes_map.begin(); it != an_archive.a_nodes_map.end(); it++ ){
+      if( it->second.node_signature.kind != Sign_Head ) CONTINUE;
+      jobs.push_back(resign_job());
+      jobs.back().ns = &it->second;
+    }
+    if( verbose || dry_run ) cout << "nodes: " << an_archive.a_nodes_map.size() << " to re-sign: " << jobs.size() << endl;
+    if( dry_run || jobs.empty() ) RETURN Exit_NoError;
+
+  //----------------------------------------
+  // read them, each thread takes the next node
+  //
+    atomic<size_t> next(0);
+    vector<thread> readers;
+    for( uint k = 0; k < thread_count; k++ ){
+      readers.push_back(thread([&]{
+        size_t i;
+        while( (i = next++) < jobs.size() ){
+          resign_node(an_archive.node_pathname(jobs[i].ns->node) ,jobs[i]);
+        }
+      }));
+    }
+    for( uint k = 0; k < thread_count; k++ ) readers[k].join();
+
+  //----------------------------------------
+  // put the new signatures in the taxonomy and commit it
+  //
+    size_t resigned = 0 ,problems = 0;
+    for( size_t i = 0; i < jobs.size(); i++ ){
+      resign_job &job = jobs[i];
+      if( job.error ){
+        cerr << "could not read: " << an_archive.node_pathname(job.ns->node) << " " << strerror(job.error) << endl;
+        problems++;
+      }else if( job.mis_signed ){
+        cerr << "mis-signed, not re-signed: " << an_archive.node_pathname(job.ns->node) << endl;
+        problems++;
+      }else{
+        job.ns->node_signature = job.current;
+        resigned++;
+      }
+    }
+    if( resigned != 0 && an_archive.commit() != Archive_Success ) RETURN Exit_InternalError;
+    if( verbose ) cout << "re-signed: " << resigned << " left: " << problems << endl;
+
+    if( problems != 0 ) RETURN Exit_ProblemsFound;
+  RETURN Exit_NoError;
+  }
@@ -0,0 +1,306 @@
+/*
+  similar [options] <archive> [<node> ...]
+
+  Near duplicate nodes, those whose contents are alike but not the same, see minhash.h.
+
+  The sketches in tax/sketches are first brought up to date, the nodes added since the last
+  run are read and sketched by a pool of threads, then the sketches are put in an LSH index.
+
+  Given nodes, the nodes near each of them are listed, most similar first.  Without, the
+  whole archive is put into clusters: the candidate pairs of each LSH bucket that reach the
+  threshold are joined, and every cluster of more than one node is listed, in node order.
+  Only pairs that share a bucket are ever compared.
+*/
+
+// before we start, a bit of Vogon poetry:
+//
+  const char *vogon_poetry = R"VOGON_POETRY(
+     similar [options] <archive> [<node> ...]
+
+    <archive> the archive to look in
+    <node>    list the nodes near these, otherwise list the clusters of near duplicates
+
+    options:
+
+      -h --help            this message
+      -v --verbose         progress information
+         --threshold <s>   estimated similarity, 0 to 1, for two nodes to be near, default 0.8
+         --threads <n>     threads sketching new nodes, default 4
+
+    output:
+
+      near: <node> <node> <similarity>
+      cluster: <node> <node> ...
+
+  )VOGON_POETRY";
+
+#include "types.h"
+
+// Program Termination Return Codes
+const uint Exit_NoError   =0;
+const uint Exit_BadParms  =1;
+const uint Exit_NoArchive =2;
+const uint Exit_NoNode =3;
+const uint Exit_InternalError =4;
+
+// for sterror and errno
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+// STL objects used
+#include <string>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <set>
+#include <list>
+#include <map>
+#include <algorithm>
+using namespace std;
+
+// local objects used
+#include "file.h"
+#include "directory.h"
+#include "taxonomy.h"
+#include "archive.h"
+#include "minhash.h"
+
+
+/*--------------------------------------------------------------------------------
+  union-find over node numbers, for the clusters
+*/
+  class node_clusters{
+  public:
+    size_t find(size_t node){
+      map<size_t ,size_t>::iterator it = parent.find(node);
+      if( it == parent.end() ){
+        parent[node] = node;
+        RETURN node;
+      }
+      if( it->second == node ) RETURN node;
+      size_t root = find(it->second);
+      it->second = root;
+      RETURN root;
+    }
+
+    void join(size_t a ,size_t b){
+      size_t root_a = find(a) ,root_b = find(b);
+      if( root_a == root_b ) RETURN;
+      if( root_b < root_a ) swap(root_a ,root_b);
+      parent[root_b] = root_a;  // the smallest node is the root
+    }
+
+    // the clusters of more than one node, each in node order, ordered by their first node
+    void list(vector<vector<size_t>> &clusters){
+      map<size_t ,vector<size_t>> by_root;
+      for( map<size_t ,size_t>::iterator it = parent.begin(); it != parent.end(); it++ ){
+        by_root[find(it->first)].push_back(it->first);
+      }
+      clusters.clear();
+      for( map<size_t ,vector<size_t>>::iterator it = by_root.begin(); it != by_root.end(); it++ ){
+        if( it->second.size() > 1 ) clusters.push_back(it->second);
+      }
+    }
+
+  protected:
+    map<size_t ,size_t> parent;
+  };
+
+  /*
+    joins the pairs of each bucket that reach 'threshold'
+
+    A bucket holding more than LSH_Bucket_Limit nodes, many small nodes alike in one band,
+    has each node compared against its first only, so the work stays linear in the bucket.
+    Pairs already in one cluster are not compared again.
+  */
+  void cluster(const sketch_store &store ,const lsh_index &index ,double threshold ,node_clusters &clusters){
+    for( uint b = 0; b < LSH_Bands; b++ ){
+      lsh_index::bucket_map::const_iterator bit;
+      for( bit = index.bands[b].begin(); bit != index.bands[b].end(); bit++ ){
+        const vector<size_t> &nodes = bit->second;
+        if( nodes.size() < 2 ) CONTINUE;
+        size_t firsts = nodes.size() > LSH_Bucket_Limit ? 1 : nodes.size() - 1;
+        for( size_t i = 0; i < firsts; i++ ){
+          const sketch &si = store.find(nodes[i])->second.s;
+          for( size_t j = i + 1; j < nodes.size(); j++ ){
+            if( clusters.find(nodes[i]) == clusters.find(nodes[j]) ) CONTINUE;
+            if( si.similarity(store.find(nodes[j])->second.s) >= threshold ) clusters.join(nodes[i] ,nodes[j]);
+          }
+        }
+      }
+    }
+  }
+
+
+/*--------------------------------------------------------------------------------
+
+   This is called from the shell. See the Vogon poetry at the top of this file for
+   the usage message.
+
+*/
+  int main(int argc ,char **argv){
+
+    //----------------------------------------
+    // parse options
+    //
+      list<char *> args;
+      bool verbose=false;
+      double threshold=0.8;
+      uint thread_count=4;
+      bool bad_parms=false;
+
+      if(argv == 0){
+        cerr << "serious problem here, argv was zero when the program was called" << endl;
+        RETURN Exit_InternalError;
+      }
+      if(argc == 1){
+        cerr << vogon_poetry;
+        RETURN Exit_BadParms;
+      }
+
+      for( argv++ ; *argv; argv++ ){
+        // check for options
+        //
+          if( (*argv)[0] == '-' ){
+            if( !strcmp(*argv, "-h") || !strcmp(*argv, "--help") ){
+              cout << vogon_poetry;
+              bad_parms=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "-v") || !strcmp(*argv, "--verbose") ){
+              verbose=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--threshold") ){
+              argv++;
+              char *end;
+              if( *argv ){
+                threshold = strtod(*argv ,&end);
+                if( *end == 0 && threshold > 0 && threshold <= 1 ) CONTINUE;
+              }
+              cerr << "expected a similarity greater than 0 and at most 1 after --threshold" << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--threads") ){
+              argv++;
+              char *end;
+              if( *argv ){
+                thread_count = strtoul(*argv ,&end ,10);
+                if( *end == 0 && thread_count != 0 ) CONTINUE;
+              }
+              cerr << "expected a count greater than zero after --threads" << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            bad_parms=true;
+            cerr << "unrecognized option: " << *argv << endl;
+            CONTINUE;
+          }
+
+        // if it isn't and option, it is an arg
+        //
+          args.push_back(*argv);
+          CONTINUE;
+      }
+    if( args.empty() ){
+      cerr << "need an archive argument" << endl;
+      bad_parms=true;
+    }
+    string arch_path;
+    vector<size_t> nodes;
+    if( !args.empty() ){
+      arch_path = args.front();
+      args.pop_front();
+      for( list<char *>::iterator it = args.begin(); it != args.end(); it++ ){
+        char *end;
+        size_t node = strtoul(*it ,&end ,10);
+        if( *end != 0 || **it == 0 ){
+          cerr << "not a node number: " << *it << endl;
+          bad_parms=true;
+          CONTINUE;
+        }
+        nodes.push_back(node);
+      }
+    }
+    if(bad_parms){
+      cerr << "errors when parsing parameters, nothing done" << endl;
+      RETURN Exit_BadParms;
+    }
+
+  //----------------------------------------
+  // load the taxonomy and bring the sketches up to date
+  //
+    archive an_archive;
+    if( !an_archive.open(arch_path ,false) ){
+      cerr << "not an archive: \"" << arch_path << "\"" << endl;
+      RETURN Exit_NoArchive;
+    }
+    if( verbose ) cout << "parsing taxonomy file: \"" << an_archive.taxonomy_pathname() << "\"" << endl;
+    if( an_archive.load() != Archive_Success ) RETURN Exit_InternalError;
+
+    string sketches_pathname = an_archive.tax_path + "/sketches";
+    sketch_store store;
+    if( !store.load(sketches_pathname) && verbose ) cout << "no sketches, every node is sketched" << endl;
+    size_t kept = store.size();
+    size_t unreadable;
+    size_t sketched = store.update(an_archive.a_nodes_map ,an_archive.store_path ,thread_count ,unreadable);
+    if( unreadable != 0 ) cerr << "node files that could not be read: " << unreadable << endl;
+    if( verbose ) cout << "nodes: " << an_archive.a_nodes_map.size() << " sketched: " << sketched << endl;
+    if( (sketched != 0 || store.size() != kept) && !store.write(sketches_pathname) ){
+      cerr << "could not write sketches: \"" << sketches_pathname << "\"" << endl;
+    }
+
+    lsh_index index;
+    index.build(store);
+    cout << fixed << setprecision(3);
+
+  //----------------------------------------
+  // the nodes near those given
+  //
+    if( !nodes.empty() ){
+      uint status = Exit_NoError;
+      for( size_t i = 0; i < nodes.size(); i++ ){
+        sketch_store::const_iterator it = store.find(nodes[i]);
+        if( it == store.end() ){
+          cerr << "no such node: " << nodes[i] << endl;
+          status = Exit_NoNode;
+          CONTINUE;
+        }
+        vector<pair<double ,size_t>> near;
+        vector<size_t> candidates = index.candidates(it->second.s);
+        for( size_t j = 0; j < candidates.size(); j++ ){
+          if( candidates[j] == nodes[i] ) CONTINUE;
+          double s = it->second.s.similarity(store.find(candidates[j])->second.s);
+          if( s >= threshold ) near.push_back(make_pair(-s ,candidates[j]));
+        }
+        sort(near.begin() ,near.end());
+        for( size_t j = 0; j < near.size(); j++ ){
+          cout << "near: " << nodes[i] << " " << near[j].second << " " << -near[j].first << endl;
+        }
+      }
+      RETURN status;
+    }
+
+  //----------------------------------------
+  // the clusters of the whole archive
+  //
+    node_clusters clusters;
+    cluster(store ,index ,threshold ,clusters);
+    vector<vector<size_t>> listed;
+    clusters.list(listed);
+    for( size_t i = 0; i < listed.size(); i++ ){
+      cout << "cluster:";
+      for( size_t j = 0; j < listed[i].size(); j++ ) cout << " " << listed[i][j];
+      cout << endl;
+    }
+    if( verbose ) cout << "clusters: " << listed.size() << endl;
+  RETURN Exit_NoError;
+  }
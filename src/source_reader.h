@@ -0,0 +1,292 @@
+#ifndef SOURCE_READER_H
+#define SOURCE_READER_H
+
+/*
+ defines classes:
+    io_options
+    source_read
+    source_reader
+
+  Brings the source files of an insert into memory, one source_image each, together with
+  their signatures, in the order of the file list.
+
+  The sync engine is what insert always did: open, read the file, sign it, close, one file at
+  a time and one call at a time.
+
+  The uring engine keeps 'depth' files in flight through an io_uring, see uring.h.  Opens
+  are queued for the files ahead, each file is read as its open completes, into a registered
+  buffer when it fits in one and one is free, and closed as its read completes.  Files are
+  still handed out in list order, so node numbers come out as with the sync engine.  A
+  file larger than Uring_LargeFile is left open and brought in by the sync engine when its
+  turn comes, so it is not read ahead, and the files being read ahead are held to
+  io_options::read_ahead bytes, Uring_ReadAhead unless --memory-cap sets less.  The file
+  being handed out is always read, however small the read ahead.
+
+  A file that gets shorter while it is read is skipped, see source_image::load().
+
+  With drop_cache, --no-cache-pollution, the page cache lets go of a source file once it is
+  read, see drop_cached() in file.h.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+
+// STL objects used
+#include <iostream>
+#include <string>
+#include <deque>
+#include <memory>
+using namespace std;
+
+// locally defined objects
+#include "types.h"
+#include "file.h"
+#include "directory.h"
+#include "node_writer.h"
+#include "uring.h"
+#include "stats.h"
+
+  const size_t Uring_LargeFile = 8 << 20;    // larger files are read by the sync engine, in their turn
+  const size_t Uring_ReadAhead = 64 << 20;   // bytes read ahead of the file being handed out
+  const size_t Uring_BufferSize = 64 << 10;  // size of each registered buffer
+
+
+/*--------------------------------------------------------------------------------
+  which engine, from the insert command line
+*/
+  class io_options{
+  public:
+    io_options(): uring(false),depth(64),read_ahead(Uring_ReadAhead),drop_cache(false){;}
+    bool uring;  // read and write through io_uring
+    uint depth;  // files in flight
+    size_t read_ahead;  // bytes of files read ahead of the one handed out
+    bool drop_cache;  // files read or written once are dropped from the page cache
+  };
+
+
+/*--------------------------------------------------------------------------------
+  one source file as handed out by the reader
+*/
+  class source_read{
+  public:
+    source_read(): record(0),error(0),loaded(false){;}
+    const file_record *record;
+    int error;    // errno when the file could not be opened, otherwise 0
+    bool loaded;  // the file was opened and read
+    signature source_signature;
+    shared_ptr<source_image> image;
+  };
+
+
+/*--------------------------------------------------------------------------------
+  hands out the files of a list, read by the engine chosen in 'io'
+*/
+  class source_reader{
+  public:
+    source_reader(const file_record_list &files ,const io_options &io)
+      :failed(false)
+      ,next_file(files.begin())
+      ,end_file(files.end())
+      ,depth(io.depth)
+      ,read_ahead(io.read_ahead)
+      ,drop_cache(io.drop_cache)
+      ,buffered(0)
+    {
+      if( !io.uring || !ring.open(2 * depth) ) RETURN;
+      buffers.reset(new uring_buffers);
+      if( !buffers->allocate(depth ,Uring_BufferSize) || !buffers->register_with(ring) ) buffers.reset();
+    }
+
+    // the kernel may still be reading into images of the window when the list is not finished
+    ~source_reader(){
+      struct io_uring_cqe cqe;
+      while( ring.is_open() && ring.in_flight > 0 && ring.submit(1) ){
+        while( ring.peek(cqe) ){
+          if( cqe.user_data == Close_Tag ) CONTINUE;
+          reading &a_reading = *(reading *)(uintptr_t)cqe.user_data;
+          if( !a_reading.opened && cqe.res >= 0 ) a_reading.fd = cqe.res;
+          a_reading.opened = true;
+        }
+      }
+      for( deque<reading>::iterator it = window.begin(); it != window.end(); it++ ){
+        if( it->fd != -1 ) close(it->fd);
+      }
+    }
+
+    bool failed;  // the ring gave an error, the files not yet handed out were not read
+
+    // the pool of registered buffers the images may be in, empty when there is none
+    shared_ptr<uring_buffers> registered_buffers() const{ RETURN buffers; }
+
+    // the next file of the list, false when there are no more
+    bool next(source_read &r){
+      r = source_read();
+      if( ring.is_open() ) RETURN next_uring(r);
+      if( next_file == end_file ) RETURN false;
+      r.record = &*next_file;
+      next_file++;
+      int fds = open_read(r.record->pathname);
+      if( fds == -1 ){
+        r.error = errno;
+        RETURN true;
+      }
+      load(fds ,r);
+      RETURN true;
+    }
+
+  protected:
+    // the sync engine, closes 'fds'
+    void load(int fds ,source_read &r){
+      STATS_TIMER(Phase_Sign);
+      r.image.reset(new source_image);
+      r.loaded = r.image->load(fds ,drop_cache);
+      if( r.loaded ) r.source_signature.sign(r.image->data ,r.image->size);
+      else r.source_signature.sign(fds);
+      close(fds);
+    }
+
+    class reading{
+    public:
+      reading(): record(0),fd(-1),size(0),done(0),error(0),opened(false),loaded(false),large(false),finished(false){;}
+      const file_record *record;
+      shared_ptr<source_image> image;
+      int fd;
+      size_t size;
+      size_t done;  // bytes read so far
+      int error;
+      bool opened;
+      bool loaded;
+      bool large;  // left open for the sync engine
+      bool finished;
+    };
+
+    bool next_uring(source_read &r){
+      fill();
+      if( window.empty() ) RETURN false;
+      {
+        STATS_TIMER(Phase_Sign);
+        while( !window.front().finished ){
+          if( !ring.submit(1) ){
+            cerr << "io_uring_enter: " << strerror(errno) << endl;
+            failed = true;
+            RETURN false;
+          }
+          reap();
+          fill();
+        }
+      }
+      reading &front = window.front();
+      r.record = front.record;
+      r.error = front.error;
+      if( front.large ){
+        load(front.fd ,r);
+      }else if( front.loaded ){
+        STATS_TIMER(Phase_Sign);
+        r.image = front.image;
+        r.source_signature.sign(front.image->data ,front.image->size);
+        r.loaded = true;
+      }
+      buffered -= front.size;
+      window.pop_front();
+      RETURN true;
+    }
+
+    // queues opens for the files ahead
+    void fill(){
+      while( next_file != end_file && window.size() < depth && (window.empty() || buffered < read_ahead) && ring.room() ){
+        window.push_back(reading());
+        reading &a_reading = window.back();
+        a_reading.record = &*next_file;
+        next_file++;
+        ring.prep_openat(a_reading.record->pathname.c_str() ,O_RDONLY ,0 ,(uint64_t)(uintptr_t)&a_reading);
+      }
+    }
+
+    // moves each reading that completed an operation on to its next one
+    void reap(){
+      struct io_uring_cqe cqe;
+      while( ring.peek(cqe) ){
+        if( cqe.user_data == Close_Tag ) CONTINUE;
+        reading &a_reading = *(reading *)(uintptr_t)cqe.user_data;
+        if( !a_reading.opened ){
+          opened(a_reading ,cqe.res);
+        }else if( cqe.res <= 0 ){  // an error, or the file got shorter since it was opened
+          finish(a_reading ,false);
+        }else{
+          a_reading.done += cqe.res;
+          if( a_reading.done < a_reading.size ) read(a_reading);
+          else finish(a_reading ,true);
+        }
+      }
+    }
+
+    void opened(reading &a_reading ,int result){
+      a_reading.opened = true;
+      if( result < 0 ){
+        a_reading.error = -result;
+        a_reading.finished = true;
+        RETURN;
+      }
+      a_reading.fd = result;
+      struct stat file_attributes;
+      if( fstat(a_reading.fd ,&file_attributes) == -1 ){
+        finish(a_reading ,false);
+        RETURN;
+      }
+      size_t size = file_attributes.st_size;
+      if( size > Uring_LargeFile ){
+        a_reading.large = true;
+        a_reading.finished = true;
+        RETURN;
+      }
+      a_reading.image.reset(new source_image);
+      if( size == 0 ){
+        finish(a_reading ,true);
+        RETURN;
+      }
+      int index = -1;
+      if( buffers && size <= buffers->buffer_size ) index = buffers->take();
+      if( index >= 0 ) a_reading.image->adopt(buffers ,index ,size);
+      else a_reading.image->allocate(size);
+      a_reading.size = size;
+      buffered += size;
+      read(a_reading);
+    }
+
+    void read(reading &a_reading){
+      size_t length = a_reading.size - a_reading.done;
+      if( length > Uring_IOMax ) length = Uring_IOMax;
+      const source_image &image = *a_reading.image;
+      ring.prep_rw(
+         IORING_OP_READ ,a_reading.fd ,image.data + a_reading.done ,length ,a_reading.done
+        ,image.buffer_index ,(uint64_t)(uintptr_t)&a_reading
+      );
+    }
+
+    void finish(reading &a_reading ,bool loaded){
+      a_reading.loaded = loaded;
+      a_reading.finished = true;
+      if( drop_cache ) drop_cached(a_reading.fd);
+      ring.prep_close(a_reading.fd ,Close_Tag);
+      a_reading.fd = -1;
+    }
+
+    static const uint64_t Close_Tag = ~(uint64_t)0;  // closes are not waited for
+
+    file_record_list::const_iterator next_file;
+    file_record_list::const_iterator end_file;
+    uint depth;
+    size_t read_ahead;
+    bool drop_cache;
+    uring ring;
+    shared_ptr<uring_buffers> buffers;
+    deque<reading> window;  // files in flight, in list order
+    size_t buffered;  // bytes of the files in the window
+  };
+
+#endif
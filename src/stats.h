@@ -0,0 +1,177 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ defines classes:
+    run_stats
+    stats_timer
+
+ defines macros:
+    STATS_TIMER(phase)     times the rest of the enclosing block as 'phase'
+    STATS_ADD(counter ,n)  adds n to 'counter'
+    STATS_OPEN(pathname ,interval)  sends the stats to 'pathname', "-" for stderr
+    STATS_TICK()           emits the stats if 'interval' seconds have passed since the last
+    STATS_FINISH()         emits the final stats
+
+  Per phase timing and counters for a run of a program, insert in particular.  Timers read
+  CLOCK_MONOTONIC, and phases and counters are atomics so the writer threads can add to them.
+  The stats go out as one JSON object per line, periodically while running and once at the
+  end with "final": true.
+
+  All of it is compiled only when STATS is defined, see the makefile.  Without it the macros
+  expand to nothing, so the instrumentation costs nothing in a build that does not want it.
+*/
+
+#ifdef STATS
+
+#include <time.h>
+#include <stdint.h>
+
+// STL objects used
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <atomic>
+#include <mutex>
+using namespace std;
+
+// locally defined objects
+#include "types.h"
+
+  const uint Phase_Parse = 0;     // taxonomy parse and index load
+  const uint Phase_Traverse = 1;  // directory traversal
+  const uint Phase_Sign = 2;      // signature::sign of source files, and the strong hashes of new nodes
+  const uint Phase_Find = 3;      // looking a source file up in an archive, includes same()
+  const uint Phase_Same = 4;      // comparing a source file with a candidate node
+  const uint Phase_Copy = 5;      // writing node files
+  const uint Phase_Print = 6;     // printing the taxonomy and the indexes
+  const uint Phase_Rev = 7;       // the delta of the old taxonomy, and moving the new one into place
+  const uint Phase_Count = 8;
+
+  const char *phase_names[Phase_Count] = {
+    "parse" ,"traverse" ,"sign" ,"find" ,"same" ,"copy" ,"print" ,"rev"
+  };
+
+  const uint Count_Examined = 0;      // source files looked at
+  const uint Count_Inserted = 1;      // nodes created
+  const uint Count_BytesRead = 2;     // source and node bytes read
+  const uint Count_BytesWritten = 3;  // node bytes written
+  const uint Count_Candidates = 4;    // nodes with the same signature as a source file
+  const uint Count_SameCalls = 5;     // same() comparisons made
+  const uint Count_SameFalse = 6;     // same() comparisons that found a difference, signature collisions
+  const uint Count_BloomRejects = 7;  // lookups the Bloom filter answered as new content, see bloom.h
+  const uint Count_BloomFalse = 8;    // lookups the Bloom filter passed that found no node, false positives
+  const uint Count_BloomBytes = 9;    // memory held by the Bloom filters
+  const uint Count_RunDuplicates = 10;  // source files found to be a node created in this run, by strong hash
+  const uint Count_Count = 11;
+
+  const char *counter_names[Count_Count] = {
+    "examined" ,"inserted" ,"bytes_read" ,"bytes_written" ,"candidates" ,"same_calls" ,"same_false"
+    ,"bloom_rejects" ,"bloom_false_positives" ,"bloom_bytes" ,"run_duplicates"
+  };
+
+  uint64_t monotonic_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC ,&ts);
+    RETURN (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+
+  class run_stats{
+  public:
+    run_stats(): interval_ns(0),os(0){
+      start_ns = last_emit_ns = monotonic_ns();
+      for( uint k = 0; k < Phase_Count; k++ ){ phase_ns[k] = 0; phase_calls[k] = 0; }
+      for( uint k = 0; k < Count_Count; k++ ) counters[k] = 0;
+    }
+
+    atomic<uint64_t> phase_ns[Phase_Count];
+    atomic<uint64_t> phase_calls[Phase_Count];
+    atomic<uint64_t> counters[Count_Count];
+
+    bool open(const string &pathname ,double interval){
+      interval_ns = interval * 1e9;
+      if( pathname == "-" ){
+        os = &cerr;
+        RETURN true;
+      }
+      file.open(pathname);
+      if( !file.good() ) RETURN false;
+      os = &file;
+      RETURN true;
+    }
+
+    void tick(){
+      if( os == 0 || interval_ns == 0 ) RETURN;
+      uint64_t now = monotonic_ns();
+      if( now - last_emit_ns < interval_ns ) RETURN;
+      last_emit_ns = now;
+      emit(false);
+    }
+
+    void emit(bool final){
+      if( os == 0 ) RETURN;
+      lock_guard<mutex> lock(guard);
+      *os << "{\"final\": " << (final ? "true" : "false")
+          << ", \"elapsed_s\": " << (monotonic_ns() - start_ns) * 1e-9
+          << ", \"phases\": {";
+      for( uint k = 0; k < Phase_Count; k++ ){
+        if( k != 0 ) *os << ", ";
+        *os << "\"" << phase_names[k] << "\": {\"seconds\": " << phase_ns[k] * 1e-9
+            << ", \"calls\": " << phase_calls[k] << "}";
+      }
+      *os << "}, \"counters\": {";
+      for( uint k = 0; k < Count_Count; k++ ){
+        if( k != 0 ) *os << ", ";
+        *os << "\"" << counter_names[k] << "\": " << counters[k];
+      }
+      // of the lookups for content not in the archive, the share the filter let through
+      uint64_t absent = counters[Count_BloomRejects] + counters[Count_BloomFalse];
+      *os << "}, \"bloom_fpr\": " << (absent ? (double)counters[Count_BloomFalse] / absent : 0.0);
+      // of the full comparisons made, the share that a signature match sent there for nothing
+      uint64_t compared = counters[Count_SameCalls];
+      *os << ", \"collision_rate\": " << (compared ? (double)counters[Count_SameFalse] / compared : 0.0);
+      *os << "}" << endl;
+    }
+
+  protected:
+    uint64_t start_ns;
+    uint64_t last_emit_ns;
+    uint64_t interval_ns;
+    ostream *os;  // 0 when no stats were asked for
+    ofstream file;
+    mutex guard;
+  };
+
+  run_stats the_stats;
+
+  class stats_timer{
+  public:
+    stats_timer(uint phase): phase(phase),start_ns(monotonic_ns()){;}
+    ~stats_timer(){
+      the_stats.phase_ns[phase] += monotonic_ns() - start_ns;
+      the_stats.phase_calls[phase]++;
+    }
+  private:
+    uint phase;
+    uint64_t start_ns;
+  };
+
+  #define STATS_CONCAT_(a ,b) a##b
+  #define STATS_CONCAT(a ,b) STATS_CONCAT_(a ,b)
+  #define STATS_TIMER(phase) stats_timer STATS_CONCAT(a_stats_timer_ ,__LINE__)(phase)
+  #define STATS_ADD(counter ,n) (the_stats.counters[counter] += (n))
+  #define STATS_OPEN(pathname ,interval) the_stats.open(pathname ,interval)
+  #define STATS_TICK() the_stats.tick()
+  #define STATS_FINISH() the_stats.emit(true)
+
+#else
+
+  #define STATS_TIMER(phase)
+  #define STATS_ADD(counter ,n)
+  #define STATS_OPEN(pathname ,interval) (cerr << "built without STATS, no stats will be written" << endl ,true)
+  #define STATS_TICK()
+  #define STATS_FINISH()
+
+#endif
+
+#endif
@@ -0,0 +1,322 @@
+/*
+  synch <archive1> <archive2>
+
+  Causes both archives to have the same entries.
+
+  The node keys, (size, signature), of both taxonomies are sorted and merge joined.  A node
+  found on only one side has its node file transferred to the other archive under a newly
+  allocated node number, see transfer() in file.h.  Nodes found on both sides have their
+  source phrases unioned.  Node files are only read when a match is ambiguous (more than
+  one node on a side shares the key), when a key is a head signature, see file.h and
+  node_key.h, or when --compare is given.  So for archives signed Sign_Regions the node data read and moved is
+  proportional to the difference between the archives, not to their size.  The rest of the
+  work still grows with the archives: both taxonomies are parsed, and the key sizes come
+  from a stat of every node file on both sides, see node_key_list::build().
+
+*/
+
+// before we start, a bit of Vogon poetry:
+//
+  const char *vogon_poetry = R"VOGON_POETRY(
+     synch [options] <archive1> <archive2>
+
+    <archive1> <archive2> the names of the archives to synchronize
+
+    options:
+
+      -h --help            this message
+      -n --dry-run         report what would be transferred, change nothing
+      -v --verbose         progress information, and each node transferred
+         --compare         confirm every (size, signature) match by comparing the node files
+
+    exits with 6 when another program holds one of the archives
+
+  )VOGON_POETRY";
+
+#include "types.h"
+
+// Program Termination Return Codes
+const uint Exit_NoError   =0;
+const uint Exit_BadParms  =1;
+const uint Exit_NoArchive =2;
+const uint Exit_InternalError =4;
+const uint Exit_FileCreationError =5;
+const uint Exit_ArchiveBusy =6;
+
+// for sterror and errno
+#include <errno.h>
+#include <string.h>
+
+// STL objects used
+#include <string>
+#include <fstream>
+#include <vector>
+#include <set>
+#include <list>
+using namespace std;
+
+// local objects used
+#include "file.h"
+#include "directory.h"
+#include "taxonomy.h"
+#include "archive.h"
+#include "node_key.h"
+
+
+/*--------------------------------------------------------------------------------
+  the plan produced by the merge join
+*/
+  class synch_plan{
+  public:
+    list< pair<size_t ,size_t> > matched;  // (node in archive 0, node in archive 1)
+    list<size_t> only_in[2];  // nodes to be transferred to the other archive
+
+    /*
+      Matches the nodes of two groups that share a key.  When each side has exactly one node
+      and both are signed Sign_Regions the key is taken as identity, unless 'compare' is set.
+      Otherwise each pair is compared.  A Sign_Head key is never identity: files of one size
+      that share a header, disk images and zip files, have the same head signature.
+    */
+    void match_group(
+       const archive &a0 ,node_key_list::const_iterator first0 ,node_key_list::const_iterator last0
+      ,const archive &a1 ,node_key_list::const_iterator first1 ,node_key_list::const_iterator last1
+      ,bool compare
+    ){
+      if( !compare && last0 - first0 == 1 && last1 - first1 == 1
+        && first0->node_signature.kind != Sign_Head && first1->node_signature.kind != Sign_Head
+      ){
+        matched.push_back(pair<size_t ,size_t>(first0->node ,first1->node));
+        RETURN;
+      }
+      set<size_t> taken;  // nodes of archive 1 already matched
+      for( node_key_list::const_iterator i = first0; i != last0; i++ ){
+        node_key_list::const_iterator j = first1;
+        while( j != last1 ){
+          if( taken.find(j->node) == taken.end() && same_nodes(a0.node_pathname(i->node) ,a1.node_pathname(j->node)) ) BREAK;
+        j++;
+        }
+        if( j == last1 ){
+          only_in[0].push_back(i->node);
+          CONTINUE;
+        }
+        taken.insert(j->node);
+        matched.push_back(pair<size_t ,size_t>(i->node ,j->node));
+      }
+      for( node_key_list::const_iterator j = first1; j != last1; j++ ){
+        if( taken.find(j->node) == taken.end() ) only_in[1].push_back(j->node);
+      }
+    }
+
+    void join(const archive &a0 ,const node_key_list &keys0 ,const archive &a1 ,const node_key_list &keys1 ,bool compare){
+      node_key_list::const_iterator i = keys0.begin();
+      node_key_list::const_iterator j = keys1.begin();
+      while( i != keys0.end() && j != keys1.end() ){
+        if( i->key_less(*j) ){
+          only_in[0].push_back(i->node);
+          i++;
+          CONTINUE;
+        }
+        if( j->key_less(*i) ){
+          only_in[1].push_back(j->node);
+          j++;
+          CONTINUE;
+        }
+        node_key_list::const_iterator i_end = keys0.group_end(i);
+        node_key_list::const_iterator j_end = keys1.group_end(j);
+        match_group(a0 ,i ,i_end ,a1 ,j ,j_end ,compare);
+        i = i_end;
+        j = j_end;
+      }
+      for( ; i != keys0.end(); i++ ) only_in[0].push_back(i->node);
+      for( ; j != keys1.end(); j++ ) only_in[1].push_back(j->node);
+    }
+  };
+
+
+/*--------------------------------------------------------------------------------
+  copies a node from one archive to the other under a new node number
+*/
+  const uint Synch_Success = 0;
+  const uint Synch_AllocFail = 1;
+  const uint Synch_TransferFail = 2;
+
+  uint transfer_node(const archive &from ,size_t node ,archive &to ,bool verbose){
+    node_set ns = from.a_nodes_map.find(node)->second;
+    if( !to.nna.alloc(ns.node) ){
+      cerr << "could not allocate a new node number in: " << to.path << endl;
+      RETURN Synch_AllocFail;
+    }
+    if( !transfer(from.node_pathname(node) ,to.node_pathname(ns.node)) ){
+      cerr << "could not transfer node: " << from.node_pathname(node) << " to: " << to.node_pathname(ns.node) << endl;
+      cerr << strerror(errno) << endl;
+      unlink(to.node_pathname(ns.node).c_str());
+      to.nna.dealloc(ns.node);
+      RETURN Synch_TransferFail;
+    }
+    if( verbose ) cout << "transferred " << from.node_pathname(node) << " to " << to.node_pathname(ns.node) << endl;
+    to.a_nodes_map.insert(pair<size_t ,node_set>(ns.node ,ns));
+    RETURN Synch_Success;
+  }
+
+
+/*--------------------------------------------------------------------------------
+
+   This is called from the shell. See the Vogon poetry at the top of this file for
+   the usage message.
+
+*/
+  int main(int argc ,char **argv){
+
+    //----------------------------------------
+    // parse options
+    //
+      list<char *> args;
+      bool verbose=false;
+      bool dry_run=false;
+      bool compare=false;
+      bool bad_parms=false;
+
+      if(argv == 0){
+        cerr << "serious problem here, argv was zero when the program was called" << endl;
+        RETURN Exit_InternalError;
+      }
+      if(argc == 1){
+        cerr << vogon_poetry;
+        RETURN Exit_BadParms;
+      }
+
+      for( argv++ ; *argv; argv++ ){
+        // check for options
+        //
+          if( (*argv)[0] == '-' ){
+            if( !strcmp(*argv, "-h") || !strcmp(*argv, "--help") ){
+              cout << vogon_poetry;
+              bad_parms=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "-n") || !strcmp(*argv, "--dry-run") ){
+              dry_run=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "-v") || !strcmp(*argv, "--verbose") ){
+              verbose=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--compare") ){
+              compare=true;
+              CONTINUE;
+            }
+
+            bad_parms=true;
+            cerr << "unrecognized option: " << *argv << endl;
+            CONTINUE;
+          }
+
+        // if it isn't and option, it is an arg
+        //
+          args.push_back(*argv);
+          CONTINUE;
+      }
+    if(bad_parms){
+      cerr << "errors when parsing parameters, nothing done" << endl;
+      RETURN Exit_BadParms;
+    }
+    if( args.size() != 2 ){
+      cerr << "need two arguments, but found " << args.size() << " argument";
+      if(args.size() != 1)  cerr << "s";
+      cerr << endl;
+      RETURN Exit_BadParms;
+    }
+
+  //----------------------------------------
+  // load both taxonomies and their node keys
+  //
+    archive archives[2];
+    node_key_list keys[2];
+    for( uint k = 0; k < 2; k++ ){
+      string arch_path = k == 0 ? args.front() : args.back();
+      if( !archives[k].open(arch_path ,false) ){
+        cerr << "not an archive: \"" << arch_path << "\"" << endl;
+        RETURN Exit_NoArchive;
+      }
+      if( !archives[k].lock() ) RETURN Exit_ArchiveBusy;
+      if( archives[k].load() != Archive_Success ) RETURN Exit_InternalError;
+    }
+    // one file signed by its head in one archive and otherwise in the other meets only on its head signature
+    bool by_head = node_key_list::has_head_signed(archives[0].a_nodes_map) || node_key_list::has_head_signed(archives[1].a_nodes_map);
+    if( by_head ) cerr << "nodes signed by their head only, see resign: the archives are joined on head signatures and every match is read" << endl;
+    for( uint k = 0; k < 2; k++ ){
+      keys[k].build(archives[k].store_path ,archives[k].a_nodes_map ,by_head);
+      if( verbose ) cout << archives[k].path << ": " << keys[k].size() << " nodes" << endl;
+    }
+
+  //----------------------------------------
+  // merge join
+  //
+    synch_plan plan;
+    plan.join(archives[0] ,keys[0] ,archives[1] ,keys[1] ,compare);
+    if( verbose || dry_run ){
+      cout << "matched: " << plan.matched.size()
+           << " only in " << archives[0].path << ": " << plan.only_in[0].size()
+           << " only in " << archives[1].path << ": " << plan.only_in[1].size()
+           << endl;
+    }
+    if( dry_run ){
+      for( uint k = 0; k < 2; k++ ){
+        list<size_t>::const_iterator it = plan.only_in[k].begin();
+        while( it != plan.only_in[k].end() ){
+          cout << "transfer " << archives[k].node_pathname(*it) << " to " << archives[1-k].store_path << endl;
+        it++;
+        }
+      }
+      RETURN Exit_NoError;
+    }
+
+  //----------------------------------------
+  // union the source phrases of matched nodes
+  //
+    bool changed[2] = {false ,false};
+    list< pair<size_t ,size_t> >::const_iterator mit = plan.matched.begin();
+    while( mit != plan.matched.end() ){
+      node_set &ns0 = archives[0].a_nodes_map.find(mit->first)->second;
+      node_set &ns1 = archives[1].a_nodes_map.find(mit->second)->second;
+      if( ns0.union_sources(ns1) ) changed[0] = true;
+      if( ns1.union_sources(ns0) ) changed[1] = true;
+    mit++;
+    }
+
+  //----------------------------------------
+  // transfer the nodes missing on either side
+  //
+    uint errors = 0;
+    for( uint k = 0; k < 2; k++ ){
+      list<size_t>::const_iterator it = plan.only_in[k].begin();
+      while( it != plan.only_in[k].end() ){
+        if( transfer_node(archives[k] ,*it ,archives[1-k] ,verbose) == Synch_Success ) changed[1-k] = true;
+        else errors++;
+      it++;
+      }
+    }
+
+  //----------------------------------------
+  // commit the taxonomies that changed
+  //
+    for( uint k = 0; k < 2; k++ ){
+      if( !changed[k] ) CONTINUE;
+      if( verbose ) cout << "writing nodes_map back to: " << archives[k].taxonomy_pathname() << endl;
+      if( archives[k].commit() != Archive_Success ){
+        cerr << "could not commit the taxonomy of: " << archives[k].path << endl;
+        RETURN Exit_FileCreationError;
+      }
+    }
+
+    if( errors != 0 ){
+      cerr << errors << " nodes could not be transferred, run synch again once the cause is fixed" << endl;
+      RETURN Exit_InternalError;
+    }
+
+  RETURN Exit_NoError;
+  }
@@ -6,6 +6,8 @@
 /*
  defines classes:
     node_set
+    taxonomy_text
+    node_set_scanner
 
  provides functions:
    parser for nodes_map 
@@ -27,11 +29,13 @@
 
 // STL objects used
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <sstream>
 #include <list>
 #include <set>
 #include <map>
+#include <memory>
 
 
 // locally defined objects
@@ -54,6 +58,8 @@ using namespace std;
 */
   class node_set {
   public:
+    node_set(): lazy(false),text_offset(0),text_length(0){;}
+
     size_t node;  // file name in store according to the node phrase of the node_set
     time_t mtime; // modify time for the node according to the node phrase
     signature node_signature;  // checksum for the node according to the node phrase
@@ -61,11 +67,19 @@ using namespace std;
     file_record_list sources;  // the source phrases from this node_set
     list<phrase> other_phrases;
 
+    // set by nodes_map::index(), the sources and other phrases are still in the taxonomy file
+    bool lazy;
+    off_t text_offset;  // where the node set starts in that file
+    size_t text_length;  // up to the next node phrase, blank lines included
+
     void clear(){
       node=0;
       mtime=0;
       sources.clear();
       other_phrases.clear();
+      lazy=false;
+      text_offset=0;
+      text_length=0;
     }
 
     void print(ostream &os) const{
@@ -88,6 +102,13 @@ using namespace std;
         node_signature.print(node_signature_stream);
         a_phrase.push_back(node_signature_stream.str());
 
+        // head signatures are from before kinds were recorded, their phrases are left as they were
+        if( node_signature.kind != Sign_Head ){
+          stringstream kind_stream;
+          kind_stream << node_signature.kind;
+          a_phrase.push_back(kind_stream.str());
+        }
+
         a_phrase.print(os);
 
       // then print the source phrases:
@@ -138,7 +159,8 @@ using namespace std;
       stringstream ss;
 
       // phrase set must start with a node phrase
-      //    # node # <number> # <mtime> # <signature> ; the last three fields constitute a file descriptor
+      //    # node # <number> # <mtime> # <signature> [# <kind>] ; the fields after the number constitute a file descriptor
+      //    the kind is left out for Sign_Head signatures, see file.h
       //
         if( (stat=getphraseline(is ,lineno ,input_filename ,phrase_stream ,data_stream)) != ParseStatus::Found ){
           RETURN stat; 
@@ -146,30 +168,8 @@ using namespace std;
 
         lineno++;
         stat = a_phrase.parse(phrase_stream ,data_stream ,input_filename ,lineno ,err);
-        phrase::iterator pit = a_phrase.first();
-        if( stat != ParseStatus::Found || a_phrase.size() != 4 || *pit != string("node")){
-          if( stat != ParseStatus::Found) cerr << err.str();
-          cerr << input_filename << ":" << lineno << " malformed nodes_map, first phrase is not a node phrase" << endl;
-          RETURN ParseStatus::Malformed;
-        }
-        pit++;
-        ss.clear();
-        ss.str(*pit);
-        if( !(ss >> node) ){
-          cerr << input_filename << ":" << lineno << " malformed node number field in node phrase" << endl;
-          RETURN ParseStatus::Malformed;
-        }
-        pit++;
-        ss.clear();
-        ss.str(*pit);
-        if( !(ss >> mtime) ){
-          cerr << input_filename << ":" << lineno << " malformed mtime field in node phrase" << endl;
-          RETURN ParseStatus::Malformed;
-        }
-
-        pit++;
-        if( !node_signature.parse(*pit) ){
-          cerr << input_filename << ":" << lineno << " malformed signature field in node phrase" << endl;
+        if( stat != ParseStatus::Found ) cerr << err.str();
+        if( stat != ParseStatus::Found || parse_node_phrase(a_phrase ,input_filename ,lineno) != ParseStatus::Found ){
           RETURN ParseStatus::Malformed;
         }
 
@@ -229,12 +229,210 @@ using namespace std;
         RETURN ParseStatus::Found;
     }
 
+    // node, mtime, and signature, from 'a_phrase', a node phrase
+    ParseStatus parse_node_phrase(const phrase &a_phrase ,const string &input_filename ,size_t lineno){
+      stringstream ss;
+      phrase::const_iterator pit = a_phrase.begin();
+      if( (a_phrase.size() != 4 && a_phrase.size() != 5) || *pit != string("node")){
+        cerr << input_filename << ":" << lineno << " malformed nodes_map, first phrase is not a node phrase" << endl;
+        RETURN ParseStatus::Malformed;
+      }
+      pit++;
+      ss.str(*pit);
+      if( !(ss >> node) ){
+        cerr << input_filename << ":" << lineno << " malformed node number field in node phrase" << endl;
+        RETURN ParseStatus::Malformed;
+      }
+      pit++;
+      ss.clear();
+      ss.str(*pit);
+      if( !(ss >> mtime) ){
+        cerr << input_filename << ":" << lineno << " malformed mtime field in node phrase" << endl;
+        RETURN ParseStatus::Malformed;
+      }
+      pit++;
+      if( !node_signature.parse(*pit) ){
+        cerr << input_filename << ":" << lineno << " malformed signature field in node phrase" << endl;
+        RETURN ParseStatus::Malformed;
+      }
+      pit++;
+      node_signature.kind = Sign_Head;
+      if( pit != a_phrase.end() ){
+        ss.clear();
+        ss.str(*pit);
+        if( !(ss >> node_signature.kind) || node_signature.kind > Sign_Current ){
+          cerr << input_filename << ":" << lineno << " malformed or unknown signature kind in node phrase" << endl;
+          RETURN ParseStatus::Malformed;
+        }
+      }
+      RETURN ParseStatus::Found;
+    }
+
+    /*
+      for two node sets that describe identical files, possibly in different archives
+      adds the source phrases 'from' has that this one does not, and keeps the earlier mtime
+      returns true if this node set was changed
+    */
+    bool union_sources(const node_set &from){
+      bool changed = false;
+      file_record_list::const_iterator it = from.sources.begin();
+      while( it != from.sources.end() ){
+        if( sources.insert(*it).second ) changed = true;
+      it++;
+      }
+      if( from.mtime < mtime ){
+        mtime = from.mtime;
+        changed = true;
+      }
+      RETURN changed;
+    }
+
     // node numbers are unique
     bool operator < (const node_set &other) const {
       RETURN node < other.node;
     }
   };
 
+/*--------------------------------------------------------------------------------
+  a taxonomy file held open for the node sets indexed from it
+*/
+  class taxonomy_text{
+  public:
+    taxonomy_text(const string &a_pathname): pathname(a_pathname){
+      fd = open_read(pathname);
+    }
+    ~taxonomy_text(){
+      if( fd != -1 ) close(fd);
+    }
+
+    string pathname;
+    int fd;
+
+    bool read(off_t offset ,size_t length ,string &text) const{
+      text.resize(length);
+      size_t done = 0;
+      while( done < length ){
+        ssize_t n = pread(fd ,&text[done] ,length - done ,offset + done);
+        if( n <= 0 ) RETURN false;
+        done += n;
+      }
+      RETURN true;
+    }
+
+    bool copy(ostream &os ,off_t offset ,size_t length) const{
+      char buff[64 * 1024];
+      size_t done = 0;
+      while( done < length ){
+        size_t want = length - done < sizeof(buff) ? length - done : sizeof(buff);
+        ssize_t n = pread(fd ,buff ,want ,offset + done);
+        if( n <= 0 ) RETURN false;
+        os.write(buff ,n);
+        done += n;
+      }
+      RETURN os.good();
+    }
+
+  private:
+    taxonomy_text(const taxonomy_text &);
+    taxonomy_text &operator = (const taxonomy_text &);
+  };
+
+/*--------------------------------------------------------------------------------
+  splits a taxonomy into node sets by their node phrases, without parsing the other phrases
+
+  next() gives the node phrase of each node set, where the set is in the file, and when asked
+  for, its text as it is in the file: the node phrase line and every line after it up to the
+  next node phrase.  Lines before the first node phrase belong to no node set and are passed
+  over, as are those after a node phrase that does not parse.
+
+  A scanner may be started part way into the file, 'start_offset' is then where the stream
+  has been positioned, so that the node sets it gives are placed in the file.
+*/
+  class node_set_scanner{
+  public:
+    node_set_scanner(istream &a_is ,const string &a_pathname ,off_t start_offset = 0)
+      :misparse_count(0),is(a_is),pathname(a_pathname),lineno(0),offset(start_offset),pending(false){;}
+
+    uint misparse_count;  // node phrases that did not parse
+
+    bool next(node_set &ns ,string *text){
+      bool found = false;
+      if( text ) text->clear();
+      if( pending ){
+        ns = pending_set;
+        if( text ) *text = line_text;
+        pending = false;
+        found = true;
+      }
+      off_t line_offset;
+      while( read_line(line_offset) ){
+        if( !node_line ){
+          if( found && text ) text->append(line_text);
+          CONTINUE;
+        }
+        pending_set.clear();
+        bool parsed = pending_set.parse_node_phrase(a_phrase ,pathname ,lineno) == ParseStatus::Found;
+        if( !parsed ){
+          misparse_count++;
+          cerr << pathname << ":" << lineno << " misparsed nodeset skipped" << endl;
+        }
+        pending_set.text_offset = line_offset;
+        if( found ){
+          ns.text_length = line_offset - ns.text_offset;
+          pending = parsed;
+          RETURN true;
+        }
+        if( parsed ){
+          ns = pending_set;
+          if( text ) *text = line_text;
+          found = true;
+        }
+      }
+      if( found ) ns.text_length = offset - ns.text_offset;
+      RETURN found;
+    }
+
+  private:
+    // the next line, and its data line when it has a top control, into line_text
+    bool read_line(off_t &line_offset){
+      string line;
+      line_offset = offset;
+      if( !getline(is ,line) ) RETURN false;
+      lineno++;
+      line_text = line;
+      if( !is.eof() ) line_text += '\n';  // the last line may have no newline
+      string data_line;
+      if( !line.empty() && line[0] == '.' && getline(is ,data_line) ){
+        lineno++;
+        line_text += data_line;
+        if( !is.eof() ) line_text += '\n';
+      }
+      offset += line_text.size();
+
+      // only a line that mentions a node can be a node phrase, the others are not parsed
+      node_line = false;
+      if( line.find("node") == string::npos && data_line.find("node") == string::npos ) RETURN true;
+      stringstream phrase_stream(line);
+      stringstream data_stream(data_line);
+      stringstream err;
+      a_phrase.clear();
+      node_line =
+        a_phrase.parse(phrase_stream ,data_stream ,pathname ,lineno ,err) == ParseStatus::Found
+        && a_phrase.front() == string("node");
+      RETURN true;
+    }
+
+    istream &is;
+    string pathname;
+    size_t lineno;
+    off_t offset;  // of the next line
+    string line_text;
+    bool node_line;  // line_text is a node phrase, parsed into a_phrase
+    phrase a_phrase;
+    node_set pending_set;  // read while looking for the end of the node set before it
+    bool pending;
+  };
+
 /*--------------------------------------------------------------------------------
   
   Parses a taxonomy file into a map, where the key to the map is the node number (which is
@@ -243,6 +441,17 @@ using namespace std;
 
   This is the top level parse for a taxonomy file.
 
+  index() is the lazy alternative to parse(): only the node phrases are parsed, which is all
+  that finding a source file among the nodes needs, and each node set remembers where it is
+  in the file.  load() parses the sources of one node set when it is to be looked at or
+  changed, and print() copies the node sets that were never loaded from the file as they
+  are, so most of the taxonomy goes from one file to the next without being parsed.  The
+  file is held open for as long as the map needs it.
+
+  open() and seek() are for a caller that wants only a few node sets: print() writes the node
+  sets in node number order, so one is found by a binary search over the file rather than
+  by indexing all of them.
+
   --compares might go faster if we mapped the node size rather than the node number ..
 */
   class nodes_map : public map<size_t ,node_set>{
@@ -251,12 +460,121 @@ using namespace std;
     void print(ostream &os){
       iterator it = begin();
       while(it != end()){
+        if( it->second.lazy ){  // node sets that follow one another in the file go in one copy
+          off_t offset = it->second.text_offset;
+          size_t length = it->second.text_length;
+          it++;
+          while( it != end() && it->second.lazy && it->second.text_offset == offset + (off_t)length ){
+            length += it->second.text_length;
+          it++;
+          }
+          if( !text->copy(os ,offset ,length) ) os.setstate(ios::badbit);
+          CONTINUE;
+        }
         it->second.print(os);
         os << endl;
       it++;
       }
     };
 
+    /*
+      the node phrases of the taxonomy at 'nodes_map_file_path', see above
+      returns NotFound when the file can not be opened
+    */
+    ParseStatus index(const string &nodes_map_file_path){
+      clear();
+      text.reset(new taxonomy_text(nodes_map_file_path));
+      ifstream is(nodes_map_file_path);
+      if( text->fd == -1 || !is.good() ) RETURN ParseStatus::NotFound;
+      node_set_scanner scanner(is ,nodes_map_file_path);
+      node_set a_node_set;
+      while( scanner.next(a_node_set ,0) ){
+        a_node_set.lazy = true;
+        insert(pair<size_t ,node_set>(a_node_set.node ,a_node_set));  // as with parse(), the first of a node number is kept
+      }
+      if( scanner.misparse_count == 0 ) RETURN ParseStatus::Found;
+      RETURN ParseStatus::Malformed;
+    }
+
+    // holds the taxonomy at 'nodes_map_file_path' open for seek(), nothing is read
+    bool open(const string &nodes_map_file_path){
+      clear();
+      text.reset(new taxonomy_text(nodes_map_file_path));
+      RETURN text->fd != -1;
+    }
+
+    /*
+      finds the node set of 'node' in the open taxonomy and adds it to the map unloaded, as
+      index() would, see load()
+
+      The search relies on the node sets being in node number order.  It returns false when
+      the node set is not found that way, either it is not there or the file is out of order, and
+      the caller should index() the file instead.
+    */
+    bool seek(size_t node){
+      struct stat st;
+      if( fstat(text->fd ,&st) == -1 ) RETURN false;
+      ifstream is(text->pathname);
+      if( !is.good() ) RETURN false;
+      node_set ns;
+      off_t lo = 0;  // where a node set starts, those before it have lesser node numbers
+      off_t hi = st.st_size;  // the node set is at or after lo and starts before hi
+      while( lo < hi ){
+        off_t mid = lo + (hi - lo) / 2;
+        off_t start = mid;
+        is.clear();
+        is.seekg(mid > lo ? mid - 1 : lo);
+        if( mid > lo ){  // to the start of the line after the one mid falls in
+          string skipped;
+          if( getline(is ,skipped) && !is.eof() ) start = is.tellg();
+          else start = hi;  // mid is in the last line
+        }
+        node_set_scanner scanner(is ,text->pathname ,start);
+        if( start >= hi || !scanner.next(ns ,0) || ns.text_offset >= hi ) BREAK;  // none start after mid
+        if( ns.node == node ) RETURN found(ns);
+        if( ns.node < node ) lo = ns.text_offset + ns.text_length;
+        else hi = ns.text_offset;
+      }
+
+      // the node sets between lo and hi are walked
+      is.clear();
+      is.seekg(lo);
+      node_set_scanner scanner(is ,text->pathname ,lo);
+      while( lo < hi && scanner.next(ns ,0) && ns.text_offset < hi && ns.node <= node ){
+        if( ns.node == node ) RETURN found(ns);
+      }
+      RETURN false;
+    }
+
+    // parses the sources of a node set that index() left in the file, false if they do not parse
+    bool load(node_set &ns){
+      if( !ns.lazy ) RETURN true;
+      string bytes;
+      if( !text->read(ns.text_offset ,ns.text_length ,bytes) ){
+        cerr << text->pathname << " could not be read back for node " << ns.node << endl;
+        RETURN false;
+      }
+      istringstream is(bytes);
+      node_set a_node_set;
+      a_node_set.clear();
+      if( a_node_set.parse(is ,text->pathname ,0) != ParseStatus::Found || a_node_set.node != ns.node ){
+        cerr << text->pathname << " misparsed node set for node " << ns.node << endl;
+        RETURN false;
+      }
+      ns.sources.swap(a_node_set.sources);
+      ns.other_phrases.swap(a_node_set.other_phrases);
+      ns.lazy = false;
+      RETURN true;
+    }
+
+    // every node set, for when all of the sources are wanted
+    bool load_all(){
+      for( iterator it = begin(); it != end(); it++ ){
+        if( !load(it->second) ) RETURN false;
+      }
+      RETURN true;
+    }
+
     /*
        is is the open file we are parsing from.
        nodes_map_file_path is a string for error messages.
@@ -283,6 +601,86 @@ using namespace std;
       else RETURN ParseStatus::Malformed;
     }
 
+  private:
+    bool found(node_set &ns){
+      ns.lazy = true;
+      insert(pair<size_t ,node_set>(ns.node ,ns));
+      RETURN true;
+    }
+
+    shared_ptr<taxonomy_text> text;  // the file given to index() or open(), when there is one
+  };
+
+/*--------------------------------------------------------------------------------
+  reads a taxonomy one node set at a time, for when the whole of it is not wanted in memory
+
+  The node sets must be in node order, as nodes_map::print writes them.  next() returns false
+  at the end, and also on a node set that does not parse or is out of order, with 'failed'
+  then set.
+*/
+  class taxonomy_reader{
+  public:
+    taxonomy_reader(istream &a_is ,const string &a_pathname)
+      :failed(false),is(a_is),pathname(a_pathname),lineno(0),previous(0){;}
+
+    bool failed;
+
+    bool next(node_set &ns){
+      while( is.good() ){
+        ns.clear();
+        ParseStatus stat = ns.parse(is ,pathname ,lineno);
+        if( stat == ParseStatus::Found ){
+          if( ns.node <= previous ){
+            cerr << pathname << " is not in node order at node " << ns.node << endl;
+            failed = true;
+            RETURN false;
+          }
+          previous = ns.node;
+          RETURN true;
+        }
+        if( stat.value & (ParseStatus::NotFound | ParseStatus::NoObject | ParseStatus::NullObject) ) CONTINUE;
+        cerr << pathname << ":" << lineno << " misparsed node set" << endl;
+        failed = true;
+        RETURN false;
+      }
+      RETURN false;
+    }
+
+  private:
+    istream &is;
+    string pathname;
+    size_t lineno;
+    size_t previous;  // node number of the last node set read
+  };
+
+/*--------------------------------------------------------------------------------
+  signature index
+
+  maps node signatures to node numbers so that finding the nodes that might hold a source
+  file is a lookup rather than a scan of the whole nodes_map.  Several nodes may share a
+  signature, they are the candidates that must be checked with same().
+*/
+  class signature_index : public multimap<signature ,size_t>{
+  public:
+    signature_index(): head_signed(0){;}
+
+    size_t head_signed;  // nodes with Sign_Head signatures, a source file must then be looked up under both kinds
+
+    void build(const nodes_map &hd){
+      clear();
+      head_signed = 0;
+      nodes_map::const_iterator it = hd.begin();
+      while( it != hd.end() ){
+        insert(it->second);
+      it++;
+      }
+    }
+
+    void insert(const node_set &ns){
+      multimap<signature ,size_t>::insert(pair<signature ,size_t>(ns.node_signature ,ns.node));
+      if( ns.node_signature.kind == Sign_Head ) head_signed++;
+    }
+
   };
 
 /*--------------------------------------------------------------------------------
@@ -319,6 +717,16 @@ using namespace std;
       os << " [" << max_node+1 << " +INF]";
     }
 
+    // for node numbers given one at a time in increasing order, as a taxonomy_reader reads them
+    void clear(){
+      max_node=0;
+      free_nodes.clear();
+    }
+    void add(size_t node){
+      for( size_t n = max_node + 1; n < node; n++ ) free_nodes.insert(n);
+      if( node > max_node ) max_node = node;
+    }
+
     void parse(const nodes_map &hd){
       max_node=0; // zero is not a valid node number
       size_t next_in_sequence = 1;
@@ -359,8 +767,9 @@ using namespace std;
       }
       if(node_number < max_node){
         free_nodes.insert(node_number);
+        RETURN true;
       }
-      // else node_number == max_node and max_node is > 1
+      // else node_number == max_node and max_node is > 1, compact the free nodes below it
       max_node--;
       set<size_t>::iterator it;
       while( max_node != 0 && (it=free_nodes.find(max_node)) != free_nodes.end()){
@@ -0,0 +1,105 @@
+/*
+This test builds the Bloom filter for the test nodes_map, writes it, loads it back, and
+checks it against signatures that are not in the nodes_map, through enough inserts that it
+is built again larger.
+
+*/
+
+#include <string>
+#include <sstream>
+#include <fstream>
+using namespace std;
+
+
+#include "taxonomy.h"
+#include "bloom.h"
+
+
+// a signature no test node has, the MD5 of the text of 'n'
+signature other_signature(uint n){
+  stringstream ss;
+  ss << "other " << n;
+  signature s;
+  s.sign(ss.str().c_str() ,ss.str().size());
+  RETURN s;
+}
+
+int main(int argc ,char **argv){
+
+  uint errors=0;
+  nodes_map hd;
+
+  string nodes_map_input_file_path("test_nodes_map_1_in.txt");
+  ifstream is(nodes_map_input_file_path);
+  size_t lineno=0;
+  if( hd.parse(is ,nodes_map_input_file_path ,lineno) != ParseStatus::Found){
+    errors++;
+    cerr << "nodes_map parse failed" << endl;
+  }
+  is.close();
+
+  signature_index si;
+  si.build(hd);
+  bloom_filter bf;
+  bf.build(si);
+  bf.generation = 3;
+  bf.taxonomy_length = 401;
+
+  for( signature_index::iterator it = si.begin(); it != si.end(); it++ ){
+    if( !bf.may_contain(it->first) ){
+      errors++;
+      cerr << "node " << it->second << " not in the filter" << endl;
+    }
+  }
+
+  string bloom_output_file_path("test_bloom_1_out");
+  if( !bf.write(bloom_output_file_path) ){
+    errors++;
+    cerr << "could not write the filter" << endl;
+  }
+  bloom_filter bf2;
+  if( !bf2.load(bloom_output_file_path ,3 ,401) || bf2.keys != si.size() || bf2.memory() != bf.memory() ){
+    errors++;
+    cerr << "filter did not load back" << endl;
+  }
+  if( bf2.load(bloom_output_file_path ,3 ,400) ){
+    errors++;
+    cerr << "stale filter was not detected" << endl;
+  }
+  if( bf2.load(bloom_output_file_path ,4 ,401) ){
+    errors++;
+    cerr << "filter of another generation was not detected" << endl;
+  }
+  unlink(bloom_output_file_path.c_str());
+
+  // grows as the signatures go in, and keeps every one of them
+  for( uint n = 0; n < 10000; n++ ){
+    node_set ns;
+    ns.node = 5000 + n;
+    ns.node_signature = other_signature(n);
+    si.insert(ns);
+    bf.insert(other_signature(n));
+    if( bf.full() ) bf.build(si);
+  }
+  uint missing = 0;
+  for( uint n = 0; n < 10000; n++ ) if( !bf.may_contain(other_signature(n)) ) missing++;
+  if( missing != 0 || bf.memory() < 10000 * bloom_filter::Bits_Per_Key / 8 ){
+    errors++;
+    cerr << "filter lost signatures when it grew" << endl;
+  }
+
+  // signatures never added pass about one time in a hundred
+  uint passed = 0;
+  for( uint n = 10000; n < 30000; n++ ) if( bf.may_contain(other_signature(n)) ) passed++;
+  if( passed > 20000 / 30 ){
+    errors++;
+    cerr << "false positive rate too high: " << passed << " of 20000" << endl;
+  }
+
+  if(errors)
+    cerr << "test failed" << endl;
+  else
+    cerr << "test passed" << endl;
+
+  RETURN errors;
+}
@@ -0,0 +1,91 @@
+/*
+This test checks exclude_matcher on names and relative paths, with plain text patterns,
+prefixed and unprefixed regexs, and back references, then lists test_source1 with a few
+excludes, including a relative path that prunes a subtree.
+
+*/
+
+#include <string>
+#include <fstream>
+#include <set>
+#include <list>
+using namespace std;
+
+
+#include "directory.h"
+
+
+uint check(const exclude_matcher &em ,const string &name ,const string &relative_path ,bool expected){
+  if( em.excluded(name ,relative_path) == expected ) RETURN 0;
+  cerr << "expected " << (expected ? "" : "not ") << "excluded: " << name << " " << relative_path << endl;
+  RETURN 1;
+}
+
+int main(int argc ,char **argv){
+
+  uint errors=0;
+
+  exclude_matcher em;
+  if( !em.add("rdiff-backup-data") ) errors++;  // plain text
+  if( !em.add("\\.hg.*") ) errors++;  // prefix ".hg"
+  if( !em.add("core\\.[0-9]+") ) errors++;  // prefix "core."
+  if( !em.add("(ab)\\1") ) errors++;  // back reference
+  if( !em.add("/tmp/scratch") ) errors++;  // a relative path, leading slash dropped
+  if( !em.add("build/.*\\.o") ) errors++;
+  if( em.add("bad[") ){
+    errors++;
+    cerr << "a bad regex was accepted" << endl;
+  }
+
+  errors += check(em ,"rdiff-backup-data" ,"x/rdiff-backup-data" ,true);
+  errors += check(em ,"rdiff-backup-dat" ,"x/rdiff-backup-dat" ,false);
+  errors += check(em ,".hg" ,".hg" ,true);
+  errors += check(em ,".hgignore" ,"a/.hgignore" ,true);
+  errors += check(em ,"hg" ,"hg" ,false);
+  errors += check(em ,"core.1234" ,"core.1234" ,true);
+  errors += check(em ,"core.x" ,"core.x" ,false);
+  errors += check(em ,"abab" ,"abab" ,true);
+  errors += check(em ,"abba" ,"abba" ,false);
+  errors += check(em ,"scratch" ,"tmp/scratch" ,true);
+  errors += check(em ,"scratch" ,"other/tmp/scratch" ,false);
+  errors += check(em ,"main.o" ,"build/main.o" ,true);
+  errors += check(em ,"main.o" ,"src/main.o" ,false);
+
+  // with only prefixed regexs the prefilter is on, an unprefixed one turns it off
+  exclude_matcher em2;
+  em2.add("abc.*");
+  errors += check(em2 ,"abcd" ,"abcd" ,true);
+  errors += check(em2 ,"xbcd" ,"xbcd" ,false);
+  em2.add(".*~");
+  errors += check(em2 ,"xbcd~" ,"xbcd~" ,true);
+  errors += check(em2 ,"abcd" ,"abcd" ,true);
+
+  // traversal, the listing goes to the out file
+  exclude_matcher em3;
+  em3.add("rdiff-backup-data");
+  em3.add("\\.hg.*");
+  em3.add("tmp/q");
+  file_record_list files;
+  file_record_list links;
+  list_files("test_source1" ,files ,links ,em3);
+  ofstream os("test_exclude_1_out.txt");
+  set<string> pathnames;
+  file_record_list::const_iterator it = files.begin();
+  while( it != files.end() ){
+    pathnames.insert(it->pathname);
+  it++;
+  }
+  set<string>::const_iterator pit = pathnames.begin();
+  while( pit != pathnames.end() ){
+    os << *pit << endl;
+  pit++;
+  }
+  os.close();
+
+  if(errors)
+    cerr << "test failed" << endl;
+  else
+    cerr << "test passed" << endl;
+
+  RETURN errors;
+}
@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# removes sources and nodes from an archive built from both test source trees, checks the
+# store still agrees with the taxonomy, then finishes a gc left part way through, and stops
+# when another program holds the archive
+
+rm -rf test_gc_dir
+mkdir -p test_gc_dir/a/tax test_gc_dir/a/store
+
+./insert test_gc_dir/a test_source1
+./insert test_gc_dir/a test_source2
+
+set -x verbose
+./gc -n --source '.*/tmp/.*' test_gc_dir/a
+./gc --source '.*/tmp/.*' test_gc_dir/a 5 77
+ls -1 test_gc_dir/a/store
+ls -1 test_gc_dir/a/tax
+./verify test_gc_dir/a
+
+# freed node numbers are given out again, with the node files truncated
+./insert test_gc_dir/a test_source1
+./verify test_gc_dir/a
+
+# a crash after the commit leaves an intent, the next gc deletes what it lists unless the
+# node is in the taxonomy again
+echo "stray node" > test_gc_dir/a/store/20
+printf '1\n1\n20\n' > test_gc_dir/a/tax/gc-intent
+./gc -v test_gc_dir/a
+ls test_gc_dir/a/tax/gc-intent test_gc_dir/a/store/1 test_gc_dir/a/store/20
+
+# an intent whose commit never happened is dropped
+echo "stray node" > test_gc_dir/a/store/20
+printf '99\n20\n' > test_gc_dir/a/tax/gc-intent
+./gc -v --orphans test_gc_dir/a
+ls test_gc_dir/a/tax/gc-intent test_gc_dir/a/store/20
+
+# while another program holds the archive, as an insert writing nodes it has not committed
+# yet would, nothing is taken for an orphan
+echo "not yet committed" > test_gc_dir/a/store/21
+flock test_gc_dir/a/tax ./gc --orphans test_gc_dir/a || echo "exit: $?"
+ls test_gc_dir/a/store/21
+
+rm -rf test_gc_dir
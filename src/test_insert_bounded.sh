@@ -0,0 +1,30 @@
+#!/bin/bash
+
+# inserts the test source trees with --memory-cap, with a cap so small that every index and
+# the spill go out to run files and with one large enough to keep them in memory, and checks
+# that each archive ends up as it does with the taxonomy parsed into memory.
+
+rm -rf test_bounded_dir
+mkdir -p test_bounded_dir/{parsed,small,large}/{tax,store}
+
+set -x verbose
+./insert test_bounded_dir/parsed test_source1
+./insert test_bounded_dir/parsed test_source2
+./insert test_bounded_dir/parsed test_source1
+./insert -v --memory-cap 1K test_bounded_dir/small test_source1
+./insert --memory-cap 1K test_bounded_dir/small test_source2
+./insert --memory-cap 1K test_bounded_dir/small test_source1
+./insert --memory-cap 64 test_bounded_dir/large test_source1
+./insert --memory-cap 64 test_bounded_dir/large test_source2
+./insert --memory-cap 64 test_bounded_dir/large test_source1
+
+for arch in small large; do
+  diff "test_bounded_dir/parsed/tax/sources;0" "test_bounded_dir/$arch/tax/sources;0"
+  diff -r test_bounded_dir/parsed/store test_bounded_dir/$arch/store
+  ls test_bounded_dir/$arch/tax
+done
+
+./insert --memory-cap 0 test_bounded_dir/small test_source2
+./insert --memory-cap 1K test_bounded_dir/small test_bounded_dir/large test_source2
+
+rm -rf test_bounded_dir
@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# copies of one file within a source tree come to one node with all their paths as sources,
+# later copies are known by the strong hash of the first rather than read back from the
+# store; files alike in every block the signature samples are still told apart
+
+rm -rf test_insert_duplicates_dir
+mkdir -p test_insert_duplicates_dir/a/tax test_insert_duplicates_dir/a/store test_insert_duplicates_dir/src/x test_insert_duplicates_dir/src/y/z
+
+seq 1 20000 > test_insert_duplicates_dir/src/big
+for d in x y y/z; do
+  cp test_insert_duplicates_dir/src/big test_insert_duplicates_dir/src/$d/big
+done
+# one byte changed between the head and the first interior block the signature sums
+cp test_insert_duplicates_dir/src/big test_insert_duplicates_dir/src/x/near
+printf 'x' | dd of=test_insert_duplicates_dir/src/x/near bs=1 seek=6000 conv=notrunc status=none
+echo small > test_insert_duplicates_dir/src/small
+cp test_insert_duplicates_dir/src/small test_insert_duplicates_dir/src/y/small
+touch -d @1400000000 $(find test_insert_duplicates_dir/src -type f)
+
+set -x verbose
+./insert --stats test_insert_duplicates_dir/stats test_insert_duplicates_dir/a test_insert_duplicates_dir/src
+cat "test_insert_duplicates_dir/a/tax/sources;0"
+grep -o '"inserted": [0-9]*' test_insert_duplicates_dir/stats
+grep -o '"candidates": [0-9]*, "same_calls": [0-9]*, "same_false": [0-9]*' test_insert_duplicates_dir/stats
+grep -o '"run_duplicates": [0-9]*' test_insert_duplicates_dir/stats
+./verify test_insert_duplicates_dir/a
+
+# in the next run the nodes are in the store, and are compared there
+./insert --stats test_insert_duplicates_dir/stats test_insert_duplicates_dir/a test_insert_duplicates_dir/src
+grep -o '"candidates": [0-9]*, "same_calls": [0-9]*, "same_false": [0-9]*' test_insert_duplicates_dir/stats
+grep -o '"run_duplicates": [0-9]*' test_insert_duplicates_dir/stats
+grep -c "^# node" "test_insert_duplicates_dir/a/tax/sources;0"
+
+rm -rf test_insert_duplicates_dir
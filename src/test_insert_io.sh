@@ -0,0 +1,36 @@
+#!/bin/bash
+
+# inserts the test source trees with --io uring, into one archive and into two mirrors, and
+# with --no-cache-pollution, and checks that each ends up as it does with --io sync.  A file larger than a registered buffer
+# and one larger than Uring_LargeFile, see source_reader.h, are added to the trees.
+
+rm -rf test_io_dir
+mkdir -p test_io_dir/{sync,uring,shallow,m1,m2,nocache,nocache_uring}/{tax,store}
+cp -r test_source1 test_io_dir/source1
+mkdir -p test_io_dir/source1/big
+head -c 100000 /dev/zero | tr '\0' 'a' > test_io_dir/source1/big/buffer
+head -c 9000000 /dev/zero | tr '\0' 'b' > test_io_dir/source1/big/large
+
+set -x verbose
+./insert --io sync test_io_dir/sync test_io_dir/source1
+./insert --io sync test_io_dir/sync test_source2
+./insert -v --io uring test_io_dir/uring test_io_dir/source1
+./insert --io uring test_io_dir/uring test_source2
+./insert --io uring --io-depth 1 test_io_dir/shallow test_io_dir/source1
+./insert --io uring --io-depth 1 test_io_dir/shallow test_source2
+./insert --io uring test_io_dir/m1 test_io_dir/m2 test_io_dir/source1
+./insert --io uring test_io_dir/m1 test_io_dir/m2 test_source2
+./insert --no-cache-pollution test_io_dir/nocache test_io_dir/source1
+./insert --no-cache-pollution test_io_dir/nocache test_source2
+./insert --io uring --no-cache-pollution test_io_dir/nocache_uring test_io_dir/source1
+./insert --io uring --no-cache-pollution test_io_dir/nocache_uring test_source2
+
+for arch in uring shallow m1 m2 nocache nocache_uring; do
+  diff "test_io_dir/sync/tax/sources;0" "test_io_dir/$arch/tax/sources;0"
+  diff -r test_io_dir/sync/store test_io_dir/$arch/store
+done
+
+./insert --io mmap test_io_dir/uring test_source2
+./insert --io uring --io-depth 0 test_io_dir/uring test_source2
+
+rm -rf test_io_dir
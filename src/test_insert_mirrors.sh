@@ -0,0 +1,24 @@
+#!/bin/bash
+
+# inserts one source tree into two mirrors at once, one of them already holding another tree,
+# and checks that each ends up as it would from separate single archive inserts
+
+rm -rf test_mirrors_dir
+mkdir -p test_mirrors_dir/{a,b,c,d}/{tax,store}
+
+./insert test_mirrors_dir/a test_source1
+
+set -x verbose
+./insert -v test_mirrors_dir/a test_mirrors_dir/b test_source2
+
+# the same work done one archive at a time
+./insert test_mirrors_dir/c test_source1
+./insert test_mirrors_dir/c test_source2
+./insert test_mirrors_dir/d test_source2
+
+diff "test_mirrors_dir/a/tax/sources;0" "test_mirrors_dir/c/tax/sources;0"
+diff "test_mirrors_dir/b/tax/sources;0" "test_mirrors_dir/d/tax/sources;0"
+diff -r test_mirrors_dir/a/store test_mirrors_dir/c/store
+diff -r test_mirrors_dir/b/store test_mirrors_dir/d/store
+
+rm -rf test_mirrors_dir
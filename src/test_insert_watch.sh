@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# runs insert --watch on a small tree, writes files into it and into a new directory under
+# it, and checks that they reach the archive without another traversal, then stops it with
+# SIGTERM just after writing one more file, which must be committed on the way out; while it
+# runs the archive is held, and other programs that would commit to it stop
+
+rm -rf test_watch_dir
+mkdir -p test_watch_dir/a/tax test_watch_dir/a/store test_watch_dir/src/sub test_watch_dir/src/skip
+echo "one" > test_watch_dir/src/one
+echo "sub one" > test_watch_dir/src/sub/one
+
+./insert --watch --commit-interval 0.2 --exclude skip test_watch_dir/a test_watch_dir/src > test_watch_dir/insert_out 2>&1 &
+insert_pid=$!
+
+# waits for a source pathname to show up in the newest taxonomy
+wait_for(){
+  for i in $(seq 100); do
+    grep -q "$1" "test_watch_dir/a/tax/sources;0" 2>/dev/null && return 0
+    sleep 0.1
+  done
+  echo "timed out waiting for: $1"
+}
+list_sources(){
+  grep '^# source' "test_watch_dir/a/tax/sources;0" | cut -d ' ' -f 4 | sort
+}
+
+wait_for test_watch_dir/src/sub/one
+echo "after the first traversal:"
+list_sources
+
+echo "two" > test_watch_dir/src/two
+echo "one" > test_watch_dir/src/sub/one-again
+echo "skipped" > test_watch_dir/src/skip/three
+mkdir test_watch_dir/src/new
+echo "three" > test_watch_dir/src/new/three
+echo "moved" > test_watch_dir/moved
+mv test_watch_dir/moved test_watch_dir/src/moved
+wait_for test_watch_dir/src/new/three
+wait_for test_watch_dir/src/moved
+wait_for test_watch_dir/src/two
+wait_for test_watch_dir/src/sub/one-again
+echo "after writing:"
+list_sources
+
+./gc --orphans test_watch_dir/a
+echo "gc exit: $?"
+./insert test_watch_dir/a test_watch_dir/src
+echo "insert exit: $?"
+
+echo "four" > test_watch_dir/src/four
+kill -TERM $insert_pid
+wait $insert_pid
+echo "exit: $?"
+echo "after stopping:"
+list_sources
+echo "nodes: $(ls test_watch_dir/a/store | wc -l)"
+cat test_watch_dir/insert_out
+
+rm -rf test_watch_dir
@@ -0,0 +1,64 @@
+#!/bin/bash
+
+# builds one archive from each test source tree, merges both into a new archive, and checks
+# that the new archive holds every node content and every source pathname once
+
+rm -rf test_merge_dir
+mkdir -p test_merge_dir/a/tax test_merge_dir/a/store test_merge_dir/b/tax test_merge_dir/b/store
+
+./insert test_merge_dir/a test_source1
+./insert test_merge_dir/b test_source2
+
+list_archive(){
+  ( cd test_merge_dir/$1/store && md5sum * | cut -d ' ' -f 1 | sort ) > test_merge_dir/contents_$1
+  grep '^# source' "test_merge_dir/$1/tax/sources;0" | cut -d ' ' -f 4 | sort > test_merge_dir/pathnames_$1
+}
+list_archive a
+list_archive b
+
+# --move so that the node files are linked whatever the filesystem
+# pipelines are kept out of the trace, the order bash traces their commands in varies
+set -x verbose
+./merge -v --move test_merge_dir/c test_merge_dir/a test_merge_dir/b > test_merge_dir/merge_out
+grep "matched in target" test_merge_dir/merge_out
+
+set +x
+list_archive c
+sort -u test_merge_dir/contents_a test_merge_dir/contents_b > test_merge_dir/contents_ab
+sort -u test_merge_dir/pathnames_a test_merge_dir/pathnames_b > test_merge_dir/pathnames_ab
+set -x
+diff test_merge_dir/contents_ab test_merge_dir/contents_c
+diff test_merge_dir/pathnames_ab test_merge_dir/pathnames_c
+wc -l < test_merge_dir/contents_c
+wc -l < test_merge_dir/pathnames_c
+# the inputs gave up the node files placed in the target, the duplicates of those remain
+ls test_merge_dir/a/store test_merge_dir/b/store | grep -c '^[0-9]'
+
+# merging a copy of the first archive again places nothing
+rm -rf test_merge_dir/a
+mkdir -p test_merge_dir/a/tax test_merge_dir/a/store
+./insert test_merge_dir/a test_source1
+./merge -v test_merge_dir/c test_merge_dir/a > test_merge_dir/merge_out
+grep "matched in target" test_merge_dir/merge_out
+
+# as does that copy signed by the first block of each node, as before signature kinds
+set +x
+head_signature(){
+  head -c 4096 "$1" | md5sum | cut -c1-32 | fold -w2 | tac | tr -d '\n'
+}
+to_head_signatures(){
+  while read -r line; do
+    if [[ $line =~ ^"# node # "([0-9]+)" # "([0-9]+)" # " ]]; then
+      echo "# node # ${BASH_REMATCH[1]} # ${BASH_REMATCH[2]} # $(head_signature $1/store/${BASH_REMATCH[1]})"
+    else
+      echo "$line"
+    fi
+  done < "$1/tax/sources;0" > test_merge_dir/legacy
+  cp test_merge_dir/legacy "$1/tax/sources;0"
+}
+to_head_signatures test_merge_dir/a
+set -x verbose
+./merge -v test_merge_dir/c test_merge_dir/a > test_merge_dir/merge_out
+grep "matched in target" test_merge_dir/merge_out
+
+rm -rf test_merge_dir
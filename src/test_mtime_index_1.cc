@@ -0,0 +1,151 @@
+/*
+This test builds the mtime index for the test nodes_map, prints it, parses it back, and
+runs a few range queries against it.  Then it runs range queries against a larger index
+file with mtime_index_file and checks them against the same ranges of the loaded index.
+
+*/
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <limits.h>
+using namespace std;
+
+
+#include "taxonomy.h"
+#include "mtime_index.h"
+ 
+
+int main(int argc ,char **argv){
+
+  uint errors=0;
+  nodes_map hd;
+
+  string nodes_map_input_file_path("test_nodes_map_1_in.txt");
+  ifstream is(nodes_map_input_file_path);
+  size_t lineno=0;
+  if( hd.parse(is ,nodes_map_input_file_path ,lineno) != ParseStatus::Found){
+    errors++;
+    cerr << "nodes_map parse failed" << endl;
+  }
+  is.close();
+
+  mtime_index mi;
+  mi.build(hd);
+  mi.generation = 3;
+  mi.taxonomy_length = 401;
+
+  string mtime_index_output_file_path("test_mtime_index_1_out.txt");
+  ofstream os(mtime_index_output_file_path);
+  mi.print(os);
+  os.close();
+
+  mtime_index mi2;
+  if( !mi2.load(mtime_index_output_file_path ,3 ,401) || mi2.size() != 9 ){
+    errors++;
+    cerr << "mtime index did not load back" << endl;
+  }
+  if( mi2.load(mtime_index_output_file_path ,3 ,400) ){
+    errors++;
+    cerr << "stale mtime index was not detected" << endl;
+  }
+  if( mi2.load(mtime_index_output_file_path ,4 ,401) ){
+    errors++;
+    cerr << "mtime index of another generation was not detected" << endl;
+  }
+
+  // sources with 272727 <= mtime < 77778882
+  mtime_set::range_type r = mi.sources.range(272727 ,77778882);
+  if( distance(r.first ,r.second) != 5 || r.first->mtime != 272727 ){
+    errors++;
+    cerr << "source range mismatch" << endl;
+  }
+
+  // nodes with 9779779 <= mtime
+  r = mi.nodes.range(9779779 ,LONG_MAX);
+  if( distance(r.first ,r.second) != 2 || r.first->node != 4567 ){
+    errors++;
+    cerr << "node range mismatch" << endl;
+  }
+
+  // moving node 27 to an earlier mtime makes it the oldest
+  mi.move_node(27 ,272727 ,100);
+  if( mi.nodes.size() != 3 || mi.nodes.begin()->node != 27 || mi.nodes.begin()->mtime != 100 ){
+    errors++;
+    cerr << "node move failed" << endl;
+  }
+
+  // a larger index, with mtimes shared by several entries and a gap in them
+  mtime_index large;
+  large.generation = 5;
+  large.taxonomy_length = 12345;
+  for( size_t node = 1; node <= 3000; node++ ){
+    time_t mtime = node < 1500 ? node / 3 : node / 3 + 1000;
+    large.nodes.insert(mtime_entry(mtime ,node));
+    large.sources.insert(mtime_entry(mtime ,node));
+    large.sources.insert(mtime_entry(mtime + 7 ,node));
+  }
+  string large_pathname("test_mtime_index_1_large.txt");
+  if( !large.write(large_pathname) ){
+    errors++;
+    cerr << "could not write the large mtime index" << endl;
+  }
+  mtime_index_file stale_file;
+  if( stale_file.open(large_pathname ,5 ,12344) ){
+    errors++;
+    cerr << "stale mtime index file was not detected" << endl;
+  }
+  mtime_index_file large_file;
+  if( !large_file.open(large_pathname ,5 ,12345) ){
+    errors++;
+    cerr << "could not open the large mtime index" << endl;
+  }
+  time_t bounds[] = {LONG_MIN ,0 ,1 ,250 ,499 ,500 ,501 ,750 ,1499 ,1500 ,1501 ,1507 ,1600 ,2000 ,2010 ,LONG_MAX};
+  size_t bound_count = sizeof(bounds) / sizeof(bounds[0]);
+  for( uint k = 0; k < 2; k++ ){
+    const string head = k == 0 ? "node" : "source";
+    const mtime_set &the_set = k == 0 ? large.nodes : large.sources;
+    for( size_t i = 0; i < bound_count; i++ ){
+      for( size_t j = i; j < bound_count; j++ ){
+        mtime_set::range_type r = the_set.range(bounds[i] ,bounds[j]);
+        off_t first = large_file.lower_bound(head ,bounds[i]);
+        off_t last = large_file.lower_bound(head ,bounds[j]);
+
+        // forward from the first, and back from the last, give the range
+        mtime_entry entry;
+        off_t offset = first;
+        mtime_set::const_iterator it = r.first;
+        while( offset < last && large_file.next(offset ,entry) && it != r.second ){
+          if( entry.mtime != it->mtime || entry.node != it->node ) BREAK;
+        it++;
+        }
+        if( offset != last || it != r.second ){
+          errors++;
+          cerr << head << " range " << bounds[i] << " to " << bounds[j] << " read forward mismatch" << endl;
+        }
+        offset = last;
+        it = r.second;
+        while( offset > first && it != r.first && large_file.prev(offset ,entry) ){
+          it--;
+          if( entry.mtime != it->mtime || entry.node != it->node ) BREAK;
+        }
+        if( offset != first || it != r.first ){
+          errors++;
+          cerr << head << " range " << bounds[i] << " to " << bounds[j] << " read backward mismatch" << endl;
+        }
+      }
+    }
+  }
+  if( large_file.bad ){
+    errors++;
+    cerr << "large mtime index file read failed" << endl;
+  }
+  unlink(large_pathname.c_str());
+
+  if(errors)
+    cerr << "test failed" << endl;
+  else
+    cerr << "test passed" << endl;
+
+  RETURN errors;
+}
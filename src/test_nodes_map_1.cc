@@ -40,6 +40,52 @@ int main(int argc ,char **argv){
   close(fd0);
   close(fd1);
 
+  // each node set is found by seek(), as index() and load() would give it
+  nodes_map sought;
+  if( !sought.open(nodes_map_input_file_path) ){
+    errors++;
+    cerr << "could not open the nodes_map for seek" << endl;
+  }
+  for( nodes_map::iterator it = hd.begin(); it != hd.end(); it++ ){
+    if( !sought.seek(it->first) || !sought.load(sought.find(it->first)->second)
+      || sought.find(it->first)->second.sources.size() != it->second.sources.size()
+    ){
+      errors++;
+      cerr << "seek did not find node " << it->first << endl;
+    }
+  }
+  if( sought.seek(28) || sought.seek(1) || sought.seek(5000) ){
+    errors++;
+    cerr << "seek found a node that is not there" << endl;
+  }
+
+  // and in a taxonomy large enough for the binary search to do the work
+  string large_file_path("test_nodes_map_1_large.txt");
+  ofstream los(large_file_path);
+  for( size_t node = 2; node <= 4000; node += 2 ){
+    los << "# node # " << node << " # " << 1000 + node << " # d6de91c1a33b606eb2462ccf8be04acb" << endl;
+    for( size_t k = 0; k <= node % 3; k++ ){
+      los << "# source # test/" << node << "/" << k << " # " << 1000 + node << endl;
+    }
+    los << endl;
+  }
+  los.close();
+  nodes_map large;
+  large.open(large_file_path);
+  for( size_t node = 1; node <= 4001; node++ ){
+    bool found = large.seek(node);
+    if( found != (node % 2 == 0) ){
+      errors++;
+      cerr << "seek of node " << node << " in the large nodes_map was wrong" << endl;
+      continue;
+    }
+    if( found && (!large.load(large.find(node)->second) || large.find(node)->second.sources.size() != node % 3 + 1) ){
+      errors++;
+      cerr << "seek of node " << node << " in the large nodes_map gave the wrong node set" << endl;
+    }
+  }
+  unlink(large_file_path.c_str());
+
   if(errors != 0) cerr << "test failed, there were errors" << endl;
   else  cerr << "test passed" << endl;
 
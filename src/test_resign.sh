@@ -0,0 +1,73 @@
+#!/bin/bash
+
+# files that share their first block are told apart by their signatures, with no full
+# comparison; then an archive whose nodes are signed by their first block only, as archives
+# from before signature kinds are, is inserted into, verified, and re-signed
+
+rm -rf test_resign_dir
+mkdir -p test_resign_dir/a/tax test_resign_dir/a/store test_resign_dir/b/tax test_resign_dir/b/store test_resign_dir/src
+
+# the signature of a file by its first block, printed as the node phrase has it
+head_signature(){
+  head -c 4096 "$1" | md5sum | cut -c1-32 | fold -w2 | tac | tr -d '\n'
+}
+
+# rewrites the taxonomy of archive $1 as it would have been written before kinds
+to_head_signatures(){
+  while read -r line; do
+    if [[ $line =~ ^"# node # "([0-9]+)" # "([0-9]+)" # " ]]; then
+      echo "# node # ${BASH_REMATCH[1]} # ${BASH_REMATCH[2]} # $(head_signature $1/store/${BASH_REMATCH[1]})"
+    else
+      echo "$line"
+    fi
+  done < "$1/tax/sources;0" > test_resign_dir/legacy
+  cp test_resign_dir/legacy "$1/tax/sources;0"
+}
+
+# five files with one header, differing after it
+head -c 4096 /dev/zero > test_resign_dir/header
+for n in 1 2 3 4 5; do
+  (cat test_resign_dir/header; seq $n 1000) > test_resign_dir/src/image$n
+done
+touch -d @1400000000 test_resign_dir/src/*
+
+set -x verbose
+./insert --stats test_resign_dir/stats test_resign_dir/a test_resign_dir/src
+cat "test_resign_dir/a/tax/sources;0"
+./insert --stats test_resign_dir/stats test_resign_dir/a test_resign_dir/src
+grep -o '"same_calls": [0-9]*, "same_false": [0-9]*' test_resign_dir/stats
+
+# under head signatures the five are candidates for each other, each source file is compared
+# with all five nodes at once and found
+set +x
+to_head_signatures test_resign_dir/a
+set -x verbose
+./insert --stats test_resign_dir/stats test_resign_dir/a test_resign_dir/src
+grep -o '"candidates": [0-9]*, "same_calls": [0-9]*, "same_false": [0-9]*' test_resign_dir/stats
+grep -c "^# node" "test_resign_dir/a/tax/sources;0"
+
+# an archive as it would have been written before kinds
+./insert test_resign_dir/b test_source1
+set +x
+to_head_signatures test_resign_dir/b
+set -x verbose
+cat "test_resign_dir/b/tax/sources;0"
+./verify test_resign_dir/b
+
+# test_source2 shares files with test_source1, they are found under their old signatures
+./insert test_resign_dir/b test_source2
+grep -c "^# node" "test_resign_dir/b/tax/sources;0"
+grep "^# node" "test_resign_dir/b/tax/sources;0"
+
+./resign -n test_resign_dir/b
+./resign -v --threads 2 test_resign_dir/b
+grep "^# node" "test_resign_dir/b/tax/sources;0"
+./verify test_resign_dir/b
+./resign -v test_resign_dir/b
+./versions show-version test_resign_dir/b 1 | grep "^# node"
+
+# nothing new once re-signed
+./insert test_resign_dir/b test_source1
+grep -c "^# node" "test_resign_dir/b/tax/sources;0"
+
+rm -rf test_resign_dir
@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# near duplicates: a list of numbers, the same list with one line changed, and with lines
+# added, among unrelated and empty files; then one more near duplicate is inserted, and only
+# it is sketched on the next run
+
+rm -rf test_similar_dir
+mkdir -p test_similar_dir/a/tax test_similar_dir/a/store test_similar_dir/src test_similar_dir/more
+
+seq 1 3000 > test_similar_dir/src/base
+seq 1 3000 | sed 's/^1500$/fifteen hundred/' > test_similar_dir/src/changed
+seq 1 3100 > test_similar_dir/src/longer
+seq 1 3000 | sed 's/$/ apples/' > test_similar_dir/src/unrelated
+seq 1 2000 | sed 's/$/ apples/' > test_similar_dir/src/unrelated_shorter
+: > test_similar_dir/src/empty
+echo "x" > test_similar_dir/src/tiny
+touch -d @1400000000 test_similar_dir/src/*
+./insert test_similar_dir/a test_similar_dir/src
+
+set -x verbose
+cat "test_similar_dir/a/tax/sources;0"
+./similar --threads 2 test_similar_dir/a
+./similar test_similar_dir/a 1
+./similar --threshold 0.999 test_similar_dir/a
+./similar test_similar_dir/a 99
+echo "exit: $?"
+
+seq 1 2900 > test_similar_dir/more/shorter
+touch -d @1400000000 test_similar_dir/more/shorter
+./insert test_similar_dir/a test_similar_dir/more
+./similar -v test_similar_dir/a
+./similar test_similar_dir/a 1
+ls -1 test_similar_dir/a/tax
+
+rm -rf test_similar_dir
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# exports an archive built from both test source trees to SQLite and reads it back
+
+rm -rf test_sqlite_dir
+mkdir -p test_sqlite_dir/a/tax test_sqlite_dir/a/store
+
+./insert test_sqlite_dir/a test_source1
+./insert test_sqlite_dir/a test_source2
+
+set -x verbose
+./to_sqlite -v --batch 5 test_sqlite_dir/a test_sqlite_dir/a.db > test_sqlite_dir/to_sqlite_out
+grep rows test_sqlite_dir/to_sqlite_out
+sqlite3 test_sqlite_dir/a.db "SELECT node ,file_id IS NULL ,mtime ,signature FROM arch_nodes ORDER BY node"
+sqlite3 test_sqlite_dir/a.db "SELECT node ,mtime ,pathname FROM arch_source ORDER BY node ,pathname"
+sqlite3 test_sqlite_dir/a.db "SELECT name FROM sqlite_master WHERE type = 'index' ORDER BY name"
+
+# a second export replaces the first
+./to_sqlite test_sqlite_dir/a test_sqlite_dir/a.db
+sqlite3 test_sqlite_dir/a.db "SELECT count(*) FROM arch_source"
+
+rm -rf test_sqlite_dir
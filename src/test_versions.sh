@@ -0,0 +1,78 @@
+#!/bin/bash
+
+# commits three versions of a taxonomy, checks that show-version rebuilds each of them from
+# sources;0 and the deltas, and that the generation is right after a crash part way through
+# a commit, then converts an archive that keeps its older versions whole and checks it the
+# same way, before and after a commit to it, and one with a gap in its versions
+
+rm -rf test_versions_dir
+mkdir -p test_versions_dir/a/{tax,store} test_versions_dir/saved
+
+./insert test_versions_dir/a test_source1
+cp "test_versions_dir/a/tax/sources;0" test_versions_dir/saved/2
+./insert test_versions_dir/a test_source2
+cp "test_versions_dir/a/tax/sources;0" test_versions_dir/saved/1
+./gc --source '.*/tmp/.*' test_versions_dir/a > /dev/null
+cp "test_versions_dir/a/tax/sources;0" test_versions_dir/saved/0
+
+set -x verbose
+ls -1 test_versions_dir/a/tax
+sed '1s/^\(# delta # 2\) # [0-9]*/\1 # <inode>/' "test_versions_dir/a/tax/delta;2"
+for n in 0 1 2; do
+  ./versions show-version test_versions_dir/a $n > test_versions_dir/shown
+  diff test_versions_dir/saved/$n test_versions_dir/shown
+done
+./versions show-version test_versions_dir/a 3
+./versions show-version test_versions_dir/a 4
+
+# a commit that replaced sources;0 but did not get to advancing the generation
+echo 2 > test_versions_dir/a/tax/generation
+for n in 0 1 2; do
+  ./versions show-version test_versions_dir/a $n > test_versions_dir/shown
+  diff test_versions_dir/saved/$n test_versions_dir/shown
+done
+
+# a commit that wrote its delta but did not get to replacing sources;0, the next commit
+# writes over the delta
+echo "# delta # 3 # 1 # 1" > "test_versions_dir/a/tax/delta;3"
+./versions show-version test_versions_dir/a 2 > test_versions_dir/shown
+diff test_versions_dir/saved/2 test_versions_dir/shown
+./insert test_versions_dir/a test_source1
+cat test_versions_dir/a/tax/generation
+for n in 0 1 2; do
+  ./versions show-version test_versions_dir/a $((n + 1)) > test_versions_dir/shown
+  diff test_versions_dir/saved/$n test_versions_dir/shown
+done
+
+# an archive from before deltas, without a generation file
+mkdir -p test_versions_dir/b/{tax,store}
+cp -r test_versions_dir/a/store test_versions_dir/b
+for n in 0 1 2; do cp test_versions_dir/saved/$n "test_versions_dir/b/tax/sources;$n"; done
+./versions show-version test_versions_dir/b 1 > test_versions_dir/shown
+diff test_versions_dir/saved/1 test_versions_dir/shown
+./versions -v convert test_versions_dir/b
+ls -1 test_versions_dir/b/tax
+for n in 0 1 2; do
+  ./versions show-version test_versions_dir/b $n > test_versions_dir/shown
+  diff test_versions_dir/saved/$n test_versions_dir/shown
+done
+./insert test_versions_dir/b test_source1
+ls -1 test_versions_dir/b/tax
+for n in 0 1 2; do
+  ./versions show-version test_versions_dir/b $((n + 1)) > test_versions_dir/shown
+  diff test_versions_dir/saved/$n test_versions_dir/shown
+done
+
+# an archive from before deltas that has lost a version, nothing is converted rather than
+# leave the versions past the gap behind
+mkdir -p test_versions_dir/c/{tax,store}
+cp -r test_versions_dir/a/store test_versions_dir/c
+for n in 0 2; do cp test_versions_dir/saved/$n "test_versions_dir/c/tax/sources;$n"; done
+./versions -v convert test_versions_dir/c
+echo $?
+ls -1 test_versions_dir/c/tax
+
+./versions show-version test_versions_dir/a
+./versions list test_versions_dir/a
+
+rm -rf test_versions_dir
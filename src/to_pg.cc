@@ -1,13 +1,17 @@
 /*
   Copies the archive to a PostgreSQL database.
 
-  It is a bit of a hack, and is only expected to be used once.
+  It started as a bit of a hack, expected to be used once.  It now keeps a database in step
+  with the archive: each run sends what was added since the last, see to_pg() below.
+
+  The metadata rows are bulk loaded with binary COPY, see pg_copy.h.  bench_to_pg measures the
+  rows per second of this against one INSERT per row.
 */
 
 // before we start, a bit of Vogon poetry:
 //
   const char *vogon_poetry = R"VOGON_POETRY(
-     to_pg <archive> <user> <db>
+     to_pg [options] <archive> <user> <db>
 
     <archive> the name of the archive
          <user> the database user
@@ -16,8 +20,11 @@
     options:
 
       -h --help            this message
-         --list_insert     prints 'insert-file <filename>' on cout for each file included in the archive
-      -v --verbose         progress information, does not do --list_insert as that can get very long
+      -v --verbose         progress information
+         --batch <n>       rows handed to the server at a time, default 10000
+         --commit <n>      rows per checkpointed transaction, default 100000, 0 for one transaction
+         --connections <n> connections uploading node files in parallel, default 4
+         --chunk <n>       bytes per large object write, default 1048576
 
   )VOGON_POETRY";
 
@@ -41,6 +48,7 @@ const uint Exit_FileCreationError =5;
 #include <fstream>
 #include <set>
 #include <list>
+#include <vector>
 using namespace std;
 
 #include<libpq-fe.h>
@@ -50,12 +58,18 @@ using namespace std;
 #include "file.h"
 #include "directory.h"
 #include "taxonomy.h"
+#include "archive.h"
+#include "pg_copy.h"
+#include "pg_lo.h"
 
-PGconn *open_pg(const string &user, const string&db){
+string pg_conninfo(const string &user, const string&db){
   stringstream query;
   query << "user=" << user << " " << "dbname=" << db;
-      
-  PGconn *conn = PQconnectdb(query.str().c_str());
+  return query.str();
+}
+
+PGconn *open_pg(const string &user, const string&db){
+  PGconn *conn = PQconnectdb(pg_conninfo(user ,db).c_str());
   if (PQstatus(conn) == CONNECTION_BAD) {
     fprintf(stderr, "Connection to database failed: %s\n", PQerrorMessage(conn));
     PQfinish(conn);
@@ -64,108 +78,300 @@ PGconn *open_pg(const string &user, const string&db){
   return conn;
 }
 
+/*--------------------------------------------------------------------------------
+  the export watermark, kept in the single row of arch_export
+
+  'generation' is the taxonomy generation, see archive.h, that the database fully reflects.
+  While a run is exporting generation 'target_generation' each committed batch moves
+  'next_node' forward; all nodes below it are already in the database as of the target.
+  An interrupted run leaves next_node non zero, and the next run resumes from there.
+*/
+  const char *arch_export_table =
+    "CREATE TABLE IF NOT EXISTS arch_export ("
+    "  id INT PRIMARY KEY CHECK (id = 1)"
+    "  ,generation BIGINT"
+    "  ,target_generation BIGINT"
+    "  ,next_node BIGINT"
+    "  ,max_node BIGINT"
+    ")";
+
+  class export_state{
+  public:
+    export_state(): found(false),generation(0),target_generation(0),next_node(0),max_node(0){;}
+
+    bool found;  // false when nothing has been exported yet
+    size_t generation;
+    size_t target_generation;
+    size_t next_node;
+    size_t max_node;  // largest node number exported
+
+    bool read(PGconn *conn){
+      if( !pg_command(conn ,arch_export_table) ) RETURN false;
+      PGresult *res = PQexec(conn ,"SELECT generation ,target_generation ,next_node ,max_node FROM arch_export WHERE id = 1");
+      bool ok = PQresultStatus(res) == PGRES_TUPLES_OK;
+      if( !ok ) cerr << PQresultErrorMessage(res) << endl;
+      found = ok && PQntuples(res) == 1;
+      if( found ){
+        generation = strtoull(PQgetvalue(res ,0 ,0) ,0 ,10);
+        target_generation = strtoull(PQgetvalue(res ,0 ,1) ,0 ,10);
+        next_node = strtoull(PQgetvalue(res ,0 ,2) ,0 ,10);
+        max_node = strtoull(PQgetvalue(res ,0 ,3) ,0 ,10);
+      }
+      PQclear(res);
+      RETURN ok;
+    }
+
+    // to be called inside the transaction of the batch it records
+    bool write(PGconn *conn) const{
+      stringstream ss;
+      ss << "INSERT INTO arch_export (id ,generation ,target_generation ,next_node ,max_node) VALUES (1"
+         << " ," << generation << " ," << target_generation << " ," << next_node << " ," << max_node
+         << ") ON CONFLICT (id) DO UPDATE SET"
+         << " generation = EXCLUDED.generation ,target_generation = EXCLUDED.target_generation"
+         << " ,next_node = EXCLUDED.next_node ,max_node = EXCLUDED.max_node";
+      RETURN pg_command(conn ,ss.str().c_str());
+    }
+  };
+
+
+/*--------------------------------------------------------------------------------
+  what one node needs sent to bring the database from an older taxonomy to the current one
+*/
+  class node_delta{
+  public:
+    node_delta(): is_new(false),replaced(false),mtime_changed(false),resigned(false){;}
+    const node_set *ns;  // in the current taxonomy
+    bool is_new;  // the node row and all its sources
+    bool replaced;  // also is_new, the number held other content and its rows go first
+    bool mtime_changed;  // the node row exists but the node mtime went down
+    bool resigned;  // the node row exists, the same content has a signature of another kind
+    file_record_list new_sources;  // source rows for a node that already has a row
+
+    size_t rows() const{
+      RETURN (is_new || mtime_changed || resigned ? 1 : 0) + (is_new ? ns->sources.size() : new_sources.size());
+    }
+  };
+
+  /*
+    true when the node file in the store still has the signature 'base' recorded for it
+
+    gc frees node numbers and insert gives the lowest free one to the next new file, so a node
+    of the database may be other content under the same number.  The signatures tell, except
+    when the node was brought to another kind by resign, then the file is signed again with
+    the kind of 'base'.
+  */
+  bool same_content(const string &store_path ,const node_set &ns ,const node_set &base){
+    if( ns.node_signature.kind == base.node_signature.kind ) RETURN ns.node_signature == base.node_signature;
+    stringstream node_pathname;
+    node_pathname << store_path << "/" << ns.node;
+    int fd = open_read(node_pathname);
+    if( fd == -1 ) RETURN false;
+    signature found;
+    bool signed_ok = found.sign(fd ,base.node_signature.kind);
+    close(fd);
+    RETURN signed_ok && found == base.node_signature;
+  }
+
+  // 'base' is the taxonomy the database already holds for the node, 0 if it holds none
+  bool diff_node(const string &store_path ,const node_set &ns ,const node_set *base ,node_delta &delta){
+    delta.ns = &ns;
+    if( base == 0 ){
+      delta.is_new = true;
+      RETURN true;
+    }
+    if( ns.node_signature != base->node_signature || ns.node_signature.kind != base->node_signature.kind ){
+      if( !same_content(store_path ,ns ,*base) ){
+        delta.is_new = true;
+        delta.replaced = true;
+        RETURN true;
+      }
+      delta.resigned = true;
+    }
+    delta.mtime_changed = ns.mtime != base->mtime;
+    file_record_list::const_iterator it = ns.sources.begin();
+    while( it != ns.sources.end() ){
+      if( base->sources.find(*it) == base->sources.end() ) delta.new_sources.insert(*it);
+    it++;
+    }
+    RETURN delta.mtime_changed || delta.resigned || !delta.new_sources.empty();
+  }
+
+
 /*--------------------------------------------------------------------------------
   Writes the taxonomy and node files to a postgres db.
 
+  Only what was added since the generation recorded in arch_export is sent: the older
+  taxonomy is found among the versions in the tax directory and compared node by node with
+  sources;0.  The first run compares with an empty taxonomy, and so sends everything.
+
+  The work goes in batches of about commit_rows rows, in node order.  For each batch the node
+  files go first, uploaded in parallel by the large object pool, see pg_lo.h, so that their
+  large object ids are known when the arch_nodes rows are sent.  Then in one transaction the
+  arch_nodes and arch_source rows go in two COPY streams, see pg_copy.h, lowered node mtimes
+  and the signatures of resigned nodes are updated, and the watermark is moved past the
+  batch.  A large object uploaded for a batch that did not commit is orphaned, vacuumlo finds
+  those.
+
+  A node number that now holds other content, see same_content(), has its rows deleted in the
+  transaction of its batch and is then sent as a new node, file and all sources.  The large
+  object of the old content is orphaned too.
+
+  Nodes that disappear from the taxonomy are not removed from the database.
+
+  'current_generation' is the generation of the taxonomy in an_archive, read before it was
+  loaded.  PG_Moved is returned, before anything is sent, when a commit to the archive is
+  found to have been made since, see main().
  */
   const uint PG_Success = 0;
   const uint PG_OpenFail = 1;
   const uint PG_ParseFail = 2;
   const uint PG_SystemErr = 3;
+  const uint PG_Moved = 4;
 
   uint to_pg(
-     const string &store_path
-     ,const string &taxonomy_pathname 
-     ,PGconn *conn
+     const archive &an_archive
+    ,size_t current_generation
+    ,PGconn *conn
+    ,lo_upload_pool &pool  // connections for the node file uploads
+    ,size_t batch_rows  // rows handed to libpq at a time
+    ,size_t commit_rows  // rows per checkpointed transaction, zero for one transaction
+    ,bool verbose
   ){
-    // open, parse into memory, and close, the sources file 
+    const nodes_map &a_nodes_map = an_archive.a_nodes_map;
+
+    // where the database stands
     //
-      ifstream is(taxonomy_pathname);
-      if( !is.good() ){
-        cerr << "could not open taxonomy file: \"" << taxonomy_pathname << "\"" << endl;
-        RETURN PG_OpenFail;
+      export_state state;
+      if( !state.read(conn) ) RETURN PG_SystemErr;
+      bool resuming = state.found && state.next_node != 0;
+      if( state.generation > current_generation || (resuming && state.target_generation > current_generation) ){
+        cerr << "the database is at a later taxonomy generation than the archive" << endl;
+        RETURN PG_SystemErr;
+      }
+      if( state.found && !resuming && state.generation == current_generation ){
+        if( verbose ) cout << "database is up to date at generation " << current_generation << endl;
+        RETURN PG_Success;
       }
 
-      cout << "parsing taxonomy file: \"" << taxonomy_pathname << "\" to get the nodes_map.. " << endl;
-      uint lineno=0;
-      nodes_map a_nodes_map;
-      if( a_nodes_map.parse(is ,taxonomy_pathname ,lineno) != ParseStatus::Found){ // filename passed for err messes
-        cerr << "parse failed" << endl;
-        RETURN PG_ParseFail;
+    // the taxonomies the database holds, the one of the last complete export, and when
+    // resuming, the one the interrupted run was exporting
+    //
+      nodes_map base;
+      nodes_map resume_base;
+      size_t generations[2] = {state.generation ,state.target_generation};
+      nodes_map *bases[2] = {&base ,&resume_base};
+      for( uint k = 0; k < (resuming ? 2 : 1); k++ ){
+        size_t version = current_generation - generations[k];
+        if( generations[k] != 0 && !an_archive.has_version(version) ){
+          cerr << "taxonomy of generation " << generations[k] << " is no longer in the archive, the database must be reloaded" << endl;
+          RETURN PG_OpenFail;
+        }
+        if( an_archive.load_version(version ,*bases[k]) != Archive_Success ) RETURN PG_ParseFail;
+      }
+      // versions are counted back from sources;0, so they were the wanted ones only if no commit came between
+      if( an_archive.generation() != current_generation ) RETURN PG_Moved;
+      if( verbose ){
+        cout << "exporting generation " << current_generation << " over generation " << state.generation;
+        if( resuming ) cout << ", resuming generation " << state.target_generation << " at node " << state.next_node;
+        cout << endl;
       }
-      cout << "parse complete" << endl;
-      is.close();
 
-    // copy the only_one archive to the db
+    // what has to be sent
     //
-      cout << "writing db" << endl;
-      stringstream stream_buffer;
-      PGresult *res;
-      nodes_map::iterator nm_it = a_nodes_map.begin();
-      char *pathname;
+      vector<node_delta> deltas;
+      nodes_map::const_iterator nm_it = a_nodes_map.begin();
       while( nm_it != a_nodes_map.end() ){
-        res = PQexec(conn, "BEGIN");
-        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-          cerr << PQresultErrorMessage(res) << endl;
+        const nodes_map &held = resuming && nm_it->first < state.next_node ? resume_base : base;
+        nodes_map::const_iterator held_it = held.find(nm_it->first);
+        node_delta delta;
+        if( diff_node(an_archive.store_path ,nm_it->second ,held_it == held.end() ? 0 : &held_it->second ,delta) ) deltas.push_back(delta);
+      nm_it++;
+      }
+      if( verbose ) cout << deltas.size() << " nodes to send" << endl;
+
+    // send it in checkpointed batches
+    //
+      state.found = true;
+      state.target_generation = current_generation;
+      size_t node_rows = 0;
+      size_t source_rows = 0;
+      size_t uploaded = 0;
+      size_t b = 0;
+      while( b < deltas.size() ){
+        size_t e = b;
+        size_t rows = 0;
+        while( e < deltas.size() && (commit_rows == 0 || rows < commit_rows) ){
+          rows += deltas[e].rows();
+        e++;
         }
-        node_set &ns = nm_it->second; // the sources list
-        size_t node = nm_it->second.node;
-
-        // load the node file into the lo table
-        stream_buffer << store_path << "/" << dec << node;
-        Oid file_id = lo_import(conn, stream_buffer.str().c_str());
-        if( file_id == InvalidOid){
-          cerr << PQerrorMessage(conn) << endl;
+
+        vector<size_t> new_nodes;
+        for( size_t i = b; i < e; i++ ) if( deltas[i].is_new ) new_nodes.push_back(deltas[i].ns->node);
+        file_id_map file_ids;
+        size_t failed = pool.upload(an_archive.store_path ,new_nodes ,file_ids);
+        if( failed != 0 ) cerr << failed << " node files could not be uploaded, their file_id is left NULL" << endl;
+        uploaded += file_ids.size();
+
+        if( !pg_command(conn ,"BEGIN") ) RETURN PG_SystemErr;
+        for( size_t i = b; i < e; i++ ){
+          if( !deltas[i].replaced ) CONTINUE;
+          stringstream ss;
+          ss << "DELETE FROM arch_source WHERE node = " << deltas[i].ns->node << ";"
+             << "DELETE FROM arch_nodes WHERE node = " << deltas[i].ns->node;
+          if( !pg_command(conn ,ss.str().c_str()) ) RETURN PG_SystemErr;
         }
-        stream_buffer.clear();
-        stream_buffer.str(std::string());
-
-        // put the node metadata into arch_nodes table
-        stream_buffer
-          << "INSERT INTO arch_nodes (node ,file_id ,mtime ,signature) VALUES ("
-          << dec << node
-          << " ," << file_id
-          << " ," << nm_it->second.mtime
-          << " ,"
-          << "'";
-        nm_it->second.node_signature.print(stream_buffer);
-        stream_buffer 
-          << "');";
-        res = PQexec(conn, stream_buffer.str().c_str());
-        stream_buffer.clear();
-        stream_buffer.str(std::string());
-        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-          cerr << PQresultErrorMessage(res) << endl;
+        if( !new_nodes.empty() ){
+          pg_copy copy(conn ,batch_rows);
+          if( !copy.begin(string("arch_nodes") + arch_nodes_columns) ) RETURN PG_SystemErr;
+          for( size_t i = b; i < e; i++ ){
+            if( !deltas[i].is_new ) CONTINUE;
+            if( !copy_node_row(copy ,*deltas[i].ns ,file_ids) ) RETURN PG_SystemErr;
+            node_rows++;
+          }
+          if( !copy.end() ) RETURN PG_SystemErr;
         }
-
-        // the source files associated with the node
-        file_record_list::iterator fr_it = nm_it->second.sources.begin();
-        file_record_list::iterator fr_end = nm_it->second.sources.end();
-        while( fr_it != fr_end ){
-          pathname = PQescapeLiteral(conn, fr_it->pathname.c_str(), strlen(fr_it->pathname.c_str()));
-          stream_buffer
-            << "INSERT INTO arch_source (node ,mtime ,pathname) VALUES ("
-            << dec << node
-            << " ," << fr_it->mtime 
-            << " ," << pathname
-            << ");";
-          PQfreemem(pathname);
-          res = PQexec(conn, stream_buffer.str().c_str());
-          stream_buffer.clear();
-          stream_buffer.str(std::string());
-          if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-            cerr << PQresultErrorMessage(res) << endl;
+        {
+          pg_copy copy(conn ,batch_rows);
+          if( !copy.begin(string("arch_source") + arch_source_columns) ) RETURN PG_SystemErr;
+          for( size_t i = b; i < e; i++ ){
+            const file_record_list &sources = deltas[i].is_new ? deltas[i].ns->sources : deltas[i].new_sources;
+            file_record_list::const_iterator fr_it = sources.begin();
+            while( fr_it != sources.end() ){
+              if( !copy_source_row(copy ,deltas[i].ns->node ,*fr_it) ) RETURN PG_SystemErr;
+              source_rows++;
+            fr_it++;
+            }
           }
-          fr_it++;
+          if( !copy.end() ) RETURN PG_SystemErr;
         }
-
-        res = PQexec(conn, "COMMIT");
-        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-          cerr << PQresultErrorMessage(res) << endl;
+        for( size_t i = b; i < e; i++ ){
+          if( deltas[i].is_new || !(deltas[i].mtime_changed || deltas[i].resigned) ) CONTINUE;
+          stringstream node_sig;
+          deltas[i].ns->node_signature.print(node_sig);
+          stringstream ss;
+          ss << "UPDATE arch_nodes SET mtime = " << deltas[i].ns->mtime << " ,signature = '" << node_sig.str() << "'"
+             << " WHERE node = " << deltas[i].ns->node;
+          if( !pg_command(conn ,ss.str().c_str()) ) RETURN PG_SystemErr;
         }
-        nm_it++;
+        state.next_node = deltas[e-1].ns->node + 1;
+        if( deltas[e-1].ns->node > state.max_node ) state.max_node = deltas[e-1].ns->node;
+        if( !state.write(conn) || !pg_command(conn ,"COMMIT") ) RETURN PG_SystemErr;
+        if( verbose ) cout << "committed through node " << deltas[e-1].ns->node << endl;
+        b = e;
+      }
+
+    // the export is complete
+    //
+      state.generation = current_generation;
+      state.next_node = 0;
+      if( !pg_command(conn ,"BEGIN") || !state.write(conn) || !pg_command(conn ,"COMMIT") ) RETURN PG_SystemErr;
+      if( verbose ){
+        cout << "arch_nodes rows: " << node_rows
+             << " arch_source rows: " << source_rows
+             << " large objects: " << uploaded
+             << endl;
       }
-  PQfinish(conn);
+
   RETURN PG_Success;
   }
 
@@ -189,19 +395,17 @@ PGconn *open_pg(const string &user, const string&db){
     // parse options
     // 
       list<char *> args;
-      list<regex> excludes;
       bool verbose=false;
-      bool list_insert=false;
+      size_t batch_rows=10000;
+      size_t commit_rows=100000;
+      size_t connections=4;
+      size_t chunk_size=1 << 20;
       bool bad_parms=false;
-      bool help=false;
 
       if(argv == 0){
         cerr << "serious problem here, argv was zero when the program was called" << endl;
         RETURN Exit_InternalError;
       }
-      if( !strcmp(*argv, "insert") ){
-        cerr << "insert: Does not a rose by any other name not smell just as sweet? Why have you renamed the program?" << endl;
-      }
       if(argc == 1){
         cerr << vogon_poetry;
         RETURN Exit_BadParms;
@@ -218,6 +422,30 @@ PGconn *open_pg(const string &user, const string&db){
               CONTINUE;
             }
 
+            if( !strcmp(*argv, "-v") || !strcmp(*argv, "--verbose") ){
+              verbose=true;
+              CONTINUE;
+            }
+
+            size_t *count = 0;
+            if( !strcmp(*argv, "--batch") ) count = &batch_rows;
+            if( !strcmp(*argv, "--commit") ) count = &commit_rows;
+            if( !strcmp(*argv, "--connections") ) count = &connections;
+            if( !strcmp(*argv, "--chunk") ) count = &chunk_size;
+            if( count ){
+              char *option = *argv;
+              argv++;
+              char *end;
+              if( *argv ){
+                *count = strtoul(*argv ,&end ,10);
+                if( *end == 0 ) CONTINUE;
+              }
+              cerr << "expected a count after " << option << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
             bad_parms=true;
             cerr << "unrecognized option: " << *argv << endl;
             CONTINUE;
@@ -228,14 +456,17 @@ PGconn *open_pg(const string &user, const string&db){
           args.push_back(*argv);
           CONTINUE;
       }
+    if( batch_rows == 0 || connections == 0 || chunk_size == 0 ){
+      cerr << "--batch, --connections and --chunk must be greater than zero" << endl;
+      bad_parms=true;
+    }
     if(bad_parms){
       cerr << "errors when parsing parameters, nothing done" << endl;
       RETURN Exit_BadParms;
     }
 
   //----------------------------------------
-  // pull out the program arguments: the archive and source paths
-  //    see file.h for blaze_path - makes directories along the whole path if needed
+  // pull out the program arguments: the archive, the database user, and the database
   // 
     if( args.size() != 3 ){
       cerr << "need three arguments, but found " << args.size() << " argument";
@@ -251,20 +482,15 @@ PGconn *open_pg(const string &user, const string&db){
     args.pop_front();
     strip_trailing(arch_path);
 
-    stringstream taxonomy_pathname;
-    taxonomy_pathname << arch_path << "/tax/sources" << ";" << "0";
-    if( !exists(taxonomy_pathname.str()) ){
-      cerr << "taxonomy_pathname not found: " << "\"" << taxonomy_pathname.str() << "\"" << endl;
+    archive an_archive;
+    if( !an_archive.open(arch_path ,false) ){
+      cerr << "not an archive: " << "\"" << arch_path << "\"" << endl;
       RETURN 1;
     }
-
-    string store_path = arch_path;
-    store_path += "/store";
-    if( !exists(store_path) ){
-      cerr << "store path not found: " << "\"" << store_path << "\"" << endl;
+    if( !exists(an_archive.taxonomy_pathname()) ){
+      cerr << "taxonomy_pathname not found: " << "\"" << an_archive.taxonomy_pathname() << "\"" << endl;
       RETURN 1;
     }
-
   //----------------------------------------
   // open the database
   //
@@ -274,9 +500,36 @@ PGconn *open_pg(const string &user, const string&db){
       RETURN 1;
     }
 
-  // first move the taxonomy the db, then move the store contents
+    lo_upload_pool pool;
+    pool.chunk_size = chunk_size;
+    if( !pool.open(pg_conninfo(user ,db) ,connections) ){
+      cerr << "could not open " << connections << " connections for the node file uploads" << endl;
+      PQfinish(conn);
+      RETURN 1;
+    }
+
+  // move the store contents and the taxonomy to the db
   //
-    if( to_pg(store_path ,taxonomy_pathname.str() ,conn) != PG_Success){
+  //   no lock is taken, so that an export can run beside insert --watch, instead the
+  //   generation is read before the taxonomy and again after it, and the taxonomies read again
+  //   should a commit have come between, see to_pg()
+  //
+    const uint Max_Tries = 10;
+    uint status = PG_Moved;
+    for( uint tries = 0; status == PG_Moved && tries < Max_Tries; tries++ ){
+      if( tries != 0 && verbose ) cout << "the archive was committed to while it was read, reading it again" << endl;
+      size_t generation = an_archive.generation();
+      if( verbose ) cout << "parsing taxonomy file: \"" << an_archive.taxonomy_pathname() << "\"" << endl;
+      if( an_archive.load() != Archive_Success ){
+        PQfinish(conn);
+        RETURN 1;
+      }
+      if( an_archive.generation() != generation ) CONTINUE;
+      status = to_pg(an_archive ,generation ,conn ,pool ,batch_rows ,commit_rows ,verbose);
+    }
+    PQfinish(conn);
+    if( status == PG_Moved ) cerr << "the archive was committed to every time it was read" << endl;
+    if( status != PG_Success){
       cerr << "Error transfering tax to pq" << endl;
       RETURN 1;
     }
@@ -0,0 +1,299 @@
+/*
+  Copies the taxonomy of an archive to a local SQLite database file.
+
+  The tables are those of schema.psql, arch_nodes and arch_source, so queries written for the
+  PostgreSQL copy work on this one.  There are no large objects here, file_id is left NULL,
+  the node files stay in the store.
+
+  The taxonomy is read with archive::load, as to_pg reads it.  Rows go in through two
+  prepared statements in WAL mode, and the indexes are made after the load rather than kept
+  up to date row by row.  Any earlier tables in the file are replaced.  The drop of the old
+  tables, the load and the indexes are one transaction, so a reader of the file sees the old
+  tables or the new ones, never a part load, and a failed export leaves the old tables.
+*/
+
+// before we start, a bit of Vogon poetry:
+//
+  const char *vogon_poetry = R"VOGON_POETRY(
+     to_sqlite [options] <archive> <db file>
+
+    <archive> the name of the archive
+    <db file> the SQLite database, created if it does not exist
+
+    options:
+
+      -h --help            this message
+      -v --verbose         progress information
+         --batch <n>       rows between progress lines with -v, default 100000
+
+  )VOGON_POETRY";
+
+#include "types.h"
+
+// Program Termination Return Codes
+const uint Exit_NoError   =0;
+const uint Exit_BadParms  =1;
+const uint Exit_NoArchive =2;
+const uint Exit_InternalError =4;
+const uint Exit_FileCreationError =5;
+
+// for sterror and errno
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+// STL objects used
+#include <string>
+#include <fstream>
+#include <set>
+#include <list>
+using namespace std;
+
+#include <sqlite3.h>
+
+// local objects used
+#include "file.h"
+#include "directory.h"
+#include "taxonomy.h"
+#include "archive.h"
+
+
+/*--------------------------------------------------------------------------------
+  runs SQL that returns no rows, errors are reported on cerr
+*/
+  bool sqlite_command(sqlite3 *db ,const char *command){
+    char *message = 0;
+    if( sqlite3_exec(db ,command ,0 ,0 ,&message) == SQLITE_OK ) RETURN true;
+    cerr << command << ": " << (message ? message : sqlite3_errmsg(db)) << endl;
+    sqlite3_free(message);
+    RETURN false;
+  }
+
+  const char *sqlite_schema =
+    "DROP TABLE IF EXISTS arch_nodes;"
+    "DROP TABLE IF EXISTS arch_source;"
+    "CREATE TABLE arch_nodes ("
+    "  node INTEGER PRIMARY KEY"
+    "  ,file_id INTEGER"
+    "  ,mtime INTEGER"
+    "  ,signature TEXT"
+    ");"
+    "CREATE TABLE arch_source ("
+    "  id INTEGER PRIMARY KEY"
+    "  ,node INTEGER"
+    "  ,mtime INTEGER"
+    "  ,pathname TEXT"
+    ");";
+
+  const char *sqlite_indexes =
+    "CREATE INDEX arch_nodes_signature ON arch_nodes (signature);"
+    "CREATE INDEX arch_source_node ON arch_source (node);"
+    "CREATE INDEX arch_source_pathname ON arch_source (pathname);";
+
+
+/*--------------------------------------------------------------------------------
+  Writes the taxonomy to the SQLite database.
+
+ */
+  const uint SQ_Success = 0;
+  const uint SQ_SystemErr = 1;
+
+  uint to_sqlite(const archive &an_archive ,sqlite3 *db ,size_t batch_rows ,bool verbose){
+    if(
+      !sqlite_command(db ,"PRAGMA journal_mode = WAL")
+      || !sqlite_command(db ,"PRAGMA synchronous = NORMAL")
+      || !sqlite_command(db ,"BEGIN")
+    ) RETURN SQ_SystemErr;
+    if( !sqlite_command(db ,sqlite_schema) ){
+      sqlite_command(db ,"ROLLBACK");
+      RETURN SQ_SystemErr;
+    }
+
+    sqlite3_stmt *node_stmt = 0;
+    sqlite3_stmt *source_stmt = 0;
+    if(
+      sqlite3_prepare_v2(db ,"INSERT INTO arch_nodes (node ,file_id ,mtime ,signature) VALUES (? ,NULL ,? ,?)" ,-1 ,&node_stmt ,0) != SQLITE_OK
+      || sqlite3_prepare_v2(db ,"INSERT INTO arch_source (node ,mtime ,pathname) VALUES (? ,? ,?)" ,-1 ,&source_stmt ,0) != SQLITE_OK
+    ){
+      cerr << "could not prepare statements: " << sqlite3_errmsg(db) << endl;
+      sqlite3_finalize(node_stmt);
+      sqlite3_finalize(source_stmt);
+      sqlite_command(db ,"ROLLBACK");
+      RETURN SQ_SystemErr;
+    }
+
+    // one statement at a time, all in the transaction begun above
+    //
+      bool ok = true;
+      size_t rows = 0;
+      size_t node_rows = 0;
+      size_t source_rows = 0;
+      stringstream node_sig;
+      nodes_map::const_iterator nm_it = an_archive.a_nodes_map.begin();
+      while( ok && nm_it != an_archive.a_nodes_map.end() ){
+        const node_set &ns = nm_it->second;
+        node_sig.clear();
+        node_sig.str(std::string());
+        ns.node_signature.print(node_sig);
+        string sig = node_sig.str();
+
+        sqlite3_bind_int64(node_stmt ,1 ,ns.node);
+        sqlite3_bind_int64(node_stmt ,2 ,ns.mtime);
+        sqlite3_bind_text(node_stmt ,3 ,sig.data() ,sig.size() ,SQLITE_STATIC);
+        if( sqlite3_step(node_stmt) != SQLITE_DONE ){
+          cerr << "insert of node " << ns.node << " failed: " << sqlite3_errmsg(db) << endl;
+          ok = false;
+          BREAK;
+        }
+        sqlite3_reset(node_stmt);
+        node_rows++;
+        rows++;
+
+        file_record_list::const_iterator fr_it = ns.sources.begin();
+        while( fr_it != ns.sources.end() ){
+          sqlite3_bind_int64(source_stmt ,1 ,ns.node);
+          sqlite3_bind_int64(source_stmt ,2 ,fr_it->mtime);
+          sqlite3_bind_text(source_stmt ,3 ,fr_it->pathname.data() ,fr_it->pathname.size() ,SQLITE_STATIC);
+          if( sqlite3_step(source_stmt) != SQLITE_DONE ){
+            cerr << "insert of source \"" << fr_it->pathname << "\" failed: " << sqlite3_errmsg(db) << endl;
+            ok = false;
+            BREAK;
+          }
+          sqlite3_reset(source_stmt);
+          source_rows++;
+          rows++;
+        fr_it++;
+        }
+
+        if( ok && rows >= batch_rows ){
+          if( verbose ) cout << "loaded through node " << ns.node << endl;
+          rows = 0;
+        }
+      nm_it++;
+      }
+      sqlite3_finalize(node_stmt);
+      sqlite3_finalize(source_stmt);
+
+    // indexes now that the rows are in, then the commit
+    //
+      if( ok && verbose ) cout << "building indexes" << endl;
+      if( !ok || !sqlite_command(db ,sqlite_indexes) || !sqlite_command(db ,"COMMIT") ){
+        sqlite_command(db ,"ROLLBACK");
+        RETURN SQ_SystemErr;
+      }
+
+    if( verbose ){
+      cout << "arch_nodes rows: " << node_rows
+           << " arch_source rows: " << source_rows
+           << endl;
+    }
+  RETURN SQ_Success;
+  }
+
+/*--------------------------------------------------------------------------------
+
+   This is called from the shell. See the Vogon poetry at the top of this file for
+   the usage message.
+
+*/
+  int main(int argc ,char **argv){
+
+    //----------------------------------------
+    // parse options
+    //
+      list<char *> args;
+      bool verbose=false;
+      size_t batch_rows=100000;
+      bool bad_parms=false;
+
+      if(argv == 0){
+        cerr << "serious problem here, argv was zero when the program was called" << endl;
+        RETURN Exit_InternalError;
+      }
+      if(argc == 1){
+        cerr << vogon_poetry;
+        RETURN Exit_BadParms;
+      }
+
+      for( argv++ ; *argv; argv++ ){
+        // check for options
+        //
+          if( (*argv)[0] == '-' ){
+
+            if( !strcmp(*argv, "-h") || !strcmp(*argv, "--help") ){
+              cout << vogon_poetry;
+              bad_parms=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "-v") || !strcmp(*argv, "--verbose") ){
+              verbose=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--batch") ){
+              argv++;
+              char *end;
+              if( *argv ){
+                batch_rows = strtoul(*argv ,&end ,10);
+                if( *end == 0 && batch_rows != 0 ) CONTINUE;
+              }
+              cerr << "expected a count greater than zero after --batch" << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            bad_parms=true;
+            cerr << "unrecognized option: " << *argv << endl;
+            CONTINUE;
+          }
+
+        // if it isn't and option, it is an arg
+        //
+          args.push_back(*argv);
+          CONTINUE;
+      }
+    if(bad_parms){
+      cerr << "errors when parsing parameters, nothing done" << endl;
+      RETURN Exit_BadParms;
+    }
+
+  //----------------------------------------
+  // pull out the program arguments: the archive and the database file
+  //
+    if( args.size() != 2 ){
+      cerr << "need two arguments, but found " << args.size() << " argument";
+      if(args.size() != 1)  cerr << "s";
+      cerr << endl;
+      RETURN Exit_BadParms;
+    }
+    string arch_path = args.front();
+    string db_pathname = args.back();
+
+    archive an_archive;
+    if( !an_archive.open(arch_path ,false) ){
+      cerr << "not an archive: " << "\"" << arch_path << "\"" << endl;
+      RETURN Exit_NoArchive;
+    }
+    if( verbose ) cout << "parsing taxonomy file: \"" << an_archive.taxonomy_pathname() << "\"" << endl;
+    if( an_archive.load() != Archive_Success ) RETURN Exit_InternalError;
+
+  //----------------------------------------
+  // open the database and load it
+  //
+    sqlite3 *db = 0;
+    if( sqlite3_open(db_pathname.c_str() ,&db) != SQLITE_OK ){
+      cerr << "could not open database: \"" << db_pathname << "\": " << sqlite3_errmsg(db) << endl;
+      sqlite3_close(db);
+      RETURN Exit_FileCreationError;
+    }
+    uint status = to_sqlite(an_archive ,db ,batch_rows ,verbose);
+    sqlite3_close(db);
+    if( status != SQ_Success ){
+      cerr << "Error transfering tax to sqlite" << endl;
+      RETURN Exit_InternalError;
+    }
+
+  RETURN Exit_NoError;
+  }
@@ -0,0 +1,326 @@
+#ifndef URING_H
+#define URING_H
+
+/*
+ defines classes:
+    uring
+    uring_buffers
+
+  A thin io_uring over the raw system calls, as liburing is not something we can count on
+  being installed.  A uring is a submission queue and a completion queue shared with the
+  kernel.  Entries are queued with the prep_ routines, handed to the kernel together by
+  submit(), and their results are collected with peek().  Each entry carries a user_data
+  word that comes back with its completion, the callers use it to find their own state.
+
+  uring_buffers is a pool of equal sized buffers that can be registered with one or more
+  rings, so that reads and writes into them use READ_FIXED and WRITE_FIXED and the kernel
+  does not map the pages on every call.  A buffer is taken by one thread and given back by
+  another, insert reads into it and a node writer releases it, so the free list is locked.
+
+  The ring needs kernel 5.6 for the open, close, read, write and fadvise operations,
+  uring_usable() probes for them.  Registered buffers count against RLIMIT_MEMLOCK, when registering fails the
+  buffers simply go unused.
+*/
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+
+// STL objects used
+#include <vector>
+#include <mutex>
+using namespace std;
+
+// locally defined objects
+#include "types.h"
+
+  const uint32_t Uring_IOMax = 1 << 30;  // longest single read or write we queue
+
+
+/*--------------------------------------------------------------------------------
+  one io_uring instance
+*/
+  class uring{
+  public:
+    uring(): in_flight(0),fd(-1),queued(0),sq_ring(0),sq_ring_size(0),cq_ring(0),cq_ring_size(0),sqes(0),sqes_size(0){;}
+    ~uring(){ close(); }
+
+    uint in_flight;  // entries queued or submitted and not yet completed
+
+    // false with errno set when the kernel does not give us a ring
+    bool open(uint entries){
+      close();
+      struct io_uring_params params;
+      memset(&params ,0 ,sizeof(params));
+      fd = syscall(__NR_io_uring_setup ,entries ,&params);
+      if( fd == -1 ) RETURN false;
+
+      sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+      cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+      bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+      if( single_mmap && cq_ring_size > sq_ring_size ) sq_ring_size = cq_ring_size;
+      sq_ring = map(sq_ring_size ,IORING_OFF_SQ_RING);
+      if( sq_ring == 0 ) RETURN fail();
+      if( single_mmap ){
+        cq_ring = sq_ring;
+        cq_ring_size = 0;  // not mapped on its own
+      }else{
+        cq_ring = map(cq_ring_size ,IORING_OFF_CQ_RING);
+        if( cq_ring == 0 ) RETURN fail();
+      }
+      sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+      sqes = (struct io_uring_sqe *)map(sqes_size ,IORING_OFF_SQES);
+      if( sqes == 0 ) RETURN fail();
+
+      char *sq = (char *)sq_ring;
+      sq_head = (uint32_t *)(sq + params.sq_off.head);
+      sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+      sq_mask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+      sq_entries = params.sq_entries;
+      uint32_t *sq_array = (uint32_t *)(sq + params.sq_off.array);
+      for( uint32_t k = 0; k < sq_entries; k++ ) sq_array[k] = k;  // entries are used in ring order
+
+      char *cq = (char *)cq_ring;
+      cq_head = (uint32_t *)(cq + params.cq_off.head);
+      cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+      cq_mask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+      cq_entries = params.cq_entries;
+      cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+      sq_tail_local = *sq_tail;
+      in_flight = 0;
+      queued = 0;
+      RETURN true;
+    }
+
+    bool is_open() const{ RETURN fd != -1; }
+
+    void close(){
+      if( sqes ) munmap(sqes ,sqes_size);
+      if( cq_ring && cq_ring_size ) munmap(cq_ring ,cq_ring_size);
+      if( sq_ring ) munmap(sq_ring ,sq_ring_size);
+      if( fd != -1 ) ::close(fd);
+      fd = -1;
+      sq_ring = cq_ring = 0;
+      sqes = 0;
+    }
+
+    // true when every operation in 'ops' is known to the kernel
+    bool supports(const vector<uint8_t> &ops){
+      size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+      vector<char> probe_buffer(probe_size ,0);
+      struct io_uring_probe *probe = (struct io_uring_probe *)&probe_buffer[0];
+      if( syscall(__NR_io_uring_register ,fd ,IORING_REGISTER_PROBE ,probe ,256) == -1 ) RETURN false;
+      for( size_t k = 0; k < ops.size(); k++ ){
+        if( ops[k] > probe->last_op || !(probe->ops[ops[k]].flags & IO_URING_OP_SUPPORTED) ) RETURN false;
+      }
+      RETURN true;
+    }
+
+    bool register_buffers(const struct iovec *iovecs ,uint count){
+      RETURN syscall(__NR_io_uring_register ,fd ,IORING_REGISTER_BUFFERS ,iovecs ,count) == 0;
+    }
+
+    // room for another entry, counting the completions the queue must be able to hold
+    bool room() const{
+      RETURN in_flight < sq_entries && in_flight < cq_entries;
+    }
+
+    // queues an open of 'pathname', which must stay put until the open completes
+    void prep_openat(const char *pathname ,int flags ,mode_t mode ,uint64_t user_data){
+      struct io_uring_sqe *sqe = next_sqe(IORING_OP_OPENAT ,AT_FDCWD ,user_data);
+      sqe->addr = (uint64_t)(uintptr_t)pathname;
+      sqe->len = mode;
+      sqe->open_flags = flags;
+    }
+
+    // a read or a write, 'buffer_index' of a registered buffer that holds 'buffer', or -1
+    void prep_rw(uint8_t op ,int file_fd ,const void *buffer ,uint32_t length ,uint64_t offset ,int buffer_index ,uint64_t user_data){
+      if( buffer_index >= 0 ){
+        if( op == IORING_OP_READ ) op = IORING_OP_READ_FIXED;
+        if( op == IORING_OP_WRITE ) op = IORING_OP_WRITE_FIXED;
+      }
+      struct io_uring_sqe *sqe = next_sqe(op ,file_fd ,user_data);
+      sqe->addr = (uint64_t)(uintptr_t)buffer;
+      sqe->len = length;
+      sqe->off = offset;
+      if( buffer_index >= 0 ) sqe->buf_index = buffer_index;
+    }
+
+    void prep_close(int file_fd ,uint64_t user_data){
+      next_sqe(IORING_OP_CLOSE ,file_fd ,user_data);
+    }
+
+    // writes out and waits for the dirty pages of the whole file, see sync_file_range(2)
+    void prep_sync_file_range(int file_fd ,uint64_t user_data){
+      struct io_uring_sqe *sqe = next_sqe(IORING_OP_SYNC_FILE_RANGE ,file_fd ,user_data);
+      sqe->sync_range_flags = SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER;
+    }
+
+    // posix_fadvise over the whole file
+    void prep_fadvise(int file_fd ,int advice ,uint64_t user_data){
+      struct io_uring_sqe *sqe = next_sqe(IORING_OP_FADVISE ,file_fd ,user_data);
+      sqe->fadvise_advice = advice;
+    }
+
+    // hands the queued entries to the kernel and waits for 'wait_for' completions
+    bool submit(uint wait_for){
+      uint to_submit = queued;
+      if( to_submit ) __atomic_store_n(sq_tail ,sq_tail_local ,__ATOMIC_RELEASE);
+      queued = 0;
+      while( true ){
+        long n = syscall(
+          __NR_io_uring_enter ,fd ,to_submit ,wait_for ,wait_for ? IORING_ENTER_GETEVENTS : 0 ,0 ,0
+        );
+        if( n >= 0 ){
+          to_submit -= n;
+          if( to_submit == 0 ) RETURN true;
+          CONTINUE;
+        }
+        if( errno == EINTR ) CONTINUE;
+        RETURN false;
+      }
+    }
+
+    // takes the next completion off the queue, false when there is none
+    bool peek(struct io_uring_cqe &cqe){
+      uint32_t head = *cq_head;
+      if( head == __atomic_load_n(cq_tail ,__ATOMIC_ACQUIRE) ) RETURN false;
+      cqe = cqes[head & cq_mask];
+      __atomic_store_n(cq_head ,head + 1 ,__ATOMIC_RELEASE);
+      in_flight--;
+      RETURN true;
+    }
+
+  private:
+    void *map(size_t size ,off_t offset){
+      void *pt = mmap(0 ,size ,PROT_READ | PROT_WRITE ,MAP_SHARED | MAP_POPULATE ,fd ,offset);
+      if( pt == MAP_FAILED ) RETURN 0;
+      RETURN pt;
+    }
+
+    bool fail(){
+      int saved = errno;
+      close();
+      errno = saved;
+      RETURN false;
+    }
+
+    // callers check room() first, so the submission queue always has a free entry
+    struct io_uring_sqe *next_sqe(uint8_t op ,int file_fd ,uint64_t user_data){
+      struct io_uring_sqe *sqe = &sqes[sq_tail_local & sq_mask];
+      memset(sqe ,0 ,sizeof(*sqe));
+      sqe->opcode = op;
+      sqe->fd = file_fd;
+      sqe->user_data = user_data;
+      sq_tail_local++;
+      queued++;
+      in_flight++;
+      RETURN sqe;
+    }
+
+    int fd;
+    uint queued;  // entries not yet given to the kernel
+    uint32_t sq_tail_local;  // the tail as it is once the queued entries are given
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    uint32_t cq_entries;
+    struct io_uring_cqe *cqes;
+
+    uring(const uring &);
+    uring &operator = (const uring &);
+  };
+
+  // true when this kernel gives us a ring with the operations insert uses, errno says why not
+  bool uring_usable(){
+    uring ring;
+    if( !ring.open(2) ) RETURN false;
+    vector<uint8_t> ops = {
+      IORING_OP_OPENAT ,IORING_OP_CLOSE ,IORING_OP_READ ,IORING_OP_WRITE ,IORING_OP_SYNC_FILE_RANGE ,IORING_OP_FADVISE
+    };
+    if( !ring.supports(ops) ){
+      errno = ENOSYS;
+      RETURN false;
+    }
+    RETURN true;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  buffers that may be registered with rings
+*/
+  class uring_buffers{
+  public:
+    uring_buffers(): buffer_size(0),memory(0),memory_size(0){;}
+    ~uring_buffers(){
+      if( memory ) munmap(memory ,memory_size);
+    }
+
+    size_t buffer_size;
+
+    bool allocate(uint count ,size_t a_buffer_size){
+      buffer_size = a_buffer_size;
+      memory_size = count * buffer_size;
+      void *pt = mmap(0 ,memory_size ,PROT_READ | PROT_WRITE ,MAP_PRIVATE | MAP_ANONYMOUS ,-1 ,0);
+      if( pt == MAP_FAILED ) RETURN false;
+      memory = (char *)pt;
+      iovecs.resize(count);
+      for( uint k = 0; k < count; k++ ){
+        iovecs[k].iov_base = memory + k * buffer_size;
+        iovecs[k].iov_len = buffer_size;
+        free_list.push_back(k);
+      }
+      RETURN true;
+    }
+
+    bool register_with(uring &ring) const{
+      RETURN !iovecs.empty() && ring.register_buffers(&iovecs[0] ,iovecs.size());
+    }
+
+    // index of a free buffer, -1 when they are all in use
+    int take(){
+      lock_guard<mutex> lock(guard);
+      if( free_list.empty() ) RETURN -1;
+      int index = free_list.back();
+      free_list.pop_back();
+      RETURN index;
+    }
+
+    void give(int index){
+      lock_guard<mutex> lock(guard);
+      free_list.push_back(index);
+    }
+
+    char *buffer(int index) const{ RETURN memory + index * buffer_size; }
+
+  private:
+    char *memory;
+    size_t memory_size;
+    vector<struct iovec> iovecs;
+    mutex guard;
+    vector<int> free_list;
+
+    uring_buffers(const uring_buffers &);
+    uring_buffers &operator = (const uring_buffers &);
+  };
+
+#endif
@@ -0,0 +1,482 @@
+/*
+  verify <archive>
+
+  Checks the store of an archive against its taxonomy:
+
+    missing     a node of the taxonomy has no file in the store
+    orphan      a file in the store is not a node of the taxonomy
+    corrupt     a node file is not a regular file, or can not be read to the end
+    mis-signed  the signature of a node file differs from the one in its node phrase
+
+  Every node is stat'ed, then the node files to be read are ordered by where they lie on
+  the disk, the physical offset of their first extent from FIEMAP, or the inode number on
+  filesystems without it, and read by a pool of threads taking them in that order.  Each
+  file is read to the end, so unreadable blocks anywhere in it are found, though the
+  signature only covers the regions of the file its kind sums, see file.h.  --bandwidth caps the combined
+  read rate so that a verify can run alongside other work on the same disks.
+
+  --fast reads only a random sample of the nodes.  The taxonomy does not hold node lengths,
+  so the only size check possible for the rest is that a node file is empty exactly when its
+  signature is that of an empty file, which catches nodes truncated to nothing.
+
+  The archive is locked while it is checked, so that a commit can not change it under the
+  check.  When another program holds it, an insert say, verify goes on without the lock but
+  does not look for orphans, as the node files of an insert are in the store before the
+  taxonomy that names them is committed.  It says so, and the orphan count is given as
+  unchecked.
+
+*/
+
+// before we start, a bit of Vogon poetry:
+//
+  const char *vogon_poetry = R"VOGON_POETRY(
+     verify [options] <archive>
+
+    <archive> the archive to check
+
+    options:
+
+      -h --help            this message
+      -v --verbose         progress information
+         --fast            stat every node, but read only a sample of them
+         --sample <n>      nodes read with --fast, default 1000
+         --seed <n>        seed for choosing the sample, default from the clock
+         --threads <n>     reader threads, default 4
+         --bandwidth <MB/s>  cap on the combined read rate, default none
+
+    exits with 3 when problems were found, orphans are not looked for while another
+    program holds the archive
+
+  )VOGON_POETRY";
+
+#include "types.h"
+
+// Program Termination Return Codes
+const uint Exit_NoError   =0;
+const uint Exit_BadParms  =1;
+const uint Exit_NoArchive =2;
+const uint Exit_ProblemsFound =3;
+const uint Exit_InternalError =4;
+
+// for sterror and errno
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <openssl/md5.h>
+
+// STL objects used
+#include <string>
+#include <fstream>
+#include <vector>
+#include <set>
+#include <list>
+#include <map>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+using namespace std;
+
+// local objects used
+#include "file.h"
+#include "directory.h"
+#include "taxonomy.h"
+#include "archive.h"
+
+
+/*--------------------------------------------------------------------------------
+  where a file starts on the disk, used only to order the reads
+
+  the physical offset of the first extent, or failing that the inode number, which on most
+  filesystems loosely follows allocation order
+*/
+  uint64_t disk_location(int fd ,const struct stat &file_attributes){
+    char buff[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    memset(buff ,0 ,sizeof(buff));
+    struct fiemap *fm = (struct fiemap *)buff;
+    fm->fm_start = 0;
+    fm->fm_length = FIEMAP_MAX_OFFSET;
+    fm->fm_extent_count = 1;
+    if( ioctl(fd ,FS_IOC_FIEMAP ,fm) == 0 && fm->fm_mapped_extents == 1 ) RETURN fm->fm_extents[0].fe_physical;
+    RETURN file_attributes.st_ino;
+  }
+
+
+/*--------------------------------------------------------------------------------
+  holds the readers to a combined rate
+*/
+  class bandwidth_cap{
+  public:
+    bandwidth_cap(double bytes_per_s): bytes_per_s(bytes_per_s),total(0){
+      start = chrono::steady_clock::now();
+    }
+
+    // called before reading n bytes, sleeps until the reads so far fit under the cap
+    void take(size_t n){
+      if( bytes_per_s <= 0 ) RETURN;
+      chrono::steady_clock::time_point due;
+      {
+        lock_guard<mutex> lock(guard);
+        total += n;
+        due = start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(total / bytes_per_s));
+      }
+      this_thread::sleep_until(due);
+    }
+
+  protected:
+    double bytes_per_s;  // zero for no cap
+    double total;
+    chrono::steady_clock::time_point start;
+    mutex guard;
+  };
+
+
+/*--------------------------------------------------------------------------------
+  the findings, added to from the reader threads
+*/
+  class verify_report{
+  public:
+    verify_report(): nodes(0),read(0),bytes_read(0),orphans_checked(true){;}
+
+    size_t nodes;  // nodes in the taxonomy
+    atomic<size_t> read;  // node files read
+    atomic<uint64_t> bytes_read;
+
+    set<size_t> missing;
+    set<string> orphans;
+    bool orphans_checked;  // false when the archive was in use and the store was not listed
+    map<size_t ,string> corrupt;  // node -> what went wrong
+    set<size_t> mis_signed;
+
+    void add_corrupt(size_t node ,const string &why){
+      lock_guard<mutex> lock(guard);
+      corrupt[node] = why;
+    }
+    void add_mis_signed(size_t node){
+      lock_guard<mutex> lock(guard);
+      mis_signed.insert(node);
+    }
+
+    size_t problems() const{
+      RETURN missing.size() + orphans.size() + corrupt.size() + mis_signed.size();
+    }
+
+    void print(ostream &os ,const string &store_path) const{
+      set<size_t>::const_iterator it;
+      for( it = missing.begin(); it != missing.end(); it++ ) os << "missing: " << store_path << "/" << *it << endl;
+      set<string>::const_iterator oit;
+      for( oit = orphans.begin(); oit != orphans.end(); oit++ ) os << "orphan: " << store_path << "/" << *oit << endl;
+      map<size_t ,string>::const_iterator cit;
+      for( cit = corrupt.begin(); cit != corrupt.end(); cit++ ) os << "corrupt: " << store_path << "/" << cit->first << " " << cit->second << endl;
+      for( it = mis_signed.begin(); it != mis_signed.end(); it++ ) os << "mis-signed: " << store_path << "/" << *it << endl;
+      os << "nodes: " << nodes
+         << " read: " << read
+         << " missing: " << missing.size()
+         << " orphan: " << (orphans_checked ? to_string(orphans.size()) : string("unchecked"))
+         << " corrupt: " << corrupt.size()
+         << " mis-signed: " << mis_signed.size()
+         << endl;
+    }
+
+  protected:
+    mutex guard;
+  };
+
+
+/*--------------------------------------------------------------------------------
+  one node file to be read
+*/
+  class read_job{
+  public:
+    uint64_t location;
+    size_t node;
+    off_t size;
+    const signature *recorded;
+
+    bool operator < (const read_job &other) const{
+      if( location != other.location ) RETURN location < other.location;
+      RETURN node < other.node;
+    }
+  };
+
+  // reads the node file to the end, checking its signature on the way
+  void read_node(const string &pathname ,const read_job &job ,bandwidth_cap &cap ,verify_report &report){
+    int fd = open_read(pathname);
+    if( fd == -1 ){
+      report.add_corrupt(job.node ,strerror(errno));
+      RETURN;
+    }
+    posix_fadvise(fd ,0 ,0 ,POSIX_FADV_SEQUENTIAL);
+
+    const size_t chunk = 1 << 20;
+    vector<uchar> buff(chunk);
+    off_t done = 0;
+    while( true ){
+      cap.take(chunk);
+      ssize_t n = read(fd ,&buff[0] ,chunk);
+      if( n == -1 ){
+        report.add_corrupt(job.node ,strerror(errno));
+        close(fd);
+        RETURN;
+      }
+      if( n == 0 ) BREAK;
+      done += n;
+      report.bytes_read += n;
+    }
+    signature found;
+    bool signed_ok = found.sign(fd ,job.recorded->kind);  // of the same kind as the node phrase, the pages were just read
+    posix_fadvise(fd ,0 ,0 ,POSIX_FADV_DONTNEED);  // a verify should not push the working set out of the cache
+    close(fd);
+    report.read++;
+
+    if( done != job.size ){
+      stringstream ss;
+      ss << "read " << done << " bytes of " << job.size;
+      report.add_corrupt(job.node ,ss.str());
+      RETURN;
+    }
+    if( !signed_ok || found != *job.recorded ) report.add_mis_signed(job.node);
+  }
+
+
+/*--------------------------------------------------------------------------------
+  checks the store against a_nodes_map
+
+  with 'sample' nonzero only that many nodes, chosen at random, are read
+ */
+  void verify(
+     const archive &an_archive
+    ,size_t sample
+    ,uint seed
+    ,uint thread_count
+    ,double bytes_per_s
+    ,bool verbose
+    ,verify_report &report
+  ){
+    signature empty_signature[Sign_Current + 1];  // by kind
+    for( uint kind = 0; kind <= Sign_Current; kind++ ) empty_signature[kind].sign(0 ,0 ,kind);
+
+    // stat every node
+    //
+      report.nodes = an_archive.a_nodes_map.size();
+      vector<read_job> jobs;
+      jobs.reserve(an_archive.a_nodes_map.size());
+      struct stat file_attributes;
+      nodes_map::const_iterator nm_it = an_archive.a_nodes_map.begin();
+      while( nm_it != an_archive.a_nodes_map.end() ){
+        const node_set &ns = nm_it->second;
+        nm_it++;
+        string pathname = an_archive.node_pathname(ns.node);
+        if( lstat(pathname.c_str() ,&file_attributes) == -1 ){
+          if( errno == ENOENT ) report.missing.insert(ns.node);
+          else report.add_corrupt(ns.node ,strerror(errno));
+          CONTINUE;
+        }
+        if( !S_ISREG(file_attributes.st_mode) ){
+          report.add_corrupt(ns.node ,"not a regular file");
+          CONTINUE;
+        }
+        if( (file_attributes.st_size == 0) != (ns.node_signature == empty_signature[ns.node_signature.kind]) ){
+          report.add_mis_signed(ns.node);
+          CONTINUE;
+        }
+        read_job job;
+        job.location = 0;
+        job.node = ns.node;
+        job.size = file_attributes.st_size;
+        job.recorded = &ns.node_signature;
+        jobs.push_back(job);
+      }
+
+    // files in the store that are not nodes, only when no insert can be adding to it
+    //
+      DIR *store_dirp = NULL;
+      if( report.orphans_checked && (store_dirp = opendir(an_archive.store_path.c_str())) == NULL ){
+        cerr << "could not open the store: " << an_archive.store_path << " " << strerror(errno) << endl;
+      } else if( store_dirp != NULL ){
+        struct dirent *dep;
+        while( (dep = readdir(store_dirp)) != NULL ){
+          string filename = dep->d_name;
+          if( filename == "." || filename == ".." ) CONTINUE;
+          char *end;
+          errno = 0;
+          size_t node = strtoul(filename.c_str() ,&end ,10);
+          bool numeric = *end == 0 && errno == 0 && isdigit((uchar)filename[0]);
+          if( !numeric || an_archive.a_nodes_map.find(node) == an_archive.a_nodes_map.end() ) report.orphans.insert(filename);
+        }
+        closedir(store_dirp);
+      }
+
+    // choose what is read, and put it in disk order
+    //
+      if( sample != 0 && sample < jobs.size() ){
+        mt19937 generator(seed);
+        shuffle(jobs.begin() ,jobs.end() ,generator);
+        jobs.resize(sample);
+      }
+      vector<read_job>::iterator jit = jobs.begin();
+      while( jit != jobs.end() ){
+        int fd = open_read(an_archive.node_pathname(jit->node));
+        if( fd != -1 ){
+          if( fstat(fd ,&file_attributes) == 0 ) jit->location = disk_location(fd ,file_attributes);
+          close(fd);
+        }
+      jit++;
+      }
+      sort(jobs.begin() ,jobs.end());
+      if( verbose ) cout << "nodes: " << report.nodes << " to read: " << jobs.size() << endl;
+
+    // read them, each thread takes the next job in disk order
+    //
+      bandwidth_cap cap(bytes_per_s);
+      atomic<size_t> next(0);
+      vector<thread> readers;
+      for( uint k = 0; k < thread_count; k++ ){
+        readers.push_back(thread([&]{
+          size_t i;
+          while( (i = next++) < jobs.size() ){
+            read_node(an_archive.node_pathname(jobs[i].node) ,jobs[i] ,cap ,report);
+            if( verbose && (i + 1) % 10000 == 0 ) cout << "read: " << i + 1 << " bytes: " << report.bytes_read << endl;
+          }
+        }));
+      }
+      for( uint k = 0; k < thread_count; k++ ) readers[k].join();
+  }
+
+
+/*--------------------------------------------------------------------------------
+
+   This is called from the shell. See the Vogon poetry at the top of this file for
+   the usage message.
+
+*/
+  int main(int argc ,char **argv){
+
+    //----------------------------------------
+    // parse options
+    //
+      list<char *> args;
+      bool verbose=false;
+      bool fast=false;
+      size_t sample=1000;
+      uint seed=time(0);
+      uint thread_count=4;
+      double bandwidth=0;
+      bool bad_parms=false;
+
+      if(argv == 0){
+        cerr << "serious problem here, argv was zero when the program was called" << endl;
+        RETURN Exit_InternalError;
+      }
+      if(argc == 1){
+        cerr << vogon_poetry;
+        RETURN Exit_BadParms;
+      }
+
+      for( argv++ ; *argv; argv++ ){
+        // check for options
+        //
+          if( (*argv)[0] == '-' ){
+            if( !strcmp(*argv, "-h") || !strcmp(*argv, "--help") ){
+              cout << vogon_poetry;
+              bad_parms=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "-v") || !strcmp(*argv, "--verbose") ){
+              verbose=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--fast") ){
+              fast=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--sample") || !strcmp(*argv, "--seed") || !strcmp(*argv, "--threads") ){
+              char *option = *argv;
+              argv++;
+              char *end;
+              if( *argv ){
+                unsigned long value = strtoul(*argv ,&end ,10);
+                if( *end == 0 && (value != 0 || !strcmp(option, "--seed")) ){
+                  if( !strcmp(option, "--sample") ) sample = value;
+                  else if( !strcmp(option, "--seed") ) seed = value;
+                  else thread_count = value;
+                  CONTINUE;
+                }
+              }
+              cerr << "expected a count greater than zero after " << option << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "--bandwidth") ){
+              argv++;
+              char *end;
+              if( *argv ){
+                bandwidth = strtod(*argv ,&end);
+                if( *end == 0 && bandwidth > 0 ) CONTINUE;
+              }
+              cerr << "expected MB/s greater than zero after --bandwidth" << endl;
+              bad_parms=true;
+              if( !*argv ) BREAK;
+              CONTINUE;
+            }
+
+            bad_parms=true;
+            cerr << "unrecognized option: " << *argv << endl;
+            CONTINUE;
+          }
+
+        // if it isn't and option, it is an arg
+        //
+          args.push_back(*argv);
+          CONTINUE;
+      }
+    if(bad_parms){
+      cerr << "errors when parsing parameters, nothing done" << endl;
+      RETURN Exit_BadParms;
+    }
+    if( args.size() != 1 ){
+      cerr << "need one argument, but found " << args.size() << " arguments" << endl;
+      RETURN Exit_BadParms;
+    }
+
+  //----------------------------------------
+  // load the taxonomy and check the store against it
+  //
+    string arch_path = args.front();
+    archive an_archive;
+    if( !an_archive.open(arch_path ,false) ){
+      cerr << "not an archive: \"" << arch_path << "\"" << endl;
+      RETURN Exit_NoArchive;
+    }
+    bool busy;
+    if( !an_archive.try_lock(busy) ){
+      if( !busy ){
+        cerr << "could not open archive tax directory: \"" << an_archive.tax_path << "\"" << endl;
+        RETURN Exit_NoArchive;
+      }
+      cerr << "archive is in use by another program, its store is not checked for orphans: \"" << an_archive.path << "\"" << endl;
+    }
+    if( verbose ) cout << "parsing taxonomy file: \"" << an_archive.taxonomy_pathname() << "\"" << endl;
+    if( an_archive.load() != Archive_Success ) RETURN Exit_InternalError;
+
+    verify_report report;
+    report.orphans_checked = !busy;
+    verify(an_archive ,fast ? sample : 0 ,seed ,thread_count ,bandwidth * 1e6 ,verbose ,report);
+    report.print(cout ,an_archive.store_path);
+
+    if( report.problems() != 0 ) RETURN Exit_ProblemsFound;
+  RETURN Exit_NoError;
+  }
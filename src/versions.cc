@@ -0,0 +1,174 @@
+/*
+  versions [options] <command> <archive> [<n>]
+
+  The older versions of an archive's taxonomy, see history.h.
+
+  show-version writes version <n> to stdout, rebuilt from sources;0 and the deltas back to
+  it one node set at a time, so a version of any size is shown without being held in
+  memory.  Version 0 is sources;0 itself.
+
+  convert turns the whole older versions of an archive from before deltas, sources;1,
+  sources;2, and so on, into deltas.  The next commit to such an archive does this anyway,
+  convert is for doing it ahead of time, and for seeing what it saves.  A version missing
+  from the run is reported and nothing is converted, see convert_history() in history.h.
+*/
+
+// before we start, a bit of Vogon poetry:
+//
+  const char *vogon_poetry = R"VOGON_POETRY(
+     versions [options] show-version <archive> <n>
+     versions [options] convert <archive>
+
+    <archive> the name of the archive
+    <n>       the version, 0 is the current taxonomy, 1 the one before it, ...
+
+    commands:
+
+      show-version         write version <n> of the taxonomy to stdout
+      convert              keep the older versions as deltas rather than whole copies
+
+    options:
+
+      -h --help            this message
+      -v --verbose         the versions converted
+
+    convert exits with 6 when another program holds the archive
+
+  )VOGON_POETRY";
+
+#include "types.h"
+
+// Program Termination Return Codes
+const uint Exit_NoError   =0;
+const uint Exit_BadParms  =1;
+const uint Exit_NoArchive =2;
+const uint Exit_NoVersion =3;
+const uint Exit_InternalError =4;
+const uint Exit_ArchiveBusy =6;
+
+// for sterror and errno
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+// STL objects used
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <set>
+#include <list>
+using namespace std;
+
+// local objects used
+#include "file.h"
+#include "archive.h"
+#include "history.h"
+
+
+  int main(int argc ,char **argv){
+
+    //----------------------------------------
+    // parse options
+    //
+      list<char *> args;
+      bool verbose=false;
+      bool bad_parms=false;
+
+      if(argv == 0){
+        cerr << "serious problem here, argv was zero when the program was called" << endl;
+        RETURN Exit_InternalError;
+      }
+      if(argc == 1){
+        cerr << vogon_poetry;
+        RETURN Exit_BadParms;
+      }
+
+      for( argv++ ; *argv; argv++ ){
+        // check for options
+        //
+          if( (*argv)[0] == '-' ){
+            if( !strcmp(*argv, "-h") || !strcmp(*argv, "--help") ){
+              cout << vogon_poetry;
+              bad_parms=true;
+              CONTINUE;
+            }
+
+            if( !strcmp(*argv, "-v") || !strcmp(*argv, "--verbose") ){
+              verbose=true;
+              CONTINUE;
+            }
+
+            bad_parms=true;
+            cerr << "unrecognized option: " << *argv << endl;
+            CONTINUE;
+          }
+
+        // if it isn't and option, it is an arg
+        //
+          args.push_back(*argv);
+          CONTINUE;
+      }
+    string command;
+    string arch_path;
+    size_t version = 0;
+    if( args.size() < 2 ){
+      cerr << "need a command and an archive argument" << endl;
+      bad_parms=true;
+    }else{
+      command = args.front();
+      args.pop_front();
+      arch_path = args.front();
+      args.pop_front();
+      if( command == "show-version" ){
+        char *end = 0;
+        if( args.size() == 1 ) version = strtoul(args.front() ,&end ,10);
+        if( args.size() != 1 || *end != 0 ){
+          cerr << "show-version needs a version number" << endl;
+          bad_parms=true;
+        }
+      }else if( command == "convert" ){
+        if( !args.empty() ){
+          cerr << "convert takes only an archive" << endl;
+          bad_parms=true;
+        }
+      }else{
+        cerr << "unrecognized command: " << command << endl;
+        bad_parms=true;
+      }
+    }
+    if(bad_parms){
+      cerr << "errors when parsing parameters, nothing done" << endl;
+      RETURN Exit_BadParms;
+    }
+
+    archive an_archive;
+    if( !an_archive.open(arch_path ,false) ){
+      cerr << "not an archive: \"" << arch_path << "\"" << endl;
+      RETURN Exit_NoArchive;
+    }
+
+  //----------------------------------------
+  // show-version
+  //
+    if( command == "show-version" ){
+      version_reader reader(an_archive.tax_path ,version);
+      if( !reader.found ){
+        cerr << "version " << version << " is not in the archive" << endl;
+        RETURN Exit_NoVersion;
+      }
+      if( !reader.write(cout) ){
+        cerr << "could not rebuild version " << version << endl;
+        RETURN Exit_InternalError;
+      }
+      RETURN Exit_NoError;
+    }
+
+  //----------------------------------------
+  // convert
+  //
+    if( !an_archive.lock() ) RETURN Exit_ArchiveBusy;
+    int converted = convert_history(an_archive.tax_path);
+    if( converted < 0 ) RETURN Exit_InternalError;
+    if( verbose ) cout << "versions converted: " << converted << endl;
+  RETURN Exit_NoError;
+  }
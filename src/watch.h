@@ -0,0 +1,167 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+/*
+ defines classes:
+    tree_watch
+
+  Watches a source tree with inotify so that insert --watch can pick up the files that
+  change without traversing the whole tree again.
+
+  Every directory of the tree that is not excluded gets a watch.  A file is reported once it
+  is closed after writing, or moved into a watched directory.  A directory that appears is
+  watched in turn, and the files already in it are reported, as they may have been written
+  before the watch was in place.  When the kernel queue overflows events are lost, this is
+  flagged and the caller is expected to traverse the tree again.
+
+  fanotify would watch a whole mount with one mark, but it needs CAP_SYS_ADMIN, inotify
+  needs nothing more than a watch per directory, see /proc/sys/fs/inotify/max_user_watches.
+  A directory that is moved or renamed keeps its watch under its old pathname until the
+  next full traversal.
+*/
+
+#include <sys/inotify.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+
+// STL objects used
+#include <iostream>
+#include <string>
+#include <set>
+#include <map>
+#include <list>
+using namespace std;
+
+// locally defined objects
+#include "types.h"
+#include "directory.h"
+
+
+  class tree_watch{
+  public:
+    tree_watch(): overflowed(false),fd(-1),out_of_watches(false){;}
+    ~tree_watch(){
+      if( fd != -1 ) close(fd);
+    }
+
+    bool overflowed;  // events were lost, set until the caller clears it
+
+    bool open(){
+      fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      if( fd == -1 ) cerr << "inotify_init1: " << strerror(errno) << endl;
+      RETURN fd != -1;
+    }
+
+    // to be polled for input
+    int descriptor() const{ RETURN fd; }
+
+    size_t size() const{ RETURN watched.size(); }
+
+    /*
+      watches 'dirname' and the directories under it that are not excluded
+
+      'relative_path' is that of dirname relative to the root of the tree, for the path
+      excludes.  When 'found' is given the regular files already in the directories are
+      added to it.
+    */
+    void add_tree(const string &dirname ,const string &relative_path ,const exclude_matcher &excludes ,set<string> *found){
+      list< pair<string ,string> > directories;
+      directories.push_back(pair<string ,string>(dirname ,relative_path));
+      while( !directories.empty() ){
+        string path = directories.front().first;
+        string relative = directories.front().second;
+        directories.pop_front();
+
+        if( !add_watch(path ,relative) ) CONTINUE;
+        DIR *dirp = opendir(path.c_str());
+        if( dirp == NULL ) CONTINUE;
+        struct dirent *dep;
+        while( (dep = readdir(dirp)) != NULL ){
+          string name = dep->d_name;
+          if( name == "." || name == ".." ) CONTINUE;
+          string child_relative = relative.empty() ? name : relative + "/" + name;
+          if( excludes.excluded(name ,child_relative) ) CONTINUE;
+          if( dep->d_type == DT_DIR ){
+            directories.push_back(pair<string ,string>(path + "/" + name ,child_relative));
+            CONTINUE;
+          }
+          if( found && dep->d_type == DT_REG ) found->insert(path + "/" + name);
+        }
+        closedir(dirp);
+      }
+    }
+
+    // reads the events that are ready, the pathnames of files to look at go into 'pending'
+    void read_events(const exclude_matcher &excludes ,set<string> &pending){
+      char buff[64 * 1024] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+      while( true ){
+        ssize_t n = read(fd ,buff ,sizeof(buff));
+        if( n <= 0 ) BREAK;  // EAGAIN, nothing more for now
+        char *pt = buff;
+        while( pt < buff + n ){
+          const struct inotify_event *event = (const struct inotify_event *)pt;
+          pt += sizeof(struct inotify_event) + event->len;
+
+          if( event->mask & IN_Q_OVERFLOW ){
+            overflowed = true;
+            CONTINUE;
+          }
+          map<int ,watched_dir>::iterator wit = watched.find(event->wd);
+          if( wit == watched.end() ) CONTINUE;
+          if( event->mask & IN_IGNORED ){
+            watched.erase(wit);
+            CONTINUE;
+          }
+          if( event->len == 0 ) CONTINUE;
+
+          string name = event->name;
+          const watched_dir &dir = wit->second;
+          string relative = dir.relative_path.empty() ? name : dir.relative_path + "/" + name;
+          if( excludes.excluded(name ,relative) ) CONTINUE;
+          string pathname = dir.path + "/" + name;
+          if( event->mask & IN_ISDIR ){
+            if( event->mask & (IN_CREATE | IN_MOVED_TO) ) add_tree(pathname ,relative ,excludes ,&pending);
+            CONTINUE;
+          }
+          if( event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO) ) pending.insert(pathname);
+        }
+      }
+    }
+
+  protected:
+    class watched_dir{
+    public:
+      string path;
+      string relative_path;
+    };
+
+    bool add_watch(const string &path ,const string &relative_path){
+      int wd = inotify_add_watch(
+         fd ,path.c_str()
+        ,IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK
+      );
+      if( wd == -1 ){
+        if( errno == ENOSPC ){
+          if( !out_of_watches ) cerr << "out of inotify watches, see /proc/sys/fs/inotify/max_user_watches, not watching: " << path << endl;
+          out_of_watches = true;
+        }else{
+          cerr << "could not watch: " << path << " " << strerror(errno) << endl;
+        }
+        RETURN false;
+      }
+      watched_dir &dir = watched[wd];
+      dir.path = path;
+      dir.relative_path = relative_path;
+      RETURN true;
+    }
+
+    int fd;
+    bool out_of_watches;
+    map<int ,watched_dir> watched;  // watch descriptor -> directory
+  };
+
+#endif